@@ -4,36 +4,259 @@
 #include "inetaddress.h"
 #include "eventloop.h"
 
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h> // memcpy
+#include <strings.h> // bzero
+#include <unistd.h>
+
+#include <algorithm> // std::min
+
 using namespace leanet;
 
-Acceptor::Acceptor(EventLoop* loop, const InetAddress& listenAddr)
+Acceptor::Acceptor(EventLoop* loop, const InetAddress& listenAddr, bool reusePort)
 	: loop_(loop),
 		acceptSocket_(sockets::createNonblockingOrDie(AF_INET)),
 		acceptChannel_(loop, acceptSocket_.fd()),
-		listenning_(false)
+		listenning_(false),
+		accepting_(false),
+		acceptBudget_(kDefaultAcceptBudget),
+		submitsAccepts_(loop->supportsCompletions()),
+		outOfFds_(false),
+		submitted_(),
+		lastIteration_(0),
+		completedInIteration_(0),
+		idleFd_(::open("/dev/null", O_RDONLY | O_CLOEXEC)),
+		wakeups_(),
+		accepted_(),
+		dropped_(),
+		errors_(),
+		budgetExhausted_()
 {
+	assert(idleFd_ >= 0);
 	acceptSocket_.setReuseAddr(true);
+	if (reusePort) {
+		acceptSocket_.setReusePort(true);
+	}
 	acceptSocket_.bindAddress(listenAddr);
 
 	acceptChannel_.setReadCallback(std::bind(&Acceptor::handleRead, this));
 }
 
+Acceptor::~Acceptor() {
+	if (listenning_) {
+		loop_->assertInLoopThread();
+		acceptChannel_.disableAll();
+		acceptChannel_.remove();
+	}
+	for (size_t i = 0; i < submitted_.size(); ++i) {
+		// the connection accepted meanwhile is closed by handleAccepted()
+		submitted_[i]->acceptor = NULL;
+		loop_->cancelSubmission(submitted_[i]->id);
+	}
+	if (idleFd_ >= 0) {
+		::close(idleFd_);
+	}
+}
+
+AcceptStats Acceptor::stats() const {
+	AcceptStats stats;
+	stats.wakeups = wakeups_.get();
+	stats.accepted = accepted_.get();
+	stats.dropped = dropped_.get();
+	stats.errors = errors_.get();
+	stats.budgetExhausted = budgetExhausted_.get();
+	return stats;
+}
+
+InetAddress Acceptor::localAddress() const {
+	return InetAddress(sockets::getLocalAddr(acceptSocket_.fd()));
+}
+
 void Acceptor::listen() {
 	loop_->assertInLoopThread();
 	listenning_ = true;
+	accepting_ = true;
 	acceptSocket_.listen();
-	acceptChannel_.enableReading();
+	startAccepting();
+}
+
+void Acceptor::pause() {
+	loop_->assertInLoopThread();
+	if (listenning_ && accepting_) {
+		accepting_ = false;
+		stopAccepting();
+	}
+}
+
+void Acceptor::resume() {
+	loop_->assertInLoopThread();
+	if (paused()) {
+		accepting_ = true;
+		startAccepting();
+	}
+}
+
+void Acceptor::startAccepting() {
+	if (submitsAccepts_ && !outOfFds_) {
+		if (acceptChannel_.isReading()) {
+			acceptChannel_.disableReading();
+		}
+		submitAccepts();
+	} else if (!acceptChannel_.isReading()) {
+		acceptChannel_.enableReading();
+	}
+}
+
+void Acceptor::stopAccepting() {
+	for (size_t i = 0; i < submitted_.size(); ++i) {
+		if (!submitted_[i]->cancelled) {
+			submitted_[i]->cancelled = true;
+			loop_->cancelSubmission(submitted_[i]->id);
+		}
+	}
+	if (acceptChannel_.isReading()) {
+		acceptChannel_.disableReading();
+	}
+}
+
+void Acceptor::submitAccepts() {
+	int pending = 0;
+	for (size_t i = 0; i < submitted_.size(); ++i) {
+		if (!submitted_[i]->cancelled) {
+			++pending;
+		}
+	}
+	for (; pending < acceptBudget_; ++pending) {
+		std::shared_ptr<SubmittedAccept> accept(std::make_shared<SubmittedAccept>());
+		accept->acceptor = this;
+		accept->addrlen = static_cast<socklen_t>(sizeof(accept->addr));
+		void (*cb)(const std::shared_ptr<SubmittedAccept>&, int) = &Acceptor::handleAccepted;
+		accept->id = loop_->submitAccept(acceptSocket_.fd(),
+				static_cast<struct sockaddr*>(static_cast<void*>(&accept->addr)), &accept->addrlen,
+				std::bind(cb, accept, std::placeholders::_1));
+		submitted_.push_back(accept);
+	}
+}
+
+void Acceptor::handleAccepted(const std::shared_ptr<SubmittedAccept>& accept, int result) {
+	if (accept->acceptor != NULL) {
+		accept->acceptor->handleAccepted(accept.get(), result);
+	} else if (result >= 0) {
+		sockets::close(result);
+	}
+}
+
+void Acceptor::handleAccepted(SubmittedAccept* accept, int result) {
+	loop_->assertInLoopThread();
+	for (size_t i = 0; i < submitted_.size(); ++i) {
+		if (submitted_[i].get() == accept) {
+			submitted_[i].swap(submitted_.back());
+			break;
+		}
+	}
+	// keeps accept alive
+	std::shared_ptr<SubmittedAccept> guard;
+	guard.swap(submitted_.back());
+	submitted_.pop_back();
+
+	if (result == -ECANCELED || (result < 0 && accept->cancelled)) {
+		return;
+	}
+	// the completions of one poll are a wakeup, those of all the accepts
+	// submitted exhaust the budget
+	if (loop_->iteration() != lastIteration_) {
+		lastIteration_ = loop_->iteration();
+		completedInIteration_ = 0;
+		wakeups_.increment();
+	}
+	if (++completedInIteration_ == acceptBudget_) {
+		budgetExhausted_.increment();
+	}
+
+	if (result >= 0) {
+		// accepted, even if cancelled meanwhile
+		accepted_.increment();
+		struct sockaddr_in6 addr;
+		::bzero(&addr, sizeof(addr));
+		::memcpy(&addr, &accept->addr, std::min(sizeof(addr), static_cast<size_t>(accept->addrlen)));
+		InetAddress peeraddr;
+		peeraddr.setSockAddrInet6(addr);
+		newConnection(result, peeraddr);
+	} else if (result == -EMFILE || result == -ENFILE) {
+		// a submitted accept fails at once without fds, whether there is a
+		// connection or not, wait for one to be readable instead
+		dropConnection();
+		if (!outOfFds_) {
+			outOfFds_ = true;
+			stopAccepting();
+		}
+	} else {
+		errors_.increment();
+	}
+	if (accepting_) {
+		startAccepting();
+	}
 }
 
 void Acceptor::handleRead() {
 	loop_->assertInLoopThread();
-	InetAddress peeraddr;
-	int connfd = acceptSocket_.accept(&peeraddr);
-	if (connfd >= 0) {
-		if (newConnectionCallback_) {
-			newConnectionCallback_(connfd, peeraddr);
+	wakeups_.increment();
+	int n = 0;
+	bool accepted = false;
+	// paused by the callback stops the batch
+	for (; n < acceptBudget_ && accepting_; ++n) {
+		InetAddress peeraddr;
+		int connfd = acceptSocket_.accept(&peeraddr);
+		if (connfd >= 0) {
+			accepted_.increment();
+			accepted = true;
+			newConnection(connfd, peeraddr);
+		} else if (errno == EAGAIN) {
+			break;
+		} else if (errno == EMFILE || errno == ENFILE) {
+			dropConnection();
 		} else {
-			sockets::close(connfd);
+			errors_.increment();
+		}
+	}
+	if (n == acceptBudget_) {
+		budgetExhausted_.increment();
+	}
+	if (outOfFds_ && accepted) {
+		// fds are back
+		outOfFds_ = false;
+		if (accepting_) {
+			startAccepting();
 		}
 	}
 }
+
+void Acceptor::newConnection(int connfd, const InetAddress& peeraddr) {
+	if (newConnectionCallback_) {
+		newConnectionCallback_(connfd, peeraddr);
+	} else {
+		sockets::close(connfd);
+	}
+}
+
+void Acceptor::dropConnection() {
+	if (idleFd_ < 0) {
+		idleFd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+	}
+	if (idleFd_ < 0) {
+		// taken by another thread meanwhile, tried again next time
+		errors_.increment();
+		return;
+	}
+	::close(idleFd_);
+	int connfd = ::accept(acceptSocket_.fd(), NULL, NULL);
+	if (connfd >= 0) {
+		::close(connfd);
+		dropped_.increment();
+	} else {
+		errors_.increment();
+	}
+	idleFd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
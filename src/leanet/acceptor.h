@@ -1,39 +1,146 @@
 #ifndef LEANET_ACCEPTOR_H
 #define LEANET_ACCEPTOR_H
 
+#include <stdint.h>
+#include <netinet/in.h> // sockaddr_in6
+
 #include <functional>
+#include <memory> // std::shared_ptr
+#include <vector>
 
 #include "noncopyable.h"
+#include "atomic.h"
 #include "channel.h"
 #include "socket.h"
 #include "callbacks.h"
+#include "inetaddress.h"
 
 namespace leanet {
 
 class EventLoop;
-class InetAddress;
 
+// accepts of a listening socket, with accepts submitted to the poller a
+// wakeup is a poll completing some of them
+struct AcceptStats {
+	AcceptStats()
+		: wakeups(0),
+			accepted(0),
+			dropped(0),
+			errors(0),
+			budgetExhausted(0)
+	{ }
+
+	// readable events handled
+	int64_t wakeups;
+	int64_t accepted;
+	// accepted and closed at once for lack of fds
+	int64_t dropped;
+	// failed accepts otherwise, e.g. ECONNABORTED
+	int64_t errors;
+	// wakeups which stopped at the budget with more maybe pending
+	int64_t budgetExhausted;
+};
+
+//
+// accepts connections on readable events of the listening socket, or, if
+// the poller of loop supports completions, by as many accepts submitted
+// to it as the budget, each submitted again once it completes. out of fds,
+// it waits for readable events until a connection is accepted again,
+// since a submitted accept fails at once then.
+//
 class Acceptor: noncopyable {
 public:
 	typedef std::function<void (int, const InetAddress&)> NewConnectionCallback;
 
-	Acceptor(EventLoop* loop, const InetAddress& listenAddr);
+	// with reusePort, sockets bound to the same address share the
+	// connections by SO_REUSEPORT
+	Acceptor(EventLoop* loop, const InetAddress& listenAddr, bool reusePort = false);
+	~Acceptor();
 
 	void setNewConnectionCallback(const NewConnectionCallback& cb)
 	{ newConnectionCallback_ = cb; }
 
+	// connections accepted on one wakeup at most, the rest are left to the
+	// next poll so a storm of connections doesn't starve other channels.
+	// accepts submitted at once.
+	// called in loop thread
+	void setAcceptBudget(int budget)
+	{ acceptBudget_ = budget; }
+
+	// thread safe
+	AcceptStats stats() const;
+
 	bool listenning() const { return listenning_; }
+	// the port chosen by kernel if listenAddr has port 0
+	InetAddress localAddress() const;
 
 	void listen();
 
+	// stops and starts polling the listening socket, new connections wait
+	// in the backlog meanwhile. called in loop thread
+	void pause();
+	void resume();
+	bool paused() const
+	{ return listenning_ && !accepting_; }
+
+	static const int kDefaultAcceptBudget = 32;
+
 private:
+	// an accept submitted to the poller, kept by its completion callback so
+	// the address written by the kernel outlives the acceptor
+	struct SubmittedAccept {
+		SubmittedAccept()
+			: acceptor(NULL),
+				id(0),
+				cancelled(false),
+				addrlen(0)
+		{ }
+
+		// NULL once the acceptor is destroyed
+		Acceptor* acceptor;
+		uint64_t id;
+		bool cancelled;
+		struct sockaddr_in6 addr;
+		socklen_t addrlen;
+	};
+
 	void handleRead();
+	static void handleAccepted(const std::shared_ptr<SubmittedAccept>& accept, int result);
+	void handleAccepted(SubmittedAccept* accept, int result);
+	// submitted accepts, or readable events
+	void startAccepting();
+	void stopAccepting();
+	// submits accepts up to the budget
+	void submitAccepts();
+	// accepts a connection with idleFd_ and closes it at once
+	void dropConnection();
+	void newConnection(int connfd, const InetAddress& peeraddr);
 
 	EventLoop* loop_;
 	Socket acceptSocket_;
 	Channel acceptChannel_;
 	NewConnectionCallback newConnectionCallback_;
 	bool listenning_;
+	// listenning and not paused
+	bool accepting_;
+	int acceptBudget_;
+	// the poller supports completions, accepts are submitted to it unless
+	// out of fds
+	const bool submitsAccepts_;
+	bool outOfFds_;
+	std::vector<std::shared_ptr<SubmittedAccept>> submitted_;
+	// of the last wakeup of submitted accepts, and accepts completed in it
+	int64_t lastIteration_;
+	int completedInIteration_;
+	// reserved for accepting, and closing, a connection when out of fds, or
+	// the pending connection keeps the socket readable and the loop busy
+	int idleFd_;
+
+	mutable AtomicInt64 wakeups_;
+	mutable AtomicInt64 accepted_;
+	mutable AtomicInt64 dropped_;
+	mutable AtomicInt64 errors_;
+	mutable AtomicInt64 budgetExhausted_;
 };
 
 }
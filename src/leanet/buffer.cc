@@ -1,4 +1,5 @@
 #include "buffer.h"
+#include "bufferpool.h"
 
 #include <errno.h>
 #include <sys/uio.h> // readv
@@ -6,25 +7,72 @@
 namespace leanet {
 
 const char Buffer::kCRLF[] = "\r\n";
+char Buffer::kEmpty[kCheapPrepend];
+
+Buffer::Buffer(const Buffer& other)
+	: buffer_(NULL),
+		size_(0),
+		readerIndex_(other.readerIndex_),
+		writerIndex_(other.writerIndex_),
+		pool_(other.pool_)
+{
+	if (other.buffer_ != NULL) {
+		reallocate(other.size_);
+		::memcpy(buffer_, other.buffer_, other.writerIndex_);
+	}
+}
+
+void Buffer::reallocate(size_t size) {
+	assert(size >= writerIndex_);
+	char* storage = NULL;
+	if (pool_) {
+		storage = pool_->allocate(&size);
+	} else {
+		storage = new char[size];
+	}
+	if (buffer_ != NULL) {
+		::memcpy(storage, buffer_, writerIndex_);
+	}
+	releaseStorage();
+	buffer_ = storage;
+	size_ = size;
+}
+
+void Buffer::releaseStorage() {
+	if (buffer_ == NULL) {
+		return;
+	}
+	if (pool_) {
+		pool_->deallocate(buffer_, size_);
+	} else {
+		delete[] buffer_;
+	}
+	buffer_ = NULL;
+	size_ = 0;
+}
 
 ssize_t Buffer::readFd(int fd, int* savedErrno) {
 	char extrabuf[65536];
+	return readFd(fd, extrabuf, sizeof(extrabuf), savedErrno);
+}
+
+ssize_t Buffer::readFd(int fd, char* spill, size_t spillSize, int* savedErrno) {
 	struct iovec iov[2];
 	const size_t writable = writableBytes();
 	iov[0].iov_base = beginWrite();
 	iov[0].iov_len = writable;
-	iov[1].iov_base = extrabuf;
-	iov[1].iov_len = sizeof(extrabuf);
+	iov[1].iov_base = spill;
+	iov[1].iov_len = spillSize;
 
-	const int iovcnt = (writable < sizeof(extrabuf)) ? 2 : 1;
+	const int iovcnt = (spill != NULL && writable < spillSize) ? 2 : 1;
 	const ssize_t n = sockets::readv(fd, iov, iovcnt);
 	if (n < 0) {
 		*savedErrno = errno;
 	} else if (static_cast<size_t>(n) <= writable) {
 		hasWritten(n);
 	} else {
-		writerIndex_ = buffer_.size();
-		append(extrabuf, n - writable);
+		writerIndex_ = size_;
+		append(spill, n - writable);
 	}
 
 	return n;
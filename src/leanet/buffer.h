@@ -6,7 +6,7 @@
 
 #include <utility> // std::swap since C++11
 #include <algorithm>
-#include <vector>
+#include <memory> // std::shared_ptr
 
 #include "types.h"
 #include "copyable.h"
@@ -15,6 +15,8 @@
 
 namespace leanet {
 
+class BufferPool;
+
 //
 // two usages:
 // 1. as an input buffer
@@ -26,6 +28,10 @@ namespace leanet {
 // 									 retrieve(len)
 // at net endpoint: append data from writerIndex
 //
+// storage is from a BufferPool if given, and goes back to it when the
+// buffer is destroyed or shrunk, see shrink(). retrieving keeps it, so what
+// peek() returned stays valid until the next write.
+//
 
 class Buffer: public copyable {
 public:
@@ -33,21 +39,72 @@ public:
 	static const size_t kInitialSize = 1024; // 1k
 
 	explicit Buffer(size_t initialSize = kInitialSize)
-		: buffer_(kCheapPrepend + initialSize),
+		: buffer_(NULL),
+			size_(0),
 			readerIndex_(kCheapPrepend),
-			writerIndex_(kCheapPrepend)
+			writerIndex_(kCheapPrepend),
+			pool_()
 	{
+		reallocate(kCheapPrepend + initialSize);
 		assert(readableBytes() == 0);
 		assert(writableBytes() == initialSize);
 		assert(prependableBytes() == kCheapPrepend);
 	}
 
-	// implicit copy-control members are okay
+	// storage from pool(if not NULL), rounded up to its block size, none
+	// until written if initialSize is 0.
+	Buffer(size_t initialSize, const std::shared_ptr<BufferPool>& pool)
+		: buffer_(NULL),
+			size_(0),
+			readerIndex_(kCheapPrepend),
+			writerIndex_(kCheapPrepend),
+			pool_(pool)
+	{
+		if (initialSize > 0) {
+			reallocate(kCheapPrepend + initialSize);
+		}
+		assert(readableBytes() == 0);
+		assert(writableBytes() >= initialSize);
+		assert(prependableBytes() == kCheapPrepend);
+	}
+
+	Buffer(const Buffer& other);
+
+	Buffer(Buffer&& other)
+		: buffer_(other.buffer_),
+			size_(other.size_),
+			readerIndex_(other.readerIndex_),
+			writerIndex_(other.writerIndex_),
+			pool_(std::move(other.pool_))
+	{
+		other.buffer_ = NULL;
+		other.size_ = 0;
+		other.readerIndex_ = kCheapPrepend;
+		other.writerIndex_ = kCheapPrepend;
+	}
+
+	Buffer& operator=(const Buffer& other) {
+		Buffer copy(other);
+		swap(copy);
+		return *this;
+	}
+
+	Buffer& operator=(Buffer&& other) {
+		Buffer moved(std::move(other));
+		swap(moved);
+		return *this;
+	}
+
+	~Buffer() {
+		releaseStorage();
+	}
 
 	void swap(Buffer& other) {
-		buffer_.swap(other.buffer_);
+		std::swap(buffer_, other.buffer_);
+		std::swap(size_, other.size_);
 		std::swap(readerIndex_, other.readerIndex_);
 		std::swap(writerIndex_, other.writerIndex_);
+		pool_.swap(other.pool_);
 	}
 
 	//
@@ -60,6 +117,9 @@ public:
 
 	void prepend(const void* data, size_t len) {
 		assert(len <= prependableBytes());
+		if (buffer_ == NULL) {
+			reallocate(kCheapPrepend);
+		}
 		readerIndex_ -= len;
 		const char* d = static_cast<const char*>(data);
 		std::copy(d, d + len, begin() + readerIndex_);
@@ -202,7 +262,7 @@ public:
 	// write series functions
 	//
 	size_t writableBytes() const {
-		return buffer_.size() - writerIndex_;
+		return buffer_ != NULL ? size_ - writerIndex_ : 0;
 	}
 
 	char* beginWrite() {
@@ -262,6 +322,21 @@ public:
 
 	// like append but data from fd
 	ssize_t readFd(int fd, int* savedErrno);
+	// reads into the writable bytes, and into spill(if any) what they can't
+	// take, which is appended then.
+	ssize_t readFd(int fd, char* spill, size_t spillSize, int* savedErrno);
+
+	// releases the memory but readable bytes and reserve writable bytes, a
+	// pooled buffer holds none if both are 0
+	void shrink(size_t reserve) {
+		Buffer other(readableBytes() + reserve, pool_);
+		other.append(peek(), readableBytes());
+		swap(other);
+	}
+
+	size_t internalCapacity() const {
+		return size_;
+	}
 
 	void ensureWritableBytes(size_t len) {
 		if (writableBytes() < len) {
@@ -271,18 +346,24 @@ public:
 	}
 
 private:
+	// without storage, an empty buffer is read from kEmpty
 	char* begin() {
-		return &*buffer_.begin();
+		return buffer_ != NULL ? buffer_ : kEmpty;
 	}
 
 	const char* begin() const {
-		return &*buffer_.begin();
+		return buffer_ != NULL ? buffer_ : kEmpty;
 	}
 
+	// keeps [0, writerIndex_)
+	void reallocate(size_t size);
+	void releaseStorage();
+
 	void extend(size_t len) {
 		/* no more buffer in buffer_ */
-		if (writableBytes() + prependableBytes() < len + kCheapPrepend) {
-			buffer_.resize(writerIndex_ + len);
+		if (buffer_ == NULL || writableBytes() + prependableBytes() < len + kCheapPrepend) {
+			// at least doubled as std::vector grows, or appends are quadratic
+			reallocate(std::max(writerIndex_ + len, 2 * size_));
 		} else { /* just need to move ahead */
 			assert(kCheapPrepend < readerIndex_);
 			size_t readable = readableBytes();
@@ -296,11 +377,14 @@ private:
 		}
 	}
 
-	std::vector<char> buffer_;
+	char* buffer_;
+	size_t size_;
 	size_t readerIndex_;
 	size_t writerIndex_;
+	std::shared_ptr<BufferPool> pool_;
 
 	static const char kCRLF[];
+	static char kEmpty[kCheapPrepend];
 };
 
 }
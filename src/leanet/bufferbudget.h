@@ -0,0 +1,55 @@
+#ifndef LEANET_BUFFERBUDGET_H
+#define LEANET_BUFFERBUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "noncopyable.h"
+#include "atomic.h"
+
+namespace leanet {
+
+//
+// bytes buffered by a group of connections(those of a TcpServer), which may
+// be in different loops.
+//
+// a connection counts the capacity of its input buffer and the bytes queued
+// in its output buffer, and adds the change after each read and write.
+// while the total is over the limit, connections with output queued stop
+// reading until it is written, so peers which don't read what they ask for
+// can't make the server buffer more, and so do connections whose input is
+// left over a floor, so peers which send faster than it is taken can't
+// either, see TcpConnection::setBufferBudget().
+//
+class BufferBudget: noncopyable {
+public:
+	// 0 for no limit, the bytes are counted all the same
+	explicit BufferBudget(size_t limit)
+		: limit_(limit),
+			bytes_()
+	{ }
+
+	size_t limit() const {
+		return limit_;
+	}
+
+	int64_t bytes() const {
+		return bytes_.get();
+	}
+
+	void add(int64_t bytes) {
+		bytes_.add(bytes);
+	}
+
+	bool exceeded() const {
+		return limit_ > 0 && bytes_.get() > static_cast<int64_t>(limit_);
+	}
+
+private:
+	const size_t limit_;
+	mutable AtomicInt64 bytes_;
+};
+
+}
+
+#endif // LEANET_BUFFERBUDGET_H
@@ -0,0 +1,340 @@
+#include "bufferchain.h"
+
+#include <errno.h>
+#include <limits.h> // IOV_MAX
+#include <string.h>
+#include <sys/uio.h> // writev
+#include <sys/stat.h> // fstat
+
+#include <algorithm>
+#include <utility> // std::move
+
+#include "sockets.h"
+#include "logger.h"
+#include "bufferpool.h"
+
+namespace leanet {
+
+const size_t BufferChain::kBlockSize;
+const size_t BufferChain::kMinSliceSize;
+
+BufferChain::~BufferChain() {
+	retrieveAll();
+	// the owner waits for zeroCopyPending() to drop to 0, or resets the
+	// connection so that nothing more is sent from the slices left.
+	completedSeq_ = zeroCopySeq_;
+	completed_.clear();
+	releaseCompleted();
+}
+
+void BufferChain::append(const void* data, size_t len) {
+	const char* d = static_cast<const char*>(data);
+	if (!segments_.empty()) {
+		// fills the tail block first
+		Segment& tail = segments_.back();
+		size_t n = std::min(tail.writableBytes(), len);
+		if (n > 0) {
+			char* end = tail.block + (tail.data - tail.block) + tail.size;
+			::memcpy(end, d, n);
+			tail.size += n;
+			readableBytes_ += n;
+			d += n;
+			len -= n;
+		}
+	}
+
+	if (len > 0) {
+		// large data is copied once into a block of its own size
+		Segment segment;
+		segment.blockSize = std::max(kBlockSize, len);
+		segment.block = allocateBlock(&segment.blockSize);
+		::memcpy(segment.block, d, len);
+		segment.data = segment.block;
+		segment.size = len;
+		segments_.push_back(std::move(segment));
+		readableBytes_ += len;
+	}
+}
+
+void BufferChain::appendSlice(const void* data, size_t len, const ReleaseCallback& release) {
+	if (len < kMinSliceSize) {
+		append(data, len);
+		if (release) {
+			release();
+		}
+		return;
+	}
+
+	Segment segment;
+	segment.data = static_cast<const char*>(data);
+	segment.size = len;
+	segment.release = release;
+	segments_.push_back(std::move(segment));
+	readableBytes_ += len;
+}
+
+void BufferChain::appendSlice(const void* data, size_t len, const std::shared_ptr<const void>& owner) {
+	if (len < kMinSliceSize) {
+		append(data, len);
+		return;
+	}
+
+	Segment segment;
+	segment.data = static_cast<const char*>(data);
+	segment.size = len;
+	segment.owner = owner;
+	segments_.push_back(std::move(segment));
+	readableBytes_ += len;
+}
+
+void BufferChain::appendFile(int fd, off_t offset, size_t len, const ReleaseCallback& release) {
+	if (len == 0) {
+		if (release) {
+			release();
+		}
+		return;
+	}
+
+	Segment segment;
+	segment.size = len;
+	segment.fd = fd;
+	segment.offset = offset;
+	struct stat st;
+	if (::fstat(fd, &st) < 0) {
+		LOG_SYSERR << "BufferChain::appendFile";
+	} else {
+		segment.pipe = S_ISFIFO(st.st_mode);
+	}
+	segment.release = release;
+	segments_.push_back(std::move(segment));
+	readableBytes_ += len;
+}
+
+int BufferChain::gather(struct iovec* iov, int maxIov, bool zeroCopy) const {
+	int n = 0;
+	for (std::deque<Segment>::const_iterator it = segments_.begin();
+			 it != segments_.end() && it->fd < 0 && isZeroCopy(*it) == zeroCopy && n < maxIov;
+			 ++it, ++n) {
+		iov[n].iov_base = const_cast<char*>(it->data);
+		iov[n].iov_len = it->size;
+	}
+	return n;
+}
+
+int BufferChain::peek(struct iovec* iov, int maxIov) const {
+	int n = 0;
+	for (std::deque<Segment>::const_iterator it = segments_.begin();
+			 it != segments_.end() && it->fd < 0 && n < maxIov;
+			 ++it, ++n) {
+		iov[n].iov_base = const_cast<char*>(it->data);
+		iov[n].iov_len = it->size;
+	}
+	return n;
+}
+
+void BufferChain::retrieve(size_t len) {
+	assert(len <= readableBytes_);
+	while (len > 0) {
+		Segment& front = segments_.front();
+		if (len < front.size) {
+			if (front.fd < 0) {
+				front.data += len;
+			} else {
+				front.offset += static_cast<off_t>(len);
+			}
+			front.size -= len;
+			readableBytes_ -= len;
+			break;
+		}
+		len -= front.size;
+		readableBytes_ -= front.size;
+		popFront();
+	}
+}
+
+void BufferChain::retrieveAll() {
+	while (!segments_.empty()) {
+		readableBytes_ -= segments_.front().size;
+		popFront();
+	}
+	assert(readableBytes_ == 0);
+}
+
+void BufferChain::popFront() {
+	if (segments_.front().block != NULL) {
+		deallocateBlock(segments_.front().block, segments_.front().blockSize);
+		segments_.front().block = NULL;
+	}
+	if (segments_.front().zeroCopied) {
+		// released when the last send referring to it completes
+		Pending pending;
+		pending.seq = zeroCopySeq_ - 1;
+		pending.release.swap(segments_.front().release);
+		pending.owner.swap(segments_.front().owner);
+		pending_.push_back(std::move(pending));
+		segments_.pop_front();
+		return;
+	}
+
+	// released after popped, release may append to the chain again
+	ReleaseCallback release;
+	release.swap(segments_.front().release);
+	std::shared_ptr<const void> owner;
+	owner.swap(segments_.front().owner);
+	segments_.pop_front();
+	if (release) {
+		release();
+	}
+}
+
+char* BufferChain::allocateBlock(size_t* size) {
+	if (pool_) {
+		return pool_->allocate(size);
+	}
+	return new char[*size];
+}
+
+void BufferChain::deallocateBlock(char* block, size_t size) {
+	if (pool_) {
+		pool_->deallocate(block, size);
+	} else {
+		delete[] block;
+	}
+}
+
+ssize_t BufferChain::writeFd(int fd, int* savedErrno) {
+	waitingPipe_ = -1;
+	ssize_t total = 0;
+	while (!segments_.empty()) {
+		Segment& front = segments_.front();
+		size_t expected = 0;
+		ssize_t n = 0;
+		if (front.fd < 0) {
+			// memory segments until a file in one system call
+			const bool zeroCopy = isZeroCopy(front);
+			struct iovec iov[IOV_MAX];
+			const int iovcnt = gather(iov, IOV_MAX, zeroCopy);
+			for (int i = 0; i < iovcnt; ++i) {
+				expected += iov[i].iov_len;
+			}
+			n = zeroCopy ? writeZeroCopy(fd, iov, iovcnt) : sockets::writev(fd, iov, iovcnt);
+		} else {
+			expected = front.size;
+			n = writeFile(fd, &front);
+			if (n == 0) {
+				// truncated file or closed pipe, the rest will never come
+				LOG_ERROR << "BufferChain::writeFd - unexpected end of fd " << front.fd
+									<< ", " << front.size << " bytes dropped";
+				readableBytes_ -= front.size;
+				popFront();
+				continue;
+			}
+		}
+
+		if (n < 0) {
+			if (total == 0) {
+				*savedErrno = errno;
+				return n;
+			}
+			break;
+		}
+		retrieve(static_cast<size_t>(n));
+		total += n;
+		if (static_cast<size_t>(n) < expected) {
+			// fd is full
+			break;
+		}
+	}
+	return total;
+}
+
+ssize_t BufferChain::writeFile(int fd, Segment* segment) {
+	if (segment->pipe) {
+		ssize_t n = sockets::splice(segment->fd, fd, segment->size);
+		if (n < 0 && errno == EAGAIN && sockets::pipeReadableBytes(segment->fd) == 0) {
+			// nothing to move rather than fd full
+			waitingPipe_ = segment->fd;
+			errno = EAGAIN;
+		}
+		return n;
+	}
+	// the offset is advanced by retrieve()
+	off_t offset = segment->offset;
+	return sockets::sendfile(fd, segment->fd, &offset, segment->size);
+}
+
+ssize_t BufferChain::writeZeroCopy(int fd, const struct iovec* iov, int iovcnt) {
+	ssize_t n = sockets::sendZeroCopy(fd, iov, iovcnt);
+	if (n < 0 && errno == ENOBUFS) {
+		// out of optmem for notifications, copies this time
+		return sockets::writev(fd, iov, iovcnt);
+	}
+	if (n <= 0) {
+		return n;
+	}
+
+	// the segments sent from are referred to by this send
+	++zeroCopySeq_;
+	++zeroCopySends_;
+	completed_.push_back(false);
+	size_t len = static_cast<size_t>(n);
+	for (std::deque<Segment>::iterator it = segments_.begin(); len > 0; ++it) {
+		it->zeroCopied = true;
+		len -= std::min(len, it->size);
+	}
+	return n;
+}
+
+int BufferChain::handleZeroCopyCompletions(int fd, int* savedErrno) {
+	int count = 0;
+	int ret = 0;
+	uint32_t lo = 0;
+	uint32_t hi = 0;
+	bool copied = false;
+	while ((ret = sockets::recvZeroCopyCompletion(fd, &lo, &hi, &copied)) > 0) {
+		++count;
+		// a range of sends may be reported at once
+		for (uint32_t seq = lo; ; ++seq) {
+			uint32_t i = seq - completedSeq_;
+			if (i < completed_.size()) {
+				completed_[i] = true;
+			}
+			if (copied) {
+				++zeroCopyCopied_;
+			}
+			if (seq == hi) {
+				break;
+			}
+		}
+	}
+	if (ret < 0) {
+		*savedErrno = errno;
+		if (count == 0) {
+			return -1;
+		}
+	}
+
+	// completions may be out of order, slices are released in order
+	while (!completed_.empty() && completed_.front()) {
+		completed_.pop_front();
+		++completedSeq_;
+	}
+	releaseCompleted();
+	return count;
+}
+
+void BufferChain::releaseCompleted() {
+	while (!pending_.empty()
+			&& static_cast<int32_t>(pending_.front().seq - completedSeq_) < 0) {
+		ReleaseCallback release;
+		release.swap(pending_.front().release);
+		std::shared_ptr<const void> owner;
+		owner.swap(pending_.front().owner);
+		pending_.pop_front();
+		if (release) {
+			release();
+		}
+	}
+}
+
+}
@@ -0,0 +1,217 @@
+#ifndef LEANET_BUFFERCHAIN_H
+#define LEANET_BUFFERCHAIN_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h> // ssize_t
+
+#include <deque>
+#include <memory> // std::shared_ptr
+#include <functional>
+
+#include "noncopyable.h"
+#include "callbacks.h"
+#include "stringview.h"
+
+struct iovec;
+
+namespace leanet {
+
+class BufferPool;
+
+//
+// output buffer as a chain of segments, written with one writev(2) for
+// memory.
+//
+// a segment is either a block owned by the chain, which small appends are
+// copied into, or a slice of memory owned by the caller, which is referred
+// to without copying and released once it has been written(or the chain is
+// destroyed), by a callback or by dropping a reference to its owner.
+// slices smaller than kMinSliceSize are copied and released at once, since
+// a segment costs an iovec in writev(2).
+// a segment may also be a range of a file, written with sendfile(2), or
+// bytes to come from a pipe, written with splice(2), the fd is released in
+// the same way and must be open until then.
+//
+// with zero copy enabled, slices of at least the threshold are written with
+// MSG_ZEROCOPY and released only after the kernel reports the sends
+// completed on the error queue, see handleZeroCopyCompletions().
+//
+// at host endpoint: append(data, len) or appendSlice(data, len, release)
+// at net endpoint: ssize_t n = chain.writeFd(sockfd, &savedErrno)
+//
+class BufferChain: noncopyable {
+public:
+	static const size_t kBlockSize = 4096;
+	static const size_t kMinSliceSize = 512;
+
+	// blocks from pool if not NULL
+	explicit BufferChain(const std::shared_ptr<BufferPool>& pool = std::shared_ptr<BufferPool>())
+		: pool_(pool),
+			segments_(),
+			readableBytes_(0),
+			waitingPipe_(-1),
+			zeroCopyThreshold_(0),
+			zeroCopySeq_(0),
+			completedSeq_(0),
+			zeroCopySends_(0),
+			zeroCopyCopied_(0)
+	{ }
+
+	~BufferChain();
+
+	size_t readableBytes() const {
+		return readableBytes_;
+	}
+
+	bool empty() const {
+		return readableBytes_ == 0;
+	}
+
+	size_t numSegments() const {
+		return segments_.size();
+	}
+
+	// copies the data into blocks owned by the chain
+	void append(const void* data, size_t len);
+
+	void append(const StringView& view) {
+		append(view.data(), view.size());
+	}
+
+	// refers to the data without copying, release is called when the data
+	// will not be touched again.
+	void appendSlice(const void* data, size_t len, const ReleaseCallback& release);
+	// refers to the data without copying, holds a reference to its owner
+	// until the data will not be touched again.
+	void appendSlice(const void* data, size_t len, const std::shared_ptr<const void>& owner);
+
+	// len bytes of a regular file from offset, or len bytes read from a pipe,
+	// without copying to user space.
+	void appendFile(int fd, off_t offset, size_t len, const ReleaseCallback& release);
+
+	// fills at most maxIov iovecs with the readable memory segments in order
+	// until a file segment, returns how many are filled.
+	int peek(struct iovec* iov, int maxIov) const;
+
+	void retrieve(size_t len);
+	void retrieveAll();
+
+	// writes as much as possible with writev(2), sendfile(2) and splice(2)
+	// until the fd is full, and retrieves the written bytes, returns as
+	// writev(2).
+	ssize_t writeFd(int fd, int* savedErrno);
+
+	// the pipe that writeFd() is stopped by since it is empty, the caller
+	// waits for it readable instead of the fd writable, -1 if none.
+	int waitingPipe() const {
+		return waitingPipe_;
+	}
+
+	// slices of at least threshold bytes are written with MSG_ZEROCOPY, 0 to
+	// disable. SO_ZEROCOPY must be set on the fd written to.
+	void setZeroCopyThreshold(size_t threshold) {
+		zeroCopyThreshold_ = threshold;
+	}
+
+	bool isZeroCopy(size_t len) const {
+		return zeroCopyThreshold_ > 0 && len >= zeroCopyThreshold_;
+	}
+
+	bool zeroCopyEnabled() const {
+		return zeroCopyThreshold_ > 0;
+	}
+
+	// reads completions from the error queue of fd and releases the slices
+	// which are not referred to by kernel any more, returns how many
+	// completions are read, -1 on error with errno in savedErrno.
+	int handleZeroCopyCompletions(int fd, int* savedErrno);
+
+	// slices written but not yet released, the chain must not be destroyed
+	// before they are, unless the kernel sends nothing more from them
+	size_t zeroCopyPending() const {
+		return pending_.size();
+	}
+	// MSG_ZEROCOPY sends and how many of them the kernel copied after all
+	int64_t zeroCopySends() const {
+		return zeroCopySends_;
+	}
+	int64_t zeroCopyCopied() const {
+		return zeroCopyCopied_;
+	}
+
+private:
+	struct Segment {
+		Segment()
+			: block(NULL),
+				blockSize(0),
+				data(NULL),
+				size(0),
+				fd(-1),
+				offset(0),
+				pipe(false),
+				zeroCopied(false)
+		{ }
+
+		size_t writableBytes() const {
+			return block ? static_cast<size_t>(block + blockSize - (data + size)) : 0;
+		}
+
+		// owned storage, NULL for a slice, freed by popFront()
+		char* block;
+		size_t blockSize;
+		// unwritten bytes
+		const char* data;
+		size_t size;
+		// for a file, data is NULL
+		int fd;
+		off_t offset;
+		bool pipe;
+		// referred to by a MSG_ZEROCOPY send
+		bool zeroCopied;
+		// for a slice or a file
+		ReleaseCallback release;
+		std::shared_ptr<const void> owner;
+	};
+
+	// a zero-copied slice waiting for its send to complete
+	struct Pending {
+		uint32_t seq;
+		ReleaseCallback release;
+		std::shared_ptr<const void> owner;
+	};
+
+	bool isZeroCopy(const Segment& segment) const {
+		return !segment.block && segment.fd < 0 && isZeroCopy(segment.size);
+	}
+
+	void popFront();
+	char* allocateBlock(size_t* size);
+	void deallocateBlock(char* block, size_t size);
+	// memory segments from the front until a file, which are all or none
+	// zero copy ones.
+	int gather(struct iovec* iov, int maxIov, bool zeroCopy) const;
+	ssize_t writeFile(int fd, Segment* segment);
+	ssize_t writeZeroCopy(int fd, const struct iovec* iov, int iovcnt);
+	void releaseCompleted();
+
+	std::shared_ptr<BufferPool> pool_;
+	std::deque<Segment> segments_;
+	size_t readableBytes_;
+	int waitingPipe_;
+
+	size_t zeroCopyThreshold_;
+	// the kernel counts MSG_ZEROCOPY sends from 0 for each socket
+	uint32_t zeroCopySeq_;
+	// sends before it are completed, the flags are of the later ones
+	uint32_t completedSeq_;
+	std::deque<bool> completed_;
+	std::deque<Pending> pending_;
+	int64_t zeroCopySends_;
+	int64_t zeroCopyCopied_;
+};
+
+}
+
+#endif // LEANET_BUFFERCHAIN_H
@@ -0,0 +1,228 @@
+#include "bufferpool.h"
+
+#include <assert.h>
+
+#include <algorithm> // std::sort, std::upper_bound
+
+#include "currentthread.h"
+
+namespace leanet {
+
+const size_t BufferPool::kMinBlockSize;
+const size_t BufferPool::kMaxBlockSize;
+const size_t BufferPool::kSlabSize;
+const int64_t BufferPool::kDefaultMaxCachedBytes;
+
+BufferPool::BufferPool()
+	: ownerTid_(currentThread::tid()),
+		stats_(),
+		maxCachedBytes_(kDefaultMaxCachedBytes),
+		mutex_(),
+		slabs_(),
+		reservedBytes_(0),
+		remoteFrees_(NULL),
+		remoteBytes_(0),
+		remoteFreeCount_(0),
+		hasRemoteFrees_(false)
+{
+	for (int i = 0; i < kNumClasses; ++i) {
+		freeLists_[i] = NULL;
+	}
+}
+
+BufferPool::~BufferPool() {
+	for (size_t i = 0; i < slabs_.size(); ++i) {
+		delete[] slabs_[i].begin;
+	}
+}
+
+int BufferPool::sizeClass(size_t size) {
+	assert(size <= kMaxBlockSize);
+	int c = 0;
+	while (classSize(c) < size) {
+		++c;
+	}
+	return c;
+}
+
+bool BufferPool::inOwnerThread() const {
+	return currentThread::tid() == ownerTid_;
+}
+
+char* BufferPool::allocate(size_t* size) {
+	if (*size > kMaxBlockSize) {
+		if (inOwnerThread()) {
+			addStat(&stats_.largeAllocations, 1);
+		}
+		return new char[*size];
+	}
+
+	const int c = sizeClass(*size);
+	*size = classSize(c);
+	if (!inOwnerThread()) {
+		// joins the pool when freed
+		char* block = new char[*size];
+		Slab slab = { block, *size };
+		MutexLock lock(mutex_);
+		slabs_.push_back(slab);
+		reservedBytes_ += static_cast<int64_t>(*size);
+		return block;
+	}
+
+	addStat(&stats_.allocations, 1);
+	if (__atomic_load_n(&hasRemoteFrees_, __ATOMIC_ACQUIRE)) {
+		takeRemoteFrees();
+	}
+	if (freeLists_[c] == NULL) {
+		refill(c);
+	} else {
+		addStat(&stats_.reuses, 1);
+	}
+	FreeBlock* block = freeLists_[c];
+	freeLists_[c] = block->next;
+	addStat(&stats_.cachedBytes, -static_cast<int64_t>(*size));
+	return reinterpret_cast<char*>(block);
+}
+
+void BufferPool::deallocate(char* block, size_t size) {
+	if (size > kMaxBlockSize) {
+		delete[] block;
+		return;
+	}
+
+	FreeBlock* b = reinterpret_cast<FreeBlock*>(block);
+	b->size = size;
+	if (inOwnerThread()) {
+		const int c = sizeClass(size);
+		b->next = freeLists_[c];
+		freeLists_[c] = b;
+		addStat(&stats_.cachedBytes, static_cast<int64_t>(size));
+	} else {
+		MutexLock lock(mutex_);
+		b->next = remoteFrees_;
+		remoteFrees_ = b;
+		remoteBytes_ += static_cast<int64_t>(size);
+		++remoteFreeCount_;
+		__atomic_store_n(&hasRemoteFrees_, true, __ATOMIC_RELEASE);
+	}
+}
+
+BufferPool::Stats BufferPool::stats() const {
+	Stats stats;
+	stats.cachedBytes = __atomic_load_n(&stats_.cachedBytes, __ATOMIC_RELAXED);
+	stats.allocations = __atomic_load_n(&stats_.allocations, __ATOMIC_RELAXED);
+	stats.reuses = __atomic_load_n(&stats_.reuses, __ATOMIC_RELAXED);
+	stats.largeAllocations = __atomic_load_n(&stats_.largeAllocations, __ATOMIC_RELAXED);
+	MutexLock lock(mutex_);
+	stats.reservedBytes = reservedBytes_;
+	stats.cachedBytes += remoteBytes_;
+	stats.usedBytes = stats.reservedBytes - stats.cachedBytes;
+	stats.remoteFrees = remoteFreeCount_;
+	return stats;
+}
+
+void BufferPool::refill(int sizeClass) {
+	const size_t blockSize = classSize(sizeClass);
+	const size_t slabSize = blockSize < kSlabSize ? kSlabSize : blockSize;
+	char* slab = new char[slabSize];
+	{
+	MutexLock lock(mutex_);
+	Slab s = { slab, slabSize };
+	slabs_.push_back(s);
+	reservedBytes_ += static_cast<int64_t>(slabSize);
+	}
+
+	for (size_t offset = slabSize; offset > 0; offset -= blockSize) {
+		FreeBlock* b = reinterpret_cast<FreeBlock*>(slab + offset - blockSize);
+		b->size = blockSize;
+		b->next = freeLists_[sizeClass];
+		freeLists_[sizeClass] = b;
+	}
+	addStat(&stats_.cachedBytes, static_cast<int64_t>(slabSize));
+}
+
+void BufferPool::takeRemoteFrees() {
+	FreeBlock* list = NULL;
+	{
+	MutexLock lock(mutex_);
+	list = remoteFrees_;
+	remoteFrees_ = NULL;
+	addStat(&stats_.cachedBytes, remoteBytes_);
+	remoteBytes_ = 0;
+	__atomic_store_n(&hasRemoteFrees_, false, __ATOMIC_RELAXED);
+	}
+
+	while (list != NULL) {
+		FreeBlock* b = list;
+		list = list->next;
+		const int c = sizeClass(b->size);
+		b->next = freeLists_[c];
+		freeLists_[c] = b;
+	}
+}
+
+void BufferPool::trim(bool force) {
+	assert(inOwnerThread());
+	if (__atomic_load_n(&hasRemoteFrees_, __ATOMIC_ACQUIRE)) {
+		takeRemoteFrees();
+	}
+	if (!force && stats_.cachedBytes <= maxCachedBytes_) {
+		return;
+	}
+	const int64_t target = force ? 0 : maxCachedBytes_ / 2;
+
+	MutexLock lock(mutex_);
+	// the free bytes of every slab, by the slab each cached block is in
+	std::sort(slabs_.begin(), slabs_.end());
+	std::vector<size_t> freeBytes(slabs_.size(), 0);
+	for (int c = 0; c < kNumClasses; ++c) {
+		for (FreeBlock* b = freeLists_[c]; b != NULL; b = b->next) {
+			freeBytes[slabOf(b)] += classSize(c);
+		}
+	}
+
+	int64_t cached = stats_.cachedBytes;
+	std::vector<bool> released(slabs_.size(), false);
+	bool any = false;
+	for (size_t i = 0; i < slabs_.size() && cached > target; ++i) {
+		if (freeBytes[i] == slabs_[i].size) {
+			released[i] = true;
+			any = true;
+			cached -= static_cast<int64_t>(slabs_[i].size);
+		}
+	}
+
+	if (any) {
+		for (int c = 0; c < kNumClasses; ++c) {
+			FreeBlock** link = &freeLists_[c];
+			while (*link != NULL) {
+				if (released[slabOf(*link)]) {
+					*link = (*link)->next;
+				} else {
+					link = &(*link)->next;
+				}
+			}
+		}
+		size_t kept = 0;
+		for (size_t i = 0; i < slabs_.size(); ++i) {
+			if (released[i]) {
+				reservedBytes_ -= static_cast<int64_t>(slabs_[i].size);
+				delete[] slabs_[i].begin;
+			} else {
+				slabs_[kept++] = slabs_[i];
+			}
+		}
+		slabs_.resize(kept);
+		addStat(&stats_.cachedBytes, cached - stats_.cachedBytes);
+	}
+}
+
+size_t BufferPool::slabOf(const FreeBlock* block) const {
+	// slabs_ sorted, the last one beginning at or before block
+	Slab key = { const_cast<char*>(reinterpret_cast<const char*>(block)), 0 };
+	std::vector<Slab>::const_iterator it = std::upper_bound(slabs_.begin(), slabs_.end(), key);
+	assert(it != slabs_.begin());
+	return static_cast<size_t>(it - slabs_.begin()) - 1;
+}
+
+}
@@ -0,0 +1,139 @@
+#ifndef LEANET_BUFFERPOOL_H
+#define LEANET_BUFFERPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "noncopyable.h"
+#include "mutex.h"
+
+namespace leanet {
+
+//
+// size-classed slab pool of buffer storage, one per EventLoop.
+//
+// blocks are powers of two from kMinBlockSize to kMaxBlockSize, carved from
+// slabs of kSlabSize(or of one block for larger classes) and cached in a
+// free list per class once freed, so connection churn doesn't go to malloc.
+// the free lists belong to the thread which creates the pool, the loop
+// thread, and need no lock. blocks freed in other threads are handed back
+// through a locked list, blocks allocated in other threads come from
+// malloc and join the pool when freed. larger blocks are not pooled.
+//
+// once more than maxCachedBytes are cached, the slabs whose blocks are all
+// free go back to malloc until half of it is left by trim(), which the loop
+// calls from time to time, so freeing a block stays cheap. the others are
+// kept until the pool is destroyed, which buffers postpone by holding a
+// reference to it.
+//
+class BufferPool: noncopyable {
+public:
+	static const size_t kMinBlockSize = 512;
+	static const size_t kMaxBlockSize = 1024 * 1024;
+	static const size_t kSlabSize = 64 * 1024;
+	static const int64_t kDefaultMaxCachedBytes = 64 * 1024 * 1024;
+
+	// memory usage
+	struct Stats {
+		Stats()
+			: reservedBytes(0),
+				cachedBytes(0),
+				usedBytes(0),
+				allocations(0),
+				reuses(0),
+				largeAllocations(0),
+				remoteFrees(0)
+		{ }
+
+		// from malloc for slabs
+		int64_t reservedBytes;
+		// in the free lists
+		int64_t cachedBytes;
+		// in blocks handed out, reservedBytes - cachedBytes
+		int64_t usedBytes;
+		// in loop thread
+		int64_t allocations;
+		// served by the free lists
+		int64_t reuses;
+		// larger than kMaxBlockSize, from malloc
+		int64_t largeAllocations;
+		// freed in other threads
+		int64_t remoteFrees;
+	};
+
+	BufferPool();
+	~BufferPool();
+
+	// a block of at least *size bytes, *size is set to the size of the block
+	char* allocate(size_t* size);
+	// size is what allocate() has set
+	void deallocate(char* block, size_t size);
+
+	// called in the owner thread
+	void setMaxCachedBytes(int64_t bytes)
+	{ maxCachedBytes_ = bytes; }
+
+	// if more than maxCachedBytes are cached, returns the slabs whose blocks
+	// are all cached to malloc until at most half of it is, or all of them
+	// if force.
+	// called in the owner thread, periodically by EventLoop.
+	void trim(bool force = false);
+
+	// thread safe
+	Stats stats() const;
+
+private:
+	static const int kNumClasses = 12; // 512B ~ 1MB
+
+	struct FreeBlock {
+		FreeBlock* next;
+		size_t size;
+	};
+
+	struct Slab {
+		char* begin;
+		size_t size;
+
+		bool operator<(const Slab& rhs) const
+		{ return begin < rhs.begin; }
+	};
+
+	static int sizeClass(size_t size);
+	static size_t classSize(int sizeClass) {
+		return kMinBlockSize << sizeClass;
+	}
+
+	// stats_ is written by the owner thread only and read by stats() in any
+	// thread, by __atomic builtins with no read-modify-write
+	static void addStat(int64_t* stat, int64_t delta) {
+		__atomic_store_n(stat, __atomic_load_n(stat, __ATOMIC_RELAXED) + delta, __ATOMIC_RELAXED);
+	}
+
+	bool inOwnerThread() const;
+	void refill(int sizeClass);
+	void takeRemoteFrees();
+	// index in slabs_ sorted, with mutex_ held
+	size_t slabOf(const FreeBlock* block) const;
+
+	const uint64_t ownerTid_;
+	FreeBlock* freeLists_[kNumClasses];
+	// but reservedBytes and remoteFrees
+	Stats stats_;
+	int64_t maxCachedBytes_;
+
+	// guards what other threads touch
+	mutable Mutex mutex_;
+	std::vector<Slab> slabs_;
+	int64_t reservedBytes_;
+	FreeBlock* remoteFrees_;
+	int64_t remoteBytes_;
+	int64_t remoteFreeCount_;
+	// read without the lock by __atomic builtins
+	bool hasRemoteFrees_;
+};
+
+}
+
+#endif // LEANET_BUFFERPOOL_H
@@ -9,6 +9,7 @@
 namespace leanet {
 
 class Buffer;
+class CircularBuffer;
 class TcpConnection;
 typedef std::shared_ptr<TcpConnection> TcpConnectionPtr;
 typedef std::function<void()> TimerCallback;
@@ -16,10 +17,16 @@ typedef std::function<void (const TcpConnectionPtr&)> ConnectionCallback;
 typedef std::function<void (const TcpConnectionPtr&)> CloseCallback;
 typedef std::function<void (const TcpConnectionPtr&)> WriteCompleteCallback;
 typedef std::function<void (const TcpConnectionPtr&, size_t)> HighWaterMarkCallback;
+// memory sent without copying is not touched any more
+typedef std::function<void()> ReleaseCallback;
 
 typedef std::function<void (const TcpConnectionPtr&,
 														Buffer*,
 														Timestamp)> MessageCallback;
+// input read into a CircularBuffer, see TcpConnection
+typedef std::function<void (const TcpConnectionPtr&,
+														CircularBuffer*,
+														Timestamp)> CircularMessageCallback;
 
 void defaultConnectionCallback(const TcpConnectionPtr& conn);
 void defaultMessageCallback(const TcpConnectionPtr& conn,
@@ -19,6 +19,7 @@ Channel::Channel(EventLoop* loop, int fd)
 		interestedEvents_(kNoneEvent),
 		receivedEvents_(kNoneEvent),
 		index_(-1),
+		edgeTriggered_(false),
 		eventHanding_(false)
 { }
 
@@ -41,11 +41,15 @@ public:
 	void setReceivedEvents(int revents)
 	{ receivedEvents_ = revents; }
 
-	// read forever, so no enableReading() there...
 	void enableReading() {
 		interestedEvents_ |= kReadEvent;
 		update();
 	}
+	// reading is stopped only for backpressure, see TcpConnection
+	void disableReading() {
+		interestedEvents_ &= ~kReadEvent;
+		update();
+	}
 
 	void enableWriting() {
 		interestedEvents_ |= kWriteEvent;
@@ -62,6 +66,13 @@ public:
 		update();
 	}
 
+	// readable and writable with one update, for edge-triggered channels
+	// which register writable interest once and keep it.
+	void enableAll() {
+		interestedEvents_ |= kReadEvent | kWriteEvent;
+		update();
+	}
+
 	bool isNoneEvent() const {
 		return interestedEvents_ == kNoneEvent;
 	}
@@ -70,6 +81,15 @@ public:
 		return interestedEvents_ & kWriteEvent;
 	}
 
+	bool isReading() const {
+		return interestedEvents_ & kReadEvent;
+	}
+
+	// edge-triggered notification(EPOLLET), honored by pollers whose
+	// supportsEdgeTriggered() is true. call it before enabling any events.
+	void setEdgeTriggered(bool on) { edgeTriggered_ = on; }
+	bool isEdgeTriggered() const { return edgeTriggered_; }
+
 	void remove();
 
 	// for poller
@@ -91,6 +111,7 @@ private:
 	int receivedEvents_;
 
 	int index_; // used by poller
+	bool edgeTriggered_;
 
 	bool eventHanding_;
 	ReadEventCallback readCallback_;
@@ -1,7 +1,93 @@
-#include <leanet/circularbuffer.h>
+#include "circularbuffer.h"
+#include "sockets.h"
+
+#include <errno.h>
+#include <sys/uio.h> // readv, writev
 
 namespace leanet {
 
-const char Buffer::kCRLF[] = "\r\n";
+int CircularBuffer::peek(struct iovec* iov) const {
+	if (readableBytes() == 0) {
+		return 0;
+	}
+	iov[0].iov_base = const_cast<char*>(beginRead());
+	if (needRewind()) {
+		iov[0].iov_len = size_ - readerIndex_;
+		iov[1].iov_base = const_cast<char*>(bufferBegin());
+		iov[1].iov_len = writerIndex_;
+		return writerIndex_ > 0 ? 2 : 1;
+	}
+	iov[0].iov_len = writerIndex_ - readerIndex_;
+	return 1;
+}
+
+int CircularBuffer::peekWritable(struct iovec* iov) {
+	iov[0].iov_base = beginWrite();
+	if (writerIndex_ >= readerIndex_) {
+		// up to the end, and from the begin to the byte kept free
+		iov[0].iov_len = size_ - writerIndex_ - (readerIndex_ == 0 ? 1 : 0);
+		if (readerIndex_ > 1) {
+			iov[1].iov_base = bufferBegin();
+			iov[1].iov_len = readerIndex_ - 1;
+			return 2;
+		}
+		return 1;
+	}
+	iov[0].iov_len = readerIndex_ - writerIndex_ - 1;
+	return 1;
+}
+
+ssize_t CircularBuffer::readFd(int fd, char* spill, size_t spillSize, int* savedErrno) {
+	struct iovec iov[3];
+	int iovcnt = peekWritable(iov);
+	const size_t writable = writableBytes();
+	if (spill != NULL) {
+		iov[iovcnt].iov_base = spill;
+		iov[iovcnt].iov_len = spillSize;
+		++iovcnt;
+	}
+
+	const ssize_t n = sockets::readv(fd, iov, iovcnt);
+	if (n < 0) {
+		*savedErrno = errno;
+	} else if (static_cast<size_t>(n) <= writable) {
+		writeAhead(static_cast<size_t>(n));
+	} else {
+		writeAhead(writable);
+		append(spill, static_cast<size_t>(n) - writable);
+	}
+
+	return n;
+}
+
+ssize_t CircularBuffer::writeFd(int fd, int* savedErrno) {
+	struct iovec iov[2];
+	const int iovcnt = peek(iov);
+	if (iovcnt == 0) {
+		return 0;
+	}
+	const ssize_t n = sockets::writev(fd, iov, iovcnt);
+	if (n < 0) {
+		*savedErrno = errno;
+	} else {
+		retrieve(static_cast<size_t>(n));
+	}
+	return n;
+}
+
+void CircularBuffer::extend(size_t len) {
+	size_t rlen = readableBytes();
+	len += rlen;
+	len *= 2;
+
+	CircularBuffer tmp(len);
+	if (needRewind()) {
+		tmp.append(beginRead(), static_cast<size_t>(bufferEnd() - beginRead()));
+		tmp.append(bufferBegin(), static_cast<size_t>(beginWrite() - bufferBegin()));
+	} else {
+		tmp.append(beginRead(), readableBytes());
+	}
+	tmp.swap(*this);
+}
 
 }
@@ -2,20 +2,34 @@
 #define LEANET_CIRCULAR_BUFFER_H
 
 #include <assert.h>
+#include <sys/types.h> // ssize_t
 
 #include <algorithm> // std::copy
 
-#include <leanet/types.h>
-#include <leanet/stringview.h>
+#include "types.h"
+#include "copyable.h"
+#include "stringview.h"
+
+struct iovec;
 
 namespace leanet {
 
-// a circular buffer
-class Buffer {
+//
+// a circular buffer, an alternative to Buffer for input of connections.
+//
+// reading and retrieving never move the readable bytes, they wrap around
+// the end, so a steady stream costs no memmove as Buffer::makeSpace() does.
+// the readable bytes are in at most two segments, read from the fd with
+// readv(2) into the two free segments and written with writev(2) out of the
+// two readable ones, and they can't be handed out as one contiguous range.
+//
+// one byte is kept free to tell full from empty.
+//
+class CircularBuffer: public copyable {
 public:
 	static const size_t kInitialSize = 1024;
 
-	explicit Buffer(size_t initialSize = kInitialSize)
+	explicit CircularBuffer(size_t initialSize = kInitialSize)
 		: size_(initialSize + 1),
 			buffer_(new char[size_]),
 			writerIndex_(0),
@@ -25,7 +39,7 @@ public:
 		assert(writableBytes() == (size_ - 1));
 	}
 
-	Buffer(const Buffer& other)
+	CircularBuffer(const CircularBuffer& other)
 		: size_(other.size_),
 			buffer_(new char[other.size_]),
 			writerIndex_(other.writerIndex_),
@@ -45,17 +59,17 @@ public:
 		}
 	}
 
-	Buffer& operator=(const Buffer& other) {
-		Buffer tmp(other);
+	CircularBuffer& operator=(const CircularBuffer& other) {
+		CircularBuffer tmp(other);
 		tmp.swap(*this);
 		return *this;
 	}
 
-	~Buffer() {
+	~CircularBuffer() {
 		delete[] buffer_;
 	}
 
-	void swap(Buffer& other) {
+	void swap(CircularBuffer& other) {
 		std::swap(size_, other.size_);
 		std::swap(buffer_, other.buffer_);
 		std::swap(writerIndex_, other.writerIndex_);
@@ -63,12 +77,8 @@ public:
 	}
 
 	size_t readableBytes() const {
-		int diff = writerIndex_ - readerIndex_;
-		if (diff < 0) {
-			diff += size_;
-		}
-		assert(diff >= 0);
-		return diff;
+		return needRewind() ? writerIndex_ + size_ - readerIndex_
+												: writerIndex_ - readerIndex_;
 	}
 
 	size_t writableBytes() const {
@@ -83,6 +93,17 @@ public:
 		return buffer_ + writerIndex_;
 	}
 
+	// fills iov[0] and iov[1] with the readable bytes in order, returns how
+	// many are filled.
+	int peek(struct iovec* iov) const;
+	// fills iov[0] and iov[1] with the writable bytes in order, for reading
+	// into them elsewhere and hasWritten() then. returns how many are filled.
+	int peekWritable(struct iovec* iov);
+	void hasWritten(size_t len) {
+		assert(len <= writableBytes());
+		writeAhead(len);
+	}
+
 	void append(const char* data, size_t len) {
 		ensureWritableBytes(len);
 
@@ -133,12 +154,9 @@ public:
 		len = std::min(readableBytes(), len);
 		string result;
 		result.reserve(len);
-		if (needRewind()) {
-			result.assign(beginRead(), bufferEnd());
-			result.append(bufferBegin(), beginWrite());
-		} else {
-			result.assign(beginRead(), beginWrite());
-		}
+		const size_t first = std::min(len, static_cast<size_t>(bufferEnd() - beginRead()));
+		result.assign(beginRead(), first);
+		result.append(bufferBegin(), len - first);
 		retrieve(len);
 
 		return result;
@@ -155,6 +173,13 @@ public:
 		assert(writableBytes() >= len);
 	}
 
+	// readv(2) into the free segments, and spill for more if not NULL,
+	// which is appended then. returns as readv(2).
+	ssize_t readFd(int fd, char* spill, size_t spillSize, int* savedErrno);
+	// writev(2) out of the readable segments, and retrieves what is written.
+	// returns as writev(2).
+	ssize_t writeFd(int fd, int* savedErrno);
+
 	// for debug
 	size_t internalSize() const {
 		return size_;
@@ -162,11 +187,17 @@ public:
 
 private:
 	void writeAhead(size_t len) {
-		writerIndex_ = (writerIndex_ + len) % size_;
+		writerIndex_ += len;
+		if (writerIndex_ >= size_) {
+			writerIndex_ -= size_;
+		}
 	}
 
 	void readAhead(size_t len) {
-		readerIndex_ = (readerIndex_ + len) % size_;
+		readerIndex_ += len;
+		if (readerIndex_ >= size_) {
+			readerIndex_ -= size_;
+		}
 	}
 
 	bool needRewind() const {
@@ -197,27 +228,13 @@ private:
 		return buffer_ + size_;
 	}
 
-	void extend(size_t len) {
-		size_t rlen = readableBytes();
-		len += rlen;
-		len *= 2;
-
-		Buffer tmp(len);
-		if (needRewind()) {
-			tmp.append(beginRead(), bufferEnd() - beginRead());
-			tmp.append(bufferBegin(), beginWrite() - bufferBegin());
-		} else {
-			tmp.append(beginRead(), readableBytes());
-		}
-		tmp.swap(*this);
-	}
+	void extend(size_t len);
 
 	size_t size_;
 	char*  buffer_;
 
 	size_t writerIndex_;
 	size_t readerIndex_;
-	static const char kCRLF[];
 };
 
 } // namespace leanet
@@ -0,0 +1,99 @@
+#include "connectionregistry.h"
+
+#include <assert.h>
+
+#include <utility> // std::move
+
+using namespace leanet;
+
+ConnectionRegistry::ConnectionRegistry(size_t initialSlots)
+	: slots_(),
+		size_(0)
+{
+	size_t n = 8;
+	while (n < initialSlots) {
+		n *= 2;
+	}
+	slots_.resize(n);
+}
+
+void ConnectionRegistry::add(uint64_t id, const TcpConnectionPtr& conn) {
+	assert(id != 0);
+	if (2 * (size_ + 1) > slots_.size()) {
+		grow();
+	}
+	Slot& slot = slots_[find(id, slots_.size() - 1)];
+	assert(slot.id == 0);
+	slot.id = id;
+	slot.conn = conn;
+	++size_;
+}
+
+bool ConnectionRegistry::remove(uint64_t id) {
+	const size_t mask = slots_.size() - 1;
+	size_t i = find(id, mask);
+	if (slots_[i].id == 0) {
+		return false;
+	}
+
+	// backward shift, as in IpCounter
+	size_t hole = i;
+	for (size_t j = (i + 1) & mask; slots_[j].id != 0; j = (j + 1) & mask) {
+		size_t home = hashOf(slots_[j].id) & mask;
+		bool stays = hole <= j ? (hole < home && home <= j)
+													 : (hole < home || home <= j);
+		if (!stays) {
+			slots_[hole].id = slots_[j].id;
+			slots_[hole].conn = std::move(slots_[j].conn);
+			hole = j;
+		}
+	}
+	slots_[hole].id = 0;
+	slots_[hole].conn.reset();
+	--size_;
+	return true;
+}
+
+TcpConnectionPtr ConnectionRegistry::find(uint64_t id) const {
+	return slots_[find(id, slots_.size() - 1)].conn;
+}
+
+void ConnectionRegistry::takeAll(std::vector<TcpConnectionPtr>* conns) {
+	conns->reserve(conns->size() + size_);
+	for (size_t i = 0; i < slots_.size(); ++i) {
+		if (slots_[i].id != 0) {
+			conns->push_back(std::move(slots_[i].conn));
+			slots_[i].id = 0;
+		}
+	}
+	size_ = 0;
+}
+
+size_t ConnectionRegistry::hashOf(uint64_t id) {
+	// fibonacci hashing, the high bits folded into the low ones the mask takes
+	uint64_t h = id * 0x9e3779b97f4a7c15ULL;
+	return static_cast<size_t>(h ^ (h >> 32));
+}
+
+size_t ConnectionRegistry::find(uint64_t id, size_t mask) const {
+	size_t i = hashOf(id) & mask;
+	// never full, there is an empty slot to stop at
+	while (slots_[i].id != 0 && slots_[i].id != id) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+void ConnectionRegistry::grow() {
+	std::vector<Slot> old;
+	old.swap(slots_);
+	slots_.resize(2 * old.size());
+	const size_t mask = slots_.size() - 1;
+	for (size_t i = 0; i < old.size(); ++i) {
+		if (old[i].id != 0) {
+			Slot& slot = slots_[find(old[i].id, mask)];
+			slot.id = old[i].id;
+			slot.conn = std::move(old[i].conn);
+		}
+	}
+}
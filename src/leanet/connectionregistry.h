@@ -0,0 +1,64 @@
+#ifndef LEANET_CONNECTIONREGISTRY_H
+#define LEANET_CONNECTIONREGISTRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "noncopyable.h"
+#include "callbacks.h"
+
+namespace leanet {
+
+//
+// connections by TcpConnection::id(), the connections a TcpServer keeps.
+//
+// an open-addressing table with linear probing: a slot is the id and the
+// pointer, 24 bytes, no node or key string allocated per connection. ids
+// are handed out in order and are scattered by a multiplicative hash, or
+// the live ones would fill a run of slots which every removal shifts back.
+// the table doubles to keep under half full, removal shifts back the slots
+// after the removed one, there are no tombstones.
+//
+// not thread safe.
+//
+class ConnectionRegistry: noncopyable {
+public:
+	explicit ConnectionRegistry(size_t initialSlots = 64);
+
+	// id must be nonzero and not added yet, conn->id() usually
+	void add(uint64_t id, const TcpConnectionPtr& conn);
+	// false if id is not added
+	bool remove(uint64_t id);
+	// NULL if id is not added
+	TcpConnectionPtr find(uint64_t id) const;
+	// moves all the connections into conns, leaves it empty
+	void takeAll(std::vector<TcpConnectionPtr>* conns);
+
+	size_t size() const
+	{ return size_; }
+	bool empty() const
+	{ return size_ == 0; }
+	// for debug
+	size_t slots() const
+	{ return slots_.size(); }
+
+private:
+	struct Slot {
+		uint64_t id; // 0 for empty
+		TcpConnectionPtr conn;
+	};
+
+	static size_t hashOf(uint64_t id);
+	// of id, or the empty one where it would be
+	size_t find(uint64_t id, size_t mask) const;
+	void grow();
+
+	std::vector<Slot> slots_; // power of two
+	size_t size_;
+};
+
+}
+
+#endif // LEANET_CONNECTIONREGISTRY_H
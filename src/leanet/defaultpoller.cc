@@ -0,0 +1,48 @@
+#include "poller.h"
+#include "pollpoller.h"
+#include "epollpoller.h"
+#include "iouringpoller.h"
+#include "logger.h"
+
+#include <stdlib.h> // getenv
+
+using namespace leanet;
+
+namespace {
+
+Poller* newIoUringOrEPollPoller(EventLoop* loop) {
+	Poller* poller = IoUringPoller::available() ? IoUringPoller::newIoUringPoller(loop) : NULL;
+	if (poller == NULL) {
+		// runtime fallback for old kernels(or io_uring disabled, or the ring
+		// can't be set up for limits of locked memory)
+		LOG_WARN << "Poller::newPoller - io_uring is unavailable, fall back to epoll";
+		poller = new EPollPoller(loop);
+	}
+	return poller;
+}
+
+}
+
+Poller* Poller::newDefaultPoller(EventLoop* loop) {
+	if (::getenv("LEANET_USE_POLL")) {
+		return new PollPoller(loop);
+	} else if (::getenv("LEANET_USE_IO_URING")) {
+		return newIoUringOrEPollPoller(loop);
+	} else {
+		return new EPollPoller(loop);
+	}
+}
+
+Poller* Poller::newPoller(EventLoop* loop, EventLoop::PollerType type) {
+	switch (type) {
+		case EventLoop::kPollPoller:
+			return new PollPoller(loop);
+		case EventLoop::kEPollPoller:
+			return new EPollPoller(loop);
+		case EventLoop::kIoUringPoller:
+			return newIoUringOrEPollPoller(loop);
+		case EventLoop::kDefaultPoller:
+		default:
+			return newDefaultPoller(loop);
+	}
+}
@@ -0,0 +1,27 @@
+#include "timerqueue.h"
+#include "sortedtimerqueue.h"
+#include "timingwheel.h"
+
+#include <stdlib.h> // getenv
+
+using namespace leanet;
+
+TimerQueue* TimerQueue::newDefaultTimerQueue(EventLoop* loop) {
+	if (::getenv("LEANET_USE_TIMING_WHEEL")) {
+		return new TimingWheel(loop);
+	} else {
+		return new SortedTimerQueue(loop);
+	}
+}
+
+TimerQueue* TimerQueue::newTimerQueue(EventLoop* loop, EventLoop::TimerQueueType type) {
+	switch (type) {
+		case EventLoop::kSortedTimerQueue:
+			return new SortedTimerQueue(loop);
+		case EventLoop::kTimingWheel:
+			return new TimingWheel(loop);
+		case EventLoop::kDefaultTimerQueue:
+		default:
+			return newDefaultTimerQueue(loop);
+	}
+}
@@ -8,11 +8,21 @@
 #include <assert.h>
 #include <unistd.h>
 #include <errno.h>
+#include <strings.h> // bzero
 #include <poll.h>
 #include <sys/epoll.h>
 
 using namespace leanet;
 
+// Channel's interested events are poll(2) flags, and epoll(4) shares the
+// same values on Linux
+static_assert(EPOLLIN == POLLIN, "epoll uses same flag values as poll");
+static_assert(EPOLLPRI == POLLPRI, "epoll uses same flag values as poll");
+static_assert(EPOLLOUT == POLLOUT, "epoll uses same flag values as poll");
+static_assert(EPOLLRDHUP == POLLRDHUP, "epoll uses same flag values as poll");
+static_assert(EPOLLERR == POLLERR, "epoll uses same flag values as poll");
+static_assert(EPOLLHUP == POLLHUP, "epoll uses same flag values as poll");
+
 namespace {
 const int kNew = -1; // Channel::index_ are initialized with -1
 const int kAdded = 1;
@@ -20,7 +30,8 @@ const int kDeleted = 2;
 }
 
 EPollPoller::EPollPoller(EventLoop* loop)
-	: epollfd_(::epoll_create1(EPOLL_CLOEXEC)),
+	: Poller(loop),
+		epollfd_(::epoll_create1(EPOLL_CLOEXEC)),
 		events_(kInitEventListSize)
 {
 	if (epollfd_ < 0) {
@@ -33,11 +44,12 @@ EPollPoller::~EPollPoller() {
 }
 
 Timestamp EPollPoller::poll(int timeoutMs, ChannelList* activeChannels) {
-	LOG_TRACE << "fd total count " << channels_.size();
-  int numEvents = ::epoll_wait(epollfd_,
-                               &*events_.begin(),
-                               static_cast<int>(events_.size()),
-                               timeoutMs);
+	LOG_TRACE << "fd total count " << numChannels();
+	int numEvents = ::epoll_wait(epollfd_,
+															 &*events_.begin(),
+															 static_cast<int>(events_.size()),
+															 timeoutMs);
+	++syscalls_;
 	int savedErrno = errno;
 	Timestamp now(Timestamp::now());
 	if (numEvents > 0) {
@@ -62,28 +74,31 @@ void EPollPoller::fillActiveChannels(int numEvents, ChannelList* activeChannels)
 	assert(implicit_cast<size_t>(numEvents) <= events_.size());
 	for (int i = 0; i < numEvents; ++i) {
 		Channel* channel = static_cast<Channel*>(events_[i].data.ptr);
-		channel->setReceivedEvents(events_[i].events);
+		assert(findChannel(channel->fd()) == channel);
+		channel->setReceivedEvents(static_cast<int>(events_[i].events));
 		activeChannels->push_back(channel);
 	}
 }
 
 // add, del, mod
 void EPollPoller::updateChannel(Channel* channel) {
-	loop_->assertInLoopThread();
+	assertInLoopThread();
 	const int tag = channel->index();
+	LOG_TRACE << "fd = " << channel->fd()
+		<< " events = " << channel->interestedEvents() << " index = " << tag;
 	if (tag == kNew || tag == kDeleted) {
 		int fd = channel->fd();
 		if (tag == kNew) {
-			assert(channels_.find(fd) == channels_.end());
-			channels_[fd] = channel;
+			assert(findChannel(fd) == NULL);
+			addChannel(channel);
 		} else {
-			assert(channels_.find(fd) != channels_.end());
-			assert(channels_[fd] == channel);
+			assert(findChannel(fd) == channel);
 		}
 
 		channel->setIndex(kAdded);
 		update(EPOLL_CTL_ADD, channel);
 	} else {
+		assert(tag == kAdded);
 		if (channel->isNoneEvent()) {
 			update(EPOLL_CTL_DEL, channel);
 			channel->setIndex(kDeleted);
@@ -94,14 +109,17 @@ void EPollPoller::updateChannel(Channel* channel) {
 }
 
 void EPollPoller::removeChannel(Channel* channel) {
-	loop_->assertInLoopThread();
+	assertInLoopThread();
 
 	int fd = channel->fd();
-	size_t n = channels_.erase(fd);
-	Unused(n);
-	assert(n == 1);
+	LOG_TRACE << "fd = " << fd;
+	assert(findChannel(fd) == channel);
+	// we should call disableAll() first before we call removeChannel()
+	assert(channel->isNoneEvent());
+	eraseChannel(channel);
 
 	int idx = channel->index();
+	assert(idx == kAdded || idx == kDeleted);
 	if (idx == kAdded) {
 		update(EPOLL_CTL_DEL, channel);
 	}
@@ -111,13 +129,39 @@ void EPollPoller::removeChannel(Channel* channel) {
 void EPollPoller::update(int op, Channel* channel) {
 	struct epoll_event event;
 	::bzero(&event, sizeof(event));
-	event.events = channel->interestedEvents();
+	event.events = static_cast<uint32_t>(channel->interestedEvents());
+	if (channel->isEdgeTriggered()) {
+		event.events |= EPOLLET;
+	}
 	event.data.ptr = channel;
 	int fd = channel->fd();
+	LOG_TRACE << "epoll_ctl op = " << operationToString(op) << " fd = " << fd;
 
+	++syscalls_;
 	if (::epoll_ctl(epollfd_, op, fd, &event) < 0) {
-		// TODO
-	} else {
-		// TODO
+		//
+		// failing to delete is harmless: the fd may have been closed
+		// (and then removed from the epoll set by kernel) already.
+		// failing to add or modify means we will miss events of this fd.
+		//
+		if (op == EPOLL_CTL_DEL) {
+			LOG_SYSERR << "epoll_ctl op = " << operationToString(op) << " fd = " << fd;
+		} else {
+			LOG_SYSFATAL << "epoll_ctl op = " << operationToString(op) << " fd = " << fd;
+		}
+	}
+}
+
+const char* EPollPoller::operationToString(int op) {
+	switch (op) {
+		case EPOLL_CTL_ADD:
+			return "ADD";
+		case EPOLL_CTL_DEL:
+			return "DEL";
+		case EPOLL_CTL_MOD:
+			return "MOD";
+		default:
+			assert(false && "ERROR op");
+			return "Unknown Operation";
 	}
 }
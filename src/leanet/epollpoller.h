@@ -2,41 +2,37 @@
 #define LEANET_EPOLLER_H
 
 #include <vector>
-#include <map>
-#include "noncopyable.h"
+
+#include "poller.h"
 
 struct epoll_event;
 
 namespace leanet {
 
-class EventLoop;
-class Channel;
-class Timestamp;
-
-class EPollPoller: noncopyable {
+//
+// IO Multiplexing with epoll(4).
+//
+class EPollPoller: public Poller {
 public:
-	typedef std::vector<Channel*> ChannelList;
-
-	EPollPoller(EventLoop* loop);
-	~EPollPoller();
+	explicit EPollPoller(EventLoop* loop);
+	virtual ~EPollPoller();
 
-	Timestamp poll(int timeoutMs, ChannelList* activeChannels);
-
-	void updateChannel(Channel* channel);
-	void removeChannel(Channel* channel);
+	virtual Timestamp poll(int timeoutMs, ChannelList* activeChannels);
+	virtual void updateChannel(Channel* channel);
+	virtual void removeChannel(Channel* channel);
+	virtual bool supportsEdgeTriggered() const { return true; }
 
 private:
 	static const int kInitEventListSize = 16;
 
+	static const char* operationToString(int op);
+
 	void fillActiveChannels(int numEvents, ChannelList* activeChannels) const;
 	void update(int operation, Channel* channel);
 
 	typedef std::vector<struct epoll_event> EventList;
-	typedef std::map<int, Channel*> ChannelMap;
 
-	EventLoop* loop_;
 	int epollfd_;
-	ChannelMap channels_;
 	EventList events_;
 };
 
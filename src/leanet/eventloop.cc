@@ -12,6 +12,7 @@
 #include "poller.h"
 #include "timer.h"
 #include "timerqueue.h"
+#include "bufferpool.h"
 
 using namespace leanet;
 
@@ -45,18 +46,23 @@ IgnoreSigpipe ignPipe;
 
 }
 
-EventLoop::EventLoop()
+EventLoop::EventLoop(PollerType pollerType, TimerQueueType timerQueueType)
 	: looping_(false),
 		quit_(false),
-		callingPendingFunctors_(false),
+		iteration_(0),
 		threadId_(currentThread::tid()),
 		pollReturnedTime_(),
-		poller_(new Poller(this)),
+		poller_(Poller::newPoller(this, pollerType)),
 		activeChannels_(),
-		timerQueue_(new TimerQueue(this)),
+		timerQueue_(TimerQueue::newTimerQueue(this, timerQueueType)),
 		wakeupFd_(createEventfd()),
 		wakeupChannel_(new Channel(this, wakeupFd_)),
-		pendingFunctors_()
+		pendingFunctors_(),
+		numPendingFunctors_(),
+		readSpill_(),
+		readStats_(),
+		bufferPool_(std::make_shared<BufferPool>()),
+		lastTrimTime_()
 {
 	if (t_loopInThisThread) {
 		LOG_FATAL << "Another EventLoop " << t_loopInThisThread
@@ -82,16 +88,18 @@ void EventLoop::loop() {
 	assert(!looping_);
 	assertInLoopThread();
 
+	// quit_ is not cleared here, a quit() before the loop starts would be
+	// lost and the thread joining it would wait forever
 	looping_ = true;
-	quit_ = false;
 
 	while (!quit_) {
-		//
-		// if there no timerfd* apis, we could handle timer callbacks
-		// at there(or handle it using another separate timer thread)
-		//
+		++iteration_;
 		activeChannels_.clear();
-		pollReturnedTime_ = poller_->poll(kPollTimeMs, &activeChannels_);
+		// timer alarm is programmed here, at most once per iteration
+		int timeoutMs = timerQueue_->prepareForPoll(kPollTimeMs);
+		pollReturnedTime_ = poller_->poll(timeoutMs, &activeChannels_);
+		// without timerfd, timer callbacks are handled here
+		timerQueue_->handlePollReturned(pollReturnedTime_);
 		for (ChannelList::iterator iter = activeChannels_.begin();
 				 iter != activeChannels_.end();
 				 ++iter) {
@@ -99,10 +107,13 @@ void EventLoop::loop() {
 			(*iter)->handleEvent(pollReturnedTime_);
 		}
 		doPendingFunctors();
+		trimBufferPool();
 	}
 
 	LOG_TRACE << "EventLoop " << this << " stop looping";
 	looping_ = false;
+	// may loop() again
+	quit_ = false;
 }
 
 void EventLoop::quit() {
@@ -115,12 +126,19 @@ void EventLoop::quit() {
 }
 
 void EventLoop::queueInLoop(const Functor& cb) {
-	{
-		MutexLock lock(mutex_);
-		pendingFunctors_.push_back(cb);
-	}
+	queueTask(Task(cb));
+}
 
-	if (!isInLoopThread() || callingPendingFunctors_) {
+void EventLoop::queueTask(Task&& task) {
+	pendingFunctors_.push(std::move(task));
+
+	// wakeup coalescing: only the producer which makes the queue non-empty
+	// writes to wakeupFd_, the later ones are covered by it. if the loop is
+	// running doPendingFunctors() now, the count is not zero and it will wake
+	// up itself for the functors it has not run.
+	// in loop thread, doPendingFunctors() will be called after handling
+	// events, no need to wake up.
+	if (numPendingFunctors_.getAndAdd(1) == 0 && !isInLoopThread()) {
 		wakeup();
 	}
 }
@@ -133,34 +151,103 @@ void EventLoop::runInLoop(const Functor& cb) {
 	}
 }
 
+int64_t EventLoop::queueSize() const {
+	return numPendingFunctors_.get();
+}
+
 void EventLoop::doPendingFunctors() {
-	std::vector<Functor> functors;
-	callingPendingFunctors_ = true;
-
-	{
-	// 1. keep critical section as short as possible:
-	// 		swapped with thread-private stack variable!
-	// 2. forbid dead lock: functor() could call queueInLoop again...
-	MutexLock lock(mutex_);
-	functors.swap(pendingFunctors_);
+	const int64_t n = numPendingFunctors_.get();
+	if (n == 0) {
+		return;
 	}
 
-	for (size_t i = 0; i < functors.size(); ++i) {
-		functors[i]();
+	// run only the functors counted before, functor() could call queueInLoop
+	// again, those are run in next iteration, or we may never return to poll
+	int64_t done = 0;
+	Task functor;
+	while (done < n && pendingFunctors_.pop(&functor)) {
+		functor();
+		++done;
+	}
+	functor.reset();
+
+	// functors queued after we read the count didn't wake us up, and pop()
+	// fails if a producer is preempted in the middle of push()
+	if (numPendingFunctors_.addAndGet(-done) > 0) {
+		wakeup();
+	}
+}
+
+void EventLoop::trimBufferPool() {
+	// off the path of freeing buffers, the loop wakes up at least once every
+	// kPollTimeMs
+	if (timeDifference(pollReturnedTime_, lastTrimTime_) * 1000 < kTrimIntervalMs) {
+		return;
 	}
-	callingPendingFunctors_ = false;
+	lastTrimTime_ = pollReturnedTime_;
+	bufferPool_->trim();
 }
 
 void EventLoop::updateChannel(Channel* channel) {
+	assert(channel->ownerLoop() == this);
 	assertInLoopThread();
 	poller_->updateChannel(channel);
 }
 
 void EventLoop::removeChannel(Channel* channel) {
+	assert(channel->ownerLoop() == this);
 	assertInLoopThread();
 	poller_->removeChannel(channel);
 }
 
+bool EventLoop::hasChannel(Channel* channel) {
+	assert(channel->ownerLoop() == this);
+	assertInLoopThread();
+	return poller_->hasChannel(channel);
+}
+
+bool EventLoop::supportsEdgeTriggered() const {
+	return poller_->supportsEdgeTriggered();
+}
+
+int64_t EventLoop::pollerSyscalls() const {
+	return poller_->syscalls();
+}
+
+bool EventLoop::supportsCompletions() const {
+	return poller_->supportsCompletions();
+}
+
+uint64_t EventLoop::submitReadv(int fd, const struct iovec* iov, int iovcnt, const CompletionCallback& cb) {
+	assertInLoopThread();
+	return poller_->submitReadv(fd, iov, iovcnt, cb);
+}
+
+uint64_t EventLoop::submitWritev(int fd, const struct iovec* iov, int iovcnt, const CompletionCallback& cb) {
+	assertInLoopThread();
+	return poller_->submitWritev(fd, iov, iovcnt, cb);
+}
+
+uint64_t EventLoop::submitAccept(int fd, struct sockaddr* addr, socklen_t* addrlen, const CompletionCallback& cb) {
+	assertInLoopThread();
+	return poller_->submitAccept(fd, addr, addrlen, cb);
+}
+
+void EventLoop::cancelSubmission(uint64_t id) {
+	assertInLoopThread();
+	poller_->cancel(id);
+}
+
+const size_t EventLoop::kReadSpillSize;
+
+char* EventLoop::readSpillBuffer() {
+	assertInLoopThread();
+	if (!readSpill_) {
+		readSpill_.reset(new char[kReadSpillSize]);
+	}
+	return readSpill_.get();
+}
+
 TimerId EventLoop::runAt(const Timestamp& time, const TimerCallback& cb) {
 	return timerQueue_->addTimer(cb, time, 0.0);
 }
@@ -175,6 +262,24 @@ TimerId EventLoop::runEvery(double interval, const TimerCallback& cb) {
 	return timerQueue_->addTimer(cb, time, interval);
 }
 
+void EventLoop::cancel(TimerId timerId) {
+	timerQueue_->cancelTimer(timerId);
+}
+
+void EventLoop::useTimerfd(bool on) {
+	assertInLoopThread();
+	timerQueue_->useTimerfd(on);
+}
+
+int64_t EventLoop::timerSyscalls() const {
+	return timerQueue_->syscalls();
+}
+
+void EventLoop::restartTimer(TimerId timerId, double delay) {
+	Timestamp time(addTime(Timestamp::now(), delay));
+	timerQueue_->restartTimer(timerId, time);
+}
+
 // wakeup poll() call in loop() for calling doPendingFunctors()
 void EventLoop::wakeup() {
 	uint64_t one = 1;
@@ -1,42 +1,108 @@
 #ifndef LEANET_EVENTLOOP_H
 #define LEANET_EVENTLOOP_H
 
+#include <sys/socket.h> // socklen_t
+
 #include <vector>
-#include <memory> // std::unique_ptr
+#include <memory> // std::unique_ptr, std::shared_ptr
 #include <functional>
 
 #include "noncopyable.h"
 #include "callbacks.h"
-#include "mutex.h"
+#include "atomic.h"
+#include "mpscqueue.h"
+#include "smallfunction.h"
 #include "currentthread.h"
 #include "timestamp.h"
 #include "timerid.h"
+#include "readsizer.h"
+
+struct iovec;
 
 namespace leanet {
 
 class Channel;
 class Poller;
-class EPollPoller;
+class TimerQueue;
+class BufferPool;
 
 class EventLoop: noncopyable {
 public:
 	typedef std::function<void()> Functor;
-
-	EventLoop();
+	// gets what the system call returns, -errno on failure
+	typedef std::function<void (int)> CompletionCallback;
+
+	// I/O multiplexing backend of the loop.
+	// kDefaultPoller uses epoll(4) unless LEANET_USE_POLL(poll(2)) or
+	// LEANET_USE_IO_URING(io_uring(7)) is set in environment.
+	// kIoUringPoller falls back to epoll(4) if the kernel doesn't support it.
+	enum PollerType {
+		kDefaultPoller,
+		kPollPoller,
+		kEPollPoller,
+		kIoUringPoller
+	};
+
+	// how timers are kept.
+	// kDefaultTimerQueue uses the sorted set unless LEANET_USE_TIMING_WHEEL
+	// is set in environment.
+	// kTimingWheel is O(1) to add and cancel, at the cost of 1ms resolution,
+	// it suits a great number of timeouts which are mostly canceled.
+	enum TimerQueueType {
+		kDefaultTimerQueue,
+		kSortedTimerQueue,
+		kTimingWheel
+	};
+
+	explicit EventLoop(PollerType pollerType = kDefaultPoller,
+										 TimerQueueType timerQueueType = kDefaultTimerQueue);
 	~EventLoop();
 
 	void loop();
 	void quit();
 
 	Timestamp pollReturnedTime() const { return pollReturnedTime_; }
+	// iterations of loop() so far, events and completions handled after
+	// the same poll see the same one
+	int64_t iteration() const { return iteration_; }
 
 	// call runInLoop()
 	TimerId runAt(const Timestamp& time, const TimerCallback& cb);
 	TimerId runAfter(double delay, const TimerCallback& cb);
 	TimerId runEvery(double interval, const TimerCallback& cb);
+	// thread safe, does nothing if the timer has expired or been canceled.
+	void cancel(TimerId timerId);
+	// thread safe, moves the expiration of a pending timer to delay seconds
+	// from now, does nothing if the timer has expired or been canceled.
+	// pushing it later is nearly free, the timer is re-sorted only when the
+	// old expiration is reached, it suits idle timeouts touched on every
+	// message.
+	void restartTimer(TimerId timerId, double delay);
+	// timers wake the loop up by a timerfd(default), or by the timeout of
+	// polling which saves system calls at the cost of 1ms resolution.
+	// called in loop thread
+	void useTimerfd(bool on);
+	// system calls made for timers, for benchmarking
+	int64_t timerSyscalls() const;
 
 	void queueInLoop(const Functor& cb);
 	void runInLoop(const Functor& cb);
+	// any callable, queued as it is instead of wrapped in a Functor, so a
+	// small one(a member function bound to a shared_ptr) costs one
+	// allocation, the node of the queue holding it.
+	template<typename F>
+	void queueInLoop(F cb)
+	{ queueTask(Task(std::move(cb))); }
+	template<typename F>
+	void runInLoop(F cb) {
+		if (isInLoopThread()) {
+			cb();
+		} else {
+			queueInLoop(std::move(cb));
+		}
+	}
+	// functors queued but not run yet, thread safe
+	int64_t queueSize() const;
 
 	void assertInLoopThread() {
 		if (!isInLoopThread()) {
@@ -58,21 +124,51 @@ public:
 	// called in loop thread
 	void updateChannel(Channel* channel);
 	void removeChannel(Channel* channel);
-	//bool hasChannel(Channel* channel);
+	bool hasChannel(Channel* channel);
+	// whether the poller honors Channel::setEdgeTriggered()
+	bool supportsEdgeTriggered() const;
+	// system calls made by the poller, for benchmarking
+	int64_t pollerSyscalls() const;
+	// whether the poller submits I/O, see Poller::submitReadv()
+	bool supportsCompletions() const;
+	// called in loop thread, return ids for cancelSubmission()
+	uint64_t submitReadv(int fd, const struct iovec* iov, int iovcnt, const CompletionCallback& cb);
+	uint64_t submitWritev(int fd, const struct iovec* iov, int iovcnt, const CompletionCallback& cb);
+	uint64_t submitAccept(int fd, struct sockaddr* addr, socklen_t* addrlen, const CompletionCallback& cb);
+	// called in loop thread
+	void cancelSubmission(uint64_t id);
+
+	static const size_t kReadSpillSize = 64 * 1024;
+	// shared by reads of connections in this loop for what their input
+	// buffers can't take, allocated on first use.
+	// called in loop thread
+	char* readSpillBuffer();
+	// reads of connections in this loop
+	// called in loop thread
+	ReadStats* readStats() { return &readStats_; }
+	// storage of connection buffers in this loop, trimmed by the loop about
+	// once a second
+	const std::shared_ptr<BufferPool>& bufferPool() const { return bufferPool_; }
 
 	static EventLoop* getEventLoopOfCurrentThread();
 
 private:
 	static const int kPollTimeMs = 10000;
+	static const int kTrimIntervalMs = 1000;
 	typedef std::vector<Channel*> ChannelList;
+	// stored inline in the node of pendingFunctors_
+	typedef SmallFunction<void ()> Task;
 
 	void abortNotInLoopThread();
 	void handleRead(); // waked up
+	void queueTask(Task&& task);
 	void doPendingFunctors();
+	// BufferPool::trim() if kTrimIntervalMs has passed since the last one
+	void trimBufferPool();
 
 	bool looping_; // atomic
 	bool quit_; // atomic
-	bool callingPendingFunctors_; // atomic
+	int64_t iteration_;
 	const uint64_t threadId_;
 	Timestamp pollReturnedTime_;
 
@@ -88,9 +184,16 @@ private:
 	int wakeupFd_;
 	std::unique_ptr<Channel> wakeupChannel_;
 
-	mutable Mutex mutex_;
-	// @GuardedBy mutex_
-	std::vector<Functor> pendingFunctors_;
+	// lock-free, queued in any thread and run in loop thread
+	MpscQueue<Task> pendingFunctors_;
+	// functors queued but not run yet, the one who increases it from zero
+	// is responsible for waking up the loop
+	mutable AtomicInt64 numPendingFunctors_;
+
+	std::unique_ptr<char[]> readSpill_;
+	ReadStats readStats_;
+	std::shared_ptr<BufferPool> bufferPool_;
+	Timestamp lastTrimTime_;
 };
 
 } // namespace leanet
@@ -51,5 +51,6 @@ void EventLoopThread::threadFunc() {
 	}
 
 	loop.loop();
+	MutexLock lock(mutex_);
 	loop_ = NULL;
 }
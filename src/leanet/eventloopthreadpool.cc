@@ -10,12 +10,30 @@
 
 using namespace leanet;
 
+namespace {
+
+// Lamping and Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm"
+int jumpConsistentHash(uint64_t key, int buckets) {
+	int64_t b = -1;
+	int64_t j = 0;
+	while (j < buckets) {
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = static_cast<int64_t>(static_cast<double>(b + 1) *
+				(static_cast<double>(1LL << 31) / static_cast<double>((key >> 33) + 1)));
+	}
+	return static_cast<int>(b);
+}
+
+}
+
 EventLoopThreadPool::EventLoopThreadPool(EventLoop* baseLoop, const std::string& name)
 	: baseLoop_(baseLoop),
 		name_(name),
 		started_(false),
 		numThreads_(0),
-		next_(0)
+		next_(0),
+		strategy_(kRoundRobin)
 { }
 
 EventLoopThreadPool::~EventLoopThreadPool() {
@@ -36,27 +54,124 @@ void EventLoopThreadPool::start(const ThreadInitCallback& cb) {
 		threads_.push_back(loopThread);
 		loops_.push_back(loopThread->startLoop());
 	}
+	connections_.assign(loops_.empty() ? 1 : loops_.size(), 0);
 
 	if (numThreads_ == 0 && cb) {
 		cb(baseLoop_);
 	}
 }
 
-EventLoop* EventLoopThreadPool::getNextLoop() {
+EventLoop* EventLoopThreadPool::getNextLoop(uint64_t key) {
 	baseLoop_->assertInLoopThread();
 	assert(started_);
 
 	EventLoop* loop = baseLoop_;
 
 	if (!loops_.empty()) {
-		// round-robin
-		loop = loops_[next_];
-		++next_;
-		if (implicit_cast<size_t>(next_) >= loops_.size()) {
-			next_ = 0;
+		switch (strategy_) {
+		case kLeastConnections:
+		case kLeastPending:
+			loop = loops_[leastLoaded()];
+			break;
+		case kConsistentHash:
+			loop = getLoopForHash(key);
+			break;
+		default:
+			// round-robin
+			loop = loops_[next_];
+			++next_;
+			if (implicit_cast<size_t>(next_) >= loops_.size()) {
+				next_ = 0;
+			}
+			break;
 		}
 	}
 
 	return loop;
 }
 
+EventLoop* EventLoopThreadPool::getLoopForHash(uint64_t hashCode) {
+	baseLoop_->assertInLoopThread();
+	assert(started_);
+	if (loops_.empty()) {
+		return baseLoop_;
+	}
+	return loops_[implicit_cast<size_t>(
+			jumpConsistentHash(hashCode, static_cast<int>(loops_.size())))];
+}
+
+void EventLoopThreadPool::connectionAdded(EventLoop* loop) {
+	baseLoop_->assertInLoopThread();
+	++connections_[indexOf(loop)];
+}
+
+void EventLoopThreadPool::connectionRemoved(EventLoop* loop) {
+	baseLoop_->assertInLoopThread();
+	size_t i = indexOf(loop);
+	assert(connections_[i] > 0);
+	--connections_[i];
+}
+
+int EventLoopThreadPool::numConnections(EventLoop* loop) {
+	baseLoop_->assertInLoopThread();
+	return connections_[indexOf(loop)];
+}
+
+EventLoop* EventLoopThreadPool::getLeastConnectedLoop() {
+	baseLoop_->assertInLoopThread();
+	assert(started_);
+	if (loops_.empty()) {
+		return baseLoop_;
+	}
+	size_t least = 0;
+	for (size_t i = 1; i < loops_.size(); ++i) {
+		if (connections_[i] < connections_[least]) {
+			least = i;
+		}
+	}
+	return loops_[least];
+}
+
+size_t EventLoopThreadPool::indexOf(EventLoop* loop) const {
+	if (loops_.empty()) {
+		assert(loop == baseLoop_);
+		return 0;
+	}
+	// a few loops, a scan is as fast as a map
+	size_t i = 0;
+	while (i < loops_.size() && loops_[i] != loop) {
+		++i;
+	}
+	assert(i < loops_.size());
+	return i;
+}
+
+int64_t EventLoopThreadPool::loadOf(size_t i) const {
+	return strategy_ == kLeastPending ? loops_[i]->queueSize() : connections_[i];
+}
+
+size_t EventLoopThreadPool::leastLoaded() {
+	const size_t n = loops_.size();
+	const size_t start = implicit_cast<size_t>(next_);
+	size_t least = start;
+	int64_t leastLoad = loadOf(start);
+	for (size_t k = 1; k < n && leastLoad > 0; ++k) {
+		size_t i = start + k < n ? start + k : start + k - n;
+		int64_t load = loadOf(i);
+		if (load < leastLoad) {
+			least = i;
+			leastLoad = load;
+		}
+	}
+	next_ = static_cast<int>(least + 1 < n ? least + 1 : 0);
+	return least;
+}
+
+std::vector<EventLoop*> EventLoopThreadPool::getAllLoops() {
+	baseLoop_->assertInLoopThread();
+	assert(started_);
+	if (loops_.empty()) {
+		return std::vector<EventLoop*>(1, baseLoop_);
+	}
+	return loops_;
+}
@@ -1,6 +1,8 @@
 #ifndef LEANET_EVENTLOOPTHREADPOOL_H
 #define LEANET_EVENTLOOPTHREADPOOL_H
 
+#include <stdint.h>
+
 #include <memory>
 #include <functional>
 #include <vector>
@@ -17,6 +19,23 @@ class EventLoopThreadPool: noncopyable {
 public:
 	typedef std::function<void (EventLoop*)> ThreadInitCallback;
 
+	// how getNextLoop() picks a loop of the pool.
+	// kRoundRobin: in turn.
+	// kLeastConnections: the one with the fewest connections, as counted by
+	// connectionAdded() and connectionRemoved(), so long-lived connections
+	// don't pile up on a loop.
+	// kLeastPending: the one with the fewest functors queued, see
+	// EventLoop::queueSize(), which follows how far behind the loop is.
+	// kConsistentHash: getLoopForHash() of the key, so a client keeps
+	// landing on the loop which has its state.
+	// ties are broken in turn.
+	enum Strategy {
+		kRoundRobin,
+		kLeastConnections,
+		kLeastPending,
+		kConsistentHash
+	};
+
 	EventLoopThreadPool(EventLoop* baseLoop, const std::string& name);
 	~EventLoopThreadPool();
 
@@ -27,17 +46,47 @@ public:
 	bool started() const
 	{ return started_; }
 
-	EventLoop* getNextLoop();
+	// call it before start()
+	void setStrategy(Strategy strategy)
+	{ strategy_ = strategy; }
+	Strategy strategy() const
+	{ return strategy_; }
+
+	// key is used by kConsistentHash only
+	EventLoop* getNextLoop(uint64_t key = 0);
+	// the same loop for the same hashCode, by jump consistent hash(Lamping
+	// and Veach), so only 1/n of them move when a loop is added.
+	EventLoop* getLoopForHash(uint64_t hashCode);
+
+	// connections handed to loop, for kLeastConnections, and the base loop
+	// if there are no threads. called in base loop thread
+	void connectionAdded(EventLoop* loop);
+	void connectionRemoved(EventLoop* loop);
+	int numConnections(EventLoop* loop);
+	// with the fewest connections, the first of them
+	EventLoop* getLeastConnectedLoop();
+
+	// the base loop if there are no threads
+	std::vector<EventLoop*> getAllLoops();
 
 private:
+	size_t indexOf(EventLoop* loop) const;
+	// load of loops_[i] by strategy_
+	int64_t loadOf(size_t i) const;
+	// the least loaded from next_ on, then next_ moves past it
+	size_t leastLoaded();
+
 	EventLoop* baseLoop_;
 	const std::string name_;
 	bool started_;
 	int numThreads_;
 	int next_;
+	Strategy strategy_;
 
 	std::vector<std::shared_ptr<EventLoopThread>> threads_;
 	std::vector<EventLoop*> loops_;
+	// connections of loops_[i], or of baseLoop_
+	std::vector<int> connections_;
 };
 
 }
@@ -0,0 +1,73 @@
+#include "future.h"
+#include "eventloop.h"
+
+using namespace leanet;
+using namespace leanet::detail;
+
+FutureStateBase::FutureStateBase()
+	: mutex_(),
+		readyCond_(mutex_),
+		ready_(false),
+		armed_(false),
+		loop_(NULL),
+		self_()
+{ }
+
+FutureStateBase::~FutureStateBase() {
+}
+
+bool FutureStateBase::ready() const {
+	MutexLock lock(mutex_);
+	return ready_;
+}
+
+void FutureStateBase::wait() const {
+	MutexLock lock(mutex_);
+	while (!ready_) {
+		readyCond_.wait();
+	}
+}
+
+void FutureStateBase::markReady() {
+	bool armed;
+	{
+	MutexLock lock(mutex_);
+	assert(!ready_);
+	ready_ = true;
+	armed = armed_;
+	readyCond_.wakeAll();
+	}
+	if (armed) {
+		dispatch();
+	}
+}
+
+void FutureStateBase::arm(EventLoop* loop) {
+	bool ready;
+	{
+	MutexLock lock(mutex_);
+	assert(!armed_);
+	armed_ = true;
+	loop_ = loop;
+	ready = ready_;
+	}
+	if (ready) {
+		dispatch();
+	}
+}
+
+void FutureStateBase::dispatch() {
+	if (loop_ == NULL || loop_->isInLoopThread()) {
+		runContinuation();
+	} else {
+		// a function pointer and a pointer fit in std::function itself
+		self_ = shared_from_this();
+		loop_->queueInLoop(std::bind(&FutureStateBase::runQueued, this));
+	}
+}
+
+void FutureStateBase::runQueued(FutureStateBase* state) {
+	std::shared_ptr<FutureStateBase> guard;
+	guard.swap(state->self_);
+	state->runContinuation();
+}
@@ -0,0 +1,315 @@
+#ifndef LEANET_FUTURE_H
+#define LEANET_FUTURE_H
+
+#include <assert.h>
+
+#include <functional>
+#include <memory>
+#include <new> // placement new
+#include <type_traits>
+#include <utility> // std::move, std::forward
+
+#include "noncopyable.h"
+#include "mutex.h"
+#include "condition.h"
+#include "smallfunction.h"
+
+namespace leanet {
+
+class EventLoop;
+
+template<typename T> class Future;
+template<typename T> class Promise;
+
+namespace detail {
+
+//
+// what a Promise and its Future share, the parts independent of T.
+//
+// the continuation is armed once, and run once by whichever of the value
+// and the continuation comes last: in the loop given, as by
+// EventLoop::runInLoop(), or in that thread if the loop is NULL. the state
+// keeps itself alive while queued in the loop.
+//
+class FutureStateBase: noncopyable,
+	public std::enable_shared_from_this<FutureStateBase> {
+public:
+	virtual ~FutureStateBase();
+
+	bool ready() const;
+	// not in the loop the value comes from
+	void wait() const;
+
+protected:
+	FutureStateBase();
+
+	// after the value is stored
+	void markReady();
+	// after the continuation is stored
+	void arm(EventLoop* loop);
+
+private:
+	virtual void runContinuation() = 0;
+
+	void dispatch();
+	static void runQueued(FutureStateBase* state);
+
+	mutable Mutex mutex_;
+	mutable Condition readyCond_;
+	bool ready_;
+	bool armed_;
+	EventLoop* loop_;
+	// set while the continuation is queued in loop_
+	std::shared_ptr<FutureStateBase> self_;
+};
+
+template<typename T>
+class FutureValue: noncopyable {
+public:
+	FutureValue()
+		: constructed_(false)
+	{ }
+
+	~FutureValue() {
+		if (constructed_) {
+			get().~T();
+		}
+	}
+
+	template<typename... Args>
+	void set(Args&&... args) {
+		assert(!constructed_);
+		new (&storage_) T(std::forward<Args>(args)...);
+		constructed_ = true;
+	}
+
+	T& get() {
+		assert(constructed_);
+		return *static_cast<T*>(static_cast<void*>(&storage_));
+	}
+
+	T take() {
+		return std::move(get());
+	}
+
+private:
+	typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage_;
+	bool constructed_;
+};
+
+template<>
+class FutureValue<void>: noncopyable {
+public:
+	void set() { }
+	void take() { }
+};
+
+template<typename T>
+class FutureState: public FutureStateBase {
+public:
+	typedef SmallFunction<void (FutureState*)> Continuation;
+
+	FutureState()
+		: value_(),
+			continuation_()
+	{ }
+
+	// once
+	template<typename... Args>
+	void setValue(Args&&... args) {
+		value_.set(std::forward<Args>(args)...);
+		markReady();
+	}
+
+	// once
+	void setContinuation(EventLoop* loop, Continuation&& continuation) {
+		continuation_ = std::move(continuation);
+		arm(loop);
+	}
+
+	// after ready
+	FutureValue<T>& value()
+	{ return value_; }
+
+private:
+	virtual void runContinuation() {
+		// releases what it holds as soon as it returns
+		Continuation continuation(std::move(continuation_));
+		continuation(this);
+	}
+
+	FutureValue<T> value_;
+	Continuation continuation_;
+};
+
+// f(args...) into state
+template<typename R>
+struct SetResult {
+	template<typename F, typename... Args>
+	static void run(FutureState<R>* state, F& f, Args&&... args) {
+		state->setValue(f(std::forward<Args>(args)...));
+	}
+};
+
+template<>
+struct SetResult<void> {
+	template<typename F, typename... Args>
+	static void run(FutureState<void>* state, F& f, Args&&... args) {
+		f(std::forward<Args>(args)...);
+		state->setValue();
+	}
+};
+
+// f(value) or f() for void
+template<typename T, typename F>
+struct ContinuationResult {
+	typedef typename std::result_of<F(T)>::type type;
+};
+
+template<typename F>
+struct ContinuationResult<void, F> {
+	typedef typename std::result_of<F()>::type type;
+};
+
+template<typename T, typename R, typename F>
+class Then {
+public:
+	Then(const std::shared_ptr<FutureState<R>>& next, F&& f)
+		: next_(next),
+			f_(std::move(f))
+	{ }
+
+	void operator()(FutureState<T>* state) {
+		SetResult<R>::run(next_.get(), f_, state->value().take());
+	}
+
+private:
+	std::shared_ptr<FutureState<R>> next_;
+	F f_;
+};
+
+template<typename R, typename F>
+class Then<void, R, F> {
+public:
+	Then(const std::shared_ptr<FutureState<R>>& next, F&& f)
+		: next_(next),
+			f_(std::move(f))
+	{ }
+
+	void operator()(FutureState<void>*) {
+		SetResult<R>::run(next_.get(), f_);
+	}
+
+private:
+	std::shared_ptr<FutureState<R>> next_;
+	F f_;
+};
+
+// a pool task setting the future returned by submit()
+template<typename R, typename F>
+class SubmittedTask {
+public:
+	SubmittedTask(const std::shared_ptr<FutureState<R>>& state, F&& f)
+		: state_(state),
+			f_(std::move(f))
+	{ }
+
+	void operator()() {
+		SetResult<R>::run(state_.get(), f_);
+	}
+
+private:
+	std::shared_ptr<FutureState<R>> state_;
+	F f_;
+};
+
+} // namespace detail
+
+//
+// the result of a task run somewhere else, usually in a thread pool, got
+// by blocking in get() or, in a loop, by a continuation with then().
+//
+// one allocation for the state shared with the Promise; continuations up
+// to SmallFunction's inline size are stored in it, and queueing one in the
+// loop binds no more than a pointer. a Promise dropped without a value
+// leaves its futures waiting forever. no exceptions are carried, tasks are
+// not supposed to throw.
+//
+template<typename T>
+class Future {
+public:
+	Future()
+		: state_()
+	{ }
+
+	explicit Future(const std::shared_ptr<detail::FutureState<T>>& state)
+		: state_(state)
+	{ }
+
+	bool valid() const
+	{ return static_cast<bool>(state_); }
+
+	bool ready() const
+	{ return state_->ready(); }
+
+	// not in the loop the value comes from
+	void wait() const
+	{ state_->wait(); }
+
+	// waits and moves the value out, once, not with then()
+	T get() {
+		state_->wait();
+		std::shared_ptr<detail::FutureState<T>> state;
+		state.swap(state_);
+		return state->value().take();
+	}
+
+	// f(value), or f() for Future<void>, is run in loop once the value is
+	// set, or in the thread setting it if loop is NULL. once, the future
+	// becomes invalid. returns the future of what f returns.
+	template<typename F>
+	Future<typename detail::ContinuationResult<T, F>::type> then(EventLoop* loop, F f) {
+		typedef typename detail::ContinuationResult<T, F>::type R;
+		std::shared_ptr<detail::FutureState<R>> next(std::make_shared<detail::FutureState<R>>());
+		std::shared_ptr<detail::FutureState<T>> state;
+		state.swap(state_);
+		state->setContinuation(loop, detail::Then<T, R, F>(next, std::move(f)));
+		return Future<R>(next);
+	}
+
+private:
+	std::shared_ptr<detail::FutureState<T>> state_;
+};
+
+template<typename T>
+class Promise {
+public:
+	Promise()
+		: state_(std::make_shared<detail::FutureState<T>>())
+	{ }
+
+	// once
+	Future<T> getFuture() const
+	{ return Future<T>(state_); }
+
+	// once, thread safe
+	template<typename... Args>
+	void setValue(Args&&... args)
+	{ state_->setValue(std::forward<Args>(args)...); }
+
+private:
+	std::shared_ptr<detail::FutureState<T>> state_;
+};
+
+// runs f() by pool->run(), for ThreadPool::submit() and the like
+template<typename Pool, typename F>
+Future<typename std::result_of<F()>::type> submitTo(Pool* pool, F f) {
+	typedef typename std::result_of<F()>::type R;
+	std::shared_ptr<detail::FutureState<R>> state(std::make_shared<detail::FutureState<R>>());
+	pool->run(detail::SubmittedTask<R, F>(state, std::move(f)));
+	return Future<R>(state);
+}
+
+} // namespace leanet
+
+#endif // LEANET_FUTURE_H
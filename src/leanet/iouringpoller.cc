@@ -0,0 +1,539 @@
+#include "iouringpoller.h"
+#include "types.h"
+#include "logger.h"
+#include "channel.h"
+#include "eventloop.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <sys/uio.h> // iovec
+#include <unistd.h>
+#include <strings.h> // bzero
+#include <poll.h>
+
+#include <memory> // std::unique_ptr
+#include <utility> // std::move
+
+#ifndef NO_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+using namespace leanet;
+
+namespace {
+const int kNew = -1; // Channel::index_ are initialized with -1
+const int kAdded = 1;
+const int kDeleted = 2;
+
+// user_data of IORING_OP_POLL_REMOVE and IORING_OP_ASYNC_CANCEL requests,
+// whose completions are ignored.
+// user_data of IORING_OP_POLL_ADD requests are (fd << 32 | generation),
+// fd is never negative, so they never collide with it.
+const uint64_t kRemoveTag = UINT64_MAX;
+// user_data of submitted operations are
+// (kOperationTag | generation << 32 | slot), generation of 31 bits.
+const uint64_t kOperationTag = 1ULL << 63;
+const uint32_t kGenerationMask = 0x7fffffff;
+// how long the destructor waits for pending operations cancelled
+const int kCancelWaitMs = 100;
+const int kCancelWaits = 10;
+}
+
+#ifndef NO_IO_URING
+
+namespace {
+
+int ioUringSetup(unsigned entries, struct io_uring_params* params) {
+	return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int ringfd, unsigned toSubmit, unsigned minComplete,
+								 unsigned flags, const void* arg, size_t argsz) {
+	return static_cast<int>(::syscall(__NR_io_uring_enter, ringfd, toSubmit,
+																		minComplete, flags, arg, argsz));
+}
+
+// the shared rings are written by kernel concurrently
+unsigned loadAcquire(const unsigned* p) {
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned* p, unsigned v) {
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+template<typename T>
+T* offsetOf(void* base, uint32_t offset) {
+	return static_cast<T*>(static_cast<void*>(static_cast<char*>(base) + offset));
+}
+
+}
+
+bool IoUringPoller::available() {
+	// IORING_FEAT_EXT_ARG: waiting with timeout in io_uring_enter(2), 5.11
+	// IORING_FEAT_NODROP: no completion is lost when CQ ring overflows, 5.5
+	static const bool result = [] {
+		struct io_uring_params params;
+		::bzero(&params, sizeof(params));
+		int fd = ioUringSetup(4, &params);
+		if (fd < 0) {
+			return false;
+		}
+		::close(fd);
+		const uint32_t required = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+		return (params.features & required) == required;
+	}();
+	return result;
+}
+
+IoUringPoller::IoUringPoller(EventLoop* loop)
+	: Poller(loop),
+		ringfd_(-1),
+		sqRing_(MAP_FAILED),
+		sqRingSize_(0),
+		sqHead_(NULL),
+		sqTail_(NULL),
+		sqMask_(0),
+		sqArray_(NULL),
+		sqes_(NULL),
+		sqesSize_(0),
+		cqRing_(MAP_FAILED),
+		cqRingSize_(0),
+		cqHead_(NULL),
+		cqTail_(NULL),
+		cqMask_(0),
+		cqes_(NULL),
+		watches_(),
+		dirtyFds_(),
+		operations_(),
+		freeOperations_(),
+		completions_()
+{ }
+
+IoUringPoller* IoUringPoller::newIoUringPoller(EventLoop* loop) {
+	std::unique_ptr<IoUringPoller> poller(new IoUringPoller(loop));
+	if (!poller->setup()) {
+		return NULL;
+	}
+	return poller.release();
+}
+
+bool IoUringPoller::setup() {
+	struct io_uring_params params;
+	::bzero(&params, sizeof(params));
+	ringfd_ = ioUringSetup(kRingEntries, &params);
+	if (ringfd_ < 0) {
+		LOG_SYSERR << "IoUringPoller::setup - io_uring_setup";
+		return false;
+	}
+
+	sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (singleMmap) {
+		sqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+		cqRingSize_ = sqRingSize_;
+	}
+
+	sqRing_ = ::mmap(NULL, sqRingSize_, PROT_READ | PROT_WRITE,
+									 MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQ_RING);
+	if (sqRing_ == MAP_FAILED) {
+		LOG_SYSERR << "IoUringPoller::setup - mmap SQ ring";
+		return false;
+	}
+	if (singleMmap) {
+		cqRing_ = sqRing_;
+	} else {
+		cqRing_ = ::mmap(NULL, cqRingSize_, PROT_READ | PROT_WRITE,
+										 MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_CQ_RING);
+		if (cqRing_ == MAP_FAILED) {
+			LOG_SYSERR << "IoUringPoller::setup - mmap CQ ring";
+			return false;
+		}
+	}
+
+	sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+	void* sqes = ::mmap(NULL, sqesSize_, PROT_READ | PROT_WRITE,
+											MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		LOG_SYSERR << "IoUringPoller::setup - mmap SQEs";
+		return false;
+	}
+	sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+	sqHead_ = offsetOf<unsigned>(sqRing_, params.sq_off.head);
+	sqTail_ = offsetOf<unsigned>(sqRing_, params.sq_off.tail);
+	sqMask_ = *offsetOf<unsigned>(sqRing_, params.sq_off.ring_mask);
+	sqArray_ = offsetOf<unsigned>(sqRing_, params.sq_off.array);
+	cqHead_ = offsetOf<unsigned>(cqRing_, params.cq_off.head);
+	cqTail_ = offsetOf<unsigned>(cqRing_, params.cq_off.tail);
+	cqMask_ = *offsetOf<unsigned>(cqRing_, params.cq_off.ring_mask);
+	cqes_ = offsetOf<struct io_uring_cqe>(cqRing_, params.cq_off.cqes);
+	return true;
+}
+
+IoUringPoller::~IoUringPoller() {
+	if (sqes_ != NULL) {
+		cancelOperations();
+		::munmap(sqes_, sqesSize_);
+	}
+	if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_) {
+		::munmap(cqRing_, cqRingSize_);
+	}
+	if (sqRing_ != MAP_FAILED) {
+		::munmap(sqRing_, sqRingSize_);
+	}
+	if (ringfd_ >= 0) {
+		::close(ringfd_);
+	}
+}
+
+Timestamp IoUringPoller::poll(int timeoutMs, ChannelList* activeChannels) {
+	LOG_TRACE << "fd total count " << numChannels();
+	flushDirty();
+
+	// submits all queued requests and waits in the same system call
+	const unsigned toSubmit = *sqTail_ - loadAcquire(sqHead_);
+	int ret = enter(toSubmit, 1, timeoutMs);
+	int savedErrno = errno;
+	Timestamp now(Timestamp::now());
+	if (ret < 0 && savedErrno != EINTR && savedErrno != ETIME && savedErrno != EBUSY) {
+		errno = savedErrno;
+		LOG_SYSERR << "IoUringPoller::poll()";
+	}
+
+	// EBUSY: completions overflowed, reaping them makes room
+	reapCompletions(activeChannels);
+	runCompletions();
+	if (activeChannels->empty()) {
+		LOG_TRACE << "nothing happened";
+	} else {
+		LOG_TRACE << activeChannels->size() << " events happened";
+	}
+
+	return now;
+}
+
+void IoUringPoller::updateChannel(Channel* channel) {
+	assertInLoopThread();
+	const int tag = channel->index();
+	const int fd = channel->fd();
+	LOG_TRACE << "fd = " << fd
+		<< " events = " << channel->interestedEvents() << " index = " << tag;
+	if (tag == kNew || tag == kDeleted) {
+		if (tag == kNew) {
+			assert(findChannel(fd) == NULL);
+			addChannel(channel);
+			if (implicit_cast<size_t>(fd) >= watches_.size()) {
+				watches_.resize(fd + 1);
+			}
+			watches_[fd].channel = channel;
+		} else {
+			assert(findChannel(fd) == channel);
+		}
+		channel->setIndex(kAdded);
+	} else {
+		assert(tag == kAdded);
+		if (channel->isNoneEvent()) {
+			channel->setIndex(kDeleted);
+		}
+	}
+	// arming or cancelling is deferred to next poll()
+	markDirty(fd);
+}
+
+void IoUringPoller::removeChannel(Channel* channel) {
+	assertInLoopThread();
+	const int fd = channel->fd();
+	LOG_TRACE << "fd = " << fd;
+	assert(findChannel(fd) == channel);
+	// we should call disableAll() first before we call removeChannel()
+	assert(channel->isNoneEvent());
+	eraseChannel(channel);
+
+	int idx = channel->index();
+	assert(idx == kAdded || idx == kDeleted);
+	Unused(idx);
+	channel->setIndex(kNew);
+
+	Watch& watch = watches_[fd];
+	assert(watch.channel == channel);
+	watch.channel = NULL;
+	// an armed poll holds a reference to the file, its removal is queued
+	// here and submitted with the next poll. the fd may be closed and
+	// reused by another file before that, the completion of the old poll is
+	// told apart by the generation in its tag.
+	if (watch.armed) {
+		prepPollRemove(watch.armedTag);
+		watch.armed = false;
+	}
+}
+
+void IoUringPoller::markDirty(int fd) {
+	Watch& watch = watches_[fd];
+	if (!watch.dirty) {
+		watch.dirty = true;
+		dirtyFds_.push_back(fd);
+	}
+}
+
+void IoUringPoller::flushDirty() {
+	for (size_t i = 0; i < dirtyFds_.size(); ++i) {
+		const int fd = dirtyFds_[i];
+		Watch& watch = watches_[fd];
+		watch.dirty = false;
+
+		int events = 0;
+		if (watch.channel != NULL && watch.channel->index() == kAdded) {
+			events = watch.channel->interestedEvents();
+		}
+		if (watch.armed && watch.armedEvents != events) {
+			prepPollRemove(watch.armedTag);
+			watch.armed = false;
+		}
+		if (!watch.armed && events != 0) {
+			prepPollAdd(fd, &watch, events);
+		}
+	}
+	dirtyFds_.clear();
+}
+
+void IoUringPoller::reapCompletions(ChannelList* activeChannels) {
+	unsigned head = *cqHead_;
+	const unsigned tail = loadAcquire(cqTail_);
+	for (; head != tail; ++head) {
+		const struct io_uring_cqe& cqe = cqes_[head & cqMask_];
+		if (cqe.user_data == kRemoveTag) {
+			// -ENOENT or -EALREADY if the poll has completed, that's fine
+			continue;
+		}
+		if (cqe.user_data & kOperationTag) {
+			const uint32_t slot = static_cast<uint32_t>(cqe.user_data);
+			Operation& operation = operations_[slot];
+			assert(operation.generation == ((cqe.user_data >> 32) & kGenerationMask));
+			Completion completion;
+			completion.callback.swap(operation.callback);
+			completion.result = cqe.res;
+			completions_.push_back(std::move(completion));
+			freeOperations_.push_back(slot);
+			continue;
+		}
+
+		const int fd = static_cast<int>(cqe.user_data >> 32);
+		if (implicit_cast<size_t>(fd) >= watches_.size()) {
+			continue;
+		}
+		Watch& watch = watches_[fd];
+		if (!watch.armed || watch.armedTag != cqe.user_data) {
+			// completion of a cancelled poll
+			continue;
+		}
+
+		watch.armed = false;
+		assert(watch.channel != NULL);
+		if (cqe.res >= 0) {
+			watch.channel->setReceivedEvents(cqe.res);
+			activeChannels->push_back(watch.channel);
+		} else if (cqe.res != -ECANCELED) {
+			errno = -cqe.res;
+			LOG_SYSERR << "IoUringPoller::poll() fd = " << fd;
+			watch.channel->setReceivedEvents(POLLERR);
+			activeChannels->push_back(watch.channel);
+		}
+		// one-shot poll, re-arm it if it's still wanted
+		markDirty(fd);
+	}
+	storeRelease(cqHead_, head);
+}
+
+void IoUringPoller::runCompletions() {
+	// after the ring is consumed, callbacks may submit again
+	for (size_t i = 0; i < completions_.size(); ++i) {
+		completions_[i].callback(completions_[i].result);
+	}
+	completions_.clear();
+}
+
+uint64_t IoUringPoller::submitReadv(int fd, const struct iovec* iov, int iovcnt,
+		const EventLoop::CompletionCallback& cb) {
+	uint64_t id = 0;
+	struct io_uring_sqe* sqe = prepOperation(IORING_OP_READV, fd, cb, &id);
+	sqe->addr = reinterpret_cast<uint64_t>(iov);
+	sqe->len = static_cast<uint32_t>(iovcnt);
+	return id;
+}
+
+uint64_t IoUringPoller::submitWritev(int fd, const struct iovec* iov, int iovcnt,
+		const EventLoop::CompletionCallback& cb) {
+	uint64_t id = 0;
+	struct io_uring_sqe* sqe = prepOperation(IORING_OP_WRITEV, fd, cb, &id);
+	sqe->addr = reinterpret_cast<uint64_t>(iov);
+	sqe->len = static_cast<uint32_t>(iovcnt);
+	return id;
+}
+
+uint64_t IoUringPoller::submitAccept(int fd, struct sockaddr* addr, socklen_t* addrlen,
+		const EventLoop::CompletionCallback& cb) {
+	uint64_t id = 0;
+	struct io_uring_sqe* sqe = prepOperation(IORING_OP_ACCEPT, fd, cb, &id);
+	sqe->addr = reinterpret_cast<uint64_t>(addr);
+	sqe->addr2 = reinterpret_cast<uint64_t>(addrlen);
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	return id;
+}
+
+void IoUringPoller::cancel(uint64_t id) {
+	assertInLoopThread();
+	// -ENOENT if it has completed, and the slot may be reused by then, but
+	// not with the same generation
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = id;
+	sqe->user_data = kRemoveTag;
+}
+
+struct io_uring_sqe* IoUringPoller::prepOperation(int opcode, int fd,
+		const EventLoop::CompletionCallback& cb, uint64_t* id) {
+	assertInLoopThread();
+	uint32_t slot;
+	if (freeOperations_.empty()) {
+		slot = static_cast<uint32_t>(operations_.size());
+		operations_.push_back(Operation());
+	} else {
+		slot = freeOperations_.back();
+		freeOperations_.pop_back();
+	}
+	Operation& operation = operations_[slot];
+	operation.callback = cb;
+	operation.generation = (operation.generation + 1) & kGenerationMask;
+	*id = kOperationTag | (static_cast<uint64_t>(operation.generation) << 32) | slot;
+
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = static_cast<uint8_t>(opcode);
+	sqe->fd = fd;
+	sqe->user_data = *id;
+	return sqe;
+}
+
+void IoUringPoller::cancelOperations() {
+	size_t pending = operations_.size() - freeOperations_.size();
+	if (pending == 0) {
+		return;
+	}
+	for (size_t slot = 0; slot < operations_.size(); ++slot) {
+		if (operations_[slot].callback) {
+			cancel(kOperationTag | (static_cast<uint64_t>(operations_[slot].generation) << 32) | slot);
+		}
+	}
+	// the channels may be gone, only the completions of operations are
+	// looked at, and their callbacks dropped without being called
+	for (int i = 0; i < kCancelWaits && pending > 0; ++i) {
+		enter(*sqTail_ - loadAcquire(sqHead_), 1, kCancelWaitMs);
+		unsigned head = *cqHead_;
+		const unsigned tail = loadAcquire(cqTail_);
+		for (; head != tail; ++head) {
+			const struct io_uring_cqe& cqe = cqes_[head & cqMask_];
+			if (cqe.user_data != kRemoveTag && (cqe.user_data & kOperationTag)) {
+				operations_[static_cast<uint32_t>(cqe.user_data)].callback = EventLoop::CompletionCallback();
+				--pending;
+			}
+		}
+		storeRelease(cqHead_, head);
+	}
+	if (pending > 0) {
+		LOG_WARN << "IoUringPoller::~IoUringPoller - " << pending << " operations not cancelled";
+	}
+}
+
+void IoUringPoller::prepPollAdd(int fd, Watch* watch, int events) {
+	struct io_uring_sqe* sqe = getSqe();
+	++watch->generation;
+	watch->armedTag = (static_cast<uint64_t>(fd) << 32) | watch->generation;
+	watch->armedEvents = events;
+	watch->armed = true;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = static_cast<uint32_t>(events);
+	sqe->user_data = watch->armedTag;
+}
+
+void IoUringPoller::prepPollRemove(uint64_t tag) {
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = tag;
+	sqe->user_data = kRemoveTag;
+}
+
+struct io_uring_sqe* IoUringPoller::getSqe() {
+	unsigned tail = *sqTail_;
+	unsigned head = loadAcquire(sqHead_);
+	while (tail - head > sqMask_) {
+		// submission ring is full, submit without waiting
+		if (enter(tail - head, 0, 0) < 0 && errno != EINTR && errno != EBUSY) {
+			LOG_SYSFATAL << "IoUringPoller::getSqe() - io_uring_enter";
+		}
+		head = loadAcquire(sqHead_);
+	}
+
+	const unsigned index = tail & sqMask_;
+	struct io_uring_sqe* sqe = &sqes_[index];
+	::bzero(sqe, sizeof(*sqe));
+	sqArray_[index] = index;
+	// the caller fills sqe before kernel sees it in next io_uring_enter(2)
+	storeRelease(sqTail_, tail + 1);
+	return sqe;
+}
+
+int IoUringPoller::enter(unsigned toSubmit, unsigned minComplete, int timeoutMs) {
+	unsigned flags = 0;
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	const void* argp = NULL;
+	size_t argsz = 0;
+	if (minComplete > 0) {
+		flags |= IORING_ENTER_GETEVENTS;
+		if (timeoutMs >= 0) {
+			ts.tv_sec = timeoutMs / 1000;
+			ts.tv_nsec = (timeoutMs % 1000) * 1000 * 1000;
+			::bzero(&arg, sizeof(arg));
+			arg.ts = reinterpret_cast<uint64_t>(&ts);
+			flags |= IORING_ENTER_EXT_ARG;
+			argp = &arg;
+			argsz = sizeof(arg);
+		}
+	}
+	++syscalls_;
+	return ioUringEnter(ringfd_, toSubmit, minComplete, flags, argp, argsz);
+}
+
+#else // NO_IO_URING
+
+bool IoUringPoller::available() {
+	return false;
+}
+
+IoUringPoller::IoUringPoller(EventLoop* loop)
+	: Poller(loop)
+{ }
+
+IoUringPoller::~IoUringPoller() { }
+
+IoUringPoller* IoUringPoller::newIoUringPoller(EventLoop*) {
+	LOG_ERROR << "IoUringPoller::newIoUringPoller - io_uring is not supported";
+	return NULL;
+}
+
+Timestamp IoUringPoller::poll(int, ChannelList*) { return Timestamp::now(); }
+void IoUringPoller::updateChannel(Channel*) { }
+void IoUringPoller::removeChannel(Channel*) { }
+uint64_t IoUringPoller::submitReadv(int, const struct iovec*, int, const EventLoop::CompletionCallback&) { return 0; }
+uint64_t IoUringPoller::submitWritev(int, const struct iovec*, int, const EventLoop::CompletionCallback&) { return 0; }
+uint64_t IoUringPoller::submitAccept(int, struct sockaddr*, socklen_t*, const EventLoop::CompletionCallback&) { return 0; }
+void IoUringPoller::cancel(uint64_t) { }
+
+#endif // NO_IO_URING
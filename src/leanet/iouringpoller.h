@@ -0,0 +1,140 @@
+#ifndef LEANET_IOURINGPOLLER_H
+#define LEANET_IOURINGPOLLER_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "poller.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace leanet {
+
+//
+// IO Multiplexing with io_uring(7), since Linux 5.11.
+//
+// Every channel is watched by a one-shot IORING_OP_POLL_ADD, which is
+// re-armed after its event has been handled, so the semantic is
+// level-triggered like poll(2).
+// Arming, re-arming and cancelling requests are queued in the submission
+// ring and submitted together with waiting in a single io_uring_enter(2),
+// so there is one system call per loop iteration no matter how many
+// channels are ready or changed their interests.
+//
+// readv(2), writev(2) and accept4(2) may be submitted the same way, by
+// submitReadv() and the like, instead of being called after a poll, so a
+// connection read from and written to costs no system call of its own.
+//
+class IoUringPoller : public Poller {
+public:
+	virtual ~IoUringPoller();
+
+	// NULL if the ring can't be set up, e.g. for RLIMIT_MEMLOCK, and the
+	// caller falls back to another poller
+	static IoUringPoller* newIoUringPoller(EventLoop* loop);
+
+	virtual Timestamp poll(int timeoutMs, ChannelList* activeChannels);
+	virtual void updateChannel(Channel* channel);
+	virtual void removeChannel(Channel* channel);
+
+	virtual bool supportsCompletions() const { return true; }
+	virtual uint64_t submitReadv(int fd, const struct iovec* iov, int iovcnt,
+			const EventLoop::CompletionCallback& cb);
+	virtual uint64_t submitWritev(int fd, const struct iovec* iov, int iovcnt,
+			const EventLoop::CompletionCallback& cb);
+	virtual uint64_t submitAccept(int fd, struct sockaddr* addr, socklen_t* addrlen,
+			const EventLoop::CompletionCallback& cb);
+	virtual void cancel(uint64_t id);
+
+	// whether the running kernel supports the features we need,
+	// probed once.
+	static bool available();
+
+private:
+	static const unsigned kRingEntries = 1024;
+
+	// state of a watched fd, indexed by fd.
+	struct Watch {
+		Watch()
+			: channel(NULL),
+				armedEvents(0),
+				armedTag(0),
+				generation(0),
+				armed(false),
+				dirty(false)
+		{ }
+
+		Channel* channel;
+		int armedEvents;
+		uint64_t armedTag; // user_data of the pending poll request
+		uint32_t generation;
+		bool armed;
+		bool dirty; // in dirtyFds_
+	};
+
+	explicit IoUringPoller(EventLoop* loop);
+	// false if failed, the destructor cleans up what is done
+	bool setup();
+
+	void markDirty(int fd);
+	void flushDirty();
+	void reapCompletions(ChannelList* activeChannels);
+	// callbacks of the operations reaped
+	void runCompletions();
+	// the sqe of an operation of opcode, its callback kept until completed
+	struct io_uring_sqe* prepOperation(int opcode, int fd,
+			const EventLoop::CompletionCallback& cb, uint64_t* id);
+	// before the memory of pending operations may be freed with their
+	// callbacks, waits for them cancelled(bounded)
+	void cancelOperations();
+
+	void prepPollAdd(int fd, Watch* watch, int events);
+	void prepPollRemove(uint64_t tag);
+	struct io_uring_sqe* getSqe();
+	int enter(unsigned toSubmit, unsigned minComplete, int timeoutMs);
+
+	int ringfd_;
+	// submission ring
+	void* sqRing_;
+	size_t sqRingSize_;
+	unsigned* sqHead_;
+	unsigned* sqTail_;
+	unsigned sqMask_;
+	unsigned* sqArray_;
+	struct io_uring_sqe* sqes_;
+	size_t sqesSize_;
+	// completion ring
+	void* cqRing_;
+	size_t cqRingSize_;
+	unsigned* cqHead_;
+	unsigned* cqTail_;
+	unsigned cqMask_;
+	struct io_uring_cqe* cqes_;
+
+	std::vector<Watch> watches_;
+	std::vector<int> dirtyFds_;
+
+	// submitted operations, indexed by the low bits of their user_data, the
+	// generation in the high bits tells a reused slot from a cancelled id
+	struct Operation {
+		Operation()
+			: callback(),
+				generation(0)
+		{ }
+
+		EventLoop::CompletionCallback callback;
+		uint32_t generation;
+	};
+	std::vector<Operation> operations_;
+	std::vector<uint32_t> freeOperations_;
+	struct Completion {
+		EventLoop::CompletionCallback callback;
+		int result;
+	};
+	std::vector<Completion> completions_;
+};
+
+}
+
+#endif
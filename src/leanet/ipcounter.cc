@@ -0,0 +1,115 @@
+#include "ipcounter.h"
+#include "inetaddress.h"
+#include "sockets.h"
+
+#include <assert.h>
+#include <string.h> // memcpy
+
+using namespace leanet;
+
+IpCounter::IpCounter(size_t initialSlots)
+	: slots_(),
+		size_(0)
+{
+	size_t n = 8;
+	while (n < initialSlots) {
+		n *= 2;
+	}
+	Slot empty = { 0, 0, 0 };
+	slots_.assign(n, empty);
+}
+
+int IpCounter::add(const InetAddress& addr) {
+	if (2 * (size_ + 1) > slots_.size()) {
+		grow();
+	}
+	Slot key = keyOf(addr);
+	Slot& slot = slots_[find(key)];
+	if (slot.count == 0) {
+		slot.hi = key.hi;
+		slot.lo = key.lo;
+		++size_;
+	}
+	return ++slot.count;
+}
+
+int IpCounter::remove(const InetAddress& addr) {
+	size_t i = find(keyOf(addr));
+	assert(slots_[i].count > 0);
+	if (--slots_[i].count > 0) {
+		return slots_[i].count;
+	}
+
+	// backward shift: the slots after i in the run are moved into the hole
+	// unless they are already at or after their home slot
+	const size_t mask = slots_.size() - 1;
+	size_t hole = i;
+	for (size_t j = (i + 1) & mask; slots_[j].count != 0; j = (j + 1) & mask) {
+		size_t home = hashOf(slots_[j]) & mask;
+		// home is cyclically in (hole, j], it can't move before it
+		bool stays = hole <= j ? (hole < home && home <= j)
+													 : (hole < home || home <= j);
+		if (!stays) {
+			slots_[hole] = slots_[j];
+			hole = j;
+		}
+	}
+	slots_[hole].count = 0;
+	--size_;
+	return 0;
+}
+
+int IpCounter::count(const InetAddress& addr) const {
+	return slots_[find(keyOf(addr))].count;
+}
+
+IpCounter::Slot IpCounter::keyOf(const InetAddress& addr) {
+	// an IPv4 address as ::ffff:a.b.c.d, the same key as the peer of an IPv6
+	// socket which accepts it
+	unsigned char mapped[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0, 0, 0, 0 };
+	const unsigned char* p = mapped;
+	const struct sockaddr* sa = addr.getSockAddr();
+	if (sa->sa_family == AF_INET6) {
+		p = sockets::sockaddr_in6_cast(sa)->sin6_addr.s6_addr;
+	} else {
+		::memcpy(mapped + 12, &sockets::sockaddr_in_cast(sa)->sin_addr, 4);
+	}
+	Slot key = { 0, 0, 0 };
+	::memcpy(&key.hi, p, sizeof(key.hi));
+	::memcpy(&key.lo, p + sizeof(key.hi), sizeof(key.lo));
+	return key;
+}
+
+size_t IpCounter::hashOf(const Slot& key) {
+	// the finalizer of MurmurHash3, the low bits of ips are far from uniform
+	uint64_t h = key.hi * 0x9e3779b97f4a7c15ULL ^ key.lo;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return static_cast<size_t>(h);
+}
+
+size_t IpCounter::find(const Slot& key) const {
+	const size_t mask = slots_.size() - 1;
+	size_t i = hashOf(key) & mask;
+	// never full, there is an empty slot to stop at
+	while (slots_[i].count != 0 &&
+				 (slots_[i].hi != key.hi || slots_[i].lo != key.lo)) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+void IpCounter::grow() {
+	std::vector<Slot> old;
+	old.swap(slots_);
+	Slot empty = { 0, 0, 0 };
+	slots_.assign(2 * old.size(), empty);
+	for (size_t i = 0; i < old.size(); ++i) {
+		if (old[i].count != 0) {
+			slots_[find(old[i])] = old[i];
+		}
+	}
+}
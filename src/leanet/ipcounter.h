@@ -0,0 +1,63 @@
+#ifndef LEANET_IPCOUNTER_H
+#define LEANET_IPCOUNTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace leanet {
+
+class InetAddress;
+
+//
+// connections counted by peer ip, for limits per source.
+//
+// an open-addressing table with linear probing: a slot is the 16 bytes of
+// the ip(ipv4 as mapped into ipv6) and a count, 24 bytes with no pointer
+// and no allocation per ip. the table doubles to keep under half full, an
+// ip is removed when its count drops to zero by shifting back the slots
+// after it, so there are no tombstones and lookups never slow down.
+//
+// not thread safe.
+//
+class IpCounter: noncopyable {
+public:
+	explicit IpCounter(size_t initialSlots = 64);
+
+	// the count of addr after adding one
+	int add(const InetAddress& addr);
+	// the count of addr after removing one, which must have been added
+	int remove(const InetAddress& addr);
+	int count(const InetAddress& addr) const;
+
+	// ips with a count
+	size_t size() const
+	{ return size_; }
+	// for debug
+	size_t slots() const
+	{ return slots_.size(); }
+
+private:
+	struct Slot {
+		uint64_t hi;
+		uint64_t lo;
+		int count; // 0 for empty
+	};
+
+	static Slot keyOf(const InetAddress& addr);
+	static size_t hashOf(const Slot& key);
+
+	// of key, or the empty one where it would be
+	size_t find(const Slot& key) const;
+	void grow();
+
+	std::vector<Slot> slots_; // power of two
+	size_t size_;
+};
+
+}
+
+#endif // LEANET_IPCOUNTER_H
@@ -120,11 +120,11 @@ void Logger::Impl::formatTime() {
 	}
 
 	if (g_timezone.valid()) {
-		Fmt us("%06d ", microseconds);
-		assert(us.length() == 8);
-		stream_ << StringHelper(t_time, 17) << StringHelper(us.data(), 8);
+		Fmt us(".%06d ", microseconds);
+		assert(us.length() == 9);
+		stream_ << StringHelper(t_time, 17) << StringHelper(us.data(), 9);
 	} else {
-		Fmt us("%06dZ ", microseconds);
+		Fmt us(".%06dZ ", microseconds);
 		assert(us.length() == 9);
 		stream_ << StringHelper(t_time, 17) << StringHelper(us.data(), 9);
 	}
@@ -0,0 +1,153 @@
+#ifndef LEANET_MPSCQUEUE_H
+#define LEANET_MPSCQUEUE_H
+
+#include <stddef.h> // NULL
+#include <sched.h> // sched_yield
+#include <utility> // std::move
+
+#include "noncopyable.h"
+
+namespace leanet {
+
+//
+// Unbounded multi-producer single-consumer queue, after Dmitry Vyukov's
+// intrusive node-based algorithm:
+// http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+//
+// push() allocates a node with the item in it(moved in if it is an rvalue)
+// and pop() frees it, so an item which holds its data inline, such as a
+// SmallFunction, costs one allocation.
+//
+// push() is wait-free(one atomic exchange) and can be called in any thread.
+// pop() is lock-free and must be called in only one thread.
+//
+// pop() may return false while the queue is not empty, if a producer is
+// preempted in the middle of push(), items pushed after it are invisible
+// until it finishes. popWait() waits for it instead.
+//
+template<typename T>
+class MpscQueue: noncopyable {
+public:
+	MpscQueue()
+		: head_(&stub_),
+			tail_(&stub_)
+	{
+		stub_.next = NULL;
+	}
+
+	~MpscQueue() {
+		T x;
+		while (pop(&x)) { }
+	}
+
+	void push(const T& x) {
+		push(new Node(x));
+	}
+
+	void push(T&& x) {
+		push(new Node(std::move(x)));
+	}
+
+	bool pop(T* x) {
+		Node* node = popNode();
+		if (node == NULL) {
+			return false;
+		}
+		*x = std::move(node->value);
+		delete node;
+		return true;
+	}
+
+	// pop() which waits out producers in the middle of push(), so it
+	// returns false only if everything pushed before is popped.
+	// the wait is a few instructions unless a producer is preempted.
+	bool popWait(T* x) {
+		while (!pop(x)) {
+			if (__atomic_load_n(&head_, __ATOMIC_ACQUIRE) == tail_) {
+				return false;
+			}
+			::sched_yield();
+		}
+		return true;
+	}
+
+	// called in consumer thread
+	bool empty() const {
+		return tail_ == &stub_ && load(&stub_.next) == NULL;
+	}
+
+private:
+	struct NodeBase {
+		NodeBase* next;
+	};
+
+	struct Node: NodeBase {
+		explicit Node(const T& x)
+			: value(x)
+		{ }
+
+		explicit Node(T&& x)
+			: value(std::move(x))
+		{ }
+
+		T value;
+	};
+
+	static NodeBase* load(NodeBase* const* p) {
+		return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+	}
+
+	void push(NodeBase* node) {
+		node->next = NULL;
+		NodeBase* prev = __atomic_exchange_n(&head_, node, __ATOMIC_ACQ_REL);
+		// a window where the list is broken: prev->next is not linked yet
+		__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+	}
+
+	Node* popNode() {
+		NodeBase* tail = tail_;
+		NodeBase* next = load(&tail->next);
+		if (tail == &stub_) {
+			if (next == NULL) {
+				return NULL;
+			}
+			tail_ = next;
+			tail = next;
+			next = load(&next->next);
+		}
+
+		if (next != NULL) {
+			tail_ = next;
+			return static_cast<Node*>(tail);
+		}
+
+		NodeBase* head = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+		if (tail != head) {
+			// a producer is in the middle of push()
+			return NULL;
+		}
+
+		// tail is the last one, push stub behind it so that it can be unlinked
+		push(&stub_);
+		next = load(&tail->next);
+		if (next != NULL) {
+			tail_ = next;
+			return static_cast<Node*>(tail);
+		}
+		return NULL;
+	}
+
+	static const size_t kCacheLineSize = 64;
+
+	// producers side
+	NodeBase* head_;
+	// keeps producers and consumer off the same cache line
+	char padding_[kCacheLineSize - sizeof(NodeBase*)];
+	// consumer side
+	NodeBase* tail_;
+	NodeBase stub_;
+};
+
+} // namespace leanet
+
+#endif // LEANET_MPSCQUEUE_H
@@ -1,46 +1,103 @@
 #ifndef LEANET_POLLER_H
 #define LEANET_POLLER_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h> // socklen_t
+
 #include <vector>
-#include <map>
 
 #include "noncopyable.h"
 #include "timestamp.h"
-
-struct pollfd;
+#include "eventloop.h"
 
 namespace leanet {
 
 class Channel;
-class EventLoop;
 
 //
-// IO Multiplexing with poll(2).
+// Base class for IO Multiplexing
+//
+// This class doesn't own the Channel objects.
 //
-
 class Poller : noncopyable {
 public:
 	typedef std::vector<Channel*> ChannelList;
 
 	explicit Poller(EventLoop* loop);
-	~Poller();
-
-	Timestamp poll(int timeoutMs, ChannelList* activeChannels);
-
-	void updateChannel(Channel* channel);
-	void removeChannel(Channel* channel);
-
-	void assertInLoopThread();
+	virtual ~Poller();
+
+	// polls the I/O events.
+	// must be called in the loop thread.
+	virtual Timestamp poll(int timeoutMs, ChannelList* activeChannels) = 0;
+
+	// changes the interested I/O events.
+	// must be called in the loop thread.
+	virtual void updateChannel(Channel* channel) = 0;
+
+	// removes the channel, when it destructs.
+	// must be called in the loop thread.
+	virtual void removeChannel(Channel* channel) = 0;
+
+	virtual bool hasChannel(Channel* channel) const;
+
+	// whether Channel::isEdgeTriggered() is honored
+	virtual bool supportsEdgeTriggered() const { return false; }
+
+	// whether I/O can be submitted, see submitReadv()
+	virtual bool supportsCompletions() const { return false; }
+	// readv(2), writev(2) or accept4(2)(with SOCK_NONBLOCK | SOCK_CLOEXEC)
+	// of fd submitted with the next poll instead of a system call of its
+	// own, cb is called in poll() with what the call returns(-errno on
+	// failure) after it completes. cb is called once for every submission,
+	// cancelled or not. the memory given must be valid until then.
+	// returns the id to cancel it.
+	// must be called in the loop thread.
+	virtual uint64_t submitReadv(int fd, const struct iovec* iov, int iovcnt,
+			const EventLoop::CompletionCallback& cb);
+	virtual uint64_t submitWritev(int fd, const struct iovec* iov, int iovcnt,
+			const EventLoop::CompletionCallback& cb);
+	virtual uint64_t submitAccept(int fd, struct sockaddr* addr, socklen_t* addrlen,
+			const EventLoop::CompletionCallback& cb);
+	// the submission completes with -ECANCELED unless it has completed, or
+	// does soon. nothing if it has been reaped.
+	// must be called in the loop thread.
+	virtual void cancel(uint64_t id);
+
+	// system calls made by the poller so far, for benchmarking
+	int64_t syscalls() const { return syscalls_; }
+
+	// poll(2) if LEANET_USE_POLL is set in environment,
+	// io_uring(7) if LEANET_USE_IO_URING is set and the kernel supports it,
+	// epoll(4) otherwise.
+	static Poller* newDefaultPoller(EventLoop* loop);
+	static Poller* newPoller(EventLoop* loop, EventLoop::PollerType type);
+
+	void assertInLoopThread() const {
+		ownerLoop_->assertInLoopThread();
+	}
+
+protected:
+	// the channel of fd, NULL if none
+	Channel* findChannel(int fd) const {
+		return static_cast<size_t>(fd) < channels_.size() ? channels_[fd] : NULL;
+	}
+	// channel->fd() must have no channel
+	void addChannel(Channel* channel);
+	// channel must have been added
+	void eraseChannel(Channel* channel);
+	size_t numChannels() const
+	{ return numChannels_; }
+
+	int64_t syscalls_;
 
 private:
-	void fillActiveChannels(int numEvents, ChannelList* activeChannels) const;
-
-	typedef std::vector<struct pollfd> PollFdList;
-	typedef std::map<int, Channel*> ChannelMap;
-
 	EventLoop* ownerLoop_;
-	PollFdList pollfds_;
-	ChannelMap channels_;
+	// indexed by fd: fds are small and reused from the lowest, so the table
+	// stays as large as the most fds open at once, with no node per channel
+	// and no search per event.
+	std::vector<Channel*> channels_;
+	size_t numChannels_;
 };
 
 }
@@ -0,0 +1,33 @@
+#ifndef LEANET_POLLPOLLER_H
+#define LEANET_POLLPOLLER_H
+
+#include <vector>
+
+#include "poller.h"
+
+struct pollfd;
+
+namespace leanet {
+
+//
+// IO Multiplexing with poll(2).
+//
+class PollPoller : public Poller {
+public:
+	explicit PollPoller(EventLoop* loop);
+	virtual ~PollPoller();
+
+	virtual Timestamp poll(int timeoutMs, ChannelList* activeChannels);
+	virtual void updateChannel(Channel* channel);
+	virtual void removeChannel(Channel* channel);
+
+private:
+	void fillActiveChannels(int numEvents, ChannelList* activeChannels) const;
+
+	typedef std::vector<struct pollfd> PollFdList;
+	PollFdList pollfds_;
+};
+
+}
+
+#endif
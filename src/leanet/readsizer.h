@@ -0,0 +1,76 @@
+#ifndef LEANET_READSIZER_H
+#define LEANET_READSIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace leanet {
+
+//
+// guesses how many bytes the next read of a connection takes from recent
+// reads: grows at once if a read fills the guess, shrinks after two reads
+// in a row fit in half of it. the input buffer is made writable for the
+// guess before reading, so large frames land in it without a spill copy,
+// and an idle connection needs little.
+//
+class ReadSizer {
+public:
+	static const size_t kMinSize = 512;
+	static const size_t kInitialSize = 2048;
+	static const size_t kMaxSize = 1024 * 1024;
+
+	ReadSizer()
+		: size_(kInitialSize),
+			decrease_(false)
+	{ }
+
+	size_t size() const {
+		return size_;
+	}
+
+	void record(size_t bytesRead) {
+		if (bytesRead >= size_) {
+			size_ = size_ * 4 < kMaxSize ? size_ * 4 : kMaxSize;
+			decrease_ = false;
+		} else if (bytesRead <= size_ / 2) {
+			if (decrease_) {
+				size_ = size_ / 2 > kMinSize ? size_ / 2 : kMinSize;
+				decrease_ = false;
+			} else {
+				decrease_ = true;
+			}
+		} else {
+			decrease_ = false;
+		}
+	}
+
+private:
+	size_t size_;
+	bool decrease_;
+};
+
+// reads of connections in a loop
+struct ReadStats {
+	ReadStats()
+		: reads(0),
+			bytesRead(0),
+			spilledReads(0),
+			spilledBytes(0),
+			copiesAvoided(0),
+			bytesNotCopied(0)
+	{ }
+
+	int64_t reads;
+	int64_t bytesRead;
+	// more than the input buffer can take, copied from the spill buffer
+	int64_t spilledReads;
+	int64_t spilledBytes;
+	// more than the input buffer could take before it was grown for the
+	// guess, which were spilled and copied without adaptive sizing
+	int64_t copiesAvoided;
+	int64_t bytesNotCopied;
+};
+
+}
+
+#endif // LEANET_READSIZER_H
@@ -0,0 +1,149 @@
+#ifndef LEANET_SMALLFUNCTION_H
+#define LEANET_SMALLFUNCTION_H
+
+#include <stddef.h>
+
+#include <new> // placement new
+#include <type_traits>
+#include <utility> // std::move, std::forward
+
+#include "noncopyable.h"
+
+namespace leanet {
+
+template<typename Signature, size_t kInlineSize = 48>
+class SmallFunction;
+
+//
+// move-only std::function with room for a callable of kInlineSize bytes in
+// the object, so the small ones(a few pointers and a shared_ptr) are
+// stored without allocation. larger ones are allocated as std::function
+// does for anything over two pointers.
+//
+template<typename R, typename... Args, size_t kInlineSize>
+class SmallFunction<R (Args...), kInlineSize>: noncopyable {
+public:
+	SmallFunction()
+		: ops_(NULL)
+	{ }
+
+	template<typename F>
+	SmallFunction(F f)
+		: ops_(NULL)
+	{
+		typedef typename std::conditional<
+			sizeof(F) <= kInlineSize && std::alignment_of<F>::value <= std::alignment_of<Storage>::value,
+			Inline<F>, Heap<F>>::type Holder;
+		Holder::create(&storage_, std::move(f));
+		ops_ = Holder::ops();
+	}
+
+	SmallFunction(SmallFunction&& other)
+		: ops_(NULL)
+	{
+		moveFrom(other);
+	}
+
+	SmallFunction& operator=(SmallFunction&& other) {
+		if (this != &other) {
+			reset();
+			moveFrom(other);
+		}
+		return *this;
+	}
+
+	~SmallFunction() {
+		reset();
+	}
+
+	void swap(SmallFunction& other) {
+		SmallFunction tmp(std::move(other));
+		other = std::move(*this);
+		*this = std::move(tmp);
+	}
+
+	void reset() {
+		if (ops_) {
+			ops_->destroy(&storage_);
+			ops_ = NULL;
+		}
+	}
+
+	explicit operator bool() const
+	{ return ops_ != NULL; }
+
+	// stored in the object, for debug
+	bool isInline() const
+	{ return ops_ != NULL && ops_->isInline; }
+
+	R operator()(Args... args) {
+		return ops_->invoke(&storage_, std::forward<Args>(args)...);
+	}
+
+private:
+	typedef typename std::aligned_storage<kInlineSize>::type Storage;
+
+	struct Ops {
+		R (*invoke)(void* storage, Args&&... args);
+		// moves into to, leaves from destroyed
+		void (*move)(void* from, void* to);
+		void (*destroy)(void* storage);
+		bool isInline;
+	};
+
+	template<typename F>
+	struct Inline {
+		static void create(void* storage, F&& f) {
+			new (storage) F(std::move(f));
+		}
+		static R invoke(void* storage, Args&&... args) {
+			return (*static_cast<F*>(storage))(std::forward<Args>(args)...);
+		}
+		static void move(void* from, void* to) {
+			new (to) F(std::move(*static_cast<F*>(from)));
+			static_cast<F*>(from)->~F();
+		}
+		static void destroy(void* storage) {
+			static_cast<F*>(storage)->~F();
+		}
+		static const Ops* ops() {
+			static const Ops inlineOps = { &invoke, &move, &destroy, true };
+			return &inlineOps;
+		}
+	};
+
+	template<typename F>
+	struct Heap {
+		static void create(void* storage, F&& f) {
+			*static_cast<F**>(storage) = new F(std::move(f));
+		}
+		static R invoke(void* storage, Args&&... args) {
+			return (**static_cast<F**>(storage))(std::forward<Args>(args)...);
+		}
+		static void move(void* from, void* to) {
+			*static_cast<F**>(to) = *static_cast<F**>(from);
+		}
+		static void destroy(void* storage) {
+			delete *static_cast<F**>(storage);
+		}
+		static const Ops* ops() {
+			static const Ops heapOps = { &invoke, &move, &destroy, false };
+			return &heapOps;
+		}
+	};
+
+	void moveFrom(SmallFunction& other) {
+		if (other.ops_) {
+			other.ops_->move(&other.storage_, &storage_);
+			ops_ = other.ops_;
+			other.ops_ = NULL;
+		}
+	}
+
+	Storage storage_;
+	const Ops* ops_;
+};
+
+} // namespace leanet
+
+#endif // LEANET_SMALLFUNCTION_H
@@ -9,6 +9,10 @@
 #include "sockets.h"
 #include "logger.h"
 
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
 using namespace leanet;
 
 Socket::~Socket() {
@@ -98,3 +102,23 @@ void Socket::setKeepAlive(bool on) {
 		LOG_SYSERR << "SO_KEEPALIVE set error";
 	}
 }
+
+void Socket::setAbortOnClose(bool on) {
+	struct linger optval;
+	optval.l_onoff = on ? 1 : 0;
+	optval.l_linger = 0;
+	int ret = ::setsockopt(sockfd_, SOL_SOCKET, SO_LINGER, &optval, sizeof(optval));
+	if (ret < 0) {
+		LOG_SYSERR << "SO_LINGER set error";
+	}
+}
+
+bool Socket::setZeroCopy(bool on) {
+	int optval = on ? 1 : 0;
+	int ret = ::setsockopt(sockfd_, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval));
+	if (ret < 0) {
+		LOG_SYSERR << "SO_ZEROCOPY set error";
+		return false;
+	}
+	return true;
+}
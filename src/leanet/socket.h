@@ -47,6 +47,11 @@ public:
 	void setReusePort(bool on);
 	// SO_KEEPALIVE
 	void setKeepAlive(bool on);
+	// SO_ZEROCOPY, false if the socket does not support it
+	bool setZeroCopy(bool on);
+	// SO_LINGER of 0 seconds: close(2) resets the connection, what has not
+	// been sent is dropped
+	void setAbortOnClose(bool on);
 
 private:
 	int sockfd_;
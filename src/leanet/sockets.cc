@@ -8,6 +8,9 @@
 #include <arpa/inet.h> // ntoh* and hton*
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h> // FIONREAD
+#include <linux/errqueue.h> // sock_extended_err
 
 #include <strings.h> // bzero
 #include <stdio.h> // snprintf
@@ -15,6 +18,16 @@
 #include "types.h"
 #include "logger.h"
 
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
 using namespace leanet;
 
 namespace {
@@ -87,22 +100,25 @@ int accept(int sockfd, struct sockaddr_in6* addr) {
 #endif
 	if (connfd < 0) {
 		int savedErrno = errno;
-		LOG_SYSERR << "sockets::accept";
 		switch (savedErrno) {
 			case EAGAIN:
+				// no more pending, the end of every batch of accepts
+				break;
 			case ECONNABORTED:
 			case EINTR:
 			case EPROTO:
 			case EPERM:
 			case EMFILE:
+			case ENFILE:
+			case ENOBUFS:
+			case ENOMEM:
+				// out of fds or memory is not fatal, the caller may retry later
+				LOG_SYSERR << "sockets::accept";
 				errno = savedErrno;
 				break;
 			case EBADF:
 			case EFAULT:
 			case EINVAL:
-			case ENFILE:
-			case ENOBUFS:
-			case ENOMEM:
 			case ENOTSOCK:
 			case EOPNOTSUPP:
 				LOG_FATAL << "unexcepted error of ::accept(or 4) " << savedErrno;
@@ -281,12 +297,69 @@ ssize_t readv(int sockfd, const struct iovec* iov, int iovcnt) {
 	return ::readv(sockfd, iov, iovcnt);
 }
 
+ssize_t writev(int sockfd, const struct iovec* iov, int iovcnt) {
+	return ::writev(sockfd, iov, iovcnt);
+}
+
 void close(int sockfd) {
 	if (::close(sockfd) < 0) {
 		LOG_SYSERR << "sockets::close";
 	}
 }
 
+ssize_t sendfile(int sockfd, int fd, off_t* offset, size_t count) {
+	return ::sendfile(sockfd, fd, offset, count);
+}
+
+ssize_t splice(int pipefd, int sockfd, size_t count) {
+	return ::splice(pipefd, NULL, sockfd, NULL, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+}
+
+int pipeReadableBytes(int pipefd) {
+	int n = 0;
+	if (::ioctl(pipefd, FIONREAD, &n) < 0) {
+		return -1;
+	}
+	return n;
+}
+
+ssize_t sendZeroCopy(int sockfd, const struct iovec* iov, int iovcnt) {
+	struct msghdr msg;
+	::bzero(&msg, sizeof(msg));
+	msg.msg_iov = const_cast<struct iovec*>(iov);
+	msg.msg_iovlen = static_cast<size_t>(iovcnt);
+	return ::sendmsg(sockfd, &msg, MSG_ZEROCOPY);
+}
+
+int recvZeroCopyCompletion(int sockfd, uint32_t* lo, uint32_t* hi, bool* copied) {
+	for (;;) {
+		char control[128];
+		struct msghdr msg;
+		::bzero(&msg, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (::recvmsg(sockfd, &msg, MSG_ERRQUEUE) < 0) {
+			return errno == EAGAIN ? 0 : -1;
+		}
+
+		for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+						|| (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+				continue;
+			}
+			const struct sock_extended_err* serr =
+				reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cm));
+			if (serr->ee_errno == 0 && serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+				*lo = serr->ee_info;
+				*hi = serr->ee_data;
+				*copied = (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+				return 1;
+			}
+		}
+		// not ours, such as an ICMP error, skipped
+	}
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wconversion"
 #pragma GCC diagnostic ignored "-Wold-style-cast"
@@ -37,8 +37,23 @@ bool isSelfConnected(int sockfd);
 ssize_t read(int fd, void* data, size_t len);
 ssize_t write(int fd, const void* data, size_t len);
 ssize_t readv(int fd, const struct iovec* iov, int iovcnt);
+ssize_t writev(int fd, const struct iovec* iov, int iovcnt);
 void close(int fd);
 
+// linux apis, move file or pipe content to a socket in kernel
+ssize_t sendfile(int sockfd, int fd, off_t* offset, size_t count);
+// nonblocking on both ends
+ssize_t splice(int pipefd, int sockfd, size_t count);
+// bytes buffered in a pipe, -1 on error
+int pipeReadableBytes(int pipefd);
+// writev(2) with MSG_ZEROCOPY, the memory must not be modified until the
+// send is reported completed.
+ssize_t sendZeroCopy(int sockfd, const struct iovec* iov, int iovcnt);
+// reads a completion of MSG_ZEROCOPY sends from the error queue, returns 1
+// with sends in [*lo, *hi] completed(*copied if the kernel copied them
+// after all), 0 if there is none, -1 on error.
+int recvZeroCopyCompletion(int sockfd, uint32_t* lo, uint32_t* hi, bool* copied);
+
 uint64_t netToHost64(uint64_t n);
 uint64_t hostToNet64(uint64_t n);
 uint32_t netToHost32(uint32_t n);
@@ -0,0 +1,202 @@
+#include "sortedtimerqueue.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include "logger.h"
+#include "timer.h"
+#include "timerid.h"
+#include "channel.h"
+#include "eventloop.h"
+
+using namespace leanet;
+
+SortedTimerQueue::SortedTimerQueue(EventLoop* loop)
+	: TimerQueue(loop),
+		timers_(),
+		callingExpiredTimers_(false)
+{ }
+
+SortedTimerQueue::~SortedTimerQueue() {
+	for (TimerList::iterator it = timers_.begin(); it != timers_.end(); ++it) {
+		delete it->second;
+	}
+}
+
+std::vector<SortedTimerQueue::Entry> SortedTimerQueue::getExpired(Timestamp now) {
+	Entry sentry = std::make_pair(now, reinterpret_cast<Timer*>(UINTPTR_MAX));
+	// first not less than the key.(that is: >=)
+	TimerList::iterator expireEnd = timers_.lower_bound(sentry);
+	assert(expireEnd == timers_.end() || now < expireEnd->first);
+
+	std::vector<Entry> expired;
+	std::vector<Timer*> restarted;
+	for (TimerList::iterator it = timers_.begin(); it != expireEnd; ++it) {
+		if (now < it->second->expiration()) {
+			restarted.push_back(it->second);
+		} else {
+			expired.push_back(*it);
+		}
+	}
+	timers_.erase(timers_.begin(), expireEnd);
+
+	for (std::vector<Entry>::iterator it = expired.begin();
+			 it != expired.end();
+			 ++it) {
+		ActiveTimer timer(it->second, it->second->sequence());
+		size_t n = activeTimers_.erase(timer);
+		assert(n == 1);
+		Unused(n);
+	}
+
+	// sorted again by the new expiration, only now they reach the head
+	for (std::vector<Timer*>::iterator it = restarted.begin();
+			 it != restarted.end();
+			 ++it) {
+		insert(*it);
+	}
+
+	return expired;
+}
+
+TimerId SortedTimerQueue::addTimer(const TimerCallback& cb, Timestamp when, double interval) {
+	Timer* timer = new Timer(cb, when, interval);
+	// the timer may have expired and been deleted once queued
+	TimerId timerid(timer, timer->sequence());
+	if (loop_->isInLoopThread()) {
+		addTimerInLoop(timer);
+	} else {
+		loop_->queueInLoop(std::bind(&SortedTimerQueue::addTimerInLoop, this, timer));
+	}
+	return timerid;
+}
+
+void SortedTimerQueue::cancelTimer(TimerId timerid) {
+	if (loop_->isInLoopThread()) {
+		cancelTimerInLoop(timerid);
+	} else {
+		loop_->queueInLoop(std::bind(&SortedTimerQueue::cancelTimerInLoop, this, timerid));
+	}
+}
+
+void SortedTimerQueue::restartTimer(TimerId timerid, Timestamp when) {
+	if (loop_->isInLoopThread()) {
+		restartTimerInLoop(timerid, when);
+	} else {
+		loop_->queueInLoop(std::bind(&SortedTimerQueue::restartTimerInLoop, this, timerid, when));
+	}
+}
+
+void SortedTimerQueue::addTimerInLoop(Timer* timer) {
+	loop_->assertInLoopThread();
+	bool earliestChanged = insert(timer);
+	if (earliestChanged) {
+		scheduleAlarm(timer->expiration());
+	}
+}
+
+void SortedTimerQueue::cancelTimerInLoop(TimerId timerid) {
+	loop_->assertInLoopThread();
+	ActiveTimer timer(timerid.timer_, timerid.sequence_);
+	ActiveTimerMap::iterator it = activeTimers_.find(timer);
+	if (it != activeTimers_.end()) {
+		size_t n = timers_.erase(Entry(it->second, timer.first));
+		assert(n == 1);
+		Unused(n);
+		delete timer.first;
+		activeTimers_.erase(it);
+	} else if (callingExpiredTimers_) {
+		// because we in handleExpired(), after all timers' callback are executed,
+		// then handleExpired() will call reset(), so we add canceled timers into
+		// cancelingTimers to exclude them in reset()
+		cancelingTimers_.insert(timer);
+	}
+}
+
+void SortedTimerQueue::restartTimerInLoop(TimerId timerid, Timestamp when) {
+	loop_->assertInLoopThread();
+	ActiveTimer timer(timerid.timer_, timerid.sequence_);
+	ActiveTimerMap::iterator it = activeTimers_.find(timer);
+	if (it == activeTimers_.end()) {
+		// expired or canceled
+		return;
+	}
+
+	timer.first->setExpiration(when);
+	if (when < it->second) {
+		// earlier, sorts it now
+		size_t n = timers_.erase(Entry(it->second, timer.first));
+		assert(n == 1);
+		Unused(n);
+		activeTimers_.erase(it);
+		if (insert(timer.first)) {
+			scheduleAlarm(when);
+		}
+	}
+	// later, sorts it lazily when the old expiration is reached,
+	// see getExpired()
+}
+
+void SortedTimerQueue::handleExpired(Timestamp now) {
+
+	const std::vector<Entry>& expired = getExpired(now);
+
+	callingExpiredTimers_ = true;
+	cancelingTimers_.clear();
+	for (std::vector<Entry>::const_iterator iter = expired.begin();
+			 iter != expired.end();
+			 ++iter) {
+		iter->second->run();
+	}
+	callingExpiredTimers_ = false;
+
+	reset(expired, now);
+}
+
+void SortedTimerQueue::reset(const std::vector<Entry>& expired, Timestamp now) {
+	for (std::vector<Entry>::const_iterator it = expired.begin();
+			 it != expired.end();
+			 ++it) {
+		ActiveTimer timer(it->second, it->second->sequence());
+		if (it->second->repeat() && cancelingTimers_.find(timer) == cancelingTimers_.end()) {
+			// add a interval
+			it->second->restart(now);
+			// insert again
+			insert(it->second);
+		} else {
+			delete it->second;
+		}
+	}
+
+	Timestamp nextExpire;
+	// find first timer expiration in timers_, may be restarted later
+	if (!timers_.empty()) {
+		nextExpire = timers_.begin()->first;
+	}
+
+	if (nextExpire.valid()) {
+		scheduleAlarm(nextExpire);
+	}
+}
+
+bool SortedTimerQueue::insert(Timer* timer) {
+	loop_->assertInLoopThread();
+	bool earliestChanged = false;
+	Timestamp when = timer->expiration();
+	TimerList::iterator it = timers_.begin();
+	// timers_ is empty or less than first timer...
+	if (it == timers_.end() || when < it->first) {
+		earliestChanged = true;
+	}
+	{
+	std::pair<TimerList::iterator, bool> result
+		= timers_.insert(Entry(when, timer));
+	Unused(result);
+	}
+	activeTimers_[ActiveTimer(timer, timer->sequence())] = when;
+
+	return earliestChanged;
+}
@@ -0,0 +1,63 @@
+#ifndef LEANET_SORTEDTIMERQUEUE_H
+#define LEANET_SORTEDTIMERQUEUE_H
+
+#include <utility>
+#include <vector>
+#include <set>
+#include <map>
+
+#include "timerqueue.h"
+
+namespace leanet {
+
+//
+// Timers sorted by expiration in a balanced tree, O(log n) add and cancel.
+//
+// The timerfd alarms at the earliest expiration exactly.
+// A timer restarted later keeps its place until it is reached, and is
+// sorted again by the new expiration then.
+//
+class SortedTimerQueue: public TimerQueue {
+public:
+	explicit SortedTimerQueue(EventLoop* loop);
+	virtual ~SortedTimerQueue();
+
+	virtual TimerId addTimer(const TimerCallback& cb, Timestamp when, double interval);
+	virtual void cancelTimer(TimerId timerid);
+	virtual void restartTimer(TimerId timerid, Timestamp when);
+
+protected:
+	virtual void handleExpired(Timestamp now);
+
+private:
+	// FIXME: use unique_ptr<Timer> instead of raw pointers.
+	typedef std::pair<Timestamp, Timer*> Entry;
+	typedef std::set<Entry> TimerList;
+	typedef std::pair<Timer*, int64_t> ActiveTimer;
+	typedef std::set<ActiveTimer> ActiveTimerSet;
+	// to its key in timers_, which is earlier than the expiration if
+	// the timer is restarted later
+	typedef std::map<ActiveTimer, Timestamp> ActiveTimerMap;
+
+	void addTimerInLoop(Timer* timer);
+	void cancelTimerInLoop(TimerId timerid);
+	void restartTimerInLoop(TimerId timerid, Timestamp when);
+
+	// move out all expired timers, sorts restarted ones again
+	std::vector<Entry> getExpired(Timestamp now);
+	// readd timers which have repeat_ property
+	void reset(const std::vector<Entry>& expired, Timestamp now);
+	bool insert(Timer* timer);
+
+	// Timer list sorted by expiration
+	TimerList timers_;
+
+	// for cancel()
+	ActiveTimerMap activeTimers_;
+	bool callingExpiredTimers_; // atomic
+	ActiveTimerSet cancelingTimers_;
+};
+
+}
+
+#endif
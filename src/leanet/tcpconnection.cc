@@ -7,43 +7,106 @@
 #include "socket.h"
 #include "sockets.h"
 #include "logger.h"
+#include "bufferbudget.h"
+#include "circularbuffer.h"
+#include "weakcallback.h"
 
 #include <errno.h>
 #include <assert.h>
+#include <sys/uio.h> // struct iovec
+#include <inttypes.h> // PRIu64
+#include <stdio.h> // snprintf
+#include <limits.h> // IOV_MAX
 
 using namespace leanet;
 
-// prototype from "types.h"
-void defaultConnectionCallback(const TcpConnectionPtr& conn) {
+// prototype from "callbacks.h"
+void leanet::defaultConnectionCallback(const TcpConnectionPtr& conn) {
 	LOG_TRACE << conn->localAddress().ipPort() << " -> "
 						<< conn->peerAddress().ipPort() << " is "
 						<< (conn->connected() ? "UP" : "DOWN");
 }
 
-// prototype from "types.h"
-void defaultMessageCallback(const TcpConnectionPtr&,
+// prototype from "callbacks.h"
+void leanet::defaultMessageCallback(const TcpConnectionPtr&,
 														Buffer* buffer,
 														Timestamp) {
 	// discard received message
 	buffer->retrieveAll();
 }
 
+namespace {
+
+// the channel is destroyed along with the functor bound to it
+void deleteChannel(const std::shared_ptr<Channel>&) { }
+
+// zero-copied output of a destroyed connection is waited for at most this
+// long, polled every kZeroCopyReapInterval seconds
+const double kZeroCopyLingerSeconds = 10.0;
+const double kZeroCopyReapInterval = 0.01;
+
+// reads stopped by the budget for input are checked again this often
+const double kBudgetRetryInterval = 0.1;
+
+}
+
+const size_t TcpConnection::kDefaultInputFloor;
+
 TcpConnection::TcpConnection(
 		EventLoop* loop,
 		int sockfd,
 		const std::string& name,
 		InetAddress localaddr,
 		InetAddress peeraddr)
+	: TcpConnection(loop, sockfd, 0, std::make_shared<const std::string>(name),
+									localaddr, peeraddr)
+{
+}
+
+TcpConnection::TcpConnection(
+		EventLoop* loop,
+		int sockfd,
+		uint64_t id,
+		const std::shared_ptr<const std::string>& prefix,
+		InetAddress localaddr,
+		InetAddress peeraddr)
 	: loop_(loop),
-		name_(name),
+		id_(id),
+		prefix_(prefix),
 		state_(kConnecting),
+		edgeTriggered_(false),
 		socket_(new Socket(sockfd)),
 		channel_(new Channel(loop, sockfd)),
 		localAddr_(localaddr),
 		peerAddr_(peeraddr),
-		highWaterMark_(64*1024*1024)
+		highWaterMark_(64*1024*1024),
+		inputBuffer_(0, loop->bufferPool()),
+		circularInput_(),
+		readSizer_(),
+		readSpill_(true),
+		outputBuffer_(loop->bufferPool()),
+		pendingSends_(),
+		flushQueued_(),
+		flushing_(false),
+		completions_(loop->supportsCompletions()),
+		readSubmitted_(false),
+		readSubmission_(0),
+		readsIdle_(false),
+		inputHeld_(false),
+		writeSubmitted_(false),
+		writeSubmission_(0),
+		writeIov_(),
+		bufferIdleTimeout_(0),
+		bufferIdleTimer_(),
+		bufferIdleTimerPending_(false),
+		budget_(),
+		budgetedBytes_(0),
+		inputFloor_(kDefaultInputFloor),
+		readPaused_(false),
+		budgetRetryPending_(false)
 {
-	socket_->bindAddress(localAddr_);
+	// accepted(or connected) socket is bound already, keep-alive is left to
+	// setKeepAlive()
 	// DON'T USE shared_from_this in constructor!
 	channel_->setReadCallback(std::bind(&TcpConnection::handleRead, this, std::placeholders::_1));
 	channel_->setWriteCallback(std::bind(&TcpConnection::handleWrite, this));
@@ -53,6 +116,29 @@ TcpConnection::TcpConnection(
 
 TcpConnection::~TcpConnection() {
 	assert(state_ == kDisconnected);
+	if (outputBuffer_.zeroCopyPending() > 0) {
+		// not waited for by connectDestroyed(), the loop is gone: releases the
+		// sends reported completed, and resets the connection for the rest so
+		// that the kernel sends nothing more from them
+		int savedErrno = 0;
+		outputBuffer_.handleZeroCopyCompletions(socket_->fd(), &savedErrno);
+		if (outputBuffer_.zeroCopyPending() > 0) {
+			LOG_WARN << "TcpConnection::~TcpConnection [" << name() << "] - reset with "
+							 << outputBuffer_.zeroCopyPending() << " zero copy sends in flight";
+			socket_->setAbortOnClose(true);
+		}
+	}
+	// before the output buffer, declared after it
+	socket_.reset();
+}
+
+std::string TcpConnection::name() const {
+	if (id_ == 0) {
+		return *prefix_;
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "#%" PRIu64, id_);
+	return *prefix_ + buf;
 }
 
 void TcpConnection::connectEstablished() {
@@ -60,82 +146,383 @@ void TcpConnection::connectEstablished() {
 	assert(state_ == kConnecting);
 	setState(kConnected);
 	// register in event loop
-	channel_->enableReading();
+	if (edgeTriggered_ && loop_->supportsEdgeTriggered()) {
+		channel_->setEdgeTriggered(true);
+		channel_->enableAll();
+	} else {
+		startReading();
+	}
 	connectionCallback_(shared_from_this());
 }
 
 void TcpConnection::connectDestroyed() {
 	loop_->assertInLoopThread();
-	assert(state_ == kConnected || state_ == kDisconnecting);
-	setState(kDisconnected);
-	channel_->disableAll();
-	connectionCallback_(shared_from_this());
+	// handleClose() has done this if the connection is closed by peer
+	if (state_ == kConnected || state_ == kDisconnecting) {
+		setState(kDisconnected);
+		channel_->disableAll();
+		connectionCallback_(shared_from_this());
+	}
 	loop_->removeChannel(channel_.get());
+	// the callbacks keep the connection until the submissions complete
+	if (readSubmitted_) {
+		loop_->cancelSubmission(readSubmission_);
+	}
+	if (writeSubmitted_) {
+		loop_->cancelSubmission(writeSubmission_);
+	}
+	if (pipeChannel_) {
+		removePipeChannel();
+	}
+	if (bufferIdleTimerPending_) {
+		loop_->cancel(bufferIdleTimer_);
+		bufferIdleTimerPending_ = false;
+	}
+	if (budget_) {
+		budget_->add(-static_cast<int64_t>(budgetedBytes_));
+		budgetedBytes_ = 0;
+	}
+	if (outputBuffer_.zeroCopyPending() > 0) {
+		// the kernel may still send from the zero-copied slices, the socket is
+		// kept open for the completions and the connection until they come
+		reapZeroCopy(addTime(Timestamp::now(), kZeroCopyLingerSeconds));
+	}
 }
 
 void TcpConnection::handleRead(Timestamp receiveTime) {
+	loop_->assertInLoopThread();
+	if (readPaused_ || readSubmitted_) {
+		// paused by the write callback of the same event
+		return;
+	}
+	const bool edgeTriggered = channel_->isEdgeTriggered();
 	int savedErrno = 0;
-	ssize_t n = inputBuffer_.readFd(channel_->fd(), &savedErrno);
-	if (n > 0) {
-		// actually, messageCallback_ is registered by TcpServer or TcpClient,
-		// so it is always not null??
-		messageCallback_(shared_from_this(), &inputBuffer_, receiveTime);
-	} else if (n == 0) {
+	ssize_t n = 0;
+	// level-triggered: one read per readable event.
+	// edge-triggered: no more event until we have read to EAGAIN.
+	do {
+		n = readInput(&savedErrno);
+		if (n > 0) {
+			deliverInput(receiveTime);
+		}
+	} while (edgeTriggered && n > 0 && state_ != kDisconnected && !readPaused_);
+
+	if (n < 0 && edgeTriggered && savedErrno == EAGAIN) {
+		n = 1;
+	}
+	if (n > 0 && readsIdle_) {
+		// not idle any more, reads are submitted again
+		readsIdle_ = false;
+		if (state_ != kDisconnected && !readPaused_ && submitsReads()) {
+			channel_->disableReading();
+			submitRead();
+		}
+	}
+	handleReadResult(n, savedErrno);
+}
+
+void TcpConnection::handleReadCompleted(int result) {
+	loop_->assertInLoopThread();
+	assert(readSubmitted_);
+	readSubmitted_ = false;
+	if (state_ == kDisconnected) {
+		return;
+	}
+	if (result == -ECANCELED) {
+		// paused, idle or zero copy turned on
+		if (readsIdle_) {
+			shrinkBuffers();
+			updateBudget();
+		}
+		startReading();
+		return;
+	}
+
+	readsIdle_ = false;
+	if (result > 0) {
+		const size_t bytes = static_cast<size_t>(result);
+		if (circularMessageCallback_) {
+			circularInput_->hasWritten(bytes);
+		} else {
+			inputBuffer_.hasWritten(bytes);
+		}
+		ReadStats* stats = loop_->readStats();
+		++stats->reads;
+		stats->bytesRead += result;
+		readSizer_.record(bytes);
+		if (readPaused_) {
+			// completed before the cancel was submitted, the application
+			// sees nothing new until reads resume as with readable events
+			inputHeld_ = true;
+		} else {
+			deliverInput(loop_->pollReturnedTime());
+		}
+	}
+	if (result != 0 && state_ != kDisconnected) {
+		// after an error too, the next read tells if the peer has gone
+		startReading();
+	}
+	handleReadResult(result, result < 0 ? -result : 0);
+}
+
+void TcpConnection::handleReadResult(ssize_t n, int savedErrno) {
+	if (state_ != kDisconnected) {
+		touchBuffers();
+		updateBudget();
+	}
+	if (n == 0) {
 		handleClose();
-	} else { // n < 0
+	} else if (n < 0) {
 		errno = savedErrno;
 		LOG_SYSERR << "TcpConnection::handleRead";
 		handleError();
 	}
 }
 
+void TcpConnection::deliverInput(Timestamp receiveTime) {
+	// actually, messageCallback_ is registered by TcpServer or TcpClient,
+	// so it is always not null??
+	if (circularMessageCallback_) {
+		circularMessageCallback_(shared_from_this(), circularInput_.get(), receiveTime);
+	} else {
+		messageCallback_(shared_from_this(), &inputBuffer_, receiveTime);
+	}
+}
+
+void TcpConnection::deliverHeldInput() {
+	loop_->assertInLoopThread();
+	if (inputHeld_ && !readPaused_ && state_ != kDisconnected) {
+		inputHeld_ = false;
+		deliverInput(loop_->pollReturnedTime());
+	}
+}
+
+bool TcpConnection::submitsReads() const {
+	// completions of zero copy sends come as errors of the socket, which
+	// only a poll is told
+	return completions_ && !readsIdle_ && !outputBuffer_.zeroCopyEnabled();
+}
+
+void TcpConnection::submitRead() {
+	assert(!readSubmitted_);
+	int iovcnt = 1;
+	if (circularMessageCallback_) {
+		if (!circularInput_) {
+			circularInput_.reset(new CircularBuffer(readSizer_.size()));
+		}
+		circularInput_->ensureWritableBytes(readSizer_.size());
+		iovcnt = circularInput_->peekWritable(readIov_);
+	} else {
+		inputBuffer_.ensureWritableBytes(readSizer_.size());
+		readIov_[0].iov_base = inputBuffer_.beginWrite();
+		readIov_[0].iov_len = inputBuffer_.writableBytes();
+	}
+	readSubmitted_ = true;
+	readSubmission_ = loop_->submitReadv(channel_->fd(), readIov_, iovcnt,
+			std::bind(&TcpConnection::handleReadCompleted, shared_from_this(), std::placeholders::_1));
+}
+
+void TcpConnection::startReading() {
+	if (readPaused_ || state_ == kDisconnected || readSubmitted_) {
+		// a read cancelled comes back to here
+		return;
+	}
+	if (submitsReads()) {
+		if (channel_->isReading()) {
+			channel_->disableReading();
+		}
+		submitRead();
+	} else if (!channel_->isReading()) {
+		channel_->enableReading();
+	}
+}
+
+void TcpConnection::stopReading() {
+	if (readSubmitted_) {
+		loop_->cancelSubmission(readSubmission_);
+	}
+	if (channel_->isReading()) {
+		channel_->disableReading();
+	}
+}
+
+ssize_t TcpConnection::readInput(int* savedErrno) {
+	char* spill = readSpill_ ? loop_->readSpillBuffer() : NULL;
+	const size_t spillSize = readSpill_ ? EventLoop::kReadSpillSize : 0;
+	size_t writableBefore = 0;
+	size_t writable = 0;
+	ssize_t n = 0;
+	if (circularMessageCallback_) {
+		if (!circularInput_) {
+			circularInput_.reset(new CircularBuffer(readSizer_.size()));
+		}
+		writableBefore = std::max(circularInput_->writableBytes(), static_cast<size_t>(CircularBuffer::kInitialSize));
+		circularInput_->ensureWritableBytes(readSizer_.size());
+		writable = circularInput_->writableBytes();
+		n = circularInput_->readFd(channel_->fd(), spill, spillSize, savedErrno);
+	} else {
+		// the buffer was never smaller than kInitialSize before
+		writableBefore = std::max(inputBuffer_.writableBytes(), static_cast<size_t>(Buffer::kInitialSize));
+		inputBuffer_.ensureWritableBytes(readSizer_.size());
+		writable = inputBuffer_.writableBytes();
+		n = inputBuffer_.readFd(channel_->fd(), spill, spillSize, savedErrno);
+	}
+
+	if (n > 0) {
+		const size_t bytes = static_cast<size_t>(n);
+		ReadStats* stats = loop_->readStats();
+		++stats->reads;
+		stats->bytesRead += n;
+		if (bytes > writable) {
+			++stats->spilledReads;
+			stats->spilledBytes += static_cast<int64_t>(bytes - writable);
+		} else if (bytes > writableBefore) {
+			++stats->copiesAvoided;
+			stats->bytesNotCopied += static_cast<int64_t>(bytes - writableBefore);
+		}
+		readSizer_.record(bytes);
+	}
+	return n;
+}
+
 void TcpConnection::handleWrite() {
 	loop_->assertInLoopThread();
-	if (channel_->isWriting()) {
-		ssize_t n = ::write(channel_->fd(), outputBuffer_.peek(), outputBuffer_.readableBytes());
-		if (n > 0) {
-			outputBuffer_.retrieve(n);
-			if (outputBuffer_.readableBytes() == 0) {
-				// no more data to be wrote, so we disable writing for disabling a
-				// busy loop
-				channel_->disableWriting();
-				if (writeCompleteCallback_) {
-					// drain all readable bytes...
-					loop_->queueInLoop(std::bind(writeCompleteCallback_, shared_from_this()));
-				}
-				if (state_ == kDisconnecting) {
-					shutdownInLoop();
+	if (writeSubmitted_) {
+		// the front of output is being written, see handleWritten()
+		return;
+	}
+	if (state_ != kDisconnected && isWriting()) {
+		const bool edgeTriggered = channel_->isEdgeTriggered();
+		// level-triggered: one write per writable event.
+		// edge-triggered: write until drained or EAGAIN.
+		do {
+			int savedErrno = 0;
+			// all queued segments in one system call
+			ssize_t n = outputBuffer_.writeFd(channel_->fd(), &savedErrno);
+			if (n <= 0) {
+				if (n < 0 && savedErrno != EAGAIN) {
+					errno = savedErrno;
+					LOG_SYSERR << "TcpConnection::handleWrite";
 				}
-			} else {
-				// need to write again
+				break;
 			}
+		} while (edgeTriggered && outputBuffer_.readableBytes() > 0);
+
+		touchBuffers();
+		updateBudget();
+		if (outputBuffer_.readableBytes() == 0) {
+			handleOutputDrained();
+		} else if (outputBuffer_.waitingPipe() >= 0) {
+			waitForPipe(outputBuffer_.waitingPipe());
 		} else {
-			LOG_SYSERR << "TcpConnection::handleWrite";
+			// need to write again
 		}
 	} else {
 		LOG_TRACE << "Connection is down, no more writing";
 	}
 }
 
+void TcpConnection::handleWritten(int result) {
+	loop_->assertInLoopThread();
+	assert(writeSubmitted_);
+	writeSubmitted_ = false;
+	if (state_ == kDisconnected) {
+		LOG_TRACE << "Connection is down, no more writing";
+		return;
+	}
+	if (result < 0) {
+		// the reading side sees the connection closed
+		errno = -result;
+		LOG_SYSERR << "TcpConnection::handleWritten";
+		return;
+	}
+
+	outputBuffer_.retrieve(static_cast<size_t>(result));
+	touchBuffers();
+	if (outputBuffer_.readableBytes() == 0) {
+		updateBudget();
+		handleOutputDrained();
+	} else {
+		startWriting();
+	}
+}
+
+void TcpConnection::handleOutputDrained() {
+	// no more data to be wrote, so we disable writing for disabling a
+	// busy loop(edge-triggered channel will not be notified again).
+	// written at once by startWriting(), it was never enabled
+	if (!channel_->isEdgeTriggered() && channel_->isWriting()) {
+		channel_->disableWriting();
+	}
+	if (readPaused_ && !budgetStopsReads()) {
+		resumeReading();
+	}
+	if (writeCompleteCallback_) {
+		// drain all readable bytes...
+		loop_->queueInLoop(std::bind(writeCompleteCallback_, shared_from_this()));
+	}
+	if (state_ == kDisconnecting && !flushing_) {
+		shutdownInLoop();
+	}
+}
+
+void TcpConnection::reapZeroCopy(Timestamp deadline) {
+	loop_->assertInLoopThread();
+	int savedErrno = 0;
+	if (outputBuffer_.handleZeroCopyCompletions(socket_->fd(), &savedErrno) < 0) {
+		errno = savedErrno;
+		LOG_SYSERR << "TcpConnection::reapZeroCopy [" << name() << "] - MSG_ERRQUEUE";
+	} else if (outputBuffer_.zeroCopyPending() > 0 && Timestamp::now() < deadline) {
+		loop_->runAfter(kZeroCopyReapInterval,
+				std::bind(&TcpConnection::reapZeroCopy, shared_from_this(), deadline));
+		return;
+	}
+	if (outputBuffer_.zeroCopyPending() > 0) {
+		LOG_WARN << "TcpConnection::reapZeroCopy [" << name() << "] - reset with "
+						 << outputBuffer_.zeroCopyPending() << " zero copy sends in flight";
+		// nothing more is sent from the slices, released by the destructor
+		socket_->setAbortOnClose(true);
+	}
+}
+
 void TcpConnection::handleClose() {
 	loop_->assertInLoopThread();
 	LOG_TRACE << "TcpConnection::handleClose() state= " << state_;
 	assert(state_ == kConnected || state_ == kDisconnecting);
 	setState(kDisconnected);
 	channel_->disableAll();
+	if (pipeChannel_ && !pipeChannel_->isNoneEvent()) {
+		pipeChannel_->disableAll();
+	}
+
+	TcpConnectionPtr guardThis(shared_from_this());
+	connectionCallback_(guardThis);
 	if (closeCallback_) {
-		closeCallback_(shared_from_this());
+		closeCallback_(guardThis);
 	}
 }
 
 void TcpConnection::handleError() {
+	// completions of MSG_ZEROCOPY sends are queued as errors
+	int completions = 0;
+	if (outputBuffer_.zeroCopySends() > 0) {
+		int savedErrno = 0;
+		completions = outputBuffer_.handleZeroCopyCompletions(channel_->fd(), &savedErrno);
+		if (completions < 0) {
+			errno = savedErrno;
+			LOG_SYSERR << "TcpConnection::handleError [" << name() << "] - MSG_ERRQUEUE";
+		}
+	}
 	//
 	// getsockopt(2) will clear pending error on socket.
 	// if peer endpoint send RST, call handleError first and then call
 	// handleRead in Channel::handleEvent, read(2) will return 0 at that time.
 	//
 	int err = sockets::getSocketError(channel_->fd());
-	LOG_ERROR << "TcpConnection::handleError [" << name_ << "] - SO_ERROR= " << err << " " << strerror_tl(err);
+	if (err == 0 && completions > 0) {
+		return;
+	}
+	LOG_ERROR << "TcpConnection::handleError [" << name() << "] - SO_ERROR= " << err << " " << strerror_tl(err);
 }
 
 void TcpConnection::send(const void* message, size_t len) {
@@ -143,8 +530,8 @@ void TcpConnection::send(const void* message, size_t len) {
 		if (loop_->isInLoopThread()) {
 			sendInLoop(message, len);
 		} else {
-			loop_->runInLoop(
-					std::bind(&TcpConnection::sendInLoop, this, message, len));
+			// the caller's memory may be gone when the loop runs
+			send(std::string(static_cast<const char*>(message), len));
 		}
 	}
 }
@@ -153,16 +540,179 @@ void TcpConnection::send(const std::string& message) {
 	send(message.data(), message.size());
 }
 
+void TcpConnection::send(std::string&& message) {
+	if (state_ == kConnected) {
+		if (loop_->isInLoopThread()) {
+			const bool zeroCopy = outputBuffer_.isZeroCopy(message.size());
+			size_t remaining = writeInLoop(message.data(), message.size(), zeroCopy);
+			if (remaining > 0) {
+				std::shared_ptr<const std::string> owner(std::make_shared<std::string>(std::move(message)));
+				outputBuffer_.appendSlice(owner->data() + owner->size() - remaining, remaining, owner);
+				startWriting(zeroCopy && outputBuffer_.readableBytes() == remaining);
+			}
+		} else {
+			PendingSend item;
+			item.message.swap(message);
+			queueSend(std::move(item));
+		}
+	}
+}
+
+void TcpConnection::send(const std::shared_ptr<const Buffer>& message) {
+	if (state_ == kConnected) {
+		if (loop_->isInLoopThread()) {
+			sendBufferInLoop(message);
+		} else {
+			PendingSend item;
+			item.owner = message;
+			item.data = message->peek();
+			item.len = message->readableBytes();
+			queueSend(std::move(item));
+		}
+	}
+}
+
+void TcpConnection::send(const void* data, size_t len, const ReleaseCallback& release) {
+	if (state_ == kConnected) {
+		if (loop_->isInLoopThread()) {
+			sendInLoop(data, len, release);
+		} else {
+			void (TcpConnection::*fp)(const void*, size_t, const ReleaseCallback&) = &TcpConnection::sendInLoop;
+			PendingSend item;
+			item.task = std::bind(fp, this, data, len, release);
+			queueSend(std::move(item));
+		}
+	} else if (release) {
+		release();
+	}
+}
+
+void TcpConnection::sendFile(int fd, off_t offset, size_t len, const ReleaseCallback& release) {
+	if (state_ == kConnected) {
+		if (loop_->isInLoopThread()) {
+			sendFileInLoop(fd, offset, len, release);
+		} else {
+			PendingSend item;
+			item.task = std::bind(&TcpConnection::sendFileInLoop, this, fd, offset, len, release);
+			queueSend(std::move(item));
+		}
+	} else if (release) {
+		release();
+	}
+}
+
+void TcpConnection::send(CircularBuffer* buf) {
+	if (state_ == kConnected) {
+		if (loop_->isInLoopThread()) {
+			sendCircularInLoop(buf);
+		} else {
+			send(buf->retrieveAllAsString());
+		}
+	}
+}
+
+void TcpConnection::sendBufferInLoop(const std::shared_ptr<const Buffer>& message) {
+	sendInLoop(message->peek(), message->readableBytes(), message);
+}
+
+void TcpConnection::sendCircularInLoop(CircularBuffer* buf) {
+	loop_->assertInLoopThread();
+	if (state_ == kDisconnected) {
+		LOG_WARN << "TcpConnection::sendCircularInLoop [" << name() << "] - disconnected, give up writing";
+		return;
+	}
+
+	// iff no thing in output queue, try writing both segments directly
+	if (!completions_ && !isWriting()) {
+		int savedErrno = 0;
+		ssize_t n = buf->writeFd(channel_->fd(), &savedErrno);
+		if (n < 0 && savedErrno != EWOULDBLOCK) {
+			errno = savedErrno;
+			LOG_SYSERR << "TcpConnection::sendCircularInLoop";
+			if (savedErrno == EPIPE || savedErrno == ECONNRESET) {
+				buf->retrieveAll();
+				return;
+			}
+		}
+		if (buf->readableBytes() == 0) {
+			if (n > 0 && writeCompleteCallback_) {
+				loop_->queueInLoop(std::bind(
+							writeCompleteCallback_, shared_from_this()));
+			}
+			return;
+		}
+	}
+
+	checkHighWaterMark(buf->readableBytes());
+	struct iovec iov[2];
+	const int iovcnt = buf->peek(iov);
+	for (int i = 0; i < iovcnt; ++i) {
+		outputBuffer_.append(iov[i].iov_base, iov[i].iov_len);
+	}
+	buf->retrieveAll();
+	startWriting();
+}
+
 void TcpConnection::sendInLoop(const void* data, size_t len) {
+	size_t remaining = writeInLoop(data, len);
+	if (remaining > 0) {
+		outputBuffer_.append(static_cast<const char*>(data) + len - remaining, remaining);
+		startWriting();
+	}
+}
+
+void TcpConnection::sendInLoop(const void* data, size_t len, const std::shared_ptr<const void>& owner) {
+	const bool zeroCopy = outputBuffer_.isZeroCopy(len);
+	size_t remaining = writeInLoop(data, len, zeroCopy);
+	if (remaining > 0) {
+		outputBuffer_.appendSlice(static_cast<const char*>(data) + len - remaining, remaining, owner);
+		startWriting(zeroCopy && outputBuffer_.readableBytes() == remaining);
+	}
+}
+
+void TcpConnection::sendInLoop(const void* data, size_t len, const ReleaseCallback& release) {
+	const bool zeroCopy = outputBuffer_.isZeroCopy(len);
+	size_t remaining = writeInLoop(data, len, zeroCopy);
+	if (remaining > 0) {
+		outputBuffer_.appendSlice(static_cast<const char*>(data) + len - remaining, remaining, release);
+		startWriting(zeroCopy && outputBuffer_.readableBytes() == remaining);
+	} else if (release) {
+		release();
+	}
+}
+
+void TcpConnection::sendFileInLoop(int fd, off_t offset, size_t len, const ReleaseCallback& release) {
+	loop_->assertInLoopThread();
+	if (state_ == kDisconnected) {
+		LOG_WARN << "TcpConnection::sendFileInLoop [" << name() << "] - disconnected, give up writing";
+		if (release) {
+			release();
+		}
+		return;
+	}
+
+	const bool idle = outputBuffer_.empty();
+	checkHighWaterMark(len);
+	outputBuffer_.appendFile(fd, offset, len, release);
+	startWriting(idle);
+}
+
+size_t TcpConnection::writeInLoop(const void* data, size_t len, bool zeroCopy) {
 	loop_->assertInLoopThread();
+	if (state_ == kDisconnected) {
+		LOG_WARN << "TcpConnection::writeInLoop [" << name() << "] - disconnected, give up writing";
+		return 0;
+	}
 
 	ssize_t nwrote = 0;
 	size_t remaining = len;
 	bool faultError = false;
 
 	// iff no thing in output queue, try writing directly
-	if (!channel_->isWriting() && outputBuffer_.readableBytes() == 0) {
-		nwrote = ::write(channel_->fd(), data, len);
+	// (zero copy data is queued to be written with MSG_ZEROCOPY, and with
+	// completions_ all is queued to be written by the poller)
+	if (!zeroCopy && !completions_ && !isWriting() && outputBuffer_.empty()) {
+		nwrote = sockets::write(channel_->fd(), data, len);
 		if (nwrote >= 0) {
 			remaining = len - nwrote;
 			if (remaining == 0 && writeCompleteCallback_) {
@@ -171,8 +721,8 @@ void TcpConnection::sendInLoop(const void* data, size_t len) {
 			}
 		} else {
 			nwrote = 0;
-			if (errno == EWOULDBLOCK) {
-				LOG_SYSERR << "TcpConnection::sendInLoop";
+			if (errno != EWOULDBLOCK) {
+				LOG_SYSERR << "TcpConnection::writeInLoop";
 				if (errno == EPIPE || errno == ECONNRESET) {
 					faultError = true;
 				}
@@ -180,44 +730,319 @@ void TcpConnection::sendInLoop(const void* data, size_t len) {
 		}
 	}
 
-	// else we append data to output queue
+	// else the caller appends data to output queue
 	assert(remaining <= len);
-	if (!faultError && remaining > 0) {
-		size_t oldLen = outputBuffer_.readableBytes();
-		if (oldLen + remaining >= highWaterMark_
-				&& oldLen < highWaterMark_
-				&& highWaterMark_) {
-			loop_->queueInLoop(std::bind(
-						highWaterMarkCallback_, shared_from_this(), oldLen + remaining));
-		}
-		outputBuffer_.append(static_cast<const char*>(data) + nwrote, remaining);
-		if (!channel_->isWriting()) {
-			// iff we have written partial data, we interested on writable event
-			channel_->enableWriting();
+	if (faultError) {
+		return 0;
+	}
+	if (remaining > 0) {
+		checkHighWaterMark(remaining);
+	}
+	return remaining;
+}
+
+void TcpConnection::checkHighWaterMark(size_t queuing) {
+	size_t oldLen = outputBuffer_.readableBytes();
+	if (oldLen + queuing >= highWaterMark_
+			&& oldLen < highWaterMark_
+			&& highWaterMarkCallback_) {
+		loop_->queueInLoop(std::bind(
+					highWaterMarkCallback_, shared_from_this(), oldLen + queuing));
+	}
+}
+
+void TcpConnection::startWriting(bool writeNow) {
+	if (writeSubmitted_ || submitWrite()) {
+		// the rest is written after it completes
+		updateBudget();
+		return;
+	}
+	if (writeNow) {
+		// the output has not been tried to write directly, edge-triggered
+		// channel may not be notified since the socket has been writable
+		handleWrite();
+	} else {
+		updateBudget();
+	}
+	// iff we have written partial data, we interested on writable event
+	// (edge-triggered channel has been interested since established), so
+	// what is written at once costs no epoll_ctl(2). not while the write
+	// just tried waits for a pipe.
+	if (!channel_->isWriting() && state_ != kDisconnected && isWriting()
+			&& !(writeNow && outputBuffer_.waitingPipe() >= 0)) {
+		channel_->enableWriting();
+	}
+}
+
+bool TcpConnection::submitWrite() {
+	if (!completions_ || state_ == kDisconnected || outputBuffer_.zeroCopyEnabled()) {
+		return false;
+	}
+	// memory at the front of output, files and pipes are written on
+	// readiness by handleWrite()
+	struct iovec iov[IOV_MAX];
+	const int iovcnt = outputBuffer_.peek(iov, IOV_MAX);
+	if (iovcnt == 0) {
+		return false;
+	}
+	// kept with the output until completed, the callback keeps them alive
+	writeIov_.assign(iov, iov + iovcnt);
+	writeSubmitted_ = true;
+	writeSubmission_ = loop_->submitWritev(channel_->fd(), &*writeIov_.begin(), iovcnt,
+			std::bind(&TcpConnection::handleWritten, shared_from_this(), std::placeholders::_1));
+	return true;
+}
+
+void TcpConnection::queueSend(PendingSend&& item) {
+	pendingSends_.push(std::move(item));
+	// the flush queued takes this one unless it has started, then the
+	// first one after it queues another. so N sends between two
+	// iterations of the loop cost one functor and one writev(2).
+	if (flushQueued_.getAndSet(1) == 0) {
+		loop_->queueInLoop(std::bind(&TcpConnection::flushPendingSends, shared_from_this()));
+	}
+}
+
+void TcpConnection::flushPendingSends() {
+	loop_->assertInLoopThread();
+	flushQueued_.getAndSet(0);
+	flushing_ = true;
+	bool appended = false;
+	PendingSend item;
+	while (pendingSends_.popWait(&item)) {
+		if (item.task) {
+			// in order with the messages before
+			if (appended) {
+				startWriting(true);
+				appended = false;
+			}
+			item.task();
+		} else if (state_ != kDisconnected) {
+			if (item.owner) {
+				checkHighWaterMark(item.len);
+				outputBuffer_.appendSlice(item.data, item.len, item.owner);
+			} else {
+				const size_t len = item.message.size();
+				checkHighWaterMark(len);
+				if (len < BufferChain::kMinSliceSize) {
+					outputBuffer_.append(item.message.data(), len);
+				} else {
+					std::shared_ptr<const std::string> owner(std::make_shared<std::string>(std::move(item.message)));
+					outputBuffer_.appendSlice(owner->data(), len, owner);
+				}
+			}
+			appended = true;
 		}
 	}
+	if (appended) {
+		startWriting(true);
+	}
+	flushing_ = false;
+}
+
+void TcpConnection::waitForPipe(int pipefd) {
+	if (!channel_->isEdgeTriggered()) {
+		// the socket is writable, or it would be a busy loop
+		channel_->disableWriting();
+	}
+	if (pipeChannel_ && pipeChannel_->fd() != pipefd) {
+		removePipeChannel();
+	}
+	if (!pipeChannel_) {
+		pipeChannel_.reset(new Channel(loop_, pipefd));
+		// POLLHUP without POLLIN if the writer has closed
+		pipeChannel_->setReadCallback(std::bind(&TcpConnection::handlePipeReadable, this, pipefd));
+		pipeChannel_->setCloseCallback(std::bind(&TcpConnection::handlePipeReadable, this, pipefd));
+	}
+	pipeChannel_->enableReading();
+}
+
+void TcpConnection::handlePipeReadable(int pipefd) {
+	loop_->assertInLoopThread();
+	if (!pipeChannel_ || pipeChannel_->fd() != pipefd) {
+		// removed in the current iteration
+		return;
+	}
+	if (!pipeChannel_->isNoneEvent()) {
+		pipeChannel_->disableAll();
+	}
+	if (state_ == kDisconnected) {
+		return;
+	}
+	if (channel_->isEdgeTriggered()) {
+		// no writable edge would come
+		loop_->queueInLoop(std::bind(&TcpConnection::handleWrite, shared_from_this()));
+	} else {
+		startWriting();
+	}
+}
+
+void TcpConnection::removePipeChannel() {
+	if (!pipeChannel_->isNoneEvent()) {
+		pipeChannel_->disableAll();
+	}
+	pipeChannel_->remove();
+	// it may be in the active channels of the current iteration
+	std::shared_ptr<Channel> channel(pipeChannel_.release());
+	loop_->queueInLoop(std::bind(deleteChannel, channel));
 }
 
 void TcpConnection::shutdown() {
 	if (state_ == kConnected) {
 		setState(kDisconnecting);
-		loop_->runInLoop(std::bind(&TcpConnection::shutdownInLoop, this));
+		if (loop_->isInLoopThread()) {
+			shutdownInLoop();
+		} else {
+			// after the messages sent before
+			PendingSend item;
+			item.task = std::bind(&TcpConnection::shutdownInLoop, this);
+			queueSend(std::move(item));
+		}
 	}
 }
 
 void TcpConnection::shutdownInLoop() {
 	loop_->assertInLoopThread();
-	if (!channel_->isWriting()) {
+	if (!isWriting()) {
 		// not writing or ignoring...
 		// ::shutdown(sockfd, SHUT_WR)
 		socket_->shutdownWrite();
 	}
 }
 
+bool TcpConnection::isWriting() const {
+	return !outputBuffer_.empty();
+}
+
+size_t TcpConnection::bufferedBytes() const {
+	return inputBuffer_.internalCapacity()
+			+ (circularInput_ ? circularInput_->internalSize() : 0)
+			+ outputBuffer_.readableBytes();
+}
+
+void TcpConnection::setBufferIdleTimeout(double seconds) {
+	bufferIdleTimeout_ = seconds;
+	if (bufferIdleTimerPending_) {
+		loop_->cancel(bufferIdleTimer_);
+		bufferIdleTimerPending_ = false;
+	}
+	if (state_ == kConnected) {
+		touchBuffers();
+	}
+}
+
+void TcpConnection::touchBuffers() {
+	if (bufferIdleTimeout_ <= 0) {
+		return;
+	}
+	if (bufferIdleTimerPending_) {
+		loop_->restartTimer(bufferIdleTimer_, bufferIdleTimeout_);
+	} else {
+		// the timer doesn't keep the connection alive
+		bufferIdleTimer_ = loop_->runAfter(bufferIdleTimeout_,
+				makeWeakCallback(shared_from_this(), &TcpConnection::handleBuffersIdle));
+		bufferIdleTimerPending_ = true;
+	}
+}
+
+void TcpConnection::handleBuffersIdle() {
+	loop_->assertInLoopThread();
+	bufferIdleTimerPending_ = false;
+	if (state_ == kDisconnected) {
+		return;
+	}
+	if (readSubmitted_) {
+		// the input buffer is being read into, shrunk once the read is
+		// cancelled, see handleReadCompleted()
+		readsIdle_ = true;
+		loop_->cancelSubmission(readSubmission_);
+		return;
+	}
+	shrinkBuffers();
+	updateBudget();
+}
+
+void TcpConnection::shrinkBuffers() {
+	readSizer_ = ReadSizer();
+	// a block from the pool is less than twice of what it is for
+	if (inputBuffer_.internalCapacity() > 2 * (inputBuffer_.readableBytes() + Buffer::kCheapPrepend)) {
+		inputBuffer_.shrink(0);
+	}
+	if (circularInput_ && circularInput_->readableBytes() == 0) {
+		circularInput_.reset();
+	}
+}
+
+void TcpConnection::updateBudget() {
+	if (!budget_) {
+		return;
+	}
+	const size_t bytes = bufferedBytes();
+	if (bytes != budgetedBytes_) {
+		budget_->add(static_cast<int64_t>(bytes) - static_cast<int64_t>(budgetedBytes_));
+		budgetedBytes_ = bytes;
+	}
+	if (!readPaused_ && (channel_->isReading() || readSubmitted_) && budgetStopsReads()) {
+		LOG_TRACE << "TcpConnection::updateBudget [" << name() << "] - " << budget_->bytes()
+							<< " bytes buffered, stop reading";
+		readPaused_ = true;
+		stopReading();
+	}
+	if (readPaused_ && outputBuffer_.empty() && !budgetRetryPending_ && state_ != kDisconnected) {
+		// stopped for input, no write is coming to resume reads
+		budgetRetryPending_ = true;
+		loop_->runAfter(kBudgetRetryInterval,
+				makeWeakCallback(shared_from_this(), &TcpConnection::handleBudgetRetry));
+	}
+}
+
+bool TcpConnection::budgetStopsReads() const {
+	if (!budget_ || state_ == kDisconnected || !budget_->exceeded()) {
+		return false;
+	}
+	size_t input = inputBuffer_.readableBytes();
+	if (circularInput_) {
+		input = circularInput_->readableBytes();
+	}
+	return !outputBuffer_.empty() || input > inputFloor_;
+}
+
+void TcpConnection::handleBudgetRetry() {
+	loop_->assertInLoopThread();
+	budgetRetryPending_ = false;
+	// output queued again resumes reads once written
+	if (readPaused_ && outputBuffer_.empty() && !budgetStopsReads()) {
+		resumeReading();
+	}
+	updateBudget();
+}
+
+void TcpConnection::resumeReading() {
+	readPaused_ = false;
+	if (inputHeld_) {
+		// not in the middle of a send() from the message callback
+		loop_->queueInLoop(std::bind(&TcpConnection::deliverHeldInput, shared_from_this()));
+	}
+	startReading();
+}
+
 void TcpConnection::setTcpNoDelay(bool on) {
 	socket_->setTcpNoDelay(on);
 }
 
+bool TcpConnection::setZeroCopy(bool on, size_t threshold) {
+	if (on && !socket_->setZeroCopy(true)) {
+		return false;
+	}
+	// SO_ZEROCOPY is kept for completions of the sends made
+	outputBuffer_.setZeroCopyThreshold(on ? threshold : 0);
+	if (on && readSubmitted_) {
+		// read on readable events once cancelled
+		loop_->cancelSubmission(readSubmission_);
+	}
+	return true;
+}
+
 void TcpConnection::setKeepAlive(bool on) {
 	socket_->setKeepAlive(on);
 }
@@ -5,8 +5,18 @@
 #include "callbacks.h"
 #include "inetaddress.h"
 #include "buffer.h"
+#include "bufferchain.h"
+#include "readsizer.h"
+#include "timerid.h"
+#include "mpscqueue.h"
+#include "atomic.h"
+
+#include <sys/types.h> // off_t
+#include <sys/uio.h> // struct iovec
+#include <stdint.h>
 
 #include <string>
+#include <vector>
 #include <memory> // std::unique_ptr, std::enable_shared_from_this
 
 namespace leanet {
@@ -14,6 +24,8 @@ namespace leanet {
 class EventLoop;
 class Socket;
 class Channel;
+class BufferBudget;
+class CircularBuffer;
 
 class TcpConnection
 	: noncopyable,
@@ -26,6 +38,15 @@ public:
 			const std::string& name,
 			InetAddress localaddr,
 			InetAddress peeraddr);
+	// named "prefix#id", formatted only when name() is called. prefix is
+	// shared by the connections of a server or client, id must be nonzero.
+	TcpConnection(
+			EventLoop* loop,
+			int sockfd,
+			uint64_t id,
+			const std::shared_ptr<const std::string>& prefix,
+			InetAddress localaddr,
+			InetAddress peeraddr);
 	~TcpConnection();
 
 	void connectEstablished();
@@ -35,6 +56,11 @@ public:
 	{ connectionCallback_ = cb; }
 	void setMessageCallback(const MessageCallback& cb)
 	{ messageCallback_ = cb; }
+	// input is read into a CircularBuffer and passed to cb instead of the
+	// message callback, see CircularBuffer.
+	// call it before connectEstablished().
+	void setCircularMessageCallback(const CircularMessageCallback& cb)
+	{ circularMessageCallback_ = cb; }
 	void setWriteCompleteCallback(const WriteCompleteCallback& cb)
 	{ writeCompleteCallback_ = cb; }
 	void setHighWaterMarkCallback(const HighWaterMarkCallback& cb, size_t highWaterMark)
@@ -43,8 +69,11 @@ public:
 	void setCloseCallback(const CloseCallback& cb)
 	{ closeCallback_ = cb; }
 
-	std::string name() const
-	{ return name_; }
+	// formatted on every call, for logging
+	std::string name() const;
+	// 0 if the connection is constructed with a name
+	uint64_t id() const
+	{ return id_; }
 	EventLoop* getLoop() const
 	{ return loop_; }
 	InetAddress localAddress() const
@@ -55,33 +84,189 @@ public:
 	{ return state_ == kConnected; }
 	bool disconnected() const
 	{ return state_ == kDisconnected; }
+	Buffer* inputBuffer()
+	{ return &inputBuffer_; }
+	// capacity of the input buffer and bytes queued for output
+	size_t bufferedBytes() const;
 
+	// thread safe, copies the data
 	void send(const void* data, size_t len);
 	void send(const std::string& message);
+	// thread safe, takes over the message without copying
+	void send(std::string&& message);
+	// thread safe, refers to the message without copying until it has been
+	// written, so one message can be broadcast to many connections.
+	// the message must not be modified.
+	void send(const std::shared_ptr<const Buffer>& message);
+	// thread safe, retrieves all of buf, written out of its segments with
+	// writev(2) in the loop thread, copied in other threads.
+	void send(CircularBuffer* buf);
+	// thread safe, refers to the data without copying, the data must be
+	// valid until release is called in the loop thread(or at once in the
+	// calling thread if the connection is not connected).
+	void send(const void* data, size_t len, const ReleaseCallback& release);
+	// thread safe, sends len bytes of a file from offset by sendfile(2), or
+	// len bytes read from a pipe(offset is ignored) by splice(2), after what
+	// has been sent. fd must be open until release is called in the loop
+	// thread(or at once if the connection is not connected).
+	// queued bytes count towards the high water mark.
+	void sendFile(int fd, off_t offset, size_t len,
+								const ReleaseCallback& release = ReleaseCallback());
 	// shutdown(SHUT_WR)
 	void shutdown();
 
 	void setTcpNoDelay(bool on);
 	void setKeepAlive(bool on);
+	// data referred to without copying(all but send(data, len) and
+	// send(const std::string&)) of at least threshold bytes is written with
+	// MSG_ZEROCOPY, and released after the kernel reports the send completed
+	// instead of written. smaller data is written as usual.
+	// after connectDestroyed(), the socket is kept open until the sends in
+	// flight complete, at most 10 seconds, then the connection is reset so
+	// that nothing more is sent from the data before it is released.
+	// false if the socket does not support SO_ZEROCOPY. the completions come
+	// as errors of the socket, so reads wait for readable events instead of
+	// being submitted to a poller supporting completions.
+	// call it in the loop thread, or before connectEstablished().
+	bool setZeroCopy(bool on, size_t threshold = 64 * 1024);
+	// reads take what the input buffer can't into the spill buffer shared
+	// in the loop(default), or leave it to the next read.
+	void setReadSpill(bool on)
+	{ readSpill_ = on; }
+	// after no reads or writes for seconds, the input buffer is shrunk to
+	// what it holds(a drained one goes back to the pool of the loop, a
+	// drained circular one is freed) and the read guess starts over, so a
+	// burst doesn't leave an idle connection large.
+	// 0 to disable(default). call it in the loop thread, or before
+	// connectEstablished().
+	void setBufferIdleTimeout(double seconds);
+	static const size_t kDefaultInputFloor = 64 * 1024;
+	// counts bufferedBytes() into budget, which is shared by connections,
+	// and stops reading while it is exceeded and output is queued, until
+	// the output is written, or more than inputFloor bytes of input are
+	// left by the message callback, until the budget is not exceeded or the
+	// input is taken(checked every 100ms). the message callback must be
+	// able to take a message out of inputFloor bytes.
+	// call it before connectEstablished().
+	void setBufferBudget(const std::shared_ptr<BufferBudget>& budget,
+											 size_t inputFloor = kDefaultInputFloor)
+	{ budget_ = budget; inputFloor_ = inputFloor; }
+
+	// edge-triggered mode: reads and writes drain the socket until EAGAIN
+	// and writable interest is registered only once.
+	// call it before connectEstablished(), ignored if the poller of loop
+	// does not support edge-triggered notification.
+	void setEdgeTriggered(bool on)
+	{ edgeTriggered_ = on; }
 
 private:
 	enum State { kConnecting, kConnected, kDisconnecting, kDisconnected };
 	void setState(State s) { state_ = s; }
 
 	void handleRead(Timestamp receiveTime);
+	// a readv(2) submitted by submitRead() completed
+	void handleReadCompleted(int result);
+	// after reads, n and savedErrno of the last one
+	void handleReadResult(ssize_t n, int savedErrno);
+	// reads into the input buffer grown for the guess of readSizer_
+	ssize_t readInput(int* savedErrno);
+	// passes the input to the message callback
+	void deliverInput(Timestamp receiveTime);
+	// the input held while paused
+	void deliverHeldInput();
+	// whether reads are submitted to the poller instead of waiting for
+	// readable events, see submitRead()
+	bool submitsReads() const;
+	// submits a read into the input buffer grown for the guess of
+	// readSizer_, the buffer is not touched until it completes
+	void submitRead();
+	// reads on, submitted or on readable events, unless paused
+	void startReading();
+	// stops reads for backpressure
+	void stopReading();
 	void handleWrite();
+	// a writev(2) submitted by submitWrite() completed
+	void handleWritten(int result);
+	// after all output is written
+	void handleOutputDrained();
 	void handleClose();
 	void handleError();
+	// after connectDestroyed(), reads the completions of zero copy sends
+	// again and again until none is in flight or deadline
+	void reapZeroCopy(Timestamp deadline);
 
+	// copies what can't be written at once
 	void sendInLoop(const void* data, size_t len);
+	// refers to what can't be written at once
+	void sendInLoop(const void* data, size_t len, const std::shared_ptr<const void>& owner);
+	void sendInLoop(const void* data, size_t len, const ReleaseCallback& release);
+	void sendBufferInLoop(const std::shared_ptr<const Buffer>& message);
+	void sendCircularInLoop(CircularBuffer* buf);
+	void sendFileInLoop(int fd, off_t offset, size_t len, const ReleaseCallback& release);
+	// writes directly if nothing is queued and not zero copy, returns bytes
+	// left to be queued, 0 on error.
+	size_t writeInLoop(const void* data, size_t len, bool zeroCopy = false);
+	void checkHighWaterMark(size_t queuing);
+	// writeNow if the output just queued has not been tried to write
+	void startWriting(bool writeNow = false);
+	// submits the memory at the front of output to be written by the
+	// poller, false if not supported or none
+	bool submitWrite();
+
+	// output from other threads, queued in order and taken in the loop
+	// thread by flushPendingSends(): a message taken over, or data held
+	// by owner, or a task for the rest(sendFile(), shutdown()...).
+	struct PendingSend {
+		PendingSend()
+			: message(), owner(), data(NULL), len(0), task()
+		{ }
+
+		std::string message;
+		std::shared_ptr<const void> owner;
+		const void* data;
+		size_t len;
+		std::function<void()> task;
+	};
+	// the first item since the last flush queues it in loop
+	void queueSend(PendingSend&& item);
+	// appends the messages to the output buffer and writes them at once
+	void flushPendingSends();
+	// output is stopped by an empty pipe, waits for it instead of the socket
+	void waitForPipe(int pipefd);
+	void handlePipeReadable(int pipefd);
+	void removePipeChannel();
 	void shutdownInLoop();
+	// restarts the idle timer of buffers
+	void touchBuffers();
+	void handleBuffersIdle();
+	// shrinks the input buffer and forgets the read guess
+	void shrinkBuffers();
+	// adds the change of bufferedBytes() to budget_, stops reading if
+	// budgetStopsReads(), until the output is written or the retry finds it
+	// false.
+	void updateBudget();
+	// budget_ is exceeded, and output is queued or input over inputFloor_
+	bool budgetStopsReads() const;
+	// reads stopped with no output queued are checked again by a timer
+	void handleBudgetRetry();
+	void resumeReading();
+
+	// pending output is told by output buffer, since edge-triggered
+	// channels keep writable interest all the time and level-triggered
+	// ones drop it while waiting for a pipe
+	bool isWriting() const;
 
 	EventLoop* loop_;
-	std::string name_;
+	const uint64_t id_;
+	// the whole name if id_ is 0
+	const std::shared_ptr<const std::string> prefix_;
 	State state_;
+	bool edgeTriggered_;
 
 	std::unique_ptr<Socket> socket_;
 	std::unique_ptr<Channel> channel_;
+	// the pipe being waited for by output, kept until another one
+	std::unique_ptr<Channel> pipeChannel_;
 
 	InetAddress localAddr_;
 	InetAddress peerAddr_;
@@ -90,6 +275,8 @@ private:
 	ConnectionCallback connectionCallback_;
 	// void (const TcpConnectionPtr&, Buffer*, Timestamp)
 	MessageCallback messageCallback_;
+	// void (const TcpConnectionPtr&, CircularBuffer*, Timestamp)
+	CircularMessageCallback circularMessageCallback_;
 	// void (const TcpConnectionPtr&)
 	CloseCallback closeCallback_;
 	// void (const TcpConnectionPtr&)
@@ -98,8 +285,51 @@ private:
 	size_t highWaterMark_;
 	HighWaterMarkCallback highWaterMarkCallback_;
 
+	// from the pool of loop, allocated by reads and sized by recent reads,
+	// back to the pool once drained and idle, see setBufferIdleTimeout()
 	Buffer inputBuffer_;
-	Buffer outputBuffer_;
+	// instead of inputBuffer_ for circularMessageCallback_, allocated by
+	// reads and freed once drained and idle
+	std::unique_ptr<CircularBuffer> circularInput_;
+	ReadSizer readSizer_;
+	bool readSpill_;
+	// written by writev(2) in segments, no memmove or reallocation, files
+	// and pipes by sendfile(2) and splice(2)
+	BufferChain outputBuffer_;
+	MpscQueue<PendingSend> pendingSends_;
+	// a flush is queued in loop and has not started taking pendingSends_
+	AtomicInt32 flushQueued_;
+	// in flushPendingSends(), draining output doesn't shut down, the
+	// shutdown() queued after the messages does
+	bool flushing_;
+	// the poller reads into the input buffer and writes the memory output,
+	// submitted with its poll, see Poller::submitReadv()
+	const bool completions_;
+	// readIov_ is being read into, the input buffer is not touched
+	bool readSubmitted_;
+	uint64_t readSubmission_;
+	struct iovec readIov_[2];
+	// the read submitted was cancelled to shrink the input buffer, reads
+	// wait for readable events until data comes, so an idle connection
+	// holds no input buffer
+	bool readsIdle_;
+	// a read completed after reads were paused, its input is passed on once
+	// they resume
+	bool inputHeld_;
+	// writeIov_ is being written, output is not touched but appended to
+	bool writeSubmitted_;
+	uint64_t writeSubmission_;
+	std::vector<struct iovec> writeIov_;
+
+	double bufferIdleTimeout_;
+	TimerId bufferIdleTimer_;
+	bool bufferIdleTimerPending_;
+	std::shared_ptr<BufferBudget> budget_;
+	// counted into budget_
+	size_t budgetedBytes_;
+	size_t inputFloor_;
+	bool readPaused_;
+	bool budgetRetryPending_;
 };
 
 }
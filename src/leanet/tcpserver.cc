@@ -6,75 +6,350 @@
 #include "acceptor.h"
 #include "tcpconnection.h"
 #include "logger.h"
+#include "bufferbudget.h"
+#include "countdownlatch.h"
+#include "sockets.h"
+#include "ipcounter.h"
 
 #include <stdio.h> // snprintf
 
 using namespace leanet;
 
+namespace {
+
+// how often a paused acceptor checks for room made by other loops
+const double kResumeInterval = 0.1;
+
+// FNV-1a of the ip, not the port which varies among connections of a client
+uint64_t hashOfIp(const InetAddress& addr) {
+	const struct sockaddr* sa = addr.getSockAddr();
+	const unsigned char* p;
+	size_t len;
+	if (sa->sa_family == AF_INET6) {
+		p = sockets::sockaddr_in6_cast(sa)->sin6_addr.s6_addr;
+		len = sizeof(struct in6_addr);
+	} else {
+		p = reinterpret_cast<const unsigned char*>(&sockets::sockaddr_in_cast(sa)->sin_addr);
+		len = sizeof(struct in_addr);
+	}
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+void startListening(const std::shared_ptr<Acceptor>& acceptor, CountdownLatch* latch) {
+	acceptor->listen();
+	latch->countDown();
+}
+
+void destroyConnection(const TcpConnectionPtr& conn, CountdownLatch* latch) {
+	conn->connectDestroyed();
+	latch->countDown();
+}
+
+}
+
 TcpServer::TcpServer(
 		EventLoop* loop,
 		const InetAddress& listenAddr,
-		const std::string& name)
+		const std::string& name,
+		Option option)
 	: loop_(loop),
 		name_(name),
-		acceptor_(new Acceptor(loop, listenAddr)),
+		reusePort_(option == kReusePort),
+		acceptor_(new Acceptor(loop, listenAddr, option == kReusePort)),
+		listenAddr_(acceptor_->localAddress()),
+		threadPool_(new EventLoopThreadPool(loop, name)),
+		threadInitCallback_(),
+		connectionCallback_(defaultConnectionCallback),
+		messageCallback_(defaultMessageCallback),
+		circularMessageCallback_(),
 		started_(false),
-		nextConnId_(0)
+		edgeTriggered_(false),
+		bufferIdleTimeout_(0),
+		budget_(),
+		acceptBudget_(Acceptor::kDefaultAcceptBudget),
+		maxConnections_(0),
+		maxConnectionsPerLoop_(0),
+		maxConnectionsPerIp_(0),
+		overloadPolicy_(kAcceptAndClose),
+		numConnections_(),
+		rejected_(),
+		nextConnId_(),
+		ipMutex_(),
+		ipCounter_(),
+		alive_(std::make_shared<bool>(true))
 {
+	shards_.push_back(std::unique_ptr<Shard>(new Shard(loop, name)));
 	acceptor_->setNewConnectionCallback(
 			std::bind(&TcpServer::newConnection,
 								this,
+								shards_.front().get(),
 								std::placeholders::_1,
 								std::placeholders::_2));
 }
 
 TcpServer::~TcpServer() {
-	// TODO
+	loop_->assertInLoopThread();
+	LOG_TRACE << "TcpServer::~TcpServer [" << name_ << "] destructing";
+	for (size_t i = 0; i < shards_.size(); ++i) {
+		Shard* shard = shards_[i].get();
+		if (shard->loop == loop_) {
+			destroyShard(shard, NULL);
+		} else {
+			CountdownLatch latch(1);
+			shard->loop->runInLoop(std::bind(&TcpServer::destroyShard, this, shard, &latch));
+			latch.wait();
+		}
+	}
+}
+
+void TcpServer::setThreadNum(int numThreads) {
+	assert(0 <= numThreads);
+	threadPool_->setThreadNum(numThreads);
+}
+
+void TcpServer::setBufferedBytesLimit(size_t limit) {
+	budget_ = std::make_shared<BufferBudget>(limit);
+}
+
+int64_t TcpServer::bufferedBytes() const {
+	return budget_ ? budget_->bytes() : 0;
+}
+
+void TcpServer::setMaxConnectionsPerIp(int max) {
+	maxConnectionsPerIp_ = max;
+	ipCounter_.reset(max > 0 ? new IpCounter : NULL);
+}
+
+AcceptStats TcpServer::acceptStats() const {
+	AcceptStats stats(acceptor_->stats());
+	// shards_ doesn't change after start()
+	for (size_t i = 0; i < shards_.size(); ++i) {
+		if (shards_[i]->acceptor) {
+			AcceptStats shard(shards_[i]->acceptor->stats());
+			stats.wakeups += shard.wakeups;
+			stats.accepted += shard.accepted;
+			stats.dropped += shard.dropped;
+			stats.errors += shard.errors;
+			stats.budgetExhausted += shard.budgetExhausted;
+		}
+	}
+	return stats;
 }
 
 void TcpServer::start() {
+	loop_->assertInLoopThread();
+	if (started_) {
+		return;
+	}
+	started_ = true;
 	assert(!acceptor_->listenning());
-	// bind and listen in eventloop...
-	loop_->runInLoop(std::bind(&Acceptor::listen, acceptor_));
+	threadPool_->start(threadInitCallback_);
+
+	std::vector<EventLoop*> loops(threadPool_->getAllLoops());
+	if (reusePort_ && loops.front() != loop_) {
+		// the base acceptor keeps the port bound but doesn't listen.
+		// all are listening on return, or connections may be refused
+		CountdownLatch listening(static_cast<int>(loops.size()));
+		for (size_t i = 0; i < loops.size(); ++i) {
+			char buf[32];
+			snprintf(buf, sizeof(buf), "-%zu", i);
+			Shard* shard = new Shard(loops[i], name_ + buf);
+			shards_.push_back(std::unique_ptr<Shard>(shard));
+			shard->acceptor.reset(new Acceptor(loops[i], listenAddr_, true));
+			shard->acceptor->setAcceptBudget(acceptBudget_);
+			shard->acceptor->setNewConnectionCallback(
+					std::bind(&TcpServer::newConnection,
+										this,
+										shard,
+										std::placeholders::_1,
+										std::placeholders::_2));
+			loops[i]->runInLoop(std::bind(startListening, shard->acceptor, &listening));
+		}
+		listening.wait();
+	} else {
+		// bind and listen in eventloop...
+		acceptor_->setAcceptBudget(acceptBudget_);
+		loop_->runInLoop(std::bind(&Acceptor::listen, acceptor_));
+	}
 }
 
-void TcpServer::newConnection(int sockfd, const InetAddress& peerAddr) {
-	loop_->assertInLoopThread();
-	char buf[64];
-	snprintf(buf, sizeof(buf), "#%d", nextConnId_);
-	++nextConnId_;
-	std::string connName = name_ + buf;
-	LOG_INFO << "TcpServer::newConnection [" << name_ << "] - new connection [" << connName << "] from " << peerAddr.ipPort();
-
-	// getsockaddr
-	InetAddress localAddr(sockets::getLocalAddr(sockfd));
-	// single-thread tcpserver
-	// TcpConnectionPtr conn = std::make_shared<TcpConnection>(
-	// 		loop_, sockfd, connName, localAddr, peerAddr);
-
-	// multi-thread tcpserver
-	EventLoop* ioLoop = threadPool_->getNextLoop();
-	TcpConnectionPtr conn = std::make_shared<TcpConnection>(
-			ioLoop, sockfd, connName, localAddr, peerAddr);
-	connections_[connName] = conn;
-	conn->setConnectionCallback(connectionCallback_);
-	conn->setMessageCallback(messageCallback_);
-	conn->setCloseCallback(std::bind(&TcpServer::removeConnection, this, std::placeholders::_1));
-	conn->connectEstablished();
-}
-
-void TcpServer::removeConnection(const TcpConnectionPtr& conn) {
-	loop_->runInLoop(std::bind(&TcpServer::removeConnectionInLoop, this, conn));
-}
-
-void TcpServer::removeConnectionInLoop(const TcpConnectionPtr& conn) {
-	loop_->assertInLoopThread();
-	LOG_INFO << "TcpServer::removeConnection [" << name_ << "] - connection " << conn->name();
-	size_t n = connections_.erase(conn->name());
-	assert(n == 1);
-	Unused(n);
+void TcpServer::newConnection(Shard* shard, int sockfd, const InetAddress& peerAddr) {
+	shard->loop->assertInLoopThread();
+	EventLoop* ioLoop = admit(shard, peerAddr);
+	if (ioLoop == NULL) {
+		LOG_DEBUG << "TcpServer::newConnection [" << name_ << "] - rejected connection from " << peerAddr.ipPort();
+		rejected_.increment();
+		sockets::close(sockfd);
+	} else {
+		uint64_t id = static_cast<uint64_t>(nextConnId_.incrementAndGet());
+		LOG_INFO << "TcpServer::newConnection [" << name_ << "] - new connection ["
+						 << *shard->name << "#" << id << "] from " << peerAddr.ipPort();
+
+		// getsockaddr
+		InetAddress localAddr(sockets::getLocalAddr(sockfd));
+		// single-thread tcpserver
+		// TcpConnectionPtr conn = std::make_shared<TcpConnection>(
+		// 		loop_, sockfd, id, shard->name, localAddr, peerAddr);
+
+		// multi-thread tcpserver, or accepted by the loop itself
+		TcpConnectionPtr conn = std::make_shared<TcpConnection>(
+				ioLoop, sockfd, id, shard->name, localAddr, peerAddr);
+		shard->connections.add(id, conn);
+		conn->setConnectionCallback(connectionCallback_);
+		conn->setMessageCallback(messageCallback_);
+		conn->setCircularMessageCallback(circularMessageCallback_);
+		conn->setEdgeTriggered(edgeTriggered_);
+		conn->setBufferIdleTimeout(bufferIdleTimeout_);
+		conn->setBufferBudget(budget_);
+		conn->setCloseCallback(std::bind(&TcpServer::removeConnection, this, shard, std::placeholders::_1));
+		ioLoop->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
+	}
+
+	if (overloadPolicy_ == kStopAccepting && !shard->paused && full(shard)) {
+		pauseAccepting(shard);
+	}
+}
+
+EventLoop* TcpServer::admit(Shard* shard, const InetAddress& peerAddr) {
+	EventLoop* ioLoop = shard->loop;
+	if (!shard->acceptor) {
+		ioLoop = threadPool_->getNextLoop(
+				threadPool_->strategy() == EventLoopThreadPool::kConsistentHash ? hashOfIp(peerAddr) : 0);
+	}
+	if (maxConnectionsPerLoop_ > 0 && loopConnections(shard, ioLoop) >= maxConnectionsPerLoop_) {
+		if (shard->acceptor) {
+			return NULL;
+		}
+		// another loop may have room
+		ioLoop = threadPool_->getLeastConnectedLoop();
+		if (loopConnections(shard, ioLoop) >= maxConnectionsPerLoop_) {
+			return NULL;
+		}
+	}
+	// shared by the loops with kReusePort, counted before checked
+	if (numConnections_.incrementAndGet() > maxConnections_ && maxConnections_ > 0) {
+		numConnections_.decrement();
+		return NULL;
+	}
+	if (ipCounter_) {
+		MutexLock lock(ipMutex_);
+		if (ipCounter_->add(peerAddr) > maxConnectionsPerIp_) {
+			ipCounter_->remove(peerAddr);
+			numConnections_.decrement();
+			return NULL;
+		}
+	}
+	if (!shard->acceptor) {
+		threadPool_->connectionAdded(ioLoop);
+	}
+	return ioLoop;
+}
+
+bool TcpServer::full(Shard* shard) {
+	if (maxConnections_ > 0 && numConnections_.get() >= maxConnections_) {
+		return true;
+	}
+	if (maxConnectionsPerLoop_ > 0) {
+		EventLoop* ioLoop = shard->acceptor ? shard->loop : threadPool_->getLeastConnectedLoop();
+		return loopConnections(shard, ioLoop) >= maxConnectionsPerLoop_;
+	}
+	return false;
+}
+
+int TcpServer::loopConnections(Shard* shard, EventLoop* ioLoop) {
+	return shard->acceptor ? static_cast<int>(shard->connections.size())
+												 : threadPool_->numConnections(ioLoop);
+}
+
+Acceptor* TcpServer::acceptorOf(Shard* shard) {
+	return shard->acceptor ? shard->acceptor.get() : acceptor_.get();
+}
+
+void TcpServer::pauseAccepting(Shard* shard) {
+	shard->loop->assertInLoopThread();
+	LOG_WARN << "TcpServer::pauseAccepting [" << *shard->name << "] - "
+					 << numConnections() << " connections";
+	shard->paused = true;
+	acceptorOf(shard)->pause();
+	shard->resumeTimer = shard->loop->runEvery(
+			kResumeInterval, std::bind(&TcpServer::resumeAccepting, this, shard));
+}
+
+void TcpServer::resumeAccepting(Shard* shard) {
+	shard->loop->assertInLoopThread();
+	if (shard->paused && !full(shard)) {
+		LOG_INFO << "TcpServer::resumeAccepting [" << *shard->name << "]";
+		shard->paused = false;
+		shard->loop->cancel(shard->resumeTimer);
+		acceptorOf(shard)->resume();
+	}
+}
+
+void TcpServer::removeConnection(Shard* shard, const TcpConnectionPtr& conn) {
+	if (shard->loop->isInLoopThread()) {
+		removeConnectionInLoop(shard, conn);
+	} else {
+		// destroyShard() has destroyed conn if the server is gone by then
+		shard->loop->queueInLoop(std::bind(&TcpServer::removeConnectionIfAlive,
+				std::weak_ptr<bool>(alive_), this, shard, conn));
+	}
+}
+
+void TcpServer::removeConnectionIfAlive(const std::weak_ptr<bool>& alive,
+		TcpServer* server, Shard* shard, const TcpConnectionPtr& conn) {
+	// expires in the loop thread of shard, not while it runs
+	if (alive.lock()) {
+		server->removeConnectionInLoop(shard, conn);
+	}
+}
+
+void TcpServer::removeConnectionInLoop(Shard* shard, const TcpConnectionPtr& conn) {
+	shard->loop->assertInLoopThread();
+	LOG_INFO << "TcpServer::removeConnection [" << name_ << "] - connection "
+					 << *shard->name << "#" << conn->id();
+	bool removed = shard->connections.remove(conn->id());
+	assert(removed);
+	Unused(removed);
 
 	EventLoop* ioLoop = conn->getLoop();
+	if (!shard->acceptor) {
+		threadPool_->connectionRemoved(ioLoop);
+	}
+	numConnections_.decrement();
+	if (ipCounter_) {
+		MutexLock lock(ipMutex_);
+		ipCounter_->remove(conn->peerAddress());
+	}
+	if (shard->paused) {
+		resumeAccepting(shard);
+	}
 	// do remove in eventloop thread, but why queueInLoop??
 	ioLoop->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
 }
+
+void TcpServer::destroyShard(Shard* shard, CountdownLatch* latch) {
+	shard->loop->assertInLoopThread();
+	if (shard->paused) {
+		shard->loop->cancel(shard->resumeTimer);
+	}
+	shard->acceptor.reset();
+	// waits for the connections in the other loops, which may be closing
+	// into the shard until they are destroyed
+	std::vector<TcpConnectionPtr> conns;
+	shard->connections.takeAll(&conns);
+	CountdownLatch destroyed(static_cast<int>(conns.size()));
+	for (size_t i = 0; i < conns.size(); ++i) {
+		TcpConnectionPtr conn;
+		conn.swap(conns[i]);
+		conn->getLoop()->runInLoop(std::bind(destroyConnection, conn, &destroyed));
+	}
+	destroyed.wait();
+	if (latch) {
+		latch->countDown();
+	}
+}
@@ -1,30 +1,89 @@
 #ifndef LEANET_TCPSERVER_H
 #define LEANET_TCPSERVER_H
 
+#include <stdint.h>
+
 #include <memory> // std::unique_ptr
-#include <map>
+#include <functional>
 #include <string>
+#include <vector>
 
 #include "noncopyable.h"
 #include "callbacks.h"
+#include "inetaddress.h"
+#include "atomic.h"
+#include "mutex.h"
+#include "timerid.h"
+#include "connectionregistry.h"
 
 namespace leanet {
 
-class InetAddress;
+class CountdownLatch;
 class EventLoop;
 class Acceptor;
 class EventLoopThreadPool;
+class BufferBudget;
+class IpCounter;
+struct AcceptStats;
 
 class TcpServer: noncopyable {
 public:
+	typedef std::function<void (EventLoop*)> ThreadInitCallback;
+
+	// kNoReusePort: the base loop accepts all connections and hands them to
+	// the loops of the pool in turn.
+	// kReusePort: every loop of the pool listens on its own socket bound
+	// with SO_REUSEPORT, kernel spreads the connections among them, and
+	// each loop accepts and keeps the connections of its own. so accepting
+	// scales with loops, at the cost of the balance the kernel makes.
+	enum Option {
+		kNoReusePort,
+		kReusePort
+	};
+
+	// what is done to the connections over a limit.
+	// kAcceptAndClose: they are closed once accepted, the clients know at
+	// once.
+	// kStopAccepting: the listening socket is not polled until there is room,
+	// they wait in the backlog and the loop spends nothing on them. kernel
+	// refuses or drops what the backlog can't take. with kReusePort each
+	// loop stops when it finds the server full, so a connection it accepts
+	// before is closed.
+	// connections over the limit per ip are always closed.
+	enum OverloadPolicy {
+		kAcceptAndClose,
+		kStopAccepting
+	};
+
 	TcpServer(EventLoop* loop,
 			const InetAddress& listenAddr,
-			const std::string& name);
+			const std::string& name,
+			Option option = kNoReusePort);
+	// in the base loop thread, with the loops of the pool running
 	~TcpServer();
 
+	// loops in the pool besides the base loop, 0 for the base loop only.
+	// call it before start().
 	void setThreadNum(int numThreads);
+	// called in every loop thread of the pool before it loops(or in the
+	// base loop if there are no threads). call it before start().
+	void setThreadInitCallback(const ThreadInitCallback& cb)
+	{ threadInitCallback_ = cb; }
 
+	// starts the pool and listens, in the base loop thread.
+	// calling it again does nothing.
 	void start();
+	bool started() const
+	{ return started_; }
+
+	const std::string& name() const
+	{ return name_; }
+	EventLoop* getLoop() const
+	{ return loop_; }
+	// to set the strategy which hands connections to the loops, before
+	// start(). kConsistentHash hashes the ip of peers.
+	EventLoopThreadPool* threadPool() const
+	{ return threadPool_.get(); }
 
 	// tcp connection UP and DOWN will callback cb
 	void setConnectionCallback(const ConnectionCallback& cb)
@@ -32,26 +91,135 @@ public:
 
 	void setMessageCallback(const MessageCallback& cb)
 	{ messageCallback_ = cb; }
+	// connections read into a CircularBuffer and pass it to cb instead,
+	// see TcpConnection::setCircularMessageCallback().
+	void setCircularMessageCallback(const CircularMessageCallback& cb)
+	{ circularMessageCallback_ = cb; }
+
+	// connections use edge-triggered notification when the poller
+	// supports it, see TcpConnection::setEdgeTriggered().
+	// call it before start().
+	void setEdgeTriggered(bool on)
+	{ edgeTriggered_ = on; }
+
+	// buffers of connections idle for seconds are shrunk, see
+	// TcpConnection::setBufferIdleTimeout(). call it before start().
+	void setBufferIdleTimeout(double seconds)
+	{ bufferIdleTimeout_ = seconds; }
+	// connections stop reading while the bytes buffered by all connections
+	// are over limit and they have output queued or input left, see
+	// BufferBudget and TcpConnection::setBufferBudget().
+	// call it before start().
+	void setBufferedBytesLimit(size_t limit);
+	// counted only if a limit is set
+	int64_t bufferedBytes() const;
+
+	// connections accepted on one wakeup at most, see
+	// Acceptor::setAcceptBudget(). call it before start().
+	void setAcceptBudget(int budget)
+	{ acceptBudget_ = budget; }
+	// of all acceptors, thread safe once started
+	AcceptStats acceptStats() const;
+
+	// limits of connections, 0 for none. per loop counts the connections
+	// the base loop hands to a loop, or that a loop accepts itself with
+	// kReusePort. call them before start().
+	void setMaxConnections(int max)
+	{ maxConnections_ = max; }
+	void setMaxConnectionsPerLoop(int max)
+	{ maxConnectionsPerLoop_ = max; }
+	void setMaxConnectionsPerIp(int max);
+	void setOverloadPolicy(OverloadPolicy policy)
+	{ overloadPolicy_ = policy; }
+	// thread safe
+	int numConnections() const
+	{ return numConnections_.get(); }
+	// closed for the limits
+	int64_t rejectedConnections() const
+	{ return rejected_.get(); }
+
+	// with the port chosen by kernel if listenAddr has port 0
+	InetAddress listenAddress() const
+	{ return listenAddr_; }
 
 private:
-	void newConnection(int sockfd, const InetAddress& peerAddr);
-	void removeConnection(const TcpConnectionPtr& conn);
-	void removeConnectionInLoop(const TcpConnectionPtr& conn);
+	// connections accepted by a loop, touched in the loop thread only
+	struct Shard {
+		Shard(EventLoop* shardLoop, const std::string& shardName)
+			: loop(shardLoop),
+				name(std::make_shared<const std::string>(shardName)),
+				acceptor(),
+				connections(),
+				paused(false),
+				resumeTimer()
+		{ }
+
+		EventLoop* loop;
+		// the prefix of the names of connections
+		const std::shared_ptr<const std::string> name;
+		// listening with SO_REUSEPORT in loop, NULL for the base loop
+		std::shared_ptr<Acceptor> acceptor;
+		ConnectionRegistry connections;
+		// not accepting for a limit, retried by resumeTimer meanwhile, as
+		// the connections of other loops may make room
+		bool paused;
+		TimerId resumeTimer;
+	};
+
+	void newConnection(Shard* shard, int sockfd, const InetAddress& peerAddr);
+	void removeConnection(Shard* shard, const TcpConnectionPtr& conn);
+	void removeConnectionInLoop(Shard* shard, const TcpConnectionPtr& conn);
+	// queued by removeConnection(), does nothing once alive has expired
+	static void removeConnectionIfAlive(const std::weak_ptr<bool>& alive,
+			TcpServer* server, Shard* shard, const TcpConnectionPtr& conn);
+	// the loop for a connection accepted by shard, NULL if over a limit
+	EventLoop* admit(Shard* shard, const InetAddress& peerAddr);
+	// no room for another connection accepted by shard
+	bool full(Shard* shard);
+	int loopConnections(Shard* shard, EventLoop* ioLoop);
+	// listening for shard
+	Acceptor* acceptorOf(Shard* shard);
+	void pauseAccepting(Shard* shard);
+	void resumeAccepting(Shard* shard);
+	// stops accepting and destroys the connections in the loop of shard
+	void destroyShard(Shard* shard, CountdownLatch* latch);
 
-	// std::string -> TcpConnection
-	typedef std::map<std::string, TcpConnectionPtr> ConnectionMap;
 	EventLoop* loop_;
 	const std::string name_;
+	const bool reusePort_;
 	std::shared_ptr<Acceptor> acceptor_;
+	const InetAddress listenAddr_;
 	// std::function need bind object copyable, but std::unique_ptr
 	// is not copyable
 	// std::unique_ptr<Acceptor> acceptor_;
 	std::unique_ptr<EventLoopThreadPool> threadPool_;
+	ThreadInitCallback threadInitCallback_;
 	ConnectionCallback connectionCallback_;
 	MessageCallback messageCallback_;
+	CircularMessageCallback circularMessageCallback_;
 	bool started_;
-	int nextConnId_; // used to name next connection
-	ConnectionMap connections_;
+	bool edgeTriggered_;
+	double bufferIdleTimeout_;
+	std::shared_ptr<BufferBudget> budget_;
+	int acceptBudget_;
+	int maxConnections_;
+	int maxConnectionsPerLoop_;
+	int maxConnectionsPerIp_;
+	OverloadPolicy overloadPolicy_;
+	mutable AtomicInt32 numConnections_;
+	mutable AtomicInt64 rejected_;
+	// ids of connections, from 1 in the order accepted by all the loops,
+	// see TcpConnection::id()
+	AtomicInt64 nextConnId_;
+	// shared by the loops with kReusePort
+	Mutex ipMutex_;
+	std::unique_ptr<IpCounter> ipCounter_;
+	// the base loop first, then the loops of the pool with kReusePort
+	std::vector<std::unique_ptr<Shard>> shards_;
+	// expires with the server. removals queued into the base loop by
+	// connections closing in other loops hold it weakly, as they may run
+	// after the server is destroyed in the base loop
+	std::shared_ptr<bool> alive_;
 };
 
 }
@@ -21,7 +21,7 @@ ThreadPool::~ThreadPool() {
 }
 
 void ThreadPool::start(int numThreads) {
-	assert(!threads_.empty());
+	assert(threads_.empty());
 	running_ = true;
 
 	for (int i = 0; i < numThreads; ++i) {
@@ -10,6 +10,7 @@
 #include "noncopyable.h"
 #include "mutex.h"
 #include "condition.h"
+#include "future.h"
 
 namespace leanet {
 
@@ -36,6 +37,11 @@ public:
 
 	void run(const Task& task);
 
+	// runs f() as run() does, its result comes by the future returned
+	template<typename F>
+	Future<typename std::result_of<F()>::type> submit(F f)
+	{ return submitTo(this, std::move(f)); }
+
 private:
 	bool isFull() const;
 	void runInThread();
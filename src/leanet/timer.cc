@@ -11,3 +11,17 @@ void Timer::restart(Timestamp now) {
 		expiration_ = Timestamp::invalid();
 	}
 }
+
+void Timer::reset(const TimerCallback& cb, Timestamp when, double interval) {
+	callback_ = cb;
+	expiration_ = when;
+	interval_ = interval;
+	repeat_ = interval > 0.0;
+	__atomic_store_n(&sequence_, numCreated_.incrementAndGet(), __ATOMIC_RELAXED);
+}
+
+void Timer::release() {
+	// drops what the callback holds now
+	callback_ = TimerCallback();
+	__atomic_store_n(&sequence_, 0, __ATOMIC_RELAXED);
+}
@@ -24,17 +24,35 @@ public:
 
 	Timestamp expiration() const { return expiration_; }
 	bool repeat() const { return repeat_; }
-	int64_t sequence() const { return sequence_; }
+	// may be read in another thread by TimerId holders while the pooled
+	// timer is reused
+	int64_t sequence() const { return __atomic_load_n(&sequence_, __ATOMIC_RELAXED); }
 	static int64_t numCreated() { return numCreated_.get(); }
 
 	void restart(Timestamp now);
+	// moves the expiration, the owner re-sorts it
+	void setExpiration(Timestamp when) { expiration_ = when; }
+
+protected:
+	// a free timer, for pools
+	Timer()
+		: expiration_(),
+			interval_(0.0),
+			repeat_(false),
+			sequence_(0)
+	{ }
+
+	// reuses a free timer as a new one, with a new sequence
+	void reset(const TimerCallback& cb, Timestamp when, double interval);
+	// frees the timer, TimerIds of it never match again
+	void release();
 
 private:
-	const TimerCallback callback_;
+	TimerCallback callback_;
 	Timestamp expiration_;
-	const double interval_;
-	const bool repeat_;
-	const int64_t sequence_;
+	double interval_;
+	bool repeat_;
+	int64_t sequence_;
 
 	static AtomicInt64 numCreated_;
 };
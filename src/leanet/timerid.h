@@ -7,7 +7,8 @@ namespace leanet {
 
 class Timer;
 // friend declaration is not forward declaration
-class TimerQueue;
+class SortedTimerQueue;
+class TimingWheel;
 
 class TimerId: public copyable {
 public:
@@ -23,7 +24,8 @@ public:
 
 	// implicit copy-control members are okay
 
-	friend class TimerQueue;
+	friend class SortedTimerQueue;
+	friend class TimingWheel;
 
 private:
 	Timer* timer_;
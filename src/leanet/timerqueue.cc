@@ -1,19 +1,11 @@
 #include "timerqueue.h"
 
 #include <unistd.h>
-#include <assert.h>
 #include <sys/timerfd.h>
 #include <strings.h>
 #include <stdint.h>
 
-#include <algorithm>
-#include <iterator>
-
 #include "logger.h"
-#include "timer.h"
-#include "timerid.h"
-#include "channel.h"
-#include "eventloop.h"
 
 using namespace leanet;
 
@@ -38,19 +30,6 @@ struct timespec howMuchTimeFromNow(Timestamp when) {
 	return ts;
 }
 
-void resetTimerfd(int timerfd, Timestamp expiration) {
-	struct itimerspec newValue;
-	struct itimerspec oldValue;
-	::bzero(&newValue, sizeof(newValue));
-	::bzero(&oldValue, sizeof(oldValue));
-	newValue.it_value = howMuchTimeFromNow(expiration);
-	// no interval
-	int ret = ::timerfd_settime(timerfd, 0, &newValue, &oldValue);
-	if (ret) {
-		LOG_SYSERR << "timerfd_settime()";
-	}
-}
-
 // called in TimerQueue::handleRead()
 void readTimerfd(int timerfd, Timestamp now) {
 	uint64_t times;
@@ -67,7 +46,11 @@ TimerQueue::TimerQueue(EventLoop* loop)
 	: loop_(loop),
 		timerfd_(::createTimerfd()),
 		timerfdChannel_(loop, timerfd_),
-		timers_()
+		useTimerfd_(true),
+		alarm_(),
+		alarmChanged_(false),
+		armedAlarm_(),
+		syscalls_(0)
 {
 	timerfdChannel_.setReadCallback(std::bind(&TimerQueue::handleRead, this));
 	timerfdChannel_.enableReading();
@@ -77,134 +60,83 @@ TimerQueue::~TimerQueue() {
 	timerfdChannel_.disableAll();
 	timerfdChannel_.remove();
 	::close(timerfd_);
-	for (TimerList::iterator it = timers_.begin(); it != timers_.end(); ++it) {
-		delete it->second;
-	}
 }
 
-std::vector<TimerQueue::Entry> TimerQueue::getExpired(Timestamp now) {
-	Entry sentry = std::make_pair(now, reinterpret_cast<Timer*>(UINTPTR_MAX));
-	// first not less than the key.(that is: >=)
-	TimerList::iterator expireEnd = timers_.lower_bound(sentry);
-	assert(expireEnd == timers_.end() || now < expireEnd->first);
-
-	std::vector<Entry> expired;
-	std::copy(timers_.begin(), expireEnd, std::back_inserter(expired));
-	timers_.erase(timers_.begin(), expireEnd);
-
-	for (std::vector<Entry>::iterator it = expired.begin();
-			 it != expired.end();
-			 ++it) {
-		ActiveTimer timer(it->second, it->second->sequence());
-		size_t n = activeTimers_.erase(timer);
-		assert(n == 1);
-		Unused(n);
-	}
-
-	return expired;
-}
-
-TimerId TimerQueue::addTimer(const TimerCallback& cb, Timestamp when, double interval) {
-	Timer* timer = new Timer(cb, when, interval);
-	loop_->runInLoop(std::bind(&TimerQueue::addTimerInLoop, this, timer));
-	return TimerId(timer, timer->sequence());
-}
-
-void TimerQueue::cancelTimer(TimerId timerid) {
-	loop_->runInLoop(std::bind(&TimerQueue::cancelTimerInLoop, this, timerid));
-}
-
-void TimerQueue::addTimerInLoop(Timer* timer) {
+void TimerQueue::useTimerfd(bool on) {
 	loop_->assertInLoopThread();
-	bool earliestChanged = insert(timer);
-	if (earliestChanged) {
-		::resetTimerfd(timerfd_, timer->expiration());
+	if (on == useTimerfd_) {
+		return;
 	}
-}
-
-void TimerQueue::cancelTimerInLoop(TimerId timerid) {
-	loop_->assertInLoopThread();
-	ActiveTimer timer(timerid.timer_, timerid.sequence_);
-	ActiveTimerSet::iterator it = activeTimers_.find(timer);
-	if (it != activeTimers_.end()) {
-		size_t n = timers_.erase(Entry(it->first->expiration(), it->first));
-		assert(n == 1);
-		Unused(n);
-		delete it->first;
-		activeTimers_.erase(it);
-	} else if (callingExpiredTimers_) {
-		// because we in handleRead(), after all timers' callback are executed,
-		// then handleRead() will call reset(), so we add canceled timers into
-		// cancelingTimers to exclude them in reset()
-		cancelingTimers_.insert(timer);
+	useTimerfd_ = on;
+	if (on) {
+		timerfdChannel_.enableReading();
+		// programs it before next polling
+		armedAlarm_ = Timestamp::invalid();
+		alarmChanged_ = true;
+	} else {
+		// an armed timerfd is ignored
+		timerfdChannel_.disableAll();
 	}
 }
 
-
-void TimerQueue::handleRead() {
-	loop_->assertInLoopThread();
-	Timestamp now(Timestamp::now());
-	::readTimerfd(timerfd_, now);
-
-	const std::vector<Entry>& expired = getExpired(now);
-
-	callingExpiredTimers_ = true;
-	cancelingTimers_.clear();
-	for (std::vector<Entry>::const_iterator iter = expired.begin();
-			 iter != expired.end();
-			 ++iter) {
-		iter->second->run();
-	}
-	callingExpiredTimers_ = false;
-
-	reset(expired, now);
+void TimerQueue::scheduleAlarm(Timestamp expiration) {
+	alarm_ = expiration;
+	alarmChanged_ = true;
 }
 
-void TimerQueue::reset(const std::vector<Entry>& expired, Timestamp now) {
-	for (std::vector<Entry>::const_iterator it = expired.begin();
-			 it != expired.end();
-			 ++it) {
-		ActiveTimer timer(it->second, it->second->sequence());
-		if (it->second->repeat() && cancelingTimers_.find(timer) == cancelingTimers_.end()) {
-			// add a interval
-			it->second->restart(now);
-			// insert again
-			insert(it->second);
-		} else {
-			delete it->second;
+int TimerQueue::prepareForPoll(int timeoutMs) {
+	if (useTimerfd_) {
+		if (alarmChanged_) {
+			alarmChanged_ = false;
+			if (alarm_.valid() && !(alarm_ == armedAlarm_)) {
+				resetTimerfd(alarm_);
+				armedAlarm_ = alarm_;
+			}
 		}
+		return timeoutMs;
 	}
 
-	Timestamp nextExpire;
-	// find first timer expiration in timers_
-	if (!timers_.empty()) {
-		nextExpire = timers_.begin()->second->expiration();
+	if (!alarm_.valid()) {
+		return timeoutMs;
 	}
-
-	if (nextExpire.valid()) {
-		::resetTimerfd(timerfd_, nextExpire);
+	int64_t microseconds = alarm_.microSecondsFromEpoch() - Timestamp::now().microSecondsFromEpoch();
+	if (microseconds <= 0) {
+		return 0;
 	}
+	// rounds up, never wakes up before the alarm
+	int64_t ms = (microseconds + 999) / 1000;
+	return ms < timeoutMs ? static_cast<int>(ms) : timeoutMs;
 }
 
-bool TimerQueue::insert(Timer* timer) {
-	loop_->assertInLoopThread();
-	bool earliestChanged = false;
-	Timestamp when = timer->expiration();
-	TimerList::iterator it = timers_.begin();
-	// timers_ is empty or less than first timer...
-	if (it == timers_.end() || when < it->first) {
-		earliestChanged = true;
-	}
-	{
-	std::pair<TimerList::iterator, bool> result
-		= timers_.insert(Entry(when, timer));
-	Unused(result);
+void TimerQueue::handlePollReturned(Timestamp now) {
+	if (useTimerfd_ || !alarm_.valid() || now < alarm_) {
+		return;
 	}
-	{
-	std::pair<ActiveTimerSet::iterator, bool> result
-		= activeTimers_.insert(ActiveTimer(timer, timer->sequence()));
-	Unused(result);
+	alarm_ = Timestamp::invalid();
+	handleExpired(now);
+}
+
+void TimerQueue::resetTimerfd(Timestamp expiration) {
+	struct itimerspec newValue;
+	struct itimerspec oldValue;
+	::bzero(&newValue, sizeof(newValue));
+	::bzero(&oldValue, sizeof(oldValue));
+	newValue.it_value = howMuchTimeFromNow(expiration);
+	// no interval
+	++syscalls_;
+	int ret = ::timerfd_settime(timerfd_, 0, &newValue, &oldValue);
+	if (ret) {
+		LOG_SYSERR << "timerfd_settime()";
 	}
+}
 
-	return earliestChanged;
+void TimerQueue::handleRead() {
+	loop_->assertInLoopThread();
+	Timestamp now(Timestamp::now());
+	++syscalls_;
+	::readTimerfd(timerfd_, now);
+	// one shot, subclass schedules the next
+	armedAlarm_ = Timestamp::invalid();
+	alarm_ = Timestamp::invalid();
+	handleExpired(now);
 }
@@ -1,58 +1,82 @@
 #ifndef LEANET_TIMERQUEUE_H
 #define LEANET_TIMERQUEUE_H
 
-#include <utility>
-#include <vector>
-#include <set>
-
 #include "callbacks.h"
 #include "noncopyable.h"
 #include "timestamp.h"
 #include "channel.h"
+#include "eventloop.h"
 
 namespace leanet {
 
-class EventLoop;
 class Timer;
 class TimerId;
 
+//
+// Base class of timer queues.
+//
+// Owns the alarm which wakes the loop up, subclasses decide how timers
+// are kept and when the alarm goes off.
+//
+// The alarm is a timerfd, or the timeout of polling if useTimerfd(false).
+// Subclasses may schedule it many times in an iteration of the loop, it is
+// programmed only once before polling.
+//
 class TimerQueue: noncopyable {
 public:
-	TimerQueue(EventLoop* loop);
-	~TimerQueue();
+	explicit TimerQueue(EventLoop* loop);
+	virtual ~TimerQueue();
 
-	TimerId addTimer(const TimerCallback& cb, Timestamp when, double interval);
-	void cancelTimer(TimerId timerid);
+	// thread safe
+	virtual TimerId addTimer(const TimerCallback& cb, Timestamp when, double interval) = 0;
+	// thread safe
+	virtual void cancelTimer(TimerId timerid) = 0;
+	// thread safe, moves the expiration of a pending timer
+	virtual void restartTimer(TimerId timerid, Timestamp when) = 0;
 
-private:
-	// FIXME: use unique_ptr<Timer> instead of raw pointers.
-	typedef std::pair<Timestamp, Timer*> Entry;
-	typedef std::set<Entry> TimerList;
-	typedef std::pair<Timer*, int64_t> ActiveTimer;
-	typedef std::set<ActiveTimer> ActiveTimerSet;
+	// the timing wheel if LEANET_USE_TIMING_WHEEL is set in environment,
+	// the sorted set otherwise.
+	static TimerQueue* newDefaultTimerQueue(EventLoop* loop);
+	static TimerQueue* newTimerQueue(EventLoop* loop, EventLoop::TimerQueueType type);
 
-	void addTimerInLoop(Timer* timer);
-	void cancelTimerInLoop(TimerId timerid);
+	// whether the alarm is a timerfd or the timeout of polling, in loop
+	// thread. the later saves the timerfd_settime(2) and read(2) system
+	// calls, at the cost of 1ms resolution.
+	void useTimerfd(bool on);
 
-	// called when timerfd alarms
-	void handleRead();
+	// called by EventLoop before polling, programs the alarm.
+	// returns the timeout of polling.
+	int prepareForPoll(int timeoutMs);
+	// called by EventLoop after polling, handles expired timers if the
+	// alarm is the timeout of polling.
+	void handlePollReturned(Timestamp now);
+
+	// system calls made for the alarm so far, for benchmarking
+	int64_t syscalls() const { return syscalls_; }
+
+protected:
+	// called when the alarm goes off, in loop thread
+	virtual void handleExpired(Timestamp now) = 0;
 
-	// move out all expired timers
-	std::vector<Entry> getExpired(Timestamp now);
-	// readd timers which have repeat_ property
-	void reset(const std::vector<Entry>& expired, Timestamp now);
-	bool insert(Timer* timer);
+	// the alarm goes off at expiration(one shot), replaces the previous one.
+	// takes effect before next polling.
+	void scheduleAlarm(Timestamp expiration);
 
 	EventLoop* loop_;
+
+private:
+	void handleRead();
+	void resetTimerfd(Timestamp expiration);
+
 	const int timerfd_; // Linux timerfd since 2.6.25
 	Channel timerfdChannel_;
-	// Timer list sorted by expiration
-	TimerList timers_;
-
-	// for cancel()
-	ActiveTimerSet activeTimers_;
-	bool callingExpiredTimers_; // atomic
-	ActiveTimerSet cancelingTimers_;
+	bool useTimerfd_;
+	// scheduled by subclass
+	Timestamp alarm_;
+	bool alarmChanged_;
+	// programmed into timerfd
+	Timestamp armedAlarm_;
+	int64_t syscalls_;
 };
 
 }
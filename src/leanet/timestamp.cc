@@ -19,7 +19,7 @@ string Timestamp::toFormattedString(bool showMicroSeconds) const {
 	struct tm tmt;
 	gmtime_r(&seconds, &tmt);
 
-	char buf[32] = {0};
+	char buf[64] = {0};
 	if (showMicroSeconds) {
 		int microseconds = static_cast<int>(microSecondsFromEpoch_ % kMicroSecondsPerSecond);
 		snprintf(buf, sizeof(buf), "%4d%02d%02d %02d:%02d:%02d.%06d",
@@ -0,0 +1,397 @@
+#include "timingwheel.h"
+
+#include <assert.h>
+
+#include "timerid.h"
+#include "eventloop.h"
+
+using namespace leanet;
+
+TimingWheel::TimingWheel(EventLoop* loop)
+	: TimerQueue(loop),
+		start_(Timestamp::now()),
+		currentTick_(0),
+		armedTick_(0),
+		armed_(false),
+		size_(0),
+		expired_(),
+		callingExpiredTimers_(false),
+		poolMutex_(),
+		chunks_(),
+		freeList_(NULL)
+{
+	for (int i = 0; i < kNumBuckets; ++i) {
+		buckets_[i] = NULL;
+	}
+	for (int i = 0; i < kRootSize / 64; ++i) {
+		rootBitmap_[i] = 0;
+	}
+}
+
+TimingWheel::~TimingWheel() {
+	// timers are owned by chunks_
+}
+
+TimerId TimingWheel::addTimer(const TimerCallback& cb, Timestamp when, double interval) {
+	WheelTimer* timer = allocTimer(cb, when, interval);
+	// the timer may have expired and been reused once queued
+	TimerId timerid(timer, timer->sequence());
+	if (loop_->isInLoopThread()) {
+		addTimerInLoop(timer);
+	} else {
+		loop_->queueInLoop(std::bind(&TimingWheel::addTimerInLoop, this, timer));
+	}
+	return timerid;
+}
+
+void TimingWheel::cancelTimer(TimerId timerid) {
+	if (loop_->isInLoopThread()) {
+		cancelTimerInLoop(timerid);
+	} else {
+		loop_->queueInLoop(std::bind(&TimingWheel::cancelTimerInLoop, this, timerid));
+	}
+}
+
+void TimingWheel::restartTimer(TimerId timerid, Timestamp when) {
+	if (loop_->isInLoopThread()) {
+		restartTimerInLoop(timerid, when);
+	} else {
+		loop_->queueInLoop(std::bind(&TimingWheel::restartTimerInLoop, this, timerid, when));
+	}
+}
+
+TimingWheel::WheelTimer* TimingWheel::allocTimer(const TimerCallback& cb, Timestamp when, double interval) {
+	WheelTimer* timer = NULL;
+	{
+	MutexLock lock(poolMutex_);
+	if (freeList_ == NULL) {
+		std::unique_ptr<WheelTimer[]> chunk(new WheelTimer[kTimersPerChunk]);
+		for (size_t i = 0; i < kTimersPerChunk; ++i) {
+			chunk[i].next = freeList_;
+			freeList_ = &chunk[i];
+		}
+		chunks_.push_back(std::move(chunk));
+	}
+	timer = freeList_;
+	freeList_ = timer->next;
+	}
+	timer->reset(cb, when, interval);
+	return timer;
+}
+
+void TimingWheel::freeTimer(WheelTimer* timer) {
+	timer->release();
+	timer->prev = NULL;
+	timer->bucket = -1;
+	timer->state = kFree;
+	timer->canceled = false;
+	MutexLock lock(poolMutex_);
+	timer->next = freeList_;
+	freeList_ = timer;
+}
+
+void TimingWheel::addTimerInLoop(WheelTimer* timer) {
+	loop_->assertInLoopThread();
+	if (size_ == 0) {
+		// nothing to cascade, skips the idle ticks at once
+		uint64_t passed = passedTickOf(Timestamp::now());
+		if (currentTick_ < passed) {
+			currentTick_ = passed;
+		}
+	}
+	++size_;
+	timer->tick = tickOf(timer->expiration());
+	insert(timer);
+
+	// handleExpired() rearms at last
+	if (!callingExpiredTimers_ && (!armed_ || timer->tick < armedTick_)) {
+		rearm();
+	}
+}
+
+void TimingWheel::cancelTimerInLoop(TimerId timerid) {
+	loop_->assertInLoopThread();
+	WheelTimer* timer = static_cast<WheelTimer*>(timerid.timer_);
+	if (timer == NULL || timer->sequence() != timerid.sequence_) {
+		// expired or canceled already
+		return;
+	}
+
+	if (timer->state == kPending) {
+		unlink(timer);
+		--size_;
+		freeTimer(timer);
+	} else if (timer->state == kExpired) {
+		// in handleExpired(), frees it there
+		timer->canceled = true;
+	}
+}
+
+void TimingWheel::restartTimerInLoop(TimerId timerid, Timestamp when) {
+	loop_->assertInLoopThread();
+	WheelTimer* timer = static_cast<WheelTimer*>(timerid.timer_);
+	if (timer == NULL
+			|| timer->sequence() != timerid.sequence_
+			|| timer->state != kPending) {
+		// expired or canceled
+		return;
+	}
+
+	timer->setExpiration(when);
+	uint64_t tick = tickOf(when);
+	if (tick < timer->tick) {
+		// earlier, moves it now
+		unlink(timer);
+		timer->tick = tick;
+		insert(timer);
+		if (!callingExpiredTimers_ && (!armed_ || timer->tick < armedTick_)) {
+			rearm();
+		}
+	}
+	// later, moves it lazily in handleExpired()
+}
+
+void TimingWheel::insert(WheelTimer* timer) {
+	uint64_t tick = timer->tick;
+	if (tick < currentTick_) {
+		tick = currentTick_;
+	}
+	uint64_t delta = tick - currentTick_;
+	if (delta > kMaxTicks) {
+		// parked, put back when reached
+		delta = kMaxTicks;
+		tick = currentTick_ + kMaxTicks;
+	}
+	timer->tick = tick;
+
+	int bucket = 0;
+	if (delta < kRootSize) {
+		bucket = static_cast<int>(tick & (kRootSize - 1));
+		rootBitmap_[bucket / 64] |= 1ULL << (bucket % 64);
+	} else {
+		int level = 1;
+		while (delta >> levelShift(level + 1) != 0) {
+			++level;
+		}
+		int index = static_cast<int>((tick >> levelShift(level)) & (kLevelSize - 1));
+		bucket = kRootSize + (level - 1) * kLevelSize + index;
+	}
+
+	timer->state = kPending;
+	timer->bucket = bucket;
+	timer->prev = NULL;
+	timer->next = buckets_[bucket];
+	if (timer->next) {
+		timer->next->prev = timer;
+	}
+	buckets_[bucket] = timer;
+}
+
+void TimingWheel::unlink(WheelTimer* timer) {
+	assert(timer->state == kPending);
+	int bucket = timer->bucket;
+	if (timer->prev) {
+		timer->prev->next = timer->next;
+	} else {
+		buckets_[bucket] = timer->next;
+	}
+	if (timer->next) {
+		timer->next->prev = timer->prev;
+	}
+	if (bucket < kRootSize && buckets_[bucket] == NULL) {
+		rootBitmap_[bucket / 64] &= ~(1ULL << (bucket % 64));
+	}
+	timer->prev = NULL;
+	timer->next = NULL;
+	timer->bucket = -1;
+}
+
+void TimingWheel::collect(int bucket) {
+	assert(bucket < kRootSize);
+	WheelTimer* timer = buckets_[bucket];
+	buckets_[bucket] = NULL;
+	rootBitmap_[bucket / 64] &= ~(1ULL << (bucket % 64));
+	while (timer) {
+		WheelTimer* next = timer->next;
+		timer->prev = NULL;
+		timer->next = NULL;
+		timer->bucket = -1;
+		timer->state = kExpired;
+		expired_.push_back(timer);
+		timer = next;
+	}
+}
+
+void TimingWheel::cascade() {
+	assert((currentTick_ & (kRootSize - 1)) == 0);
+	for (int level = 1; level < kLevels; ++level) {
+		int index = static_cast<int>((currentTick_ >> levelShift(level)) & (kLevelSize - 1));
+		int bucket = kRootSize + (level - 1) * kLevelSize + index;
+		WheelTimer* timer = buckets_[bucket];
+		buckets_[bucket] = NULL;
+		while (timer) {
+			WheelTimer* next = timer->next;
+			insert(timer);
+			timer = next;
+		}
+		// the upper level moves on only if this level wraps around
+		if (index != 0) {
+			break;
+		}
+	}
+}
+
+void TimingWheel::advance(uint64_t target) {
+	if (size_ == 0) {
+		currentTick_ = target + 1;
+		return;
+	}
+
+	while (currentTick_ <= target) {
+		int index = static_cast<int>(currentTick_ & (kRootSize - 1));
+		if (index == 0) {
+			cascade();
+		}
+		uint64_t base = currentTick_ - static_cast<uint64_t>(index);
+		int next = nextRootBucket(index);
+		if (next < 0) {
+			// empty till the next cascade
+			uint64_t wrap = base + kRootSize;
+			currentTick_ = wrap <= target ? wrap : target + 1;
+			continue;
+		}
+		uint64_t tick = base + static_cast<uint64_t>(next);
+		if (tick > target) {
+			currentTick_ = target + 1;
+			break;
+		}
+		collect(next);
+		currentTick_ = tick + 1;
+	}
+}
+
+int TimingWheel::nextRootBucket(int index) const {
+	for (int i = index / 64; i < kRootSize / 64; ++i) {
+		uint64_t bits = rootBitmap_[i];
+		if (i == index / 64) {
+			bits &= ~0ULL << (index % 64);
+		}
+		if (bits) {
+			return i * 64 + __builtin_ctzll(bits);
+		}
+	}
+	return -1;
+}
+
+bool TimingWheel::cascadesAt(uint64_t tick) const {
+	assert((tick & (kRootSize - 1)) == 0);
+	for (int level = 1; level < kLevels; ++level) {
+		int index = static_cast<int>((tick >> levelShift(level)) & (kLevelSize - 1));
+		if (buckets_[kRootSize + (level - 1) * kLevelSize + index]) {
+			return true;
+		}
+		if (index != 0) {
+			break;
+		}
+	}
+	return false;
+}
+
+uint64_t TimingWheel::nextTick() const {
+	int index = static_cast<int>(currentTick_ & (kRootSize - 1));
+	if (index == 0 && cascadesAt(currentTick_)) {
+		return currentTick_;
+	}
+	int next = nextRootBucket(index);
+	if (next >= 0) {
+		return currentTick_ - static_cast<uint64_t>(index) + static_cast<uint64_t>(next);
+	}
+
+	// timers in the buckets below index wrapped into the next round, they
+	// are due from the start of it
+	uint64_t tick = (currentTick_ | (kRootSize - 1)) + 1;
+	for (int i = 0; i < kRootSize / 64; ++i) {
+		if (rootBitmap_[i]) {
+			return tick;
+		}
+	}
+
+	// the lowest level is empty, looks for the cascade bringing timers down
+	// in one round of the second level, wakes up after it anyway.
+	for (int i = 0; i < kLevelSize; ++i, tick += kRootSize) {
+		if (cascadesAt(tick)) {
+			break;
+		}
+	}
+	return tick;
+}
+
+void TimingWheel::rearm() {
+	if (size_ == 0) {
+		// a stale alarm does nothing
+		return;
+	}
+	uint64_t tick = nextTick();
+	if (!armed_ || tick != armedTick_) {
+		scheduleAlarm(timeOf(tick));
+		armedTick_ = tick;
+		armed_ = true;
+	}
+}
+
+void TimingWheel::handleExpired(Timestamp now) {
+	// the alarm is one shot
+	armed_ = false;
+	advance(passedTickOf(now));
+
+	callingExpiredTimers_ = true;
+	for (size_t i = 0; i < expired_.size(); ++i) {
+		WheelTimer* timer = expired_[i];
+		// restarted or parked timers are not due yet
+		if (!timer->canceled && !(now < timer->expiration())) {
+			timer->run();
+		}
+	}
+	callingExpiredTimers_ = false;
+
+	for (size_t i = 0; i < expired_.size(); ++i) {
+		WheelTimer* timer = expired_[i];
+		if (timer->canceled) {
+			--size_;
+			freeTimer(timer);
+		} else if (now < timer->expiration()) {
+			timer->tick = tickOf(timer->expiration());
+			insert(timer);
+		} else if (timer->repeat()) {
+			timer->restart(now);
+			timer->tick = tickOf(timer->expiration());
+			insert(timer);
+		} else {
+			--size_;
+			freeTimer(timer);
+		}
+	}
+	expired_.clear();
+
+	rearm();
+}
+
+uint64_t TimingWheel::tickOf(Timestamp when) const {
+	int64_t microseconds = when.microSecondsFromEpoch() - start_.microSecondsFromEpoch();
+	if (microseconds <= 0) {
+		return 0;
+	}
+	return static_cast<uint64_t>((microseconds + kTickMicroSeconds - 1) / kTickMicroSeconds);
+}
+
+uint64_t TimingWheel::passedTickOf(Timestamp when) const {
+	int64_t microseconds = when.microSecondsFromEpoch() - start_.microSecondsFromEpoch();
+	if (microseconds <= 0) {
+		return 0;
+	}
+	return static_cast<uint64_t>(microseconds / kTickMicroSeconds);
+}
+
+Timestamp TimingWheel::timeOf(uint64_t tick) const {
+	return Timestamp(start_.microSecondsFromEpoch() + static_cast<int64_t>(tick) * kTickMicroSeconds);
+}
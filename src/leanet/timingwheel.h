@@ -0,0 +1,147 @@
+#ifndef LEANET_TIMINGWHEEL_H
+#define LEANET_TIMINGWHEEL_H
+
+#include <vector>
+#include <memory> // std::unique_ptr
+#include <stddef.h>
+#include <stdint.h>
+
+#include "timerqueue.h"
+#include "timer.h"
+#include "mutex.h"
+
+namespace leanet {
+
+//
+// Hierarchical timing wheel, O(1) add and cancel.
+//
+// Time is divided into ticks of kTickMicroSeconds, timers expire at the
+// first tick not earlier than their expiration. The wheel has five levels
+// like the classic Linux kernel timer wheel: 256 buckets of one tick, then
+// 4 levels of 64 buckets, each covers 64 times the span of its lower level,
+// 2^32 ticks(about 49 days) in total. Timers further than that are parked
+// in the last level and put back when they are reached.
+// Timers in higher levels cascade down when the lower level wraps around.
+//
+// A timer restarted later stays in its bucket, and is put into the bucket
+// of the new expiration when the old one is reached.
+//
+// The alarm is armed only for the next tick that has something to do:
+// the next non-empty bucket of the lowest level, or the next cascade.
+//
+// Timer objects are pooled and reused, TimerId stays safe because a
+// reused timer gets a new sequence.
+//
+class TimingWheel: public TimerQueue {
+public:
+	static const int64_t kTickMicroSeconds = 1000;
+
+	explicit TimingWheel(EventLoop* loop);
+	virtual ~TimingWheel();
+
+	virtual TimerId addTimer(const TimerCallback& cb, Timestamp when, double interval);
+	virtual void cancelTimer(TimerId timerid);
+	virtual void restartTimer(TimerId timerid, Timestamp when);
+
+	// pending timers, for testing
+	size_t size() const { return size_; }
+
+protected:
+	virtual void handleExpired(Timestamp now);
+
+private:
+	static const int kLevels = 5;
+	static const int kRootBits = 8;
+	static const int kLevelBits = 6;
+	static const int kRootSize = 1 << kRootBits;
+	static const int kLevelSize = 1 << kLevelBits;
+	static const int kNumBuckets = kRootSize + (kLevels - 1) * kLevelSize;
+	static const uint64_t kMaxTicks = (1ULL << (kRootBits + (kLevels - 1) * kLevelBits)) - 1;
+	static const size_t kTimersPerChunk = 256;
+
+	static int levelShift(int level) {
+		// level 0 is the root
+		return level == 0 ? 0 : kRootBits + (level - 1) * kLevelBits;
+	}
+
+	enum State {
+		kFree,
+		kPending, // in a bucket
+		kExpired // in expired_
+	};
+
+	struct WheelTimer: public Timer {
+		WheelTimer()
+			: prev(NULL),
+				next(NULL),
+				tick(0),
+				bucket(-1),
+				state(kFree),
+				canceled(false)
+		{ }
+
+		using Timer::reset;
+		using Timer::release;
+
+		// links in the bucket, or in the free list
+		WheelTimer* prev;
+		WheelTimer* next;
+		uint64_t tick;
+		int bucket;
+		State state;
+		bool canceled; // in expired_
+	};
+
+	// thread safe
+	WheelTimer* allocTimer(const TimerCallback& cb, Timestamp when, double interval);
+	void freeTimer(WheelTimer* timer);
+
+	void addTimerInLoop(WheelTimer* timer);
+	void cancelTimerInLoop(TimerId timerid);
+	void restartTimerInLoop(TimerId timerid, Timestamp when);
+
+	void insert(WheelTimer* timer);
+	void unlink(WheelTimer* timer);
+	// moves timers of the bucket to expired_
+	void collect(int bucket);
+	// re-inserts timers of a higher level bucket, when the lower level
+	// wraps around
+	void cascade();
+	// processes ticks until target(included)
+	void advance(uint64_t target);
+	// the next tick which has something to do
+	uint64_t nextTick() const;
+	void rearm();
+	// first non-empty bucket of the lowest level from index, -1 if none
+	int nextRootBucket(int index) const;
+	// whether timers cascade down at the tick
+	bool cascadesAt(uint64_t tick) const;
+
+	// first tick not earlier than when
+	uint64_t tickOf(Timestamp when) const;
+	// last tick not later than when
+	uint64_t passedTickOf(Timestamp when) const;
+	Timestamp timeOf(uint64_t tick) const;
+
+	const Timestamp start_;
+	// ticks before it have been processed
+	uint64_t currentTick_;
+	uint64_t armedTick_;
+	bool armed_;
+	size_t size_;
+	WheelTimer* buckets_[kNumBuckets];
+	// non-empty buckets of the lowest level
+	uint64_t rootBitmap_[kRootSize / 64];
+
+	std::vector<WheelTimer*> expired_;
+	bool callingExpiredTimers_;
+
+	// timers may be allocated in any thread
+	Mutex poolMutex_;
+	std::vector<std::unique_ptr<WheelTimer[]>> chunks_;
+	WheelTimer* freeList_;
+};
+
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef LEANET_WORKSTEALINGDEQUE_H
+#define LEANET_WORKSTEALINGDEQUE_H
+
+#include <stddef.h> // NULL
+#include <stdint.h>
+
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace leanet {
+
+//
+// Chase-Lev work-stealing deque of pointers, in the C11 memory model as in
+// "Correct and Efficient Work-Stealing for Weak Memory Models"(Le, Pop,
+// Cohen and Zappa Nardelli, PPoPP 2013).
+//
+// the owner thread pushes and pops at the bottom, LIFO, with no atomic
+// read-modify-write unless one item is left. other threads steal from
+// the top, FIFO, by a CAS on top.
+//
+// the circular array doubles when full. the old ones may still be read by
+// stealers, so they are kept until the deque is destroyed, which costs no
+// more than the last array.
+//
+// the deque doesn't own the items, the destructor drops those left.
+//
+template<typename T>
+class WorkStealingDeque: noncopyable {
+public:
+	explicit WorkStealingDeque(size_t initialCapacity = 64)
+		: top_(0),
+			bottom_(0),
+			array_(NULL),
+			retired_()
+	{
+		size_t n = 8;
+		while (n < initialCapacity) {
+			n *= 2;
+		}
+		array_ = new Array(n);
+	}
+
+	~WorkStealingDeque() {
+		delete array_;
+		for (size_t i = 0; i < retired_.size(); ++i) {
+			delete retired_[i];
+		}
+	}
+
+	// called by owner
+	void push(T* x) {
+		int64_t b = __atomic_load_n(&bottom_, __ATOMIC_RELAXED);
+		int64_t t = __atomic_load_n(&top_, __ATOMIC_ACQUIRE);
+		Array* a = __atomic_load_n(&array_, __ATOMIC_RELAXED);
+		if (b - t > static_cast<int64_t>(a->mask)) {
+			a = grow(a, t, b);
+		}
+		a->put(b, x);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		__atomic_store_n(&bottom_, b + 1, __ATOMIC_RELAXED);
+	}
+
+	// called by owner, NULL if empty
+	T* pop() {
+		int64_t b = __atomic_load_n(&bottom_, __ATOMIC_RELAXED) - 1;
+		Array* a = __atomic_load_n(&array_, __ATOMIC_RELAXED);
+		__atomic_store_n(&bottom_, b, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		int64_t t = __atomic_load_n(&top_, __ATOMIC_RELAXED);
+		T* x = NULL;
+		if (t <= b) {
+			x = a->get(b);
+			if (t == b) {
+				// the last one, raced with stealers
+				if (!__atomic_compare_exchange_n(&top_, &t, t + 1, false,
+							__ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+					x = NULL;
+				}
+				__atomic_store_n(&bottom_, b + 1, __ATOMIC_RELAXED);
+			}
+		} else {
+			__atomic_store_n(&bottom_, b + 1, __ATOMIC_RELAXED);
+		}
+		return x;
+	}
+
+	// called by any thread, NULL if empty or lost a race with another
+	// stealer or the owner
+	T* steal() {
+		int64_t t = __atomic_load_n(&top_, __ATOMIC_ACQUIRE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		int64_t b = __atomic_load_n(&bottom_, __ATOMIC_ACQUIRE);
+		if (t >= b) {
+			return NULL;
+		}
+		Array* a = __atomic_load_n(&array_, __ATOMIC_ACQUIRE);
+		T* x = a->get(t);
+		if (!__atomic_compare_exchange_n(&top_, &t, t + 1, false,
+					__ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			return NULL;
+		}
+		return x;
+	}
+
+	// racy, for statistics and hints
+	size_t size() const {
+		int64_t b = __atomic_load_n(&bottom_, __ATOMIC_RELAXED);
+		int64_t t = __atomic_load_n(&top_, __ATOMIC_RELAXED);
+		return b > t ? static_cast<size_t>(b - t) : 0;
+	}
+
+	bool empty() const {
+		return size() == 0;
+	}
+
+private:
+	struct Array {
+		explicit Array(size_t n)
+			: mask(n - 1),
+				items(new T*[n])
+		{ }
+
+		~Array() {
+			delete[] items;
+		}
+
+		T* get(int64_t i) const {
+			return __atomic_load_n(&items[static_cast<size_t>(i) & mask], __ATOMIC_RELAXED);
+		}
+
+		void put(int64_t i, T* x) {
+			__atomic_store_n(&items[static_cast<size_t>(i) & mask], x, __ATOMIC_RELAXED);
+		}
+
+		const size_t mask; // size - 1, size is a power of two
+		T** const items;
+	};
+
+	Array* grow(Array* a, int64_t t, int64_t b) {
+		Array* bigger = new Array(2 * (a->mask + 1));
+		for (int64_t i = t; i < b; ++i) {
+			bigger->put(i, a->get(i));
+		}
+		retired_.push_back(a);
+		__atomic_store_n(&array_, bigger, __ATOMIC_RELEASE);
+		return bigger;
+	}
+
+	static const size_t kCacheLineSize = 64;
+
+	// stealers side
+	int64_t top_;
+	char padding_[kCacheLineSize - sizeof(int64_t)];
+	// owner side
+	int64_t bottom_;
+	Array* array_;
+	// owner only
+	std::vector<Array*> retired_;
+};
+
+} // namespace leanet
+
+#endif // LEANET_WORKSTEALINGDEQUE_H
@@ -0,0 +1,269 @@
+#include "workstealingpool.h"
+#include "workstealingdeque.h"
+#include "thread.h"
+#include "condition.h"
+
+#include <assert.h>
+#include <sched.h> // sched_yield
+#include <stdio.h> // snprintf
+
+#include <algorithm> // std::find
+
+using namespace leanet;
+
+namespace {
+
+// rounds a worker out of tasks looks for them before it parks
+const int kSearchRounds = 64;
+
+// the pool and the worker of the current thread
+__thread const void* t_pool = NULL;
+__thread int t_workerIndex = -1;
+
+}
+
+struct WorkStealingPool::Worker {
+	Worker(Mutex& idleMutex, int workerIndex)
+		: deque(),
+			thread(),
+			index(workerIndex),
+			seed(static_cast<uint32_t>(workerIndex) * 2654435761u + 1),
+			idle(false),
+			wake(idleMutex)
+	{ }
+
+	// the victim to steal from first, xorshift
+	size_t nextVictim(size_t n) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		return seed % n;
+	}
+
+	WorkStealingDeque<Task> deque;
+	std::unique_ptr<Thread> thread;
+	const int index;
+	uint32_t seed;
+	// guarded by idleMutex_, cleared by whom wakes it up
+	bool idle;
+	Condition wake;
+};
+
+WorkStealingPool::WorkStealingPool(const std::string& nameArg)
+	: name_(nameArg),
+		threadInitCallback_(),
+		workers_(),
+		running_(false),
+		injectMutex_(),
+		injected_(),
+		numInjected_(0),
+		numSearching_(0),
+		idleMutex_(),
+		idle_(),
+		numIdle_(0)
+{ }
+
+WorkStealingPool::~WorkStealingPool() {
+	if (running_) {
+		stop();
+	}
+}
+
+void WorkStealingPool::start(int numThreads) {
+	assert(workers_.empty());
+	running_ = true;
+
+	// all of them before any steals
+	for (int i = 0; i < numThreads; ++i) {
+		workers_.push_back(std::unique_ptr<Worker>(new Worker(idleMutex_, i)));
+	}
+	for (int i = 0; i < numThreads; ++i) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%d", i+1);
+		Worker* worker = workers_[i].get();
+		worker->thread.reset(new Thread(
+					std::bind(&WorkStealingPool::runInThread, this, worker), name_ + buf));
+		worker->thread->start();
+	}
+
+	if (numThreads == 0 && threadInitCallback_) {
+		threadInitCallback_();
+	}
+}
+
+void WorkStealingPool::stop() {
+	{
+	MutexLock lock(idleMutex_);
+	__atomic_store_n(&running_, false, __ATOMIC_SEQ_CST);
+	for (size_t i = 0; i < idle_.size(); ++i) {
+		idle_[i]->idle = false;
+		idle_[i]->wake.wakeOne();
+	}
+	idle_.clear();
+	numIdle_ = 0;
+	}
+
+	for (size_t i = 0; i < workers_.size(); ++i) {
+		workers_[i]->thread->join();
+	}
+	workers_.clear();
+}
+
+size_t WorkStealingPool::queueSize() const {
+	size_t n = __atomic_load_n(&numInjected_, __ATOMIC_RELAXED);
+	for (size_t i = 0; i < workers_.size(); ++i) {
+		n += workers_[i]->deque.size();
+	}
+	return n;
+}
+
+void WorkStealingPool::run(const Task& task) {
+	if (workers_.empty()) {
+		task();
+		return;
+	}
+
+	Task* t = new Task(task);
+	if (t_pool == this) {
+		workers_[t_workerIndex]->deque.push(t);
+	} else {
+		MutexLock lock(injectMutex_);
+		injected_.push_back(t);
+		__atomic_store_n(&numInjected_, injected_.size(), __ATOMIC_RELAXED);
+	}
+	notify();
+}
+
+void WorkStealingPool::runInThread(Worker* worker) {
+	t_pool = this;
+	t_workerIndex = worker->index;
+	if (threadInitCallback_) {
+		threadInitCallback_();
+	}
+
+	for (;;) {
+		Task* task = take(worker);
+		if (task) {
+			(*task)();
+			delete task;
+		} else if (!park(worker)) {
+			break;
+		}
+	}
+	t_pool = NULL;
+}
+
+WorkStealingPool::Task* WorkStealingPool::take(Worker* worker) {
+	Task* task = worker->deque.pop();
+	if (task == NULL) {
+		task = takeInjected();
+	}
+	if (task) {
+		return task;
+	}
+
+	// while searching, run() wakes no one
+	__atomic_add_fetch(&numSearching_, 1, __ATOMIC_SEQ_CST);
+	for (int i = 0; i < kSearchRounds; ++i) {
+		task = takeInjected();
+		if (task == NULL) {
+			task = steal(worker);
+		}
+		if (task) {
+			// the last one searching wakes another for the rest
+			if (__atomic_sub_fetch(&numSearching_, 1, __ATOMIC_SEQ_CST) == 0 && hasTasks()) {
+				notify();
+			}
+			return task;
+		}
+		::sched_yield();
+	}
+	__atomic_sub_fetch(&numSearching_, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+WorkStealingPool::Task* WorkStealingPool::takeInjected() {
+	if (__atomic_load_n(&numInjected_, __ATOMIC_RELAXED) == 0) {
+		return NULL;
+	}
+	MutexLock lock(injectMutex_);
+	if (injected_.empty()) {
+		return NULL;
+	}
+	Task* task = injected_.front();
+	injected_.pop_front();
+	__atomic_store_n(&numInjected_, injected_.size(), __ATOMIC_RELAXED);
+	return task;
+}
+
+WorkStealingPool::Task* WorkStealingPool::steal(Worker* worker) {
+	const size_t n = workers_.size();
+	const size_t first = worker->nextVictim(n);
+	for (size_t i = 0; i < n; ++i) {
+		Worker* victim = workers_[(first + i) % n].get();
+		if (victim != worker) {
+			Task* task = victim->deque.steal();
+			if (task) {
+				return task;
+			}
+		}
+	}
+	return NULL;
+}
+
+bool WorkStealingPool::hasTasks() const {
+	if (__atomic_load_n(&numInjected_, __ATOMIC_RELAXED) > 0) {
+		return true;
+	}
+	for (size_t i = 0; i < workers_.size(); ++i) {
+		if (!workers_[i]->deque.empty()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool WorkStealingPool::park(Worker* worker) {
+	MutexLock lock(idleMutex_);
+	if (!__atomic_load_n(&running_, __ATOMIC_SEQ_CST)) {
+		// stopped, runs what is left
+		return hasTasks();
+	}
+
+	// counted as idle before checking for tasks: a task queued before
+	// run() sees the count is seen here, the ones after are notified
+	worker->idle = true;
+	idle_.push_back(worker);
+	__atomic_add_fetch(&numIdle_, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (hasTasks()) {
+		worker->idle = false;
+		idle_.erase(std::find(idle_.begin(), idle_.end(), worker));
+		__atomic_sub_fetch(&numIdle_, 1, __ATOMIC_SEQ_CST);
+		return true;
+	}
+
+	while (worker->idle) {
+		worker->wake.wait();
+	}
+	return true;
+}
+
+void WorkStealingPool::notify() {
+	// pairs with the fence in park(): either the task is seen there, or the
+	// parked worker is seen here
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&numSearching_, __ATOMIC_RELAXED) > 0 ||
+			__atomic_load_n(&numIdle_, __ATOMIC_RELAXED) == 0) {
+		return;
+	}
+
+	MutexLock lock(idleMutex_);
+	if (!idle_.empty()) {
+		Worker* worker = idle_.back();
+		idle_.pop_back();
+		__atomic_sub_fetch(&numIdle_, 1, __ATOMIC_SEQ_CST);
+		worker->idle = false;
+		worker->wake.wakeOne();
+	}
+}
@@ -0,0 +1,97 @@
+#ifndef LEANET_WORKSTEALINGPOOL_H
+#define LEANET_WORKSTEALINGPOOL_H
+
+#include <stddef.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "noncopyable.h"
+#include "mutex.h"
+#include "future.h"
+
+namespace leanet {
+
+//
+// thread pool for CPU-bound tasks offloaded from the loops, with the
+// run() of ThreadPool but no lock shared by every task.
+//
+// every worker has a WorkStealingDeque: tasks run in a worker go to its
+// own deque, the others to an injection queue under a mutex. a worker
+// takes from its deque, then the injection queue, then steals from the
+// other workers. out of tasks, it keeps searching for a while before it
+// parks, and run() wakes one parked worker only if no worker is
+// searching, so a burst of tasks doesn't wake every worker to fight over
+// each.
+//
+// the queue is not bounded. stop() runs the tasks queued before it.
+//
+class WorkStealingPool: noncopyable {
+public:
+	typedef std::function<void ()> Task;
+
+	explicit WorkStealingPool(const std::string& name = std::string("WorkStealingPool"));
+	~WorkStealingPool();
+
+	void setThreadInitCallback(const Task& cb)
+	{ threadInitCallback_ = cb; }
+
+	// tasks are run in the calling thread if numThreads is 0
+	void start(int numThreads);
+	// not in a worker
+	void stop();
+
+	const std::string& name() const
+	{ return name_; }
+
+	// tasks not started, racy
+	size_t queueSize() const;
+
+	// thread safe
+	void run(const Task& task);
+
+	// runs f() as run() does, its result comes by the future returned
+	template<typename F>
+	Future<typename std::result_of<F()>::type> submit(F f)
+	{ return submitTo(this, std::move(f)); }
+
+private:
+	struct Worker;
+
+	void runInThread(Worker* worker);
+	// from the deque of worker, the injection queue or other workers,
+	// NULL if none after searching for a while
+	Task* take(Worker* worker);
+	Task* takeInjected();
+	Task* steal(Worker* worker);
+	// a task may be queued
+	bool hasTasks() const;
+	// waits for a task queued, false if stopped and none is left
+	bool park(Worker* worker);
+	// wakes a parked worker if no worker is searching
+	void notify();
+
+	std::string name_;
+	Task threadInitCallback_;
+	std::vector<std::unique_ptr<Worker>> workers_;
+	bool running_;
+
+	mutable Mutex injectMutex_;
+	std::deque<Task*> injected_;
+	// read without injectMutex_
+	size_t numInjected_;
+
+	// workers not parked and looking for tasks
+	int numSearching_;
+	// guards the parked workers
+	Mutex idleMutex_;
+	std::vector<Worker*> idle_;
+	int numIdle_;
+};
+
+}
+
+#endif // LEANET_WORKSTEALINGPOOL_H
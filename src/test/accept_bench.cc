@@ -0,0 +1,120 @@
+//
+// accept rate of Acceptor under a storm of connections, by the budget of
+// accepts per wakeup. client threads connect and close as fast as they can
+// for `seconds`, the acceptor closes what it accepts.
+//
+// budget 1 is one poll round trip per connection, a larger budget takes
+// what is pending on every wakeup.
+//
+// usage: accept_bench [clients [seconds]]
+//
+#include <leanet/eventloop.h>
+#include <leanet/eventloopthread.h>
+#include <leanet/acceptor.h>
+#include <leanet/inetaddress.h>
+#include <leanet/sockets.h>
+#include <leanet/thread.h>
+#include <leanet/timestamp.h>
+#include <leanet/atomic.h>
+#include <leanet/countdownlatch.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <vector>
+
+using namespace leanet;
+
+namespace {
+
+AtomicInt32 g_stop;
+
+void onNewConnection(int sockfd, const InetAddress&) {
+	sockets::close(sockfd);
+}
+
+void connectLoop(uint16_t port) {
+	struct sockaddr_in sa;
+	::memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(port);
+	while (g_stop.get() == 0) {
+		int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0) {
+			perror("socket");
+			abort();
+		}
+		// refused when the backlog is full, tried again
+		::connect(fd, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa));
+		::close(fd);
+	}
+}
+
+void startAcceptor(Acceptor* acceptor, int budget) {
+	acceptor->setAcceptBudget(budget);
+	acceptor->setNewConnectionCallback(onNewConnection);
+	acceptor->listen();
+}
+
+void stopAcceptor(std::unique_ptr<Acceptor>* acceptor, CountdownLatch* latch) {
+	acceptor->reset();
+	latch->countDown();
+}
+
+void bench(int budget, int clients, double seconds) {
+	EventLoopThread loopThread;
+	EventLoop* loop = loopThread.startLoop();
+	std::unique_ptr<Acceptor> acceptor(new Acceptor(loop, InetAddress(0, true)));
+	loop->runInLoop(std::bind(startAcceptor, acceptor.get(), budget));
+
+	g_stop.getAndSet(0);
+	std::vector<std::unique_ptr<Thread>> threads;
+	for (int i = 0; i < clients; ++i) {
+		threads.push_back(std::unique_ptr<Thread>(
+					new Thread(std::bind(connectLoop, acceptor->localAddress().port()), "client")));
+		threads.back()->start();
+	}
+	Timestamp start(Timestamp::now());
+	::usleep(static_cast<useconds_t>(seconds * 1e6));
+	g_stop.getAndSet(1);
+	for (size_t i = 0; i < threads.size(); ++i) {
+		threads[i]->join();
+	}
+	double elapsed = timeDifference(Timestamp::now(), start);
+
+	AcceptStats stats(acceptor->stats());
+	printf("budget %4d %10.0f accepts/s %8.2f accepts/wakeup %6ld dropped %6ld errors\n",
+			budget,
+			static_cast<double>(stats.accepted) / elapsed,
+			stats.wakeups > 0 ? static_cast<double>(stats.accepted) / static_cast<double>(stats.wakeups) : 0.0,
+			static_cast<long>(stats.dropped),
+			static_cast<long>(stats.errors));
+	// destroyed in its loop
+	CountdownLatch latch(1);
+	loop->runInLoop(std::bind(stopAcceptor, &acceptor, &latch));
+	latch.wait();
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	int clients = argc > 1 ? atoi(argv[1]) : 4;
+	double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+	if (clients <= 0 || seconds <= 0) {
+		fprintf(stderr, "usage: %s [clients [seconds]]\n", argv[0]);
+		return 1;
+	}
+
+	printf("clients = %d, %.1f s\n", clients, seconds);
+	const int budgets[] = { 1, 4, Acceptor::kDefaultAcceptBudget, 256 };
+	for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); ++i) {
+		bench(budgets[i], clients, seconds);
+	}
+	return 0;
+}
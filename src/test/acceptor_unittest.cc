@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+#include <leanet/eventloop.h>
+#include <leanet/acceptor.h>
+#include <leanet/inetaddress.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vector>
+
+using namespace leanet;
+
+namespace {
+
+int connectTo(const InetAddress& addr) {
+  struct sockaddr_in sa;
+  ::memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sa.sin_port = htons(addr.port());
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  EXPECT_EQ(0, ::connect(fd, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)));
+  return fd;
+}
+
+}
+
+namespace {
+
+void testBudget(EventLoop::PollerType type) {
+  EventLoop loop(type);
+  Acceptor acceptor(&loop, InetAddress(0, true));
+  std::vector<int> accepted;
+  acceptor.setNewConnectionCallback([&accepted, &loop](int sockfd, const InetAddress&) {
+    accepted.push_back(sockfd);
+    if (accepted.size() == 10) {
+      loop.quit();
+    }
+  });
+  acceptor.setAcceptBudget(4);
+  acceptor.listen();
+
+  // all pending before the loop wakes up, accepted 4 + 4 + 2, by readable
+  // events or by 4 accepts submitted at once
+  std::vector<int> clients;
+  for (int i = 0; i < 10; ++i) {
+    clients.push_back(connectTo(acceptor.localAddress()));
+  }
+  loop.loop();
+
+  AcceptStats stats(acceptor.stats());
+  EXPECT_EQ(10, stats.accepted);
+  EXPECT_EQ(3, stats.wakeups);
+  EXPECT_EQ(2, stats.budgetExhausted);
+  EXPECT_EQ(0, stats.dropped);
+  for (size_t i = 0; i < clients.size(); ++i) {
+    ::close(clients[i]);
+    ::close(accepted[i]);
+  }
+}
+
+void testOutOfFds(EventLoop::PollerType type) {
+  EventLoop loop(type);
+  Acceptor acceptor(&loop, InetAddress(0, true));
+  int accepted = 0;
+  acceptor.setNewConnectionCallback([&accepted](int sockfd, const InetAddress&) {
+    ++accepted;
+    ::close(sockfd);
+  });
+  acceptor.listen();
+  std::vector<int> clients;
+  for (int i = 0; i < 5; ++i) {
+    clients.push_back(connectTo(acceptor.localAddress()));
+  }
+
+  // no fd can be opened but the one reserved by acceptor
+  struct rlimit saved;
+  ASSERT_EQ(0, ::getrlimit(RLIMIT_NOFILE, &saved));
+  int lowest = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+  ASSERT_GE(lowest, 0);
+  ::close(lowest);
+  struct rlimit limit = saved;
+  limit.rlim_cur = static_cast<rlim_t>(lowest);
+  ASSERT_EQ(0, ::setrlimit(RLIMIT_NOFILE, &limit));
+
+  // the pending connections are dropped instead of waking the loop up
+  // again and again, submitted accepts fail at once without fds and wait
+  // for readable events instead
+  loop.runAfter(0.1, std::bind(&EventLoop::quit, &loop));
+  loop.loop();
+  ASSERT_EQ(0, ::setrlimit(RLIMIT_NOFILE, &saved));
+
+  AcceptStats stats(acceptor.stats());
+  EXPECT_EQ(0, accepted);
+  EXPECT_EQ(5, stats.dropped);
+  EXPECT_LE(stats.wakeups, 2);
+  char buf[16];
+  for (size_t i = 0; i < clients.size(); ++i) {
+    EXPECT_GE(0, ::read(clients[i], buf, sizeof(buf)));
+    ::close(clients[i]);
+  }
+
+  // and accepted again when there are fds
+  int client = connectTo(acceptor.localAddress());
+  loop.runAfter(0.1, std::bind(&EventLoop::quit, &loop));
+  loop.loop();
+  EXPECT_EQ(1, accepted);
+  ::close(client);
+}
+
+}
+
+TEST(ACCEPTOR_TEST, BUDGET) {
+  testBudget(EventLoop::kDefaultPoller);
+  // falls back to epoll(4) if unsupported
+  testBudget(EventLoop::kIoUringPoller);
+}
+
+TEST(ACCEPTOR_TEST, OUT_OF_FDS) {
+  testOutOfFds(EventLoop::kDefaultPoller);
+  testOutOfFds(EventLoop::kIoUringPoller);
+}
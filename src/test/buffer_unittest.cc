@@ -1 +1,176 @@
 #include <gtest/gtest.h>
+#include <leanet/buffer.h>
+#include <leanet/bufferpool.h>
+#include <leanet/thread.h>
+#include <leanet/readsizer.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace leanet;
+
+TEST(BUFFER_TEST, READ_FD_SPILL) {
+  int sv[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv));
+  const std::string data(3000, 'r');
+  ASSERT_EQ(3000, ::write(sv[1], data.data(), data.size()));
+
+  // the rest is left in socket without spill
+  Buffer buffer(1000);
+  int savedErrno = 0;
+  EXPECT_EQ(1000, buffer.readFd(sv[0], NULL, 0, &savedErrno));
+  EXPECT_EQ(0u, buffer.writableBytes());
+
+  // and is appended from spill
+  char spill[4096];
+  EXPECT_EQ(2000, buffer.readFd(sv[0], spill, sizeof(spill), &savedErrno));
+  EXPECT_EQ(3000u, buffer.readableBytes());
+  EXPECT_TRUE(buffer.retrieveAllAsString() == data);
+
+  EXPECT_EQ(-1, buffer.readFd(sv[0], spill, sizeof(spill), &savedErrno));
+  EXPECT_EQ(EAGAIN, savedErrno);
+  ::close(sv[0]);
+  ::close(sv[1]);
+}
+
+TEST(BUFFER_TEST, SHRINK) {
+  Buffer buffer(0);
+  EXPECT_EQ(0u, buffer.writableBytes());
+  buffer.append(std::string(100000, 's'));
+  buffer.retrieve(99990);
+  buffer.shrink(100);
+  EXPECT_EQ(10u, buffer.readableBytes());
+  EXPECT_GE(buffer.writableBytes(), 100u);
+  EXPECT_LT(buffer.internalCapacity(), 1000u);
+  EXPECT_TRUE(buffer.retrieveAllAsString() == std::string(10, 's'));
+}
+
+TEST(BUFFER_TEST, READ_SIZER) {
+  const size_t kMinSize = ReadSizer::kMinSize;
+  const size_t kInitialSize = ReadSizer::kInitialSize;
+  const size_t kMaxSize = ReadSizer::kMaxSize;
+  ReadSizer sizer;
+  EXPECT_EQ(kInitialSize, sizer.size());
+
+  // grows at once when a read fills the guess
+  sizer.record(kInitialSize);
+  EXPECT_EQ(4 * kInitialSize, sizer.size());
+  for (int i = 0; i < 20; ++i) {
+    sizer.record(sizer.size());
+  }
+  EXPECT_EQ(kMaxSize, sizer.size());
+
+  // shrinks after two small reads in a row
+  sizer.record(100);
+  EXPECT_EQ(kMaxSize, sizer.size());
+  sizer.record(kMaxSize * 3 / 4);
+  sizer.record(100);
+  EXPECT_EQ(kMaxSize, sizer.size());
+  sizer.record(100);
+  EXPECT_EQ(kMaxSize / 2, sizer.size());
+  for (int i = 0; i < 100; ++i) {
+    sizer.record(1);
+  }
+  EXPECT_EQ(kMinSize, sizer.size());
+}
+
+TEST(BUFFER_TEST, POOL) {
+  std::shared_ptr<BufferPool> pool(std::make_shared<BufferPool>());
+
+  // rounded up to the size class, reused once freed
+  size_t size = 3000;
+  char* block = pool->allocate(&size);
+  EXPECT_EQ(4096u, size);
+  pool->deallocate(block, size);
+  size = 4096;
+  EXPECT_EQ(block, pool->allocate(&size));
+  pool->deallocate(block, size);
+  BufferPool::Stats stats = pool->stats();
+  EXPECT_EQ(2, stats.allocations);
+  EXPECT_EQ(1, stats.reuses);
+  EXPECT_EQ(static_cast<int64_t>(BufferPool::kSlabSize), stats.reservedBytes);
+  EXPECT_EQ(0, stats.usedBytes);
+
+  // a pooled buffer holds memory from the first write until shrunk
+  {
+  Buffer buffer(0, pool);
+  EXPECT_EQ(0u, buffer.internalCapacity());
+  buffer.prependInt32(7);
+  buffer.append(std::string(10000, 'p'));
+  EXPECT_GT(pool->stats().usedBytes, 10000);
+  Buffer copy(buffer);
+  EXPECT_EQ(7, copy.readInt32());
+  EXPECT_EQ(10000u, copy.readableBytes());
+  // drained, what was peeked is still there
+  const char* data = copy.peek();
+  copy.retrieveAll();
+  EXPECT_GT(copy.internalCapacity(), 0u);
+  EXPECT_EQ('p', data[9999]);
+  copy.shrink(0);
+  EXPECT_EQ(0u, copy.internalCapacity());
+  buffer.retrieve(buffer.readableBytes());
+  buffer.append("again", 5);
+  EXPECT_TRUE(buffer.retrieveAllAsString() == "again");
+  buffer.shrink(0);
+  EXPECT_EQ(0, pool->stats().usedBytes);
+  }
+  EXPECT_EQ(0, pool->stats().usedBytes);
+
+  // freed in another thread, taken back by the next allocation
+  size = 512;
+  block = pool->allocate(&size);
+  Thread thread([&pool, block, size]() { pool->deallocate(block, size); });
+  thread.start();
+  thread.join();
+  EXPECT_EQ(1, pool->stats().remoteFrees);
+  EXPECT_EQ(block, pool->allocate(&size));
+  pool->deallocate(block, size);
+
+  // larger than the classes, not pooled
+  size = BufferPool::kMaxBlockSize + 1;
+  block = pool->allocate(&size);
+  pool->deallocate(block, size);
+  EXPECT_EQ(1, pool->stats().largeAllocations);
+}
+
+TEST(BUFFER_TEST, POOL_TRIM) {
+  BufferPool pool;
+  const int64_t kMaxCached = 4 * BufferPool::kSlabSize;
+  pool.setMaxCachedBytes(kMaxCached);
+
+  // a burst of small and slab sized blocks
+  std::vector<std::pair<char*, size_t>> blocks;
+  for (int i = 0; i < 1024; ++i) {
+    size_t size = i % 8 == 0 ? BufferPool::kSlabSize : 1000;
+    blocks.push_back(std::make_pair(pool.allocate(&size), size));
+  }
+  const int64_t peak = pool.stats().reservedBytes;
+  // one kept in the first slab of 1KB blocks keeps it
+  for (size_t i = 1; i < blocks.size(); ++i) {
+    pool.deallocate(blocks[i].first, blocks[i].second);
+  }
+  // cached until trimmed, by the loop
+  BufferPool::Stats stats = pool.stats();
+  EXPECT_EQ(peak, stats.reservedBytes);
+  pool.trim();
+  stats = pool.stats();
+  EXPECT_LE(stats.cachedBytes, kMaxCached);
+  EXPECT_LT(stats.reservedBytes, peak);
+  EXPECT_EQ(static_cast<int64_t>(blocks[0].second), stats.usedBytes);
+
+  // freed blocks are still served
+  size_t size = 1000;
+  char* block = pool.allocate(&size);
+  block[0] = 'x';
+  pool.deallocate(block, size);
+
+  pool.deallocate(blocks[0].first, blocks[0].second);
+  pool.trim(true);
+  stats = pool.stats();
+  EXPECT_EQ(0, stats.cachedBytes);
+  EXPECT_EQ(0, stats.reservedBytes);
+}
@@ -0,0 +1,224 @@
+#include <gtest/gtest.h>
+#include <leanet/bufferchain.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include <string>
+
+using namespace leanet;
+
+namespace {
+
+std::string drain(int fd) {
+  std::string result;
+  char buf[65536];
+  ssize_t n;
+  while ((n = ::read(fd, buf, sizeof(buf))) > 0) {
+    result.append(buf, static_cast<size_t>(n));
+  }
+  return result;
+}
+
+// connected nonblocking loopback TCP sockets
+void tcpPair(int sv[2]) {
+  int listenfd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_in addr;
+  ::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addrlen = sizeof(addr);
+  ASSERT_EQ(0, ::bind(listenfd, reinterpret_cast<struct sockaddr*>(&addr), addrlen));
+  ASSERT_EQ(0, ::listen(listenfd, 1));
+  ASSERT_EQ(0, ::getsockname(listenfd, reinterpret_cast<struct sockaddr*>(&addr), &addrlen));
+  sv[1] = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  ASSERT_EQ(0, ::connect(sv[1], reinterpret_cast<struct sockaddr*>(&addr), addrlen));
+  ::fcntl(sv[1], F_SETFL, O_NONBLOCK);
+  sv[0] = ::accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  ASSERT_GE(sv[0], 0);
+  ::close(listenfd);
+}
+
+}
+
+TEST(BUFFERCHAIN_TEST, APPEND) {
+  BufferChain chain;
+  EXPECT_TRUE(chain.empty());
+
+  // small appends share a block
+  chain.append("hello", 5);
+  chain.append(StringView(" world"));
+  EXPECT_EQ(11u, chain.readableBytes());
+  EXPECT_EQ(1u, chain.numSegments());
+
+  // fills the tail block, then one block for the rest
+  std::string large(2 * BufferChain::kBlockSize, 'x');
+  chain.append(large.data(), large.size());
+  EXPECT_EQ(11u + large.size(), chain.readableBytes());
+  EXPECT_EQ(2u, chain.numSegments());
+
+  struct iovec iov[4];
+  ASSERT_EQ(2, chain.peek(iov, 4));
+  EXPECT_EQ(BufferChain::kBlockSize, iov[0].iov_len);
+  EXPECT_EQ(0, ::memcmp(iov[0].iov_base, "hello world", 11));
+
+  chain.retrieve(6);
+  ASSERT_EQ(2, chain.peek(iov, 4));
+  EXPECT_EQ(0, ::memcmp(iov[0].iov_base, "world", 5));
+  chain.retrieveAll();
+  EXPECT_TRUE(chain.empty());
+  EXPECT_EQ(0u, chain.numSegments());
+}
+
+TEST(BUFFERCHAIN_TEST, SLICE) {
+  int released = 0;
+  const std::string data(1000, 'd');
+  {
+  BufferChain chain;
+  chain.append("head", 4);
+  chain.appendSlice(data.data(), data.size(), [&released]() { ++released; });
+  std::shared_ptr<std::string> owner(new std::string(data));
+  chain.appendSlice(owner->data(), owner->size(), owner);
+  chain.append("tail", 4);
+  EXPECT_EQ(4u, chain.numSegments());
+  EXPECT_EQ(2008u, chain.readableBytes());
+  EXPECT_EQ(2, owner.use_count());
+
+  // not copied
+  struct iovec iov[4];
+  ASSERT_EQ(4, chain.peek(iov, 4));
+  EXPECT_EQ(data.data(), iov[1].iov_base);
+  EXPECT_EQ(owner->data(), iov[2].iov_base);
+
+  // partially written slice is not released
+  chain.retrieve(4 + 500);
+  EXPECT_EQ(0, released);
+  chain.retrieve(500);
+  EXPECT_EQ(1, released);
+  EXPECT_EQ(1004u, chain.readableBytes());
+  chain.retrieve(1000);
+  EXPECT_EQ(1, owner.use_count());
+
+  // small slices are copied and released at once
+  char small[] = "small";
+  chain.appendSlice(small, 5, [&released]() { ++released; });
+  EXPECT_EQ(2, released);
+  small[0] = 'S';
+  ASSERT_EQ(1, chain.peek(iov, 4));
+  EXPECT_EQ(0, ::memcmp(iov[0].iov_base, "tailsmall", 9));
+
+  chain.appendSlice(data.data(), data.size(), [&released]() { ++released; });
+  }
+  // released when the chain is destroyed
+  EXPECT_EQ(3, released);
+}
+
+TEST(BUFFERCHAIN_TEST, WRITE_FD) {
+  int sv[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv));
+
+  // more segments than IOV_MAX, more bytes than the socket buffer
+  BufferChain chain;
+  std::string expected;
+  std::string block(BufferChain::kBlockSize, 'a');
+  for (int i = 0; i < 2000; ++i) {
+    block[0] = static_cast<char>('a' + i % 26);
+    if (i % 2 == 0) {
+      chain.append(block.data(), block.size());
+    } else {
+      static const std::string kSlice(BufferChain::kMinSliceSize, 's');
+      chain.appendSlice(kSlice.data(), kSlice.size(), ReleaseCallback());
+      expected += kSlice;
+      continue;
+    }
+    expected += block;
+  }
+
+  std::string received;
+  while (!chain.empty()) {
+    int savedErrno = 0;
+    ssize_t n = chain.writeFd(sv[0], &savedErrno);
+    if (n < 0) {
+      ASSERT_EQ(EAGAIN, savedErrno);
+    }
+    received += drain(sv[1]);
+  }
+  EXPECT_EQ(expected.size(), received.size());
+  EXPECT_TRUE(expected == received);
+
+  ::close(sv[0]);
+  ::close(sv[1]);
+}
+
+TEST(BUFFERCHAIN_TEST, ZERO_COPY) {
+  int sv[2];
+  tcpPair(sv);
+  int on = 1;
+  if (::setsockopt(sv[0], SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+    ::close(sv[0]);
+    ::close(sv[1]);
+    return;
+  }
+
+  int released = 0;
+  const std::string large(256 * 1024, 'z');
+  const size_t kThreshold = 64 * 1024;
+  std::string expected;
+  {
+  BufferChain chain;
+  chain.setZeroCopyThreshold(kThreshold);
+  EXPECT_TRUE(chain.isZeroCopy(kThreshold));
+  EXPECT_FALSE(chain.isZeroCopy(kThreshold - 1));
+
+  // small slices and copies are written as usual
+  const std::string small(kThreshold / 2, 's');
+  chain.append("head", 4);
+  chain.appendSlice(large.data(), large.size(), [&released]() { ++released; });
+  chain.appendSlice(small.data(), small.size(), [&released]() { ++released; });
+  chain.appendSlice(large.data(), large.size(), [&released]() { ++released; });
+  expected = "head" + large + small + large;
+
+  std::string received;
+  while (!chain.empty()) {
+    int savedErrno = 0;
+    ssize_t n = chain.writeFd(sv[0], &savedErrno);
+    if (n < 0) {
+      ASSERT_EQ(EAGAIN, savedErrno);
+    }
+    received += drain(sv[1]);
+  }
+  while (received.size() < expected.size()) {
+    received += drain(sv[1]);
+  }
+  EXPECT_TRUE(expected == received);
+  EXPECT_GT(chain.zeroCopySends(), 0);
+  // only the copied small slice is released before completions
+  EXPECT_EQ(1, released);
+  EXPECT_EQ(2u, chain.zeroCopyPending());
+
+  while (chain.zeroCopyPending() > 0) {
+    struct pollfd pfd = { sv[0], 0, 0 };
+    ASSERT_EQ(1, ::poll(&pfd, 1, 1000));
+    ASSERT_TRUE(pfd.revents & POLLERR);
+    int savedErrno = 0;
+    EXPECT_GT(chain.handleZeroCopyCompletions(sv[0], &savedErrno), 0);
+  }
+  EXPECT_EQ(3, released);
+  // loopback copies to the receiver after all
+  EXPECT_LE(chain.zeroCopyCopied(), chain.zeroCopySends());
+
+  // released when the chain is destroyed, even if sends are not completed,
+  // TcpConnection waits for them or resets the connection before
+  chain.appendSlice(large.data(), large.size(), [&released]() { ++released; });
+  int savedErrno = 0;
+  chain.writeFd(sv[0], &savedErrno);
+  }
+  EXPECT_EQ(4, released);
+
+  ::close(sv[0]);
+  ::close(sv[1]);
+}
@@ -0,0 +1,165 @@
+//
+// connection churn: connections opened and closed per second by TcpServer,
+// and the cost of keeping them by name in a std::map as TcpServer did
+// before, against ConnectionRegistry by id.
+//
+// the registry part adds and removes `live` connections in turn, as a busy
+// server does. the server part runs client threads which connect, wait for
+// the server to shut the connection down as soon as it is up, and close,
+// for `seconds`. a connection is counted when the server has removed it.
+//
+// usage: churn_bench [maxThreads [clients [seconds [live]]]]
+//
+#include <leanet/eventloop.h>
+#include <leanet/tcpserver.h>
+#include <leanet/tcpconnection.h>
+#include <leanet/connectionregistry.h>
+#include <leanet/inetaddress.h>
+#include <leanet/thread.h>
+#include <leanet/timestamp.h>
+#include <leanet/atomic.h>
+#include <leanet/logger.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace leanet;
+
+namespace {
+
+const int kRegistryOps = 1000000;
+
+AtomicInt32 g_stop;
+AtomicInt64 g_closed;
+
+void benchMap(int live) {
+	typedef std::map<std::string, TcpConnectionPtr> ConnectionMap;
+	ConnectionMap connections;
+	const std::string prefix("churn");
+	TcpConnectionPtr conn;
+	Timestamp start(Timestamp::now());
+	for (int i = 0; i < kRegistryOps; ++i) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "#%d", i);
+		connections[prefix + buf] = conn;
+		if (i >= live) {
+			snprintf(buf, sizeof(buf), "#%d", i - live);
+			connections.erase(prefix + buf);
+		}
+	}
+	double elapsed = timeDifference(Timestamp::now(), start);
+	printf("std::map by name    %8.1f ns/connection\n", elapsed * 1e9 / kRegistryOps);
+}
+
+void benchRegistry(int live) {
+	ConnectionRegistry connections;
+	TcpConnectionPtr conn;
+	Timestamp start(Timestamp::now());
+	for (int i = 0; i < kRegistryOps; ++i) {
+		connections.add(static_cast<uint64_t>(i + 1), conn);
+		if (i >= live) {
+			connections.remove(static_cast<uint64_t>(i + 1 - live));
+		}
+	}
+	double elapsed = timeDifference(Timestamp::now(), start);
+	printf("ConnectionRegistry  %8.1f ns/connection\n", elapsed * 1e9 / kRegistryOps);
+}
+
+void onConnection(const TcpConnectionPtr& conn) {
+	if (conn->connected()) {
+		conn->shutdown();
+	} else {
+		g_closed.increment();
+	}
+}
+
+void churn(uint16_t port) {
+	struct sockaddr_in sa;
+	::memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(port);
+	while (g_stop.get() == 0) {
+		int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0) {
+			perror("socket");
+			abort();
+		}
+		if (::connect(fd, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)) == 0) {
+			// until the server shuts it down
+			char buf[16];
+			while (::read(fd, buf, sizeof(buf)) > 0) {
+			}
+		}
+		::close(fd);
+	}
+}
+
+// client threads, then quits the server loop
+void drive(EventLoop* serverLoop, uint16_t port, int clients, double seconds) {
+	std::vector<std::unique_ptr<Thread>> threads;
+	for (int i = 0; i < clients; ++i) {
+		threads.push_back(std::unique_ptr<Thread>(
+					new Thread(std::bind(churn, port), "client")));
+		threads.back()->start();
+	}
+	::usleep(static_cast<useconds_t>(seconds * 1e6));
+	g_stop.getAndSet(1);
+	for (size_t i = 0; i < threads.size(); ++i) {
+		threads[i]->join();
+	}
+	serverLoop->quit();
+}
+
+void benchServer(int threads, int clients, double seconds) {
+	EventLoop loop;
+	TcpServer server(&loop, InetAddress(0, true), "churn");
+	server.setThreadNum(threads > 1 ? threads : 0);
+	server.setConnectionCallback(onConnection);
+	server.start();
+
+	g_stop.getAndSet(0);
+	g_closed.getAndSet(0);
+	Thread driver(std::bind(drive, &loop, server.listenAddress().port(), clients, seconds), "driver");
+	Timestamp start(Timestamp::now());
+	driver.start();
+	loop.loop();
+	driver.join();
+	double elapsed = timeDifference(Timestamp::now(), start);
+
+	printf("%3d loops %10.0f connect+close/s\n",
+			threads, static_cast<double>(g_closed.get()) / elapsed);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	int maxThreads = argc > 1 ? atoi(argv[1]) : 4;
+	int clients = argc > 2 ? atoi(argv[2]) : 8;
+	double seconds = argc > 3 ? atof(argv[3]) : 2.0;
+	int live = argc > 4 ? atoi(argv[4]) : 10000;
+	if (maxThreads <= 0 || clients <= 0 || seconds <= 0 || live <= 0) {
+		fprintf(stderr, "usage: %s [maxThreads [clients [seconds [live]]]]\n", argv[0]);
+		return 1;
+	}
+
+	// a line per connection otherwise
+	Logger::setLogLevel(Logger::WARN);
+	printf("%d live connections\n", live);
+	benchMap(live);
+	benchRegistry(live);
+	printf("clients = %d, %.1f s\n", clients, seconds);
+	for (int threads = 1; threads <= maxThreads; threads *= 2) {
+		benchServer(threads, clients, seconds);
+	}
+	return 0;
+}
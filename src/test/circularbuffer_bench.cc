@@ -0,0 +1,114 @@
+//
+// compares Buffer with CircularBuffer as the input buffer of a connection
+// which is streamed frames, in chunks not aligned to them, and retrieves
+// the whole frames on every read, so a partial one is always left behind.
+//
+// "memory" appends the chunks, "socket" reads them from a socketpair as
+// TcpConnection does: the buffer is made writable for a chunk, then read
+// with readv(2) and a spill buffer. Buffer moves the partial frame to the
+// front when its tail runs out, CircularBuffer reads around the end.
+//
+// usage: circularbuffer_bench [frame [chunk [megabytes]]]
+//
+#include <leanet/buffer.h>
+#include <leanet/circularbuffer.h>
+
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+using namespace leanet;
+
+namespace {
+
+double cpuTime() {
+	struct timespec ts;
+	::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+void report(const char* name, const char* op, size_t bytes, double seconds) {
+	printf("%-8s %-8s %10.1f MB/s\n",
+			name, op, static_cast<double>(bytes) / seconds / (1024 * 1024));
+}
+
+// retrieves the whole frames, returns how many
+template<typename BUFFER>
+size_t consume(BUFFER* buffer, size_t frame) {
+	size_t frames = buffer->readableBytes() / frame;
+	buffer->retrieve(frames * frame);
+	return frames;
+}
+
+template<typename BUFFER>
+void benchMemory(const char* name, size_t frame, size_t chunk, size_t total) {
+	BUFFER buffer;
+	std::string data(chunk, 'm');
+	size_t frames = 0;
+	double start = cpuTime();
+	for (size_t n = 0; n < total; n += chunk) {
+		buffer.append(data.data(), data.size());
+		frames += consume(&buffer, frame);
+	}
+	report(name, "memory", total, cpuTime() - start);
+	if (frames != total / chunk * chunk / frame) {
+		fprintf(stderr, "%s lost frames\n", name);
+	}
+}
+
+template<typename BUFFER>
+void benchSocket(const char* name, size_t frame, size_t chunk, size_t total) {
+	int sv[2];
+	if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) < 0) {
+		perror("socketpair");
+		abort();
+	}
+	BUFFER buffer;
+	std::string data(chunk, 's');
+	char spill[65536];
+	size_t read = 0;
+	double start = cpuTime();
+	for (size_t n = 0; n < total; n += chunk) {
+		if (::write(sv[1], data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+			perror("write");
+			abort();
+		}
+		buffer.ensureWritableBytes(chunk);
+		int savedErrno = 0;
+		ssize_t nr = buffer.readFd(sv[0], spill, sizeof(spill), &savedErrno);
+		if (nr > 0) {
+			read += static_cast<size_t>(nr);
+		}
+		consume(&buffer, frame);
+	}
+	report(name, "socket", total, cpuTime() - start);
+	if (read != total / chunk * chunk) {
+		fprintf(stderr, "%s lost bytes\n", name);
+	}
+	::close(sv[0]);
+	::close(sv[1]);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	long frame = argc > 1 ? atol(argv[1]) : 1000;
+	long chunk = argc > 2 ? atol(argv[2]) : 16 * 1024;
+	long megabytes = argc > 3 ? atol(argv[3]) : 4096;
+	if (frame <= 0 || chunk <= 0 || chunk > 64 * 1024 || megabytes <= 0) {
+		fprintf(stderr, "usage: %s [frame [chunk(<= 64k) [megabytes]]]\n", argv[0]);
+		return 1;
+	}
+
+	const size_t total = static_cast<size_t>(megabytes) * 1024 * 1024;
+	printf("frame = %ld, chunk = %ld, %ld MB\n", frame, chunk, megabytes);
+	benchMemory<Buffer>("linear", static_cast<size_t>(frame), static_cast<size_t>(chunk), total);
+	benchMemory<CircularBuffer>("circular", static_cast<size_t>(frame), static_cast<size_t>(chunk), total);
+	benchSocket<Buffer>("linear", static_cast<size_t>(frame), static_cast<size_t>(chunk), total / 8);
+	benchSocket<CircularBuffer>("circular", static_cast<size_t>(frame), static_cast<size_t>(chunk), total / 8);
+	return 0;
+}
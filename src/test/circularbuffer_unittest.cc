@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <leanet/circularbuffer.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <string>
+
+using namespace leanet;
+
+TEST(CIRCULARBUFFER_TEST, WRAP) {
+  CircularBuffer buffer(100);
+  EXPECT_EQ(100u, buffer.writableBytes());
+
+  // the readable bytes wrap around the end without moving
+  buffer.append(std::string(80, 'a'));
+  buffer.retrieve(70);
+  buffer.append(std::string(50, 'b'));
+  EXPECT_EQ(60u, buffer.readableBytes());
+  EXPECT_EQ(40u, buffer.writableBytes());
+  EXPECT_EQ(101u, buffer.internalSize());
+
+  struct iovec iov[2];
+  ASSERT_EQ(2, buffer.peek(iov));
+  EXPECT_EQ(31u, iov[0].iov_len);
+  EXPECT_EQ(29u, iov[1].iov_len);
+
+  // no more than len across the end
+  EXPECT_TRUE(buffer.retrieveAsString(5) == std::string(5, 'a'));
+  EXPECT_TRUE(buffer.retrieveAsString(10) == std::string(5, 'a') + std::string(5, 'b'));
+  EXPECT_EQ(45u, buffer.readableBytes());
+
+  // grown, in order
+  buffer.append(std::string(100, 'c'));
+  EXPECT_EQ(145u, buffer.readableBytes());
+  EXPECT_TRUE(buffer.retrieveAllAsString() == std::string(45, 'b') + std::string(100, 'c'));
+}
+
+TEST(CIRCULARBUFFER_TEST, READ_WRITE_FD) {
+  int sv[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv));
+
+  // the free bytes are split by the end
+  CircularBuffer buffer(1000);
+  buffer.append(std::string(900, 'x'));
+  buffer.retrieve(899);
+  std::string data;
+  for (int i = 0; i < 3000; ++i) {
+    data += static_cast<char>('a' + i % 26);
+  }
+  ASSERT_EQ(3000, ::write(sv[1], data.data(), data.size()));
+
+  // into both free segments, the rest is left in socket without spill
+  int savedErrno = 0;
+  EXPECT_EQ(999, buffer.readFd(sv[0], NULL, 0, &savedErrno));
+  EXPECT_EQ(0u, buffer.writableBytes());
+  struct iovec iov[2];
+  EXPECT_EQ(2, buffer.peek(iov));
+
+  // and is appended from spill
+  char spill[4096];
+  EXPECT_EQ(2001, buffer.readFd(sv[0], spill, sizeof(spill), &savedErrno));
+  EXPECT_EQ(3001u, buffer.readableBytes());
+  EXPECT_EQ(-1, buffer.readFd(sv[0], spill, sizeof(spill), &savedErrno));
+  EXPECT_EQ(EAGAIN, savedErrno);
+
+  // written out of both readable segments
+  CircularBuffer output(1000);
+  output.append(std::string(600, 'y'));
+  output.retrieve(599);
+  output.append(data.data(), 999);
+  EXPECT_EQ(2, output.peek(iov));
+  EXPECT_EQ(1000, output.writeFd(sv[0], &savedErrno));
+  EXPECT_EQ(0u, output.readableBytes());
+  char buf[4096];
+  ASSERT_EQ(1000, ::read(sv[1], buf, sizeof(buf)));
+  EXPECT_TRUE(std::string(buf, 1000) == "y" + data.substr(0, 999));
+
+  EXPECT_TRUE(buffer.retrieveAllAsString() == "x" + data);
+  ::close(sv[0]);
+  ::close(sv[1]);
+}
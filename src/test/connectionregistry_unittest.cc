@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+#include <leanet/connectionregistry.h>
+#include <leanet/tcpconnection.h>
+#include <leanet/eventloop.h>
+#include <leanet/inetaddress.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace leanet;
+
+namespace {
+
+// connections over socketpairs, established in loop, which is not looping
+class Conns {
+public:
+  Conns(EventLoop* loop, int n)
+  {
+    std::shared_ptr<const std::string> prefix(std::make_shared<const std::string>("conns"));
+    for (int i = 0; i < n; ++i) {
+      int sv[2];
+      EXPECT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv));
+      conns_.push_back(std::make_shared<TcpConnection>(
+            loop, sv[0], static_cast<uint64_t>(i + 1), prefix, InetAddress(), InetAddress()));
+      conns_.back()->setConnectionCallback(defaultConnectionCallback);
+      conns_.back()->connectEstablished();
+      peers_.push_back(sv[1]);
+    }
+  }
+  ~Conns() {
+    for (size_t i = 0; i < conns_.size(); ++i) {
+      conns_[i]->connectDestroyed();
+      ::close(peers_[i]);
+    }
+  }
+
+  const TcpConnectionPtr& operator[](size_t i) const
+  { return conns_[i]; }
+
+private:
+  std::vector<TcpConnectionPtr> conns_;
+  std::vector<int> peers_;
+};
+
+}
+
+TEST(CONNECTIONREGISTRY_TEST, NAME) {
+  EventLoop loop;
+  Conns conns(&loop, 2);
+  EXPECT_EQ(1u, conns[0]->id());
+  EXPECT_EQ("conns#1", conns[0]->name());
+  EXPECT_EQ("conns#2", conns[1]->name());
+
+  int sv[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv));
+  TcpConnectionPtr named(std::make_shared<TcpConnection>(
+        &loop, sv[0], "named", InetAddress(), InetAddress()));
+  named->setConnectionCallback(defaultConnectionCallback);
+  named->connectEstablished();
+  EXPECT_EQ(0u, named->id());
+  EXPECT_EQ("named", named->name());
+  named->connectDestroyed();
+  ::close(sv[1]);
+}
+
+TEST(CONNECTIONREGISTRY_TEST, ADD_REMOVE) {
+  EventLoop loop;
+  Conns conns(&loop, 3);
+  // and a read submitted, if the poller supports completions
+  const long held = conns[0].use_count();
+  ConnectionRegistry registry;
+  for (size_t i = 0; i < 3; ++i) {
+    registry.add(conns[i]->id(), conns[i]);
+  }
+  EXPECT_EQ(3u, registry.size());
+  EXPECT_EQ(conns[1], registry.find(2));
+  EXPECT_FALSE(registry.find(4));
+
+  EXPECT_TRUE(registry.remove(2));
+  EXPECT_FALSE(registry.remove(2));
+  EXPECT_FALSE(registry.find(2));
+  EXPECT_EQ(conns[2], registry.find(3));
+  EXPECT_EQ(2u, registry.size());
+
+  std::vector<TcpConnectionPtr> taken;
+  registry.takeAll(&taken);
+  EXPECT_EQ(2u, taken.size());
+  EXPECT_TRUE(registry.empty());
+  EXPECT_FALSE(registry.find(1));
+  // the registry no longer refers to them
+  EXPECT_EQ(held + 1, conns[0].use_count());
+}
+
+TEST(CONNECTIONREGISTRY_TEST, RANDOM) {
+  // few slots for many collisions, grown as needed, checked against a map.
+  // ids in a window which moves on like those of a server, and some far
+  // apart which collide on the same slots
+  EventLoop loop;
+  Conns conns(&loop, 4);
+  ConnectionRegistry registry(8);
+  std::map<uint64_t, TcpConnectionPtr> expected;
+  srand(1);
+  uint64_t next = 1;
+  for (int i = 0; i < 100000; ++i) {
+    uint64_t id;
+    if (rand() % 4 == 0) {
+      id = static_cast<uint64_t>(rand() % 8 + 1) << 20;
+    } else {
+      id = next - static_cast<uint64_t>(rand() % 64);
+      if (id == 0 || id > next) {
+        id = next;
+      }
+    }
+    if (expected.count(id) > 0) {
+      expected.erase(id);
+      ASSERT_TRUE(registry.remove(id));
+    } else {
+      const TcpConnectionPtr& conn = conns[id % 4];
+      expected[id] = conn;
+      registry.add(id, conn);
+      if (id == next) {
+        ++next;
+      }
+    }
+    ASSERT_EQ(expected.size(), registry.size());
+  }
+
+  for (std::map<uint64_t, TcpConnectionPtr>::const_iterator it = expected.begin();
+       it != expected.end(); ++it) {
+    EXPECT_EQ(it->second, registry.find(it->first));
+  }
+  for (uint64_t id = 1; id < next; ++id) {
+    EXPECT_EQ(expected.count(id) > 0, static_cast<bool>(registry.find(id)));
+  }
+  EXPECT_LE(2 * registry.size(), registry.slots());
+}
@@ -0,0 +1,193 @@
+//
+// echo throughput of TcpServer from 1 to N loops, the clients keep a
+// message of `size` bytes in flight on every connection and echo back
+// what they receive, for `seconds`.
+//
+// with threads = 1 the base loop serves all connections, with more there
+// are as many loops in the pool. the clients run in as many threads as the
+// server loops, each with its own EventLoop. the connections are closed with
+// echoes in flight, so the server logs EPIPE or ECONNRESET at every round.
+//
+// usage: echo_bench [maxThreads [connections [size [seconds [reuseport]]]]]
+//
+#include <leanet/eventloop.h>
+#include <leanet/channel.h>
+#include <leanet/tcpserver.h>
+#include <leanet/tcpconnection.h>
+#include <leanet/buffer.h>
+#include <leanet/inetaddress.h>
+#include <leanet/sockets.h>
+#include <leanet/thread.h>
+#include <leanet/timestamp.h>
+#include <leanet/logger.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <vector>
+
+using namespace leanet;
+
+namespace {
+
+void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+	conn->send(buf->peek(), buf->readableBytes());
+	buf->retrieveAll();
+}
+
+int connectTo(const InetAddress& addr) {
+	struct sockaddr_in sa;
+	::memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons(addr.port());
+	int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || ::connect(fd, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)) < 0) {
+		perror("connect");
+		abort();
+	}
+	int one = 1;
+	::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	::fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+}
+
+// connections of a client thread, echoing back in its own loop
+class Clients {
+public:
+	Clients(const InetAddress& serverAddr, int connections, size_t size, double seconds)
+		: serverAddr_(serverAddr),
+			connections_(connections),
+			size_(size),
+			seconds_(seconds),
+			bytes_(0)
+	{ }
+
+	void run() {
+		EventLoop loop;
+		std::vector<int> fds;
+		std::vector<std::unique_ptr<Channel>> channels;
+		std::string message(size_, 'e');
+		for (int i = 0; i < connections_; ++i) {
+			int fd = connectTo(serverAddr_);
+			fds.push_back(fd);
+			std::unique_ptr<Channel> channel(new Channel(&loop, fd));
+			channel->setReadCallback(std::bind(&Clients::onRead, this, fd));
+			channel->enableReading();
+			channels.push_back(std::move(channel));
+			if (sockets::write(fd, message.data(), message.size()) != static_cast<ssize_t>(message.size())) {
+				perror("write");
+				abort();
+			}
+		}
+
+		loop.runAfter(seconds_, std::bind(&EventLoop::quit, &loop));
+		loop.loop();
+
+		for (size_t i = 0; i < channels.size(); ++i) {
+			channels[i]->disableAll();
+			channels[i]->remove();
+			::close(fds[i]);
+		}
+	}
+
+	int64_t bytes() const {
+		return bytes_;
+	}
+
+private:
+	void onRead(int fd) {
+		char buf[65536];
+		ssize_t n = sockets::read(fd, buf, sizeof(buf));
+		if (n > 0) {
+			bytes_ += n;
+			// whole messages from loopback, the socket buffer takes them
+			if (sockets::write(fd, buf, static_cast<size_t>(n)) != n) {
+				perror("write");
+				abort();
+			}
+		} else if (n < 0 && errno != EAGAIN) {
+			perror("read");
+			abort();
+		}
+	}
+
+	const InetAddress serverAddr_;
+	const int connections_;
+	const size_t size_;
+	const double seconds_;
+	int64_t bytes_;
+};
+
+// client threads, then quits the server loop
+void drive(EventLoop* serverLoop, const InetAddress& serverAddr,
+		int threads, int connections, size_t size, double seconds, int64_t* bytes) {
+	std::vector<std::unique_ptr<Clients>> clients;
+	std::vector<std::unique_ptr<Thread>> clientThreads;
+	for (int i = 0; i < threads; ++i) {
+		int n = connections / threads + (i < connections % threads ? 1 : 0);
+		clients.push_back(std::unique_ptr<Clients>(new Clients(serverAddr, n, size, seconds)));
+		clientThreads.push_back(std::unique_ptr<Thread>(
+					new Thread(std::bind(&Clients::run, clients.back().get()), "client")));
+		clientThreads.back()->start();
+	}
+	*bytes = 0;
+	for (int i = 0; i < threads; ++i) {
+		clientThreads[i]->join();
+		*bytes += clients[i]->bytes();
+	}
+	serverLoop->quit();
+}
+
+void bench(int threads, int connections, size_t size, double seconds, bool reusePort) {
+	EventLoop loop;
+	TcpServer server(&loop, InetAddress(0, true), "echo",
+			reusePort ? TcpServer::kReusePort : TcpServer::kNoReusePort);
+	// 1 thread: the base loop only
+	server.setThreadNum(threads > 1 ? threads : 0);
+	server.setMessageCallback(onMessage);
+	server.start();
+
+	int64_t bytes = 0;
+	Thread driver(std::bind(drive, &loop, server.listenAddress(),
+				threads, connections, size, seconds, &bytes), "driver");
+	Timestamp start(Timestamp::now());
+	driver.start();
+	loop.loop();
+	driver.join();
+	double elapsed = timeDifference(Timestamp::now(), start);
+
+	printf("%3d loops %10.1f MB/s %10.0f msg/s\n",
+			threads,
+			static_cast<double>(bytes) / elapsed / (1024 * 1024),
+			static_cast<double>(bytes) / static_cast<double>(size) / elapsed);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	int maxThreads = argc > 1 ? atoi(argv[1]) : 4;
+	int connections = argc > 2 ? atoi(argv[2]) : 64;
+	long size = argc > 3 ? atol(argv[3]) : 4096;
+	double seconds = argc > 4 ? atof(argv[4]) : 2.0;
+	bool reusePort = argc > 5 ? atoi(argv[5]) != 0 : false;
+	if (maxThreads <= 0 || connections < maxThreads || size <= 0 || seconds <= 0) {
+		fprintf(stderr, "usage: %s [maxThreads [connections(>= maxThreads) [size [seconds [reuseport]]]]]\n", argv[0]);
+		return 1;
+	}
+
+	Logger::setLogLevel(Logger::WARN);
+	printf("connections = %d, size = %ld, %.1f s, %s\n",
+			connections, size, seconds, reusePort ? "SO_REUSEPORT" : "one acceptor");
+	for (int threads = 1; threads <= maxThreads; threads *= 2) {
+		bench(threads, connections, static_cast<size_t>(size), seconds, reusePort);
+	}
+	return 0;
+}
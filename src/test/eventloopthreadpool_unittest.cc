@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+#include <leanet/eventloop.h>
+#include <leanet/eventloopthreadpool.h>
+#include <leanet/countdownlatch.h>
+
+#include <set>
+#include <vector>
+
+using namespace leanet;
+
+TEST(EVENTLOOPTHREADPOOL_TEST, ROUND_ROBIN) {
+  EventLoop loop;
+  EventLoopThreadPool pool(&loop, "rr");
+  pool.setThreadNum(3);
+  pool.start(EventLoopThreadPool::ThreadInitCallback());
+  std::vector<EventLoop*> loops(pool.getAllLoops());
+  ASSERT_EQ(3u, loops.size());
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_EQ(loops[i % 3], pool.getNextLoop());
+  }
+}
+
+TEST(EVENTLOOPTHREADPOOL_TEST, BASE_LOOP_ONLY) {
+  EventLoop loop;
+  EventLoopThreadPool pool(&loop, "base");
+  pool.setStrategy(EventLoopThreadPool::kLeastConnections);
+  pool.start(EventLoopThreadPool::ThreadInitCallback());
+  EXPECT_EQ(&loop, pool.getNextLoop());
+  EXPECT_EQ(&loop, pool.getLoopForHash(42));
+  pool.connectionAdded(&loop);
+  EXPECT_EQ(1, pool.numConnections(&loop));
+  EXPECT_EQ(&loop, pool.getLeastConnectedLoop());
+}
+
+TEST(EVENTLOOPTHREADPOOL_TEST, LEAST_CONNECTIONS) {
+  EventLoop loop;
+  EventLoopThreadPool pool(&loop, "lc");
+  pool.setThreadNum(3);
+  pool.setStrategy(EventLoopThreadPool::kLeastConnections);
+  pool.start(EventLoopThreadPool::ThreadInitCallback());
+  std::vector<EventLoop*> loops(pool.getAllLoops());
+
+  // in turn while they are even
+  for (int i = 0; i < 6; ++i) {
+    EventLoop* next = pool.getNextLoop();
+    EXPECT_EQ(loops[i % 3], next);
+    pool.connectionAdded(next);
+  }
+  EXPECT_EQ(2, pool.numConnections(loops[1]));
+
+  // the loop whose connections went away takes the next ones
+  pool.connectionRemoved(loops[1]);
+  pool.connectionRemoved(loops[1]);
+  EXPECT_EQ(loops[1], pool.getNextLoop());
+  pool.connectionAdded(loops[1]);
+  EXPECT_EQ(loops[1], pool.getNextLoop());
+  pool.connectionAdded(loops[1]);
+  EXPECT_NE(loops[1], pool.getNextLoop());
+  EXPECT_EQ(loops[0], pool.getLeastConnectedLoop());
+}
+
+TEST(EVENTLOOPTHREADPOOL_TEST, LEAST_PENDING) {
+  EventLoop loop;
+  EventLoopThreadPool pool(&loop, "lp");
+  pool.setThreadNum(3);
+  pool.setStrategy(EventLoopThreadPool::kLeastPending);
+  pool.start(EventLoopThreadPool::ThreadInitCallback());
+  std::vector<EventLoop*> loops(pool.getAllLoops());
+
+  // loops[0] and loops[1] are behind, the one blocked the most
+  CountdownLatch blocked(2);
+  CountdownLatch release(1);
+  for (int i = 0; i < 2; ++i) {
+    loops[i]->queueInLoop([&blocked, &release]() {
+      blocked.countDown();
+      release.wait();
+    });
+  }
+  blocked.wait();
+  for (int i = 0; i < 3; ++i) {
+    loops[0]->queueInLoop([]() { });
+  }
+  loops[1]->queueInLoop([]() { });
+  EXPECT_EQ(4, loops[0]->queueSize());
+  EXPECT_EQ(2, loops[1]->queueSize());
+
+  EXPECT_EQ(loops[2], pool.getNextLoop());
+  EXPECT_EQ(loops[2], pool.getNextLoop());
+  release.countDown();
+}
+
+TEST(EVENTLOOPTHREADPOOL_TEST, CONSISTENT_HASH) {
+  EventLoop loop;
+  EventLoopThreadPool pool3(&loop, "ch3");
+  pool3.setThreadNum(3);
+  pool3.setStrategy(EventLoopThreadPool::kConsistentHash);
+  pool3.start(EventLoopThreadPool::ThreadInitCallback());
+  EventLoopThreadPool pool4(&loop, "ch4");
+  pool4.setThreadNum(4);
+  pool4.start(EventLoopThreadPool::ThreadInitCallback());
+  std::vector<EventLoop*> loops3(pool3.getAllLoops());
+  std::vector<EventLoop*> loops4(pool4.getAllLoops());
+
+  const int kKeys = 10000;
+  std::vector<int> counts(3, 0);
+  int moved = 0;
+  for (uint64_t key = 0; key < kKeys; ++key) {
+    EventLoop* loop3 = pool3.getNextLoop(key);
+    EXPECT_EQ(loop3, pool3.getLoopForHash(key));
+    size_t i = 0;
+    while (loops3[i] != loop3) {
+      ++i;
+    }
+    ++counts[i];
+    // with a loop added, a key stays at the same index or moves to it
+    EventLoop* loop4 = pool4.getLoopForHash(key);
+    if (loop4 == loops4[3]) {
+      ++moved;
+    } else {
+      EXPECT_EQ(loops4[i], loop4);
+    }
+  }
+  for (size_t i = 0; i < counts.size(); ++i) {
+    EXPECT_GT(counts[i], kKeys / 3 * 9 / 10);
+  }
+  EXPECT_GT(moved, kKeys / 4 * 9 / 10);
+  EXPECT_LT(moved, kKeys / 4 * 11 / 10);
+}
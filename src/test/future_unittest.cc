@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include <leanet/future.h>
+#include <leanet/smallfunction.h>
+#include <leanet/threadpool.h>
+#include <leanet/workstealingpool.h>
+#include <leanet/eventloop.h>
+#include <leanet/eventloopthread.h>
+#include <leanet/countdownlatch.h>
+#include <leanet/atomic.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace leanet;
+
+namespace {
+
+int square(int x) {
+  return x * x;
+}
+
+struct Big {
+  char bytes[128];
+  int operator()() const { return bytes[0]; }
+};
+
+}
+
+TEST(SMALLFUNCTION_TEST, STORAGE) {
+  std::shared_ptr<int> counted(std::make_shared<int>(7));
+  SmallFunction<int (int)> small([counted](int x) { return *counted + x; });
+  EXPECT_TRUE(small.isInline());
+  EXPECT_EQ(10, small(3));
+  EXPECT_EQ(2, counted.use_count());
+
+  SmallFunction<int (int)> moved(std::move(small));
+  EXPECT_FALSE(static_cast<bool>(small));
+  EXPECT_EQ(11, moved(4));
+  EXPECT_EQ(2, counted.use_count());
+  moved.reset();
+  EXPECT_EQ(1, counted.use_count());
+
+  Big big;
+  big.bytes[0] = 5;
+  SmallFunction<int ()> heap(big);
+  EXPECT_FALSE(heap.isInline());
+  SmallFunction<int ()> other;
+  other.swap(heap);
+  EXPECT_FALSE(static_cast<bool>(heap));
+  EXPECT_EQ(5, other());
+}
+
+TEST(FUTURE_TEST, PROMISE) {
+  Promise<std::string> promise;
+  Future<std::string> future(promise.getFuture());
+  EXPECT_TRUE(future.valid());
+  EXPECT_FALSE(future.ready());
+  promise.setValue("done");
+  EXPECT_TRUE(future.ready());
+  EXPECT_EQ("done", future.get());
+  EXPECT_FALSE(future.valid());
+
+  // the continuation armed after the value runs at once without a loop
+  Promise<int> ready;
+  ready.setValue(3);
+  int got = 0;
+  ready.getFuture().then(NULL, [&got](int x) { got = x; });
+  EXPECT_EQ(3, got);
+}
+
+TEST(FUTURE_TEST, SUBMIT) {
+  ThreadPool pool;
+  pool.start(2);
+  Future<int> future(pool.submit(std::bind(square, 12)));
+  EXPECT_EQ(144, future.get());
+
+  AtomicInt32 count;
+  Future<void> done(pool.submit([&count]() { count.increment(); }));
+  done.wait();
+  EXPECT_EQ(1, count.get());
+  pool.stop();
+
+  WorkStealingPool ws;
+  ws.start(2);
+  std::vector<Future<int>> futures;
+  for (int i = 0; i < 100; ++i) {
+    futures.push_back(ws.submit(std::bind(square, i)));
+  }
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(i * i, futures[i].get());
+  }
+  ws.stop();
+}
+
+TEST(FUTURE_TEST, THEN_IN_LOOP) {
+  EventLoopThread loopThread;
+  EventLoop* loop = loopThread.startLoop();
+  ThreadPool pool;
+  pool.start(2);
+
+  // computed in the pool, continued in the loop, chained once more there
+  const int kRequests = 1000;
+  CountdownLatch latch(kRequests);
+  AtomicInt32 inLoop;
+  AtomicInt64 sum;
+  std::vector<Future<void>> tails;
+  for (int i = 0; i < kRequests; ++i) {
+    tails.push_back(pool.submit(std::bind(square, i))
+      .then(loop, [loop, &inLoop](int x) {
+        if (loop->isInLoopThread()) {
+          inLoop.increment();
+        }
+        return static_cast<int64_t>(x) + 1;
+      })
+      .then(loop, [&sum, &latch](int64_t x) {
+        sum.add(x);
+        latch.countDown();
+      }));
+  }
+  latch.wait();
+  for (int i = 0; i < kRequests; ++i) {
+    tails[i].wait();
+  }
+
+  int64_t expected = 0;
+  for (int i = 0; i < kRequests; ++i) {
+    expected += i * i + 1;
+  }
+  EXPECT_EQ(kRequests, inLoop.get());
+  EXPECT_EQ(expected, sum.get());
+  pool.stop();
+}
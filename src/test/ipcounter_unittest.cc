@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <leanet/ipcounter.h>
+#include <leanet/inetaddress.h>
+
+#include <stdlib.h>
+
+#include <map>
+#include <string>
+
+using namespace leanet;
+
+TEST(IPCOUNTER_TEST, ADD_REMOVE) {
+  IpCounter counter;
+  InetAddress a("10.0.0.1", 1000);
+  InetAddress b("10.0.0.2", 1000);
+  InetAddress v6("::1", 1000, true);
+
+  // by ip, the port doesn't matter
+  EXPECT_EQ(1, counter.add(a));
+  EXPECT_EQ(2, counter.add(InetAddress("10.0.0.1", 2000)));
+  EXPECT_EQ(1, counter.add(b));
+  EXPECT_EQ(1, counter.add(v6));
+  EXPECT_EQ(3u, counter.size());
+  EXPECT_EQ(2, counter.count(a));
+  EXPECT_EQ(0, counter.count(InetAddress("10.0.0.3", 1000)));
+
+  EXPECT_EQ(1, counter.remove(a));
+  EXPECT_EQ(0, counter.remove(a));
+  EXPECT_EQ(0, counter.count(a));
+  EXPECT_EQ(1, counter.count(b));
+  EXPECT_EQ(1, counter.count(v6));
+  EXPECT_EQ(2u, counter.size());
+}
+
+TEST(IPCOUNTER_TEST, MAPPED) {
+  // an IPv4 peer counts the same, whether accepted by an IPv4 socket or by
+  // an IPv6 one as ::ffff:a.b.c.d
+  IpCounter counter;
+  InetAddress v4("192.168.1.20", 1000);
+  InetAddress mapped("::ffff:192.168.1.20", 2000, true);
+  EXPECT_EQ(1, counter.add(v4));
+  EXPECT_EQ(2, counter.add(mapped));
+  EXPECT_EQ(1u, counter.size());
+  EXPECT_EQ(2, counter.count(v4));
+  EXPECT_EQ(0, counter.count(InetAddress("::ffff:192.168.1.21", 1000, true)));
+  // not mapped
+  EXPECT_EQ(0, counter.count(InetAddress("::192.168.1.20", 1000, true)));
+
+  EXPECT_EQ(1, counter.remove(mapped));
+  EXPECT_EQ(0, counter.remove(v4));
+  EXPECT_EQ(0u, counter.size());
+}
+
+TEST(IPCOUNTER_TEST, RANDOM) {
+  // few slots for many collisions, grown as needed, checked against a map
+  IpCounter counter(8);
+  std::map<std::string, int> counts;
+  srand(1);
+  for (int i = 0; i < 100000; ++i) {
+    char ip[32];
+    snprintf(ip, sizeof(ip), "10.0.%d.%d", rand() % 4, rand() % 256);
+    InetAddress addr(ip, 80);
+    int& count = counts[ip];
+    if (count > 0 && rand() % 2 == 0) {
+      --count;
+      ASSERT_EQ(count, counter.remove(addr));
+    } else {
+      ++count;
+      ASSERT_EQ(count, counter.add(addr));
+    }
+  }
+
+  size_t size = 0;
+  for (std::map<std::string, int>::const_iterator it = counts.begin();
+       it != counts.end(); ++it) {
+    EXPECT_EQ(it->second, counter.count(InetAddress(it->first, 80)));
+    if (it->second > 0) {
+      ++size;
+    }
+  }
+  EXPECT_EQ(size, counter.size());
+  EXPECT_LE(2 * counter.size(), counter.slots());
+}
@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+#include <leanet/mpscqueue.h>
+#include <leanet/smallfunction.h>
+#include <leanet/thread.h>
+#include <leanet/countdownlatch.h>
+#include <leanet/atomic.h>
+
+#include <memory>
+#include <vector>
+#include <string>
+
+using namespace leanet;
+
+TEST(MPSCQUEUE_TEST, FIFO) {
+  MpscQueue<std::string> queue;
+  EXPECT_TRUE(queue.empty());
+
+  std::string x;
+  EXPECT_FALSE(queue.pop(&x));
+
+  queue.push("hello");
+  queue.push(std::string("world"));
+  EXPECT_FALSE(queue.empty());
+
+  ASSERT_TRUE(queue.pop(&x));
+  EXPECT_EQ("hello", x);
+  ASSERT_TRUE(queue.pop(&x));
+  EXPECT_EQ("world", x);
+  EXPECT_FALSE(queue.pop(&x));
+  EXPECT_TRUE(queue.empty());
+
+  // reuse after drained
+  queue.push("again");
+  ASSERT_TRUE(queue.pop(&x));
+  EXPECT_EQ("again", x);
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(MPSCQUEUE_TEST, DESTROY_NONEMPTY) {
+  std::shared_ptr<int> p(new int(42));
+  {
+  MpscQueue<std::shared_ptr<int>> queue;
+  queue.push(p);
+  queue.push(p);
+  EXPECT_EQ(3, p.use_count());
+  }
+  EXPECT_EQ(1, p.use_count());
+}
+
+TEST(MPSCQUEUE_TEST, MOVE_ONLY) {
+  // stored inline in the node, as EventLoop queues its functors
+  std::shared_ptr<int> p(new int(42));
+  MpscQueue<SmallFunction<int ()>> queue;
+  queue.push(SmallFunction<int ()>([p]() { return *p; }));
+  EXPECT_EQ(2, p.use_count());
+
+  SmallFunction<int ()> f;
+  ASSERT_TRUE(queue.pop(&f));
+  EXPECT_TRUE(f.isInline());
+  EXPECT_EQ(42, f());
+  f.reset();
+  EXPECT_EQ(1, p.use_count());
+  EXPECT_FALSE(queue.pop(&f));
+}
+
+TEST(MPSCQUEUE_TEST, MULTI_PRODUCERS) {
+  const int kProducers = 4;
+  const int kItems = 100000;
+
+  MpscQueue<int> queue;
+  CountdownLatch latch(1);
+  std::vector<std::unique_ptr<Thread>> producers;
+  for (int i = 0; i < kProducers; ++i) {
+    producers.emplace_back(new Thread([&queue, &latch, i] {
+      latch.wait();
+      for (int j = 0; j < kItems; ++j) {
+        queue.push(i * kItems + j);
+      }
+    }));
+    producers.back()->start();
+  }
+  latch.countDown();
+
+  // items of every producer come out in the order they were pushed
+  std::vector<int> next(kProducers, 0);
+  int received = 0;
+  while (received < kProducers * kItems) {
+    int x = 0;
+    if (queue.pop(&x)) {
+      int producer = x / kItems;
+      EXPECT_EQ(next[producer], x % kItems);
+      next[producer] = x % kItems + 1;
+      ++received;
+    }
+  }
+
+  for (size_t i = 0; i < producers.size(); ++i) {
+    producers[i]->join();
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(MPSCQUEUE_TEST, POP_WAIT) {
+  const int kProducers = 4;
+  const int kItems = 100000;
+
+  // whatever a producer has pushed before the consumer is told is seen
+  MpscQueue<int> queue;
+  AtomicInt32 done;
+  std::vector<std::unique_ptr<Thread>> producers;
+  for (int i = 0; i < kProducers; ++i) {
+    producers.emplace_back(new Thread([&queue, &done] {
+      for (int j = 0; j < kItems; ++j) {
+        queue.push(j);
+      }
+      done.increment();
+    }));
+    producers.back()->start();
+  }
+
+  int received = 0;
+  for (;;) {
+    bool finished = done.get() == kProducers;
+    int x = 0;
+    while (queue.popWait(&x)) {
+      ++received;
+    }
+    if (finished) {
+      break;
+    }
+  }
+  EXPECT_EQ(kProducers * kItems, received);
+
+  for (size_t i = 0; i < producers.size(); ++i) {
+    producers[i]->join();
+  }
+}
@@ -0,0 +1,308 @@
+//
+// ping-pong over socketpairs in one EventLoop, compares the poll(2),
+// epoll(4) and io_uring(7) backends in throughput and system calls per
+// message, on bare channels reading and writing by themselves, and on
+// TcpConnections(reads and writes submitted to io_uring(7)), where the
+// system calls are counted by /proc/self/io.
+//
+// usage: poller_bench [pairs [active [messages]]]
+//   pairs: socketpairs watched by the loop, only `active` of them carry
+//          messages at the same time, the rest are idle connections.
+//
+#include <leanet/eventloop.h>
+#include <leanet/channel.h>
+#include <leanet/sockets.h>
+#include <leanet/timestamp.h>
+#include <leanet/tcpconnection.h>
+#include <leanet/buffer.h>
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <vector>
+
+using namespace leanet;
+using namespace std::placeholders;
+
+namespace {
+
+// read(2)-like plus write(2)-like system calls made by the process, -1 if
+// not accounted
+int64_t ioSyscalls() {
+	int fd = ::open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	char buf[512];
+	ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+	::close(fd);
+	if (n <= 0) {
+		return -1;
+	}
+	buf[n] = '\0';
+	const char* syscr = ::strstr(buf, "syscr:");
+	const char* syscw = ::strstr(buf, "syscw:");
+	if (syscr == NULL || syscw == NULL) {
+		return -1;
+	}
+	return ::atoll(syscr + 6) + ::atoll(syscw + 6);
+}
+
+void report(const char* name, double seconds, int64_t received,
+						int64_t pollerSyscalls, int64_t syscalls) {
+	double messages = static_cast<double>(received);
+	printf("%-8s %8.3f s %10.0f msg/s %6.3f poller syscalls/msg %6.3f syscalls/msg\n",
+			name,
+			seconds,
+			messages / seconds,
+			static_cast<double>(pollerSyscalls) / messages,
+			static_cast<double>(syscalls) / messages);
+}
+
+}
+
+class PingPong {
+public:
+	PingPong(EventLoop::PollerType type, int pairs, int active, int64_t messages)
+		: loop_(type),
+			active_(active),
+			messages_(messages),
+			inFlight_(0),
+			received_(0),
+			reads_(0),
+			writes_(0)
+	{
+		for (int i = 0; i < pairs; ++i) {
+			int sv[2];
+			if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) < 0) {
+				perror("socketpair");
+				abort();
+			}
+			fds_.push_back(sv[0]);
+			fds_.push_back(sv[1]);
+
+			// sv[0]: client end, counts round trips and sends next ping
+			// sv[1]: server end, echoes back
+			std::unique_ptr<Channel> client(new Channel(&loop_, sv[0]));
+			client->setReadCallback(std::bind(&PingPong::onPong, this, sv[0]));
+			client->enableReading();
+			std::unique_ptr<Channel> server(new Channel(&loop_, sv[1]));
+			server->setReadCallback(std::bind(&PingPong::onPing, this, sv[1]));
+			server->enableReading();
+			channels_.push_back(std::move(client));
+			channels_.push_back(std::move(server));
+		}
+	}
+
+	~PingPong() {
+		for (size_t i = 0; i < channels_.size(); ++i) {
+			channels_[i]->disableAll();
+			channels_[i]->remove();
+		}
+		for (size_t i = 0; i < fds_.size(); ++i) {
+			::close(fds_[i]);
+		}
+	}
+
+	void run(const char* name) {
+		// spread active pairs among all pairs
+		const size_t pairs = fds_.size() / 2;
+		const size_t step = pairs / active_;
+		for (int i = 0; i < active_; ++i) {
+			send(fds_[2 * (i * step)]);
+		}
+
+		int64_t syscallsBefore = loop_.pollerSyscalls();
+		Timestamp start(Timestamp::now());
+		loop_.loop();
+		double seconds = timeDifference(Timestamp::now(), start);
+		int64_t pollerSyscalls = loop_.pollerSyscalls() - syscallsBefore;
+
+		report(name, seconds, received_, pollerSyscalls,
+					 pollerSyscalls + reads_ + writes_);
+	}
+
+private:
+	void send(int fd) {
+		++inFlight_;
+		write(fd);
+	}
+
+	void write(int fd) {
+		char message = 'p';
+		++writes_;
+		if (sockets::write(fd, &message, sizeof(message)) != sizeof(message)) {
+			perror("write");
+			abort();
+		}
+	}
+
+	void receive(int fd) {
+		char message = 0;
+		++reads_;
+		if (sockets::read(fd, &message, sizeof(message)) != sizeof(message)) {
+			perror("read");
+			abort();
+		}
+	}
+
+	void onPing(int fd) {
+		receive(fd);
+		write(fd);
+	}
+
+	void onPong(int fd) {
+		receive(fd);
+		--inFlight_;
+		++received_;
+		if (received_ + inFlight_ < messages_) {
+			send(fd);
+		} else if (inFlight_ == 0) {
+			loop_.quit();
+		}
+	}
+
+	EventLoop loop_;
+	const int active_;
+	const int64_t messages_;
+	int64_t inFlight_;
+	int64_t received_;
+	int64_t reads_;
+	int64_t writes_;
+	std::vector<int> fds_;
+	std::vector<std::unique_ptr<Channel>> channels_;
+};
+
+// the same ping-pong between TcpConnections, the server end echoes back
+class ConnectionPingPong {
+public:
+	ConnectionPingPong(EventLoop::PollerType type, int pairs, int active, int64_t messages)
+		: loop_(type),
+			active_(active),
+			messages_(messages),
+			inFlight_(0),
+			received_(0)
+	{
+		for (int i = 0; i < pairs; ++i) {
+			int sv[2];
+			if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) < 0) {
+				perror("socketpair");
+				abort();
+			}
+			TcpConnectionPtr client(std::make_shared<TcpConnection>(
+						&loop_, sv[0], "client", InetAddress(), InetAddress()));
+			client->setMessageCallback(std::bind(&ConnectionPingPong::onPong, this, _1, _2));
+			TcpConnectionPtr server(std::make_shared<TcpConnection>(
+						&loop_, sv[1], "server", InetAddress(), InetAddress()));
+			server->setMessageCallback(std::bind(&ConnectionPingPong::onPing, this, _1, _2));
+			clients_.push_back(client);
+			servers_.push_back(server);
+		}
+		for (size_t i = 0; i < clients_.size(); ++i) {
+			clients_[i]->setConnectionCallback(defaultConnectionCallback);
+			clients_[i]->connectEstablished();
+			servers_[i]->setConnectionCallback(defaultConnectionCallback);
+			servers_[i]->connectEstablished();
+		}
+	}
+
+	~ConnectionPingPong() {
+		for (size_t i = 0; i < clients_.size(); ++i) {
+			clients_[i]->connectDestroyed();
+			servers_[i]->connectDestroyed();
+		}
+	}
+
+	void run(const char* name) {
+		const size_t step = clients_.size() / active_;
+		for (int i = 0; i < active_; ++i) {
+			send(clients_[i * step]);
+		}
+
+		int64_t syscallsBefore = loop_.pollerSyscalls();
+		int64_t ioBefore = ioSyscalls();
+		Timestamp start(Timestamp::now());
+		loop_.loop();
+		double seconds = timeDifference(Timestamp::now(), start);
+		int64_t pollerSyscalls = loop_.pollerSyscalls() - syscallsBefore;
+		int64_t io = ioBefore >= 0 ? ioSyscalls() - ioBefore : 0;
+
+		report(name, seconds, received_, pollerSyscalls, pollerSyscalls + io);
+	}
+
+private:
+	void send(const TcpConnectionPtr& conn) {
+		++inFlight_;
+		conn->send("p", 1);
+	}
+
+	void onPing(const TcpConnectionPtr& conn, Buffer* buf) {
+		conn->send(buf->peek(), buf->readableBytes());
+		buf->retrieveAll();
+	}
+
+	void onPong(const TcpConnectionPtr& conn, Buffer* buf) {
+		buf->retrieveAll();
+		--inFlight_;
+		++received_;
+		if (received_ + inFlight_ < messages_) {
+			send(conn);
+		} else if (inFlight_ == 0) {
+			loop_.quit();
+		}
+	}
+
+	EventLoop loop_;
+	const int active_;
+	const int64_t messages_;
+	int64_t inFlight_;
+	int64_t received_;
+	std::vector<TcpConnectionPtr> clients_;
+	std::vector<TcpConnectionPtr> servers_;
+};
+
+int main(int argc, char* argv[]) {
+	int pairs = argc > 1 ? atoi(argv[1]) : 1000;
+	int active = argc > 2 ? atoi(argv[2]) : 100;
+	int64_t messages = argc > 3 ? atoll(argv[3]) : 200000;
+	if (active <= 0 || pairs < active) {
+		fprintf(stderr, "usage: %s [pairs [active [messages]]]\n", argv[0]);
+		return 1;
+	}
+
+	printf("pairs = %d, active = %d, messages = %lld\n",
+			pairs, active, static_cast<long long>(messages));
+	{
+	PingPong bench(EventLoop::kPollPoller, pairs, active, messages);
+	bench.run("poll");
+	}
+	{
+	PingPong bench(EventLoop::kEPollPoller, pairs, active, messages);
+	bench.run("epoll");
+	}
+	{
+	PingPong bench(EventLoop::kIoUringPoller, pairs, active, messages);
+	bench.run("io_uring");
+	}
+
+	printf("TcpConnection\n");
+	{
+	ConnectionPingPong bench(EventLoop::kPollPoller, pairs, active, messages);
+	bench.run("poll");
+	}
+	{
+	ConnectionPingPong bench(EventLoop::kEPollPoller, pairs, active, messages);
+	bench.run("epoll");
+	}
+	{
+	ConnectionPingPong bench(EventLoop::kIoUringPoller, pairs, active, messages);
+	bench.run("io_uring");
+	}
+
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include <leanet/eventloop.h>
+#include <leanet/channel.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+using namespace leanet;
+
+namespace {
+
+// a socketpair whose watched end is moved to fd if it is not -1
+struct Pair {
+  Pair(EventLoop* loop, int fd, int* reads)
+  {
+    EXPECT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv));
+    if (fd >= 0) {
+      EXPECT_EQ(fd, ::dup2(sv[0], fd));
+      ::close(sv[0]);
+      sv[0] = fd;
+    }
+    channel.reset(new Channel(loop, sv[0]));
+    int watched = sv[0];
+    channel->setReadCallback([reads, watched](Timestamp) {
+      char c;
+      EXPECT_EQ(1, ::read(watched, &c, 1));
+      ++*reads;
+    });
+    channel->enableReading();
+  }
+  ~Pair() {
+    channel->disableAll();
+    channel->remove();
+    ::close(sv[0]);
+    ::close(sv[1]);
+  }
+
+  int sv[2];
+  std::unique_ptr<Channel> channel;
+};
+
+void pollOnce(EventLoop* loop) {
+  loop->runAfter(0.05, [loop]() { loop->quit(); });
+  loop->loop();
+}
+
+void testSparseFds(EventLoop::PollerType type) {
+  EventLoop loop(type);
+  int reads[3] = { 0, 0, 0 };
+  std::unique_ptr<Pair> low(new Pair(&loop, -1, &reads[0]));
+  // far beyond the fds open, the table grows to take it
+  std::unique_ptr<Pair> high(new Pair(&loop, 900, &reads[1]));
+  EXPECT_TRUE(loop.hasChannel(low->channel.get()));
+  EXPECT_TRUE(loop.hasChannel(high->channel.get()));
+
+  EXPECT_EQ(1, ::write(low->sv[1], "x", 1));
+  EXPECT_EQ(1, ::write(high->sv[1], "x", 1));
+  pollOnce(&loop);
+  EXPECT_EQ(1, reads[0]);
+  EXPECT_EQ(1, reads[1]);
+
+  // a new channel on the fd of a removed one
+  high.reset();
+  high.reset(new Pair(&loop, 900, &reads[2]));
+  EXPECT_EQ(1, ::write(high->sv[1], "x", 1));
+  EXPECT_EQ(1, ::write(low->sv[1], "x", 1));
+  pollOnce(&loop);
+  EXPECT_EQ(2, reads[0]);
+  EXPECT_EQ(1, reads[1]);
+  EXPECT_EQ(1, reads[2]);
+}
+
+}
+
+TEST(POLLER_TEST, POLL_SPARSE_FDS) {
+  testSparseFds(EventLoop::kPollPoller);
+}
+
+TEST(POLLER_TEST, EPOLL_SPARSE_FDS) {
+  testSparseFds(EventLoop::kEPollPoller);
+}
+
+TEST(POLLER_TEST, IO_URING_SPARSE_FDS) {
+  testSparseFds(EventLoop::kIoUringPoller);
+}
@@ -0,0 +1,1003 @@
+#include <gtest/gtest.h>
+#include <leanet/eventloop.h>
+#include <leanet/tcpconnection.h>
+#include <leanet/buffer.h>
+#include <leanet/bufferpool.h>
+#include <leanet/bufferbudget.h>
+#include <leanet/circularbuffer.h>
+#include <leanet/thread.h>
+#include <leanet/countdownlatch.h>
+#include <leanet/currentthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace leanet;
+
+namespace {
+
+// connected nonblocking loopback TCP sockets
+// sv[1] receives into rcvbuf bytes at most if not 0
+void tcpPair(int sv[2], int rcvbuf = 0) {
+  int listenfd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_in addr;
+  ::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addrlen = sizeof(addr);
+  EXPECT_EQ(0, ::bind(listenfd, reinterpret_cast<struct sockaddr*>(&addr), addrlen));
+  EXPECT_EQ(0, ::listen(listenfd, 1));
+  EXPECT_EQ(0, ::getsockname(listenfd, reinterpret_cast<struct sockaddr*>(&addr), &addrlen));
+  sv[1] = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (rcvbuf > 0) {
+    EXPECT_EQ(0, ::setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)));
+  }
+  EXPECT_EQ(0, ::connect(sv[1], reinterpret_cast<struct sockaddr*>(&addr), addrlen));
+  ::fcntl(sv[1], F_SETFL, O_NONBLOCK);
+  sv[0] = ::accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  ::close(listenfd);
+}
+
+// TcpConnections over socketpairs(or loopback TCP), peers are read in another thread
+class Pairs {
+public:
+  Pairs(EventLoop* loop, int n, bool edgeTriggered = false, bool tcp = false)
+    : loop_(loop)
+  {
+    for (int i = 0; i < n; ++i) {
+      int sv[2];
+      if (tcp) {
+        tcpPair(sv);
+      } else {
+        EXPECT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv));
+      }
+      TcpConnectionPtr conn(std::make_shared<TcpConnection>(
+            loop, sv[0], "pair", InetAddress(), InetAddress()));
+      conn->setConnectionCallback([](const TcpConnectionPtr&) { });
+      conn->setMessageCallback([](const TcpConnectionPtr&, Buffer* buf, Timestamp) {
+        buf->retrieveAll();
+      });
+      conn->setEdgeTriggered(edgeTriggered);
+      conns_.push_back(conn);
+      peers_.push_back(sv[1]);
+    }
+    CountdownLatch latch(1);
+    loop_->runInLoop([this, &latch]() {
+      for (size_t i = 0; i < conns_.size(); ++i) {
+        conns_[i]->connectEstablished();
+      }
+      latch.countDown();
+    });
+    latch.wait();
+  }
+
+  ~Pairs() {
+    CountdownLatch latch(1);
+    loop_->runInLoop([this, &latch]() {
+      for (size_t i = 0; i < conns_.size(); ++i) {
+        conns_[i]->connectDestroyed();
+      }
+      latch.countDown();
+    });
+    latch.wait();
+    for (size_t i = 0; i < peers_.size(); ++i) {
+      ::close(peers_[i]);
+    }
+  }
+
+  const std::vector<TcpConnectionPtr>& conns() const { return conns_; }
+  int peer(size_t i) const { return peers_[i]; }
+
+  // reads len bytes from every peer
+  std::vector<std::string> receive(size_t len) {
+    std::vector<std::string> received(peers_.size());
+    size_t done = 0;
+    while (done < peers_.size()) {
+      done = 0;
+      for (size_t i = 0; i < peers_.size(); ++i) {
+        char buf[65536];
+        ssize_t n = ::read(peers_[i], buf, sizeof(buf));
+        if (n > 0) {
+          received[i].append(buf, static_cast<size_t>(n));
+        }
+        if (received[i].size() >= len) {
+          ++done;
+        }
+      }
+    }
+    return received;
+  }
+
+private:
+  EventLoop* loop_;
+  std::vector<TcpConnectionPtr> conns_;
+  std::vector<int> peers_;
+};
+
+// runs an EventLoop in another thread
+class LoopThread {
+public:
+  LoopThread()
+    : loop_(NULL),
+      latch_(1),
+      thread_(std::bind(&LoopThread::threadFunc, this))
+  {
+    thread_.start();
+    latch_.wait();
+  }
+
+  ~LoopThread() {
+    loop_->quit();
+    thread_.join();
+  }
+
+  EventLoop* loop() const { return loop_; }
+
+private:
+  void threadFunc() {
+    EventLoop loop;
+    loop_ = &loop;
+    latch_.countDown();
+    loop.loop();
+  }
+
+  EventLoop* loop_;
+  CountdownLatch latch_;
+  Thread thread_;
+};
+
+}
+
+TEST(TCPCONNECTION_TEST, BROADCAST) {
+  LoopThread thread;
+  Pairs pairs(thread.loop(), 20);
+
+  // larger than the socket buffer, so references are queued
+  const size_t kSize = 1024 * 1024;
+  std::shared_ptr<Buffer> message(new Buffer);
+  for (size_t i = 0; i < kSize; ++i) {
+    message->appendInt8(static_cast<int8_t>(i % 128));
+  }
+  const std::string expected(message->peek(), message->readableBytes());
+
+  std::shared_ptr<const Buffer> shared(message);
+  message.reset();
+  for (size_t i = 0; i < pairs.conns().size(); ++i) {
+    pairs.conns()[i]->send(shared);
+  }
+
+  std::vector<std::string> received = pairs.receive(kSize);
+  for (size_t i = 0; i < received.size(); ++i) {
+    EXPECT_TRUE(received[i] == expected);
+  }
+  // all references are dropped once written
+  CountdownLatch latch(1);
+  thread.loop()->runInLoop([&latch]() { latch.countDown(); });
+  latch.wait();
+  EXPECT_EQ(1, shared.use_count());
+}
+
+TEST(TCPCONNECTION_TEST, SEND_FROM_OTHER_THREAD) {
+  LoopThread thread;
+  Pairs pairs(thread.loop(), 1);
+  const TcpConnectionPtr& conn = pairs.conns()[0];
+
+  const size_t kSize = 512 * 1024;
+  std::string expected;
+
+  // copied, the caller's memory is gone before the loop runs
+  {
+  std::vector<char> data(kSize, 'a');
+  conn->send(data.data(), data.size());
+  expected.append(data.begin(), data.end());
+  }
+
+  // taken over
+  std::string message(kSize, 'b');
+  conn->send(std::move(message));
+  expected.append(kSize, 'b');
+
+  // referred to and released in the loop thread
+  std::vector<char> data(kSize, 'c');
+  CountdownLatch released(1);
+  uint64_t releasedThread = 0;
+  EventLoop* loop = thread.loop();
+  conn->send(data.data(), data.size(), [&released, &releasedThread, loop]() {
+    EXPECT_TRUE(loop->isInLoopThread());
+    releasedThread = currentThread::tid();
+    released.countDown();
+  });
+  expected.append(kSize, 'c');
+
+  std::vector<std::string> received = pairs.receive(expected.size());
+  EXPECT_TRUE(received[0] == expected);
+  released.wait();
+  EXPECT_NE(currentThread::tid(), releasedThread);
+}
+
+TEST(TCPCONNECTION_TEST, COALESCED_SENDS) {
+  LoopThread thread;
+  EventLoop* loop = thread.loop();
+  Pairs pairs(loop, 1);
+  const TcpConnectionPtr& conn = pairs.conns()[0];
+
+  // sent while the loop is busy, queued in the connection behind one
+  // functor in loop
+  CountdownLatch blocked(1);
+  CountdownLatch release(1);
+  loop->queueInLoop([&blocked, &release]() {
+    blocked.countDown();
+    release.wait();
+  });
+  blocked.wait();
+
+  std::string expected;
+  for (int i = 0; i < 1000; ++i) {
+    // small ones are copied together, large ones referred to
+    std::string message(i % 100 == 0 ? 4096 : 16, static_cast<char>('a' + i % 26));
+    expected += message;
+    conn->send(std::move(message));
+  }
+  std::shared_ptr<Buffer> buffer(new Buffer);
+  buffer->append("shared", 6);
+  conn->send(std::shared_ptr<const Buffer>(buffer));
+  expected += "shared";
+  const char kReferred[] = "referred";
+  CountdownLatch released(1);
+  conn->send(kReferred, sizeof(kReferred) - 1, [&released]() { released.countDown(); });
+  expected += kReferred;
+  conn->send("last");
+  expected += "last";
+  // after all of them
+  conn->shutdown();
+  EXPECT_EQ(2, loop->queueSize());
+  release.countDown();
+
+  std::string received;
+  for (;;) {
+    char buf[65536];
+    ssize_t n = ::read(pairs.peer(0), buf, sizeof(buf));
+    if (n == 0) {
+      break;
+    }
+    if (n > 0) {
+      received.append(buf, static_cast<size_t>(n));
+    }
+  }
+  EXPECT_EQ(expected.size(), received.size());
+  EXPECT_TRUE(received == expected);
+  released.wait();
+}
+
+TEST(TCPCONNECTION_TEST, FLUSH_WITHOUT_INTEREST) {
+  LoopThread thread;
+  EventLoop* loop = thread.loop();
+  Pairs pairs(loop, 1);
+  const TcpConnectionPtr& conn = pairs.conns()[0];
+
+  // blocked in a timer callback, the flush and the probe then run in the
+  // functors of the same iteration, no poll in between
+  CountdownLatch blocked(1);
+  CountdownLatch release(1);
+  int64_t before = 0;
+  loop->runAfter(0.0, [loop, &blocked, &release, &before]() {
+    blocked.countDown();
+    release.wait();
+    before = loop->pollerSyscalls();
+  });
+  blocked.wait();
+  for (int i = 0; i < 10; ++i) {
+    conn->send(std::string(64, 'x'));
+  }
+  int64_t after = -1;
+  CountdownLatch probed(1);
+  loop->queueInLoop([loop, &after, &probed]() {
+    after = loop->pollerSyscalls();
+    probed.countDown();
+  });
+  release.countDown();
+  probed.wait();
+  // written at once(or submitted to the poller), writable interest was
+  // never asked for
+  EXPECT_EQ(before, after);
+
+  std::string received;
+  while (received.size() < 640) {
+    char buf[1024];
+    ssize_t n = ::read(pairs.peer(0), buf, sizeof(buf));
+    if (n > 0) {
+      received.append(buf, static_cast<size_t>(n));
+    } else {
+      ASSERT_EQ(EAGAIN, errno);
+      ::usleep(100);
+    }
+  }
+  EXPECT_EQ(std::string(640, 'x'), received);
+}
+
+TEST(TCPCONNECTION_TEST, COMPLETION_WRITES) {
+  EventLoop loop(EventLoop::kIoUringPoller);
+  if (!loop.supportsCompletions()) {
+    // fell back to epoll(4)
+    return;
+  }
+  Pairs pairs(&loop, 1);
+  const TcpConnectionPtr& conn = pairs.conns()[0];
+  int writeCompleted = 0;
+  conn->setWriteCompleteCallback([&writeCompleted](const TcpConnectionPtr&) { ++writeCompleted; });
+
+  // submitted with the next poll, not written by a system call of its own
+  std::string expected("hello");
+  conn->send(expected);
+  char buf[65536];
+  EXPECT_LT(::read(pairs.peer(0), buf, sizeof(buf)), 0);
+  // more than the socket takes at once, written as the peer reads
+  std::string large(1024 * 1024, 'x');
+  expected += large;
+  conn->send(std::move(large));
+
+  std::string received;
+  Thread reader([&]() {
+    while (received.size() < expected.size()) {
+      ssize_t n = ::read(pairs.peer(0), buf, sizeof(buf));
+      if (n > 0) {
+        received.append(buf, static_cast<size_t>(n));
+      } else {
+        ::usleep(100);
+      }
+    }
+    loop.queueInLoop(std::bind(&EventLoop::quit, &loop));
+  });
+  reader.start();
+  loop.loop();
+  reader.join();
+  // the callback queued after the last completion
+  loop.runAfter(0.01, std::bind(&EventLoop::quit, &loop));
+  loop.loop();
+
+  EXPECT_TRUE(received == expected);
+  EXPECT_EQ(1, writeCompleted);
+}
+
+namespace {
+
+// read(2)-like system calls made by the process, -1 if not accounted
+int64_t readSyscalls() {
+  int fd = ::open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  char buf[512];
+  ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+  ::close(fd);
+  if (n <= 0) {
+    return -1;
+  }
+  buf[n] = '\0';
+  const char* syscr = ::strstr(buf, "syscr:");
+  return syscr != NULL ? ::atoll(syscr + 6) : -1;
+}
+
+}
+
+TEST(TCPCONNECTION_TEST, COMPLETION_READS) {
+  EventLoop loop(EventLoop::kIoUringPoller);
+  if (!loop.supportsCompletions()) {
+    // fell back to epoll(4)
+    return;
+  }
+  Pairs pairs(&loop, 1);
+  const TcpConnectionPtr& conn = pairs.conns()[0];
+
+  // ping-pong with the peer written in the message callback
+  const int kMessages = 100;
+  const int peer = pairs.peer(0);
+  std::string expected;
+  for (int i = 0; i < kMessages; ++i) {
+    expected += static_cast<char>('a' + i % 26);
+  }
+  std::string received;
+  int messages = 0;
+  conn->setMessageCallback([&](const TcpConnectionPtr&, Buffer* buf, Timestamp) {
+    received += buf->retrieveAllAsString();
+    if (++messages < kMessages) {
+      EXPECT_EQ(1, ::write(peer, &expected[messages], 1));
+    } else {
+      loop.quit();
+    }
+  });
+
+  const int64_t readsBefore = readSyscalls();
+  const int64_t pollsBefore = loop.pollerSyscalls();
+  EXPECT_EQ(1, ::write(peer, &expected[0], 1));
+  loop.loop();
+  const int64_t reads = readSyscalls() - readsBefore;
+  const int64_t polls = loop.pollerSyscalls() - pollsBefore;
+
+  EXPECT_EQ(kMessages, messages);
+  EXPECT_EQ(expected, received);
+  // the reads submitted complete in the polls, no read(2) of their own
+  if (readsBefore >= 0) {
+    EXPECT_LT(reads, 10);
+  }
+  EXPECT_LE(polls, kMessages + 5);
+}
+
+TEST(TCPCONNECTION_TEST, SEND_FILE) {
+  LoopThread thread;
+  Pairs pairs(thread.loop(), 1);
+  const TcpConnectionPtr& conn = pairs.conns()[0];
+
+  char path[] = "/tmp/leanet_sendfile_XXXXXX";
+  int fd = ::mkstemp(path);
+  ASSERT_GE(fd, 0);
+  ::unlink(path);
+  const size_t kSize = 1024 * 1024;
+  std::string content;
+  for (size_t i = 0; i < kSize; ++i) {
+    content += static_cast<char>('a' + i % 26);
+  }
+  ASSERT_EQ(static_cast<ssize_t>(kSize), ::write(fd, content.data(), content.size()));
+
+  // in order with memory around it, the file offset is not touched
+  CountdownLatch released(1);
+  conn->send(std::string("head"));
+  conn->sendFile(fd, 100, kSize - 200, [&released]() { released.countDown(); });
+  conn->send(std::string("tail"));
+  std::string expected = "head" + content.substr(100, kSize - 200) + "tail";
+
+  std::vector<std::string> received = pairs.receive(expected.size());
+  EXPECT_TRUE(received[0] == expected);
+  released.wait();
+  EXPECT_EQ(static_cast<off_t>(kSize), ::lseek(fd, 0, SEEK_CUR));
+  ::close(fd);
+}
+
+namespace {
+
+void testSendPipe(bool edgeTriggered) {
+  LoopThread thread;
+  Pairs pairs(thread.loop(), 1, edgeTriggered);
+  const TcpConnectionPtr& conn = pairs.conns()[0];
+
+  int pipefd[2];
+  ASSERT_EQ(0, ::pipe2(pipefd, O_NONBLOCK | O_CLOEXEC));
+
+  // the pipe is empty most of the time, output waits for it
+  const size_t kChunk = 64 * 1024;
+  const int kChunks = 16;
+  CountdownLatch released(1);
+  conn->sendFile(pipefd[0], 0, kChunk * kChunks, [&released]() { released.countDown(); });
+  conn->send(std::string("tail"));
+  std::string expected;
+  Thread writer([&pipefd, kChunk, kChunks]() {
+    for (int i = 0; i < kChunks; ++i) {
+      std::string chunk(kChunk, static_cast<char>('a' + i));
+      size_t written = 0;
+      while (written < chunk.size()) {
+        ssize_t n = ::write(pipefd[1], chunk.data() + written, chunk.size() - written);
+        if (n > 0) {
+          written += static_cast<size_t>(n);
+        } else {
+          ::usleep(1000);
+        }
+      }
+      ::usleep(5000);
+    }
+  });
+  for (int i = 0; i < kChunks; ++i) {
+    expected.append(kChunk, static_cast<char>('a' + i));
+  }
+  expected += "tail";
+  writer.start();
+
+  std::vector<std::string> received = pairs.receive(expected.size());
+  writer.join();
+  EXPECT_TRUE(received[0] == expected);
+  released.wait();
+  ::close(pipefd[0]);
+  ::close(pipefd[1]);
+}
+
+}
+
+TEST(TCPCONNECTION_TEST, SEND_PIPE) {
+  testSendPipe(false);
+  testSendPipe(true);
+}
+
+TEST(TCPCONNECTION_TEST, ZERO_COPY) {
+  LoopThread thread;
+  EventLoop* loop = thread.loop();
+  {
+  // not supported by unix domain sockets
+  Pairs pairs(loop, 1);
+  EXPECT_FALSE(pairs.conns()[0]->setZeroCopy(true));
+  }
+
+  Pairs pairs(loop, 1, false, true);
+  const TcpConnectionPtr& conn = pairs.conns()[0];
+  bool supported = false;
+  CountdownLatch latch(1);
+  loop->runInLoop([&conn, &supported, &latch]() {
+    supported = conn->setZeroCopy(true, 64 * 1024);
+    latch.countDown();
+  });
+  latch.wait();
+  if (!supported) {
+    return;
+  }
+
+  // the small head is written directly, the large message is queued
+  const size_t kSize = 1024 * 1024;
+  conn->send(std::string("head"));
+  conn->send(std::string(kSize, 'z'));
+  std::string expected = "head" + std::string(kSize, 'z');
+
+  std::vector<std::string> received = pairs.receive(expected.size());
+  EXPECT_TRUE(received[0] == expected);
+
+  // released after completions are read in the loop
+  CountdownLatch released(1);
+  std::vector<char> data(kSize, 'c');
+  conn->send(data.data(), data.size(), [&released, loop]() {
+    EXPECT_TRUE(loop->isInLoopThread());
+    released.countDown();
+  });
+  received = pairs.receive(kSize);
+  EXPECT_TRUE(received[0] == std::string(kSize, 'c'));
+  released.wait();
+}
+
+TEST(TCPCONNECTION_TEST, ZERO_COPY_DESTROYED) {
+  LoopThread thread;
+  EventLoop* loop = thread.loop();
+  // sends wait in the socket for the peer
+  int sv[2];
+  tcpPair(sv, 64 * 1024);
+  TcpConnectionPtr conn(std::make_shared<TcpConnection>(
+        loop, sv[0], "zerocopy", InetAddress(), InetAddress()));
+  conn->setConnectionCallback([](const TcpConnectionPtr&) { });
+  bool supported = false;
+  CountdownLatch latch(1);
+  loop->runInLoop([&conn, &supported, &latch]() {
+    supported = conn->setZeroCopy(true, 64 * 1024);
+    conn->connectEstablished();
+    latch.countDown();
+  });
+  latch.wait();
+  if (!supported) {
+    loop->runInLoop([&conn]() { conn->connectDestroyed(); });
+    ::close(sv[1]);
+    return;
+  }
+
+  // more than the socket buffers hold, the peer doesn't read yet
+  const size_t kSize = 16 * 1024 * 1024;
+  std::vector<char> data(kSize, 'c');
+  CountdownLatch released(1);
+  conn->send(data.data(), data.size(), [&released]() { released.countDown(); });
+
+  // destroyed with the message queued(and sends in flight, unless loopback
+  // has copied them), the socket is kept open and the slice held for them
+  std::weak_ptr<TcpConnection> weakConn(conn);
+  CountdownLatch destroyed(1);
+  loop->runInLoop([&conn, &destroyed]() {
+    conn->connectDestroyed();
+    conn.reset();
+    destroyed.countDown();
+  });
+  destroyed.wait();
+
+  // what has been written is sent intact, then the socket is closed
+  size_t received = 0;
+  bool intact = true;
+  for (;;) {
+    struct pollfd pfd = { sv[1], POLLIN, 0 };
+    ASSERT_EQ(1, ::poll(&pfd, 1, 5000));
+    char buf[65536];
+    ssize_t n = ::read(sv[1], buf, sizeof(buf));
+    if (n == 0) {
+      break;
+    }
+    ASSERT_GT(n, 0);
+    for (ssize_t i = 0; i < n; ++i) {
+      intact = intact && buf[i] == 'c';
+    }
+    received += static_cast<size_t>(n);
+  }
+  EXPECT_TRUE(intact);
+  EXPECT_GT(received, 0u);
+  released.wait();
+  EXPECT_TRUE(weakConn.expired());
+  ::close(sv[1]);
+}
+
+TEST(TCPCONNECTION_TEST, ADAPTIVE_READ) {
+  LoopThread thread;
+  EventLoop* loop = thread.loop();
+  int sv[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv));
+  TcpConnectionPtr conn(std::make_shared<TcpConnection>(
+        loop, sv[0], "adaptive", InetAddress(), InetAddress()));
+  conn->setConnectionCallback([](const TcpConnectionPtr&) { });
+  size_t received = 0;
+  CountdownLatch latch(1);
+  size_t expected = 0;
+  conn->setMessageCallback([&received, &latch, &expected](const TcpConnectionPtr&, Buffer* buf, Timestamp) {
+    received += buf->readableBytes();
+    buf->retrieveAll();
+    if (received == expected) {
+      latch.countDown();
+    }
+  });
+
+  // large frames, then small ones
+  const size_t kFrame = 200 * 1024;
+  const int kFrames = 20;
+  const int kSmall = 20;
+  expected = kFrame * kFrames + 10 * kSmall;
+  loop->runInLoop([&conn]() { conn->connectEstablished(); });
+  Thread writer([&sv, kFrame, kFrames, kSmall]() {
+    std::string frame(kFrame, 'f');
+    for (int i = 0; i < kFrames; ++i) {
+      size_t written = 0;
+      while (written < frame.size()) {
+        ssize_t n = ::write(sv[1], frame.data() + written, frame.size() - written);
+        if (n > 0) {
+          written += static_cast<size_t>(n);
+        } else {
+          ::usleep(100);
+        }
+      }
+      ::usleep(1000);
+    }
+    for (int i = 0; i < kSmall; ++i) {
+      ::usleep(1000);
+      EXPECT_EQ(10, ::write(sv[1], "0123456789", 10));
+    }
+  });
+  writer.start();
+  writer.join();
+  latch.wait();
+
+  ReadStats stats;
+  BufferPool::Stats poolStats;
+  size_t held = 0;
+  CountdownLatch done(1);
+  loop->runInLoop([&conn, &stats, &poolStats, &held, &done, loop]() {
+    stats = *loop->readStats();
+    poolStats = loop->bufferPool()->stats();
+    held = conn->inputBuffer()->internalCapacity();
+    conn->connectDestroyed();
+    done.countDown();
+  });
+  done.wait();
+  ::close(sv[1]);
+
+  EXPECT_EQ(static_cast<int64_t>(expected), stats.bytesRead);
+  // the guess has grown for the large frames
+  EXPECT_LT(stats.spilledReads, stats.reads / 2);
+  // the drained input buffer keeps its storage until idle, no more
+  EXPECT_GT(held, 0u);
+  EXPECT_EQ(static_cast<int64_t>(held), poolStats.usedBytes);
+}
+
+TEST(TCPCONNECTION_TEST, BUFFER_IDLE) {
+  LoopThread thread;
+  EventLoop* loop = thread.loop();
+  int sv[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv));
+  TcpConnectionPtr conn(std::make_shared<TcpConnection>(
+        loop, sv[0], "idle", InetAddress(), InetAddress()));
+  conn->setConnectionCallback([](const TcpConnectionPtr&) { });
+  // keeps the last byte, as a partial frame
+  const size_t kSize = 1024 * 1024;
+  size_t received = 0;
+  CountdownLatch latch(1);
+  conn->setMessageCallback([&received, &latch, kSize](const TcpConnectionPtr&, Buffer* buf, Timestamp) {
+    received += buf->readableBytes() - (received > 0 ? 1 : 0);
+    buf->retrieve(buf->readableBytes() - 1);
+    if (received == kSize) {
+      latch.countDown();
+    }
+  });
+  conn->setBufferIdleTimeout(0.1);
+  loop->runInLoop([&conn]() { conn->connectEstablished(); });
+
+  Thread writer([&sv, kSize]() {
+    std::string data(kSize, 'i');
+    data[kSize - 1] = 'z';
+    size_t written = 0;
+    while (written < data.size()) {
+      ssize_t n = ::write(sv[1], data.data() + written, data.size() - written);
+      if (n > 0) {
+        written += static_cast<size_t>(n);
+      } else {
+        ::usleep(100);
+      }
+    }
+  });
+  writer.start();
+  writer.join();
+  latch.wait();
+
+  size_t busy = 0;
+  CountdownLatch checked(1);
+  loop->runInLoop([&conn, &busy, &checked]() {
+    busy = conn->inputBuffer()->internalCapacity();
+    checked.countDown();
+  });
+  checked.wait();
+  EXPECT_GT(busy, 64u * 1024);
+
+  // shrunk to the partial frame
+  ::usleep(300 * 1000);
+  size_t idle = 0;
+  std::string kept;
+  CountdownLatch done(1);
+  loop->runInLoop([&conn, &idle, &kept, &done]() {
+    idle = conn->inputBuffer()->internalCapacity();
+    kept = conn->inputBuffer()->retrieveAllAsString();
+    conn->connectDestroyed();
+    done.countDown();
+  });
+  done.wait();
+  ::close(sv[1]);
+  EXPECT_LE(idle, static_cast<size_t>(BufferPool::kMinBlockSize));
+  EXPECT_EQ("z", kept);
+}
+
+namespace {
+
+void testBufferBudget(bool edgeTriggered) {
+  LoopThread thread;
+  EventLoop* loop = thread.loop();
+  const size_t kLimit = 256 * 1024;
+  std::shared_ptr<BufferBudget> budget(std::make_shared<BufferBudget>(kLimit));
+
+  // the first one sends to a peer which doesn't read, the second only reads
+  TcpConnectionPtr conns[2];
+  int peers[2];
+  std::string received[2];
+  for (int i = 0; i < 2; ++i) {
+    int sv[2];
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv));
+    conns[i] = std::make_shared<TcpConnection>(loop, sv[0], "budget", InetAddress(), InetAddress());
+    conns[i]->setConnectionCallback([](const TcpConnectionPtr&) { });
+    std::string* input = &received[i];
+    conns[i]->setMessageCallback([input](const TcpConnectionPtr&, Buffer* buf, Timestamp) {
+      input->append(buf->retrieveAllAsString());
+    });
+    conns[i]->setEdgeTriggered(edgeTriggered);
+    conns[i]->setBufferBudget(budget);
+    peers[i] = sv[1];
+  }
+  CountdownLatch established(1);
+  loop->runInLoop([&conns, &established]() {
+    conns[0]->connectEstablished();
+    conns[1]->connectEstablished();
+    established.countDown();
+  });
+  established.wait();
+
+  const size_t kSize = 1024 * 1024;
+  conns[0]->send(std::string(kSize, 'o'));
+  CountdownLatch queued(1);
+  loop->runInLoop([&queued]() { queued.countDown(); });
+  queued.wait();
+  EXPECT_GT(budget->bytes(), static_cast<int64_t>(kLimit));
+
+  // the sender stops reading, the other one doesn't
+  EXPECT_EQ(1, ::write(peers[0], "a", 1));
+  EXPECT_EQ(1, ::write(peers[1], "b", 1));
+  ::usleep(100 * 1000);
+  std::string input[2];
+  CountdownLatch read(1);
+  loop->runInLoop([&input, &received, &read]() {
+    input[0] = received[0];
+    input[1] = received[1];
+    read.countDown();
+  });
+  read.wait();
+  EXPECT_EQ("", input[0]);
+  EXPECT_EQ("b", input[1]);
+
+  // reads again once the output is written
+  std::string output;
+  while (output.size() < kSize) {
+    char buf[65536];
+    ssize_t n = ::read(peers[0], buf, sizeof(buf));
+    if (n > 0) {
+      output.append(buf, static_cast<size_t>(n));
+    }
+  }
+  EXPECT_EQ(std::string(kSize, 'o'), output);
+  ::usleep(100 * 1000);
+  CountdownLatch done(1);
+  loop->runInLoop([&conns, &input, &received, &done]() {
+    input[0] = received[0];
+    conns[0]->connectDestroyed();
+    conns[1]->connectDestroyed();
+    done.countDown();
+  });
+  done.wait();
+  ::close(peers[0]);
+  ::close(peers[1]);
+  EXPECT_EQ("a", input[0]);
+  EXPECT_EQ(0, budget->bytes());
+}
+
+void testInputBudget(bool edgeTriggered) {
+  LoopThread thread;
+  EventLoop* loop = thread.loop();
+  const size_t kLimit = 256 * 1024;
+  const size_t kFloor = 4096;
+  std::shared_ptr<BufferBudget> budget(std::make_shared<BufferBudget>(kLimit));
+
+  // the message callback leaves the input until told to take it, nothing is
+  // written
+  int sv[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv));
+  TcpConnectionPtr conn(std::make_shared<TcpConnection>(
+        loop, sv[0], "input", InetAddress(), InetAddress()));
+  conn->setConnectionCallback([](const TcpConnectionPtr&) { });
+  bool taking = false;
+  size_t received = 0;
+  conn->setMessageCallback([&taking, &received](const TcpConnectionPtr&, Buffer* buf, Timestamp) {
+    if (taking) {
+      received += buf->readableBytes();
+      buf->retrieveAll();
+    }
+  });
+  conn->setEdgeTriggered(edgeTriggered);
+  conn->setBufferBudget(budget, kFloor);
+  CountdownLatch established(1);
+  loop->runInLoop([&conn, &established]() {
+    conn->connectEstablished();
+    established.countDown();
+  });
+  established.wait();
+
+  // the peer writes until the socket is full, the connection stops reading
+  // soon after the budget is exceeded
+  const size_t kSize = 8 * 1024 * 1024;
+  const std::string chunk(64 * 1024, 'i');
+  size_t written = 0;
+  for (int idle = 0; written < kSize && idle < 100; ) {
+    ssize_t n = ::write(sv[1], chunk.data(), chunk.size());
+    if (n > 0) {
+      written += static_cast<size_t>(n);
+      idle = 0;
+    } else {
+      ::usleep(1000);
+      ++idle;
+    }
+  }
+  EXPECT_LT(written, kSize);
+  size_t held = 0;
+  CountdownLatch checked(1);
+  loop->runInLoop([&conn, &held, &checked]() {
+    held = conn->inputBuffer()->readableBytes();
+    checked.countDown();
+  });
+  checked.wait();
+  EXPECT_GT(held, kFloor);
+  EXPECT_LT(held, 2 * kLimit);
+  EXPECT_GE(budget->bytes(), static_cast<int64_t>(held));
+
+  // reads again once the input is taken
+  CountdownLatch taken(1);
+  loop->runInLoop([&conn, &taking, &received, &taken]() {
+    taking = true;
+    received = conn->inputBuffer()->readableBytes();
+    conn->inputBuffer()->retrieveAll();
+    taken.countDown();
+  });
+  taken.wait();
+  while (written < kSize) {
+    ssize_t n = ::write(sv[1], chunk.data(), std::min(chunk.size(), kSize - written));
+    if (n > 0) {
+      written += static_cast<size_t>(n);
+    } else {
+      ::usleep(1000);
+    }
+  }
+  size_t total = 0;
+  while (total < kSize) {
+    ::usleep(10 * 1000);
+    CountdownLatch read(1);
+    loop->runInLoop([&received, &total, &read]() {
+      total = received;
+      read.countDown();
+    });
+    read.wait();
+  }
+  EXPECT_EQ(kSize, total);
+
+  CountdownLatch done(1);
+  loop->runInLoop([&conn, &done]() {
+    conn->connectDestroyed();
+    done.countDown();
+  });
+  done.wait();
+  ::close(sv[1]);
+  EXPECT_EQ(0, budget->bytes());
+}
+
+}
+
+TEST(TCPCONNECTION_TEST, BUFFER_BUDGET) {
+  testBufferBudget(false);
+  testBufferBudget(true);
+}
+
+TEST(TCPCONNECTION_TEST, BUFFER_BUDGET_INPUT) {
+  testInputBudget(false);
+  testInputBudget(true);
+}
+
+TEST(TCPCONNECTION_TEST, CIRCULAR_INPUT) {
+  LoopThread thread;
+  EventLoop* loop = thread.loop();
+  int sv[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv));
+  TcpConnectionPtr conn(std::make_shared<TcpConnection>(
+        loop, sv[0], "circular", InetAddress(), InetAddress()));
+  conn->setConnectionCallback([](const TcpConnectionPtr&) { });
+  // echoes out of the ring
+  conn->setCircularMessageCallback([](const TcpConnectionPtr& c, CircularBuffer* buf, Timestamp) {
+    c->send(buf);
+    EXPECT_EQ(0u, buf->readableBytes());
+  });
+  CountdownLatch established(1);
+  loop->runInLoop([&conn, &established]() {
+    conn->connectEstablished();
+    established.countDown();
+  });
+  established.wait();
+
+  std::string data;
+  for (size_t i = 0; i < 1000 * 1000; ++i) {
+    data += static_cast<char>('a' + i % 26);
+  }
+  Thread writer([&sv, &data]() {
+    size_t written = 0;
+    while (written < data.size()) {
+      size_t len = std::min(data.size() - written, static_cast<size_t>(3333));
+      ssize_t n = ::write(sv[1], data.data() + written, len);
+      if (n > 0) {
+        written += static_cast<size_t>(n);
+      } else {
+        ::usleep(100);
+      }
+    }
+  });
+  writer.start();
+  std::string echoed;
+  while (echoed.size() < data.size()) {
+    char buf[65536];
+    ssize_t n = ::read(sv[1], buf, sizeof(buf));
+    if (n > 0) {
+      echoed.append(buf, static_cast<size_t>(n));
+    }
+  }
+  writer.join();
+  EXPECT_TRUE(echoed == data);
+
+  CountdownLatch done(1);
+  loop->runInLoop([&conn, &done]() {
+    conn->connectDestroyed();
+    done.countDown();
+  });
+  done.wait();
+  ::close(sv[1]);
+}
@@ -0,0 +1,377 @@
+#include <gtest/gtest.h>
+#include <leanet/eventloop.h>
+#include <leanet/tcpserver.h>
+#include <leanet/eventloopthreadpool.h>
+#include <leanet/tcpconnection.h>
+#include <leanet/buffer.h>
+#include <leanet/inetaddress.h>
+#include <leanet/thread.h>
+#include <leanet/mutex.h>
+#include <leanet/acceptor.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include <memory>
+#include <set>
+#include <vector>
+#include <string>
+
+using namespace leanet;
+
+namespace {
+
+int connectTo(const InetAddress& addr) {
+  struct sockaddr_in sa;
+  ::memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sa.sin_port = htons(addr.port());
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  EXPECT_EQ(0, ::connect(fd, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)));
+  return fd;
+}
+
+// what is echoed for message on a blocking connection
+std::string echoOn(int fd, const std::string& message) {
+  EXPECT_EQ(static_cast<ssize_t>(message.size()), ::write(fd, message.data(), message.size()));
+  std::string result;
+  char buf[4096];
+  while (result.size() < message.size()) {
+    ssize_t n = ::read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    result.append(buf, static_cast<size_t>(n));
+  }
+  return result;
+}
+
+// blocking loopback client, returns what is echoed for message
+std::string echo(const InetAddress& addr, const std::string& message) {
+  int fd = connectTo(addr);
+  std::string result(echoOn(fd, message));
+  ::close(fd);
+  return result;
+}
+
+// closed by server without a byte
+bool closedByPeer(int fd) {
+  char buf[16];
+  return ::read(fd, buf, sizeof(buf)) <= 0;
+}
+
+void waitForConnections(const TcpServer& server, int n) {
+  for (int i = 0; i < 1000 && server.numConnections() != n; ++i) {
+    ::usleep(1000);
+  }
+  EXPECT_EQ(n, server.numConnections());
+}
+
+void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+  conn->send(buf->retrieveAllAsString());
+}
+
+}
+
+TEST(TCPSERVER_TEST, REUSE_PORT) {
+  EventLoop loop;
+  TcpServer server(&loop, InetAddress(0, true), "reuseport", TcpServer::kReusePort);
+  const int kThreads = 4;
+  server.setThreadNum(kThreads);
+
+  // accepted and served by the loops of the pool
+  Mutex mutex;
+  std::set<EventLoop*> loops;
+  int up = 0;
+  server.setConnectionCallback([&mutex, &loops, &up, &loop](const TcpConnectionPtr& conn) {
+    EXPECT_TRUE(conn->getLoop()->isInLoopThread());
+    EXPECT_NE(&loop, conn->getLoop());
+    if (conn->connected()) {
+      MutexLock lock(mutex);
+      loops.insert(conn->getLoop());
+      ++up;
+    }
+  });
+  server.setMessageCallback(onMessage);
+  server.start();
+  EXPECT_NE(0, server.listenAddress().port());
+
+  const int kClients = 200;
+  Thread client([&server, &loop, kClients]() {
+    for (int i = 0; i < kClients; ++i) {
+      std::string message(100 + i, static_cast<char>('a' + i % 26));
+      EXPECT_TRUE(echo(server.listenAddress(), message) == message);
+    }
+    loop.quit();
+  });
+  client.start();
+  loop.loop();
+  client.join();
+
+  MutexLock lock(mutex);
+  EXPECT_EQ(kClients, up);
+  // spread by kernel by the hash of the client ports
+  EXPECT_GT(loops.size(), 1u);
+}
+
+TEST(TCPSERVER_TEST, THREAD_POOL) {
+  EventLoop loop;
+  TcpServer server(&loop, InetAddress(0, true), "pool");
+  const int kThreads = 3;
+  server.setThreadNum(kThreads);
+  Mutex mutex;
+  std::set<EventLoop*> initialized;
+  server.setThreadInitCallback([&mutex, &initialized, &loop](EventLoop* ioLoop) {
+    EXPECT_TRUE(ioLoop->isInLoopThread());
+    EXPECT_NE(&loop, ioLoop);
+    MutexLock lock(mutex);
+    initialized.insert(ioLoop);
+  });
+
+  // accepted by the base loop, handed to the loops in turn
+  std::set<EventLoop*> loops;
+  server.setConnectionCallback([&mutex, &loops](const TcpConnectionPtr& conn) {
+    EXPECT_TRUE(conn->getLoop()->isInLoopThread());
+    if (conn->connected()) {
+      MutexLock lock(mutex);
+      loops.insert(conn->getLoop());
+    }
+  });
+  server.setMessageCallback(onMessage);
+  EXPECT_FALSE(server.started());
+  server.start();
+  server.start();
+  EXPECT_TRUE(server.started());
+
+  Thread client([&server, &loop, kThreads]() {
+    for (int i = 0; i < 2 * kThreads; ++i) {
+      std::string message(1000, static_cast<char>('a' + i));
+      EXPECT_TRUE(echo(server.listenAddress(), message) == message);
+    }
+    loop.quit();
+  });
+  client.start();
+  loop.loop();
+  client.join();
+
+  MutexLock lock(mutex);
+  EXPECT_EQ(static_cast<size_t>(kThreads), initialized.size());
+  EXPECT_TRUE(loops == initialized);
+}
+
+TEST(TCPSERVER_TEST, BASE_LOOP_ONLY) {
+  EventLoop loop;
+  TcpServer server(&loop, InetAddress(0, true), "base");
+  EventLoop* initialized = NULL;
+  server.setThreadInitCallback([&initialized](EventLoop* ioLoop) { initialized = ioLoop; });
+  server.setMessageCallback(onMessage);
+  server.start();
+  EXPECT_EQ(&loop, initialized);
+
+  Thread client([&server, &loop]() {
+    EXPECT_TRUE(echo(server.listenAddress(), "hello") == "hello");
+    loop.quit();
+  });
+  client.start();
+  loop.loop();
+  client.join();
+}
+
+TEST(TCPSERVER_TEST, CONSISTENT_HASH) {
+  EventLoop loop;
+  TcpServer server(&loop, InetAddress(0, true), "hash");
+  server.setThreadNum(4);
+  server.threadPool()->setStrategy(EventLoopThreadPool::kConsistentHash);
+
+  // the connections of a client stay on a loop
+  Mutex mutex;
+  std::set<EventLoop*> loops;
+  server.setConnectionCallback([&mutex, &loops](const TcpConnectionPtr& conn) {
+    if (conn->connected()) {
+      MutexLock lock(mutex);
+      loops.insert(conn->getLoop());
+    }
+  });
+  server.setMessageCallback(onMessage);
+  server.start();
+
+  Thread client([&server, &loop]() {
+    for (int i = 0; i < 8; ++i) {
+      EXPECT_TRUE(echo(server.listenAddress(), "hash") == "hash");
+    }
+    loop.quit();
+  });
+  client.start();
+  loop.loop();
+  client.join();
+
+  MutexLock lock(mutex);
+  EXPECT_EQ(1u, loops.size());
+}
+
+TEST(TCPSERVER_TEST, LEAST_CONNECTIONS) {
+  EventLoop loop;
+  TcpServer server(&loop, InetAddress(0, true), "least");
+  const int kThreads = 3;
+  server.setThreadNum(kThreads);
+  server.threadPool()->setStrategy(EventLoopThreadPool::kLeastConnections);
+  server.setMessageCallback(onMessage);
+  server.start();
+
+  // connections closed give their loop back, after they are removed
+  Thread client([&server, &loop, kThreads]() {
+    for (int i = 0; i < 2 * kThreads; ++i) {
+      EXPECT_TRUE(echo(server.listenAddress(), "least") == "least");
+    }
+    loop.runAfter(0.1, std::bind(&EventLoop::quit, &loop));
+  });
+  client.start();
+  loop.loop();
+  client.join();
+
+  std::vector<EventLoop*> loops(server.threadPool()->getAllLoops());
+  int connections = 0;
+  for (size_t i = 0; i < loops.size(); ++i) {
+    connections += server.threadPool()->numConnections(loops[i]);
+  }
+  EXPECT_EQ(0, connections);
+}
+
+TEST(TCPSERVER_TEST, MAX_CONNECTIONS) {
+  EventLoop loop;
+  TcpServer server(&loop, InetAddress(0, true), "max");
+  server.setThreadNum(2);
+  server.setMaxConnections(3);
+  server.setMessageCallback(onMessage);
+  server.start();
+
+  Thread client([&server, &loop]() {
+    std::vector<int> fds;
+    for (int i = 0; i < 3; ++i) {
+      fds.push_back(connectTo(server.listenAddress()));
+      EXPECT_TRUE(echoOn(fds.back(), "max") == "max");
+    }
+
+    // over the limit, closed once accepted
+    int fd = connectTo(server.listenAddress());
+    EXPECT_TRUE(closedByPeer(fd));
+    ::close(fd);
+    EXPECT_EQ(1, server.rejectedConnections());
+
+    // room again when one is gone
+    ::close(fds[0]);
+    waitForConnections(server, 2);
+    fds[0] = connectTo(server.listenAddress());
+    EXPECT_TRUE(echoOn(fds[0], "max") == "max");
+    for (size_t i = 0; i < fds.size(); ++i) {
+      ::close(fds[i]);
+    }
+    loop.quit();
+  });
+  client.start();
+  loop.loop();
+  client.join();
+}
+
+TEST(TCPSERVER_TEST, STOP_ACCEPTING) {
+  EventLoop loop;
+  TcpServer server(&loop, InetAddress(0, true), "stop");
+  server.setThreadNum(2);
+  server.setMaxConnectionsPerLoop(1);
+  server.setOverloadPolicy(TcpServer::kStopAccepting);
+  server.setMessageCallback(onMessage);
+  server.start();
+
+  Thread client([&server, &loop]() {
+    std::vector<int> fds;
+    for (int i = 0; i < 2; ++i) {
+      fds.push_back(connectTo(server.listenAddress()));
+      EXPECT_TRUE(echoOn(fds.back(), "stop") == "stop");
+    }
+
+    // waits in the backlog, not accepted
+    int fd = connectTo(server.listenAddress());
+    EXPECT_EQ(4, ::write(fd, "wait", 4));
+    ::usleep(100 * 1000);
+    EXPECT_EQ(2, server.numConnections());
+    EXPECT_EQ(2, server.acceptStats().accepted);
+    EXPECT_EQ(0, server.rejectedConnections());
+
+    // until a loop has room
+    ::close(fds[0]);
+    char buf[16];
+    EXPECT_EQ(4, ::read(fd, buf, sizeof(buf)));
+    EXPECT_EQ(3, server.acceptStats().accepted);
+    ::close(fd);
+    ::close(fds[1]);
+    loop.quit();
+  });
+  client.start();
+  loop.loop();
+  client.join();
+}
+
+TEST(TCPSERVER_TEST, MAX_CONNECTIONS_PER_IP) {
+  EventLoop loop;
+  TcpServer server(&loop, InetAddress(0, true), "ip");
+  server.setMaxConnectionsPerIp(2);
+  server.setMessageCallback(onMessage);
+  server.start();
+
+  Thread client([&server, &loop]() {
+    int fd1 = connectTo(server.listenAddress());
+    int fd2 = connectTo(server.listenAddress());
+    EXPECT_TRUE(echoOn(fd1, "ip") == "ip");
+    EXPECT_TRUE(echoOn(fd2, "ip") == "ip");
+    int fd3 = connectTo(server.listenAddress());
+    EXPECT_TRUE(closedByPeer(fd3));
+    ::close(fd3);
+
+    ::close(fd1);
+    waitForConnections(server, 1);
+    fd3 = connectTo(server.listenAddress());
+    EXPECT_TRUE(echoOn(fd3, "ip") == "ip");
+    ::close(fd2);
+    ::close(fd3);
+    loop.quit();
+  });
+  client.start();
+  loop.loop();
+  client.join();
+}
+
+TEST(TCPSERVER_TEST, DESTROYED_WITH_REMOVALS_QUEUED) {
+  EventLoop loop;
+  std::unique_ptr<TcpServer> server(new TcpServer(&loop, InetAddress(0, true), "destroyed"));
+  server->setThreadNum(2);
+  server->setMessageCallback(onMessage);
+  server->start();
+
+  const int kConns = 4;
+  std::vector<int> fds;
+  Thread client([&server, &loop, &fds, kConns]() {
+    for (int i = 0; i < kConns; ++i) {
+      fds.push_back(connectTo(server->listenAddress()));
+      EXPECT_TRUE(echoOn(fds.back(), "destroyed") == "destroyed");
+    }
+    loop.runInLoop([&server, &loop, &fds, kConns]() {
+      // the loops of the pool queue the removals into the base loop,
+      // which runs them after the server is gone
+      for (size_t i = 0; i < fds.size(); ++i) {
+        ::close(fds[i]);
+      }
+      // counting this functor itself
+      for (int i = 0; i < 1000 && loop.queueSize() < kConns + 1; ++i) {
+        ::usleep(1000);
+      }
+      EXPECT_EQ(kConns + 1, loop.queueSize());
+      server.reset();
+      loop.queueInLoop([&loop]() { loop.quit(); });
+    });
+  });
+  client.start();
+  loop.loop();
+  client.join();
+}
@@ -0,0 +1,113 @@
+//
+// ThreadPool against WorkStealingPool with small CPU-bound tasks.
+//
+// offload: `producers` threads, as the loops of a server, run `tasks`
+// tasks of about `work` ns each on the pool and wait for them.
+// fork-join: one task splits into two until `tasks` leaves, the tasks run
+// in the pool queue the others.
+//
+// usage: threadpool_bench [threads [producers [tasks [work]]]]
+//
+#include <leanet/threadpool.h>
+#include <leanet/workstealingpool.h>
+#include <leanet/thread.h>
+#include <leanet/countdownlatch.h>
+#include <leanet/timestamp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+using namespace leanet;
+
+namespace {
+
+int g_work = 1000;
+
+// about g_work ns of arithmetic
+void work(CountdownLatch* latch) {
+	volatile uint64_t x = 1;
+	for (int i = 0; i < g_work / 2; ++i) {
+		x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+	}
+	latch->countDown();
+}
+
+template<typename Pool>
+void produce(Pool* pool, int tasks, CountdownLatch* latch) {
+	for (int i = 0; i < tasks; ++i) {
+		pool->run(std::bind(work, latch));
+	}
+}
+
+template<typename Pool>
+void split(Pool* pool, int leaves, CountdownLatch* latch) {
+	if (leaves == 1) {
+		work(latch);
+	} else {
+		pool->run(std::bind(split<Pool>, pool, leaves / 2, latch));
+		pool->run(std::bind(split<Pool>, pool, leaves - leaves / 2, latch));
+	}
+}
+
+template<typename Pool>
+double offload(Pool* pool, int producers, int tasks) {
+	const int perProducer = tasks / producers;
+	CountdownLatch latch(perProducer * producers);
+	std::vector<std::unique_ptr<Thread>> threads;
+	Timestamp start(Timestamp::now());
+	for (int i = 0; i < producers; ++i) {
+		threads.push_back(std::unique_ptr<Thread>(new Thread(
+						std::bind(produce<Pool>, pool, perProducer, &latch), "producer")));
+		threads.back()->start();
+	}
+	latch.wait();
+	double elapsed = timeDifference(Timestamp::now(), start);
+	for (size_t i = 0; i < threads.size(); ++i) {
+		threads[i]->join();
+	}
+	return static_cast<double>(perProducer * producers) / elapsed;
+}
+
+template<typename Pool>
+double forkJoin(Pool* pool, int tasks) {
+	CountdownLatch latch(tasks);
+	Timestamp start(Timestamp::now());
+	pool->run(std::bind(split<Pool>, pool, tasks, &latch));
+	latch.wait();
+	return static_cast<double>(tasks) / timeDifference(Timestamp::now(), start);
+}
+
+template<typename Pool>
+void bench(const char* name, int threads, int producers, int tasks) {
+	Pool pool;
+	pool.start(threads);
+	double offloaded = offload(&pool, producers, tasks);
+	double forked = forkJoin(&pool, tasks);
+	pool.stop();
+	printf("%-16s %3d threads %12.0f offload tasks/s %12.0f fork-join tasks/s\n",
+			name, threads, offloaded, forked);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	int maxThreads = argc > 1 ? atoi(argv[1]) : 4;
+	int producers = argc > 2 ? atoi(argv[2]) : 4;
+	int tasks = argc > 3 ? atoi(argv[3]) : 200000;
+	g_work = argc > 4 ? atoi(argv[4]) : 1000;
+	if (maxThreads <= 0 || producers <= 0 || tasks < producers || g_work < 0) {
+		fprintf(stderr, "usage: %s [maxThreads [producers [tasks(>= producers) [work]]]]\n", argv[0]);
+		return 1;
+	}
+
+	printf("producers = %d, tasks = %d, work = %d ns\n", producers, tasks, g_work);
+	for (int threads = 1; threads <= maxThreads; threads *= 2) {
+		bench<ThreadPool>("ThreadPool", threads, producers, tasks);
+		bench<WorkStealingPool>("WorkStealingPool", threads, producers, tasks);
+	}
+	return 0;
+}
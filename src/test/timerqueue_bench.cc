@@ -0,0 +1,149 @@
+//
+// compares the sorted set timer queue with the timing wheel in add, cancel,
+// reset(cancel and add again, as an idle timeout touched by every message),
+// restart(the same in place) and expire throughput.
+//
+// then system calls for the alarm, when every loop iteration adds a few
+// request timeouts each earlier than the others, and cancels them as the
+// responses arrive, with timerfd or polling timeout.
+//
+// usage: timerqueue_bench [timers [resets]]
+//
+#include <leanet/eventloop.h>
+#include <leanet/timerid.h>
+#include <leanet/timestamp.h>
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+using namespace leanet;
+
+namespace {
+
+double cpuTime() {
+	struct timespec ts;
+	::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+void noop() { }
+
+int g_expired = 0;
+EventLoop* g_loop = NULL;
+int g_timers = 0;
+
+void expire() {
+	if (++g_expired == g_timers) {
+		g_loop->quit();
+	}
+}
+
+void report(const char* name, const char* op, int ops, double seconds) {
+	printf("%-8s %-8s %10.0f ops/s %8.1f ns/op\n",
+			name, op, ops / seconds, seconds * 1e9 / ops);
+}
+
+void bench(const char* name, EventLoop::TimerQueueType type, int timers, int resets) {
+	EventLoop loop(EventLoop::kDefaultPoller, type);
+	std::vector<TimerId> ids(static_cast<size_t>(timers));
+	// idle timeouts of connections, 30s ~ 90s
+	std::vector<double> delays(static_cast<size_t>(timers));
+	for (size_t i = 0; i < delays.size(); ++i) {
+		delays[i] = 30.0 + 60.0 * ::drand48();
+	}
+
+	double start = cpuTime();
+	for (size_t i = 0; i < ids.size(); ++i) {
+		ids[i] = loop.runAfter(delays[i], noop);
+	}
+	report(name, "add", timers, cpuTime() - start);
+
+	start = cpuTime();
+	for (int i = 0; i < resets; ++i) {
+		size_t k = static_cast<size_t>(i % timers);
+		loop.cancel(ids[k]);
+		ids[k] = loop.runAfter(delays[k], noop);
+	}
+	report(name, "reset", resets, cpuTime() - start);
+
+	start = cpuTime();
+	for (int i = 0; i < resets; ++i) {
+		size_t k = static_cast<size_t>(i % timers);
+		loop.restartTimer(ids[k], delays[k]);
+	}
+	report(name, "restart", resets, cpuTime() - start);
+
+	start = cpuTime();
+	for (size_t i = 0; i < ids.size(); ++i) {
+		loop.cancel(ids[i]);
+	}
+	report(name, "cancel", timers, cpuTime() - start);
+
+	// spread in 100ms, the loop sleeps in poller between expirations
+	g_loop = &loop;
+	g_timers = timers;
+	g_expired = 0;
+	start = cpuTime();
+	for (int i = 0; i < timers; ++i) {
+		loop.runAfter(0.1 * ::drand48(), expire);
+	}
+	loop.loop();
+	report(name, "expire", timers, cpuTime() - start);
+}
+
+const int kTimersPerRound = 10;
+
+void churn(EventLoop* loop, int* rounds) {
+	TimerId ids[kTimersPerRound];
+	for (int i = 0; i < kTimersPerRound; ++i) {
+		ids[i] = loop->runAfter(0.01 - 0.0005 * i, noop);
+	}
+	for (int i = 0; i < kTimersPerRound; ++i) {
+		loop->cancel(ids[i]);
+	}
+	if (--*rounds > 0) {
+		loop->queueInLoop(std::bind(churn, loop, rounds));
+	} else {
+		loop->quit();
+	}
+}
+
+void benchAlarm(const char* name, EventLoop::TimerQueueType type, bool timerfd, int rounds) {
+	EventLoop loop(EventLoop::kDefaultPoller, type);
+	loop.useTimerfd(timerfd);
+	int left = rounds;
+	loop.queueInLoop(std::bind(churn, &loop, &left));
+	double start = cpuTime();
+	loop.loop();
+	double seconds = cpuTime() - start;
+	printf("%-8s %-8s %10.0f rounds/s %6.3f timer syscalls/round\n",
+			name, timerfd ? "timerfd" : "poll",
+			rounds / seconds,
+			static_cast<double>(loop.timerSyscalls()) / rounds);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	int timers = argc > 1 ? atoi(argv[1]) : 500000;
+	int resets = argc > 2 ? atoi(argv[2]) : 2000000;
+	if (timers <= 0 || resets < 0) {
+		fprintf(stderr, "usage: %s [timers [resets]]\n", argv[0]);
+		return 1;
+	}
+
+	printf("timers = %d, resets = %d\n", timers, resets);
+	bench("set", EventLoop::kSortedTimerQueue, timers, resets);
+	bench("wheel", EventLoop::kTimingWheel, timers, resets);
+
+	const int rounds = 100000;
+	printf("rounds = %d, %d timers per round\n", rounds, kTimersPerRound);
+	benchAlarm("set", EventLoop::kSortedTimerQueue, true, rounds);
+	benchAlarm("set", EventLoop::kSortedTimerQueue, false, rounds);
+	benchAlarm("wheel", EventLoop::kTimingWheel, true, rounds);
+	benchAlarm("wheel", EventLoop::kTimingWheel, false, rounds);
+	return 0;
+}
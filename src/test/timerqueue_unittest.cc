@@ -0,0 +1,205 @@
+#include <gtest/gtest.h>
+#include <leanet/eventloop.h>
+#include <leanet/thread.h>
+#include <leanet/countdownlatch.h>
+#include <leanet/timestamp.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace leanet;
+
+namespace {
+
+const EventLoop::TimerQueueType kTypes[] = {
+  EventLoop::kSortedTimerQueue,
+  EventLoop::kTimingWheel
+};
+
+struct Fired {
+  Fired(): count(0) { }
+
+  void fire(Timestamp expected) {
+    ++count;
+    // never earlier than asked for
+    EXPECT_FALSE(Timestamp::now() < expected);
+  }
+
+  int count;
+};
+
+}
+
+TEST(TIMERQUEUE_TEST, EXPIRE) {
+  for (size_t t = 0; t < sizeof(kTypes) / sizeof(kTypes[0]); ++t) {
+    EventLoop loop(EventLoop::kDefaultPoller, kTypes[t]);
+    Fired fired;
+    // the lowest level, the second level and cascading
+    const double delays[] = { 0.0, 0.001, 0.005, 0.03, 0.3, 0.6 };
+    const int n = static_cast<int>(sizeof(delays) / sizeof(delays[0]));
+    for (int i = 0; i < n; ++i) {
+      Timestamp when(addTime(Timestamp::now(), delays[i]));
+      loop.runAt(when, std::bind(&Fired::fire, &fired, when));
+    }
+    loop.runAfter(0.7, std::bind(&EventLoop::quit, &loop));
+    loop.loop();
+    EXPECT_EQ(n, fired.count);
+  }
+}
+
+TEST(TIMERQUEUE_TEST, POLL_TIMEOUT) {
+  for (size_t t = 0; t < sizeof(kTypes) / sizeof(kTypes[0]); ++t) {
+    EventLoop loop(EventLoop::kDefaultPoller, kTypes[t]);
+    loop.useTimerfd(false);
+    Fired fired;
+    const double delays[] = { 0.0, 0.001, 0.005, 0.03, 0.3 };
+    const int n = static_cast<int>(sizeof(delays) / sizeof(delays[0]));
+    for (int i = 0; i < n; ++i) {
+      Timestamp when(addTime(Timestamp::now(), delays[i]));
+      loop.runAt(when, std::bind(&Fired::fire, &fired, when));
+    }
+    TimerId canceled = loop.runAfter(0.01, std::bind(&Fired::fire, &fired, Timestamp::now()));
+    loop.cancel(canceled);
+    loop.runAfter(0.4, std::bind(&EventLoop::quit, &loop));
+    loop.loop();
+    EXPECT_EQ(n, fired.count);
+    EXPECT_EQ(0, loop.timerSyscalls());
+  }
+}
+
+TEST(TIMERQUEUE_TEST, CANCEL) {
+  for (size_t t = 0; t < sizeof(kTypes) / sizeof(kTypes[0]); ++t) {
+    EventLoop loop(EventLoop::kDefaultPoller, kTypes[t]);
+    Fired fired;
+    Timestamp now(Timestamp::now());
+    TimerId canceled = loop.runAfter(0.01, std::bind(&Fired::fire, &fired, now));
+    TimerId far = loop.runAfter(3600.0, std::bind(&Fired::fire, &fired, now));
+    loop.runAfter(0.02, std::bind(&Fired::fire, &fired, now));
+    loop.cancel(canceled);
+    loop.cancel(far);
+    // canceling twice or an expired timer does nothing
+    loop.cancel(canceled);
+    loop.cancel(TimerId());
+
+    // canceled by a timer expiring in the same round
+    TimerId victim = loop.runAfter(0.05, std::bind(&Fired::fire, &fired, now));
+    loop.runAfter(0.05, [&loop, &victim]() { loop.cancel(victim); });
+    loop.runAfter(0.1, std::bind(&EventLoop::quit, &loop));
+    loop.loop();
+    // victim may run before it is canceled
+    EXPECT_GE(fired.count, 1);
+    EXPECT_LE(fired.count, 2);
+  }
+}
+
+TEST(TIMERQUEUE_TEST, REPEAT) {
+  for (size_t t = 0; t < sizeof(kTypes) / sizeof(kTypes[0]); ++t) {
+    EventLoop loop(EventLoop::kDefaultPoller, kTypes[t]);
+    int count = 0;
+    TimerId timer;
+    timer = loop.runEvery(0.01, [&loop, &count, &timer]() {
+      if (++count == 5) {
+        // cancels itself in its callback
+        loop.cancel(timer);
+        loop.runAfter(0.05, std::bind(&EventLoop::quit, &loop));
+      }
+    });
+    loop.loop();
+    EXPECT_EQ(5, count);
+  }
+}
+
+TEST(TIMERQUEUE_TEST, RESTART) {
+  for (size_t t = 0; t < sizeof(kTypes) / sizeof(kTypes[0]); ++t) {
+    EventLoop loop(EventLoop::kDefaultPoller, kTypes[t]);
+    Timestamp start(Timestamp::now());
+    Fired later, earlier, expired;
+    // later, touched before expiring
+    TimerId laterId = loop.runAfter(0.05, std::bind(&Fired::fire, &later, addTime(start, 0.08)));
+    loop.runAfter(0.03, [&loop, laterId]() { loop.restartTimer(laterId, 0.05); });
+    // earlier
+    TimerId earlierId = loop.runAfter(0.5, std::bind(&Fired::fire, &earlier, start));
+    loop.restartTimer(earlierId, 0.01);
+    // expired timers are not restarted
+    TimerId expiredId = loop.runAfter(0.01, std::bind(&Fired::fire, &expired, start));
+    loop.runAfter(0.05, [&loop, expiredId]() { loop.restartTimer(expiredId, 0.01); });
+
+    loop.runAfter(0.2, std::bind(&EventLoop::quit, &loop));
+    loop.loop();
+    EXPECT_EQ(1, later.count);
+    EXPECT_EQ(1, earlier.count);
+    EXPECT_EQ(1, expired.count);
+  }
+}
+
+namespace {
+
+// runs again 0.1s after it fires, n times, keeps the latest lateness
+struct Chain {
+  Chain(EventLoop* l, int n): loop(l), left(n), maxLate(0.0) { }
+
+  void fire(Timestamp expected) {
+    maxLate = std::max(maxLate, timeDifference(Timestamp::now(), expected));
+    if (--left > 0) {
+      Timestamp when(addTime(Timestamp::now(), 0.1));
+      loop->runAt(when, std::bind(&Chain::fire, this, when));
+    } else {
+      loop->quit();
+    }
+  }
+
+  EventLoop* loop;
+  int left;
+  double maxLate;
+};
+
+}
+
+TEST(TIMERQUEUE_TEST, LATENESS) {
+  for (size_t t = 0; t < sizeof(kTypes) / sizeof(kTypes[0]); ++t) {
+    EventLoop loop(EventLoop::kDefaultPoller, kTypes[t]);
+    // the only timer, added from a callback: some land in the buckets of
+    // the lowest level wrapped into the next round
+    Chain chain(&loop, 8);
+    Timestamp when(addTime(Timestamp::now(), 0.2));
+    loop.runAt(when, std::bind(&Chain::fire, &chain, when));
+    loop.loop();
+    EXPECT_EQ(0, chain.left);
+    EXPECT_LT(chain.maxLate, 0.05);
+  }
+}
+
+TEST(TIMERQUEUE_TEST, OTHER_THREAD) {
+  for (size_t t = 0; t < sizeof(kTypes) / sizeof(kTypes[0]); ++t) {
+    EventLoop* loop = NULL;
+    CountdownLatch latch(1);
+    const EventLoop::TimerQueueType type = kTypes[t];
+    Thread thread([&loop, &latch, type]() {
+      EventLoop threadLoop(EventLoop::kDefaultPoller, type);
+      loop = &threadLoop;
+      latch.countDown();
+      threadLoop.loop();
+    });
+    thread.start();
+    latch.wait();
+
+    Fired fired;
+    std::vector<TimerId> timers;
+    for (int i = 0; i < 1000; ++i) {
+      Timestamp when(addTime(Timestamp::now(), 0.001 * (i % 50)));
+      timers.push_back(loop->runAt(when, std::bind(&Fired::fire, &fired, when)));
+    }
+    // cancels half of them, some may have expired
+    for (size_t i = 0; i < timers.size(); i += 2) {
+      loop->cancel(timers[i]);
+    }
+    ::usleep(200 * 1000);
+    loop->quit();
+    thread.join();
+    EXPECT_GE(fired.count, 500);
+    EXPECT_LE(fired.count, 1000);
+  }
+}
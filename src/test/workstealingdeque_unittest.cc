@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include <leanet/workstealingdeque.h>
+#include <leanet/thread.h>
+#include <leanet/atomic.h>
+
+#include <memory>
+#include <vector>
+
+using namespace leanet;
+
+TEST(WORKSTEALINGDEQUE_TEST, OWNER_AND_STEALER) {
+  WorkStealingDeque<int> deque(8);
+  int items[20];
+  EXPECT_TRUE(deque.pop() == NULL);
+  EXPECT_TRUE(deque.steal() == NULL);
+
+  // grown past the initial capacity
+  for (int i = 0; i < 20; ++i) {
+    items[i] = i;
+    deque.push(&items[i]);
+  }
+  EXPECT_EQ(20u, deque.size());
+  // the owner takes the newest, stealers the oldest
+  EXPECT_EQ(&items[19], deque.pop());
+  EXPECT_EQ(&items[0], deque.steal());
+  EXPECT_EQ(&items[1], deque.steal());
+  EXPECT_EQ(&items[18], deque.pop());
+  EXPECT_EQ(16u, deque.size());
+  for (int i = 17; i >= 2; --i) {
+    EXPECT_EQ(&items[i], deque.pop());
+  }
+  EXPECT_TRUE(deque.empty());
+  EXPECT_TRUE(deque.pop() == NULL);
+}
+
+TEST(WORKSTEALINGDEQUE_TEST, CONCURRENT_STEALS) {
+  const int kStealers = 3;
+  const int kItems = 200000;
+
+  // every item is taken once, by the owner or one of the stealers
+  std::vector<int> items(kItems, 0);
+  std::vector<AtomicInt32> taken(kItems);
+  WorkStealingDeque<int> deque;
+  AtomicInt32 done;
+  std::vector<std::unique_ptr<Thread>> stealers;
+  for (int i = 0; i < kStealers; ++i) {
+    stealers.emplace_back(new Thread([&deque, &items, &taken, &done] {
+      while (done.get() == 0) {
+        int* x = deque.steal();
+        if (x) {
+          taken[x - &items[0]].increment();
+        }
+      }
+    }));
+    stealers.back()->start();
+  }
+
+  for (int i = 0; i < kItems; ++i) {
+    deque.push(&items[i]);
+    // pops some, so the owner races the stealers for the last one
+    if (i % 3 == 0) {
+      int* x = deque.pop();
+      if (x) {
+        taken[x - &items[0]].increment();
+      }
+    }
+  }
+  while (int* x = deque.pop()) {
+    taken[x - &items[0]].increment();
+  }
+  done.increment();
+  for (size_t i = 0; i < stealers.size(); ++i) {
+    stealers[i]->join();
+  }
+
+  for (int i = 0; i < kItems; ++i) {
+    ASSERT_EQ(1, taken[i].get()) << i;
+  }
+}
@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+#include <leanet/workstealingpool.h>
+#include <leanet/threadpool.h>
+#include <leanet/countdownlatch.h>
+#include <leanet/atomic.h>
+
+#include <unistd.h>
+
+#include <functional>
+
+using namespace leanet;
+
+namespace {
+
+// splits into two until depth, counts the leaves
+void split(WorkStealingPool* pool, int depth, AtomicInt32* leaves, CountdownLatch* latch) {
+  if (depth == 0) {
+    leaves->increment();
+    latch->countDown();
+  } else {
+    pool->run(std::bind(split, pool, depth - 1, leaves, latch));
+    pool->run(std::bind(split, pool, depth - 1, leaves, latch));
+  }
+}
+
+}
+
+TEST(WORKSTEALINGPOOL_TEST, RUN) {
+  WorkStealingPool pool("ws");
+  AtomicInt32 inits;
+  pool.setThreadInitCallback([&inits]() { inits.increment(); });
+  pool.start(4);
+
+  const int kTasks = 100000;
+  AtomicInt32 count;
+  CountdownLatch latch(kTasks);
+  for (int i = 0; i < kTasks; ++i) {
+    pool.run([&count, &latch]() {
+      count.increment();
+      latch.countDown();
+    });
+  }
+  latch.wait();
+  EXPECT_EQ(kTasks, count.get());
+  EXPECT_EQ(4, inits.get());
+  pool.stop();
+}
+
+TEST(WORKSTEALINGPOOL_TEST, NESTED) {
+  // tasks queued by tasks go to the deque of the worker, stolen by others
+  WorkStealingPool pool;
+  pool.start(4);
+  const int kDepth = 14;
+  AtomicInt32 leaves;
+  CountdownLatch latch(1 << kDepth);
+  pool.run(std::bind(split, &pool, kDepth, &leaves, &latch));
+  latch.wait();
+  EXPECT_EQ(1 << kDepth, leaves.get());
+  EXPECT_EQ(0u, pool.queueSize());
+}
+
+TEST(WORKSTEALINGPOOL_TEST, STOP_RUNS_QUEUED) {
+  AtomicInt32 count;
+  {
+  WorkStealingPool pool;
+  pool.start(2);
+  CountdownLatch blocked(2);
+  CountdownLatch release(1);
+  for (int i = 0; i < 2; ++i) {
+    pool.run([&blocked, &release]() {
+      blocked.countDown();
+      release.wait();
+    });
+  }
+  blocked.wait();
+  for (int i = 0; i < 1000; ++i) {
+    pool.run([&count]() { count.increment(); });
+  }
+  EXPECT_EQ(1000u, pool.queueSize());
+  release.countDown();
+  pool.stop();
+  EXPECT_EQ(1000, count.get());
+  }
+}
+
+TEST(WORKSTEALINGPOOL_TEST, NO_THREADS) {
+  WorkStealingPool pool;
+  pool.start(0);
+  int count = 0;
+  pool.run([&count]() { ++count; });
+  EXPECT_EQ(1, count);
+}
+
+TEST(WORKSTEALINGPOOL_TEST, PARK_AND_WAKE) {
+  // workers park between the rounds, a task wakes one
+  WorkStealingPool pool;
+  pool.start(3);
+  for (int round = 0; round < 20; ++round) {
+    CountdownLatch latch(1);
+    pool.run([&latch]() { latch.countDown(); });
+    latch.wait();
+    usleep(2000);
+  }
+}
+
+TEST(THREADPOOL_TEST, RUN) {
+  ThreadPool pool("tp");
+  pool.start(2);
+  CountdownLatch latch(100);
+  for (int i = 0; i < 100; ++i) {
+    pool.run([&latch]() { latch.countDown(); });
+  }
+  latch.wait();
+  pool.stop();
+}